@@ -0,0 +1,84 @@
+#ifndef ADAPTIVE_CODER_H
+#define ADAPTIVE_CODER_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Huffman_encoder.h"
+#include "Huffman_table.h"
+
+/*
+ * One-pass adaptive Huffman coding for low-latency streams. Encoder and
+ * decoder keep the same byte model and update it after every symbol, so no
+ * table is ever sent. Rebuilding the canonical code per symbol would cost
+ * more than the coding, so lengths are rebuilt on a schedule instead: after
+ * 64 symbols, then at doubling intervals up to ADAPTIVE_REBUILD_INTERVAL,
+ * and early when the last ADAPTIVE_CHECK_INTERVAL symbols cost a quarter
+ * more bits than the model expected, i.e. the statistics moved. Counts are
+ * halved once they sum past ADAPTIVE_MAX_TOTAL, so old data fades out.
+ *
+ * A stream is ADAPTIVE_MAGIC followed by messages. A message is its raw
+ * size and its payload size (LEB128 varints) and the payload, whose code
+ * bits are zero-padded to a byte, so every message can be sent as soon as
+ * it is encoded and the decoder knows when it holds a whole one.
+ */
+#define ADAPTIVE_MAGIC 0x41465548       // "HUFA"
+#define ADAPTIVE_REBUILD_INTERVAL 4096
+#define ADAPTIVE_FIRST_INTERVAL 64
+#define ADAPTIVE_CHECK_INTERVAL 512
+// Every byte value starts with count 1 and adds this much per occurrence.
+#define ADAPTIVE_INCREMENT 32
+#define ADAPTIVE_MAX_TOTAL (1u << 21)
+#define ADAPTIVE_MAX_MESSAGE (1u << 20)
+// Two varints of a size up to ADAPTIVE_MAX_MESSAGE's bound.
+#define ADAPTIVE_MESSAGE_HEADER_MAX 8
+
+typedef struct {
+    uint64_t counts[256];
+    uint64_t total;
+    uint8_t lengths[256];
+    unsigned max_length;
+    uint64_t model_bits;    // sum of counts * lengths at the last rebuild
+    uint64_t model_total;   // total at the last rebuild
+    uint32_t interval;      // symbols between scheduled rebuilds
+    uint32_t seen;          // symbols since the last rebuild
+    uint64_t spent_bits;    // what they cost
+} Adaptive_model;
+
+typedef struct {
+    Adaptive_model model;
+    Huffman_encoder codes;
+} Adaptive_encoder;
+
+typedef struct {
+    Adaptive_model model;
+    unsigned table_bits;
+    Huffman_decode_entry table[1 << HUFFMAN_TABLE_MAX_BITS];
+} Adaptive_decoder;
+
+Adaptive_encoder* Adaptive_encoder_create(void);
+
+// Output bytes a message of `size` (at most ADAPTIVE_MAX_MESSAGE) may take.
+size_t Adaptive_encode_bound(size_t size);
+
+// Encodes one message of 1..ADAPTIVE_MAX_MESSAGE bytes into `out` and returns its size.
+size_t Adaptive_encode_message(Adaptive_encoder* enc, const uint8_t* in, size_t size, uint8_t* out);
+
+void Adaptive_encoder_destroy(Adaptive_encoder* enc);
+
+Adaptive_decoder* Adaptive_decoder_create(void);
+
+/*
+ * Looks at the `available` bytes at `in`: returns 1 and the message's raw
+ * size, header size and payload size once the whole message is there, 0
+ * when more bytes are needed and -1 when the header is malformed.
+ */
+int Adaptive_parse_message(const uint8_t* in, size_t available, size_t* raw_size, size_t* header_size,
+                           size_t* payload_size);
+
+// Decodes one message payload into `size` bytes; -1 if it is corrupt.
+int Adaptive_decode_message(Adaptive_decoder* dec, const uint8_t* payload, size_t payload_size, uint8_t* out,
+                            size_t size);
+
+void Adaptive_decoder_destroy(Adaptive_decoder* dec);
+
+#endif
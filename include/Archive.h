@@ -0,0 +1,107 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Block_format.h"
+#include "Transform.h"
+
+typedef struct {
+    uint32_t block_size;
+    unsigned num_streams;   // 0 picks per block
+    unsigned transforms;    // TRANSFORM_SET each block may choose from
+    unsigned entropy;       // Block_entropy
+    unsigned sample_shift;  // histograms count one window in 2^sample_shift
+    unsigned split;         // cut blocks where the byte statistics shift (Block_split.h)
+    unsigned dedup;         // write a REF block for a block equal to an earlier one of the member
+} Archive_options;
+
+#define ARCHIVE_MIN_LEVEL 1
+#define ARCHIVE_MAX_LEVEL 9
+#define ARCHIVE_DEFAULT_LEVEL 5
+#define ARCHIVE_MIN_FIT_BLOCK_SIZE (64 * 1024)
+
+/*
+ * Block-format (HUF2) file layer: a file header, self-contained blocks of at
+ * most block_size input bytes, an END block carrying the total input size
+ * and an INDEX block listing the block sizes. Such a member may be followed
+ * by further members. Both directions stream through Io_pipeline and keep one block in
+ * memory. They return 0 on success and -1 after reporting the error on
+ * stderr.
+ */
+void Archive_options_init(Archive_options* options);
+
+// Presets from ARCHIVE_MIN_LEVEL (fastest) to ARCHIVE_MAX_LEVEL (smallest); -1 if out of range.
+int Archive_options_level(Archive_options* options, int level);
+
+// Halves the block size, down to ARCHIVE_MIN_FIT_BLOCK_SIZE, until compressing takes at most `budget` bytes.
+void Archive_options_fit(Archive_options* options, uint64_t budget);
+
+int Archive_compress(FILE* input, FILE* output, const Archive_options* options, uint64_t* raw_size);
+
+typedef struct {
+    uint64_t raw_size;
+    uint64_t blocks;
+    uint64_t compressed_size;   // of the file Archive_compress would write
+    double entropy;             // order-0 entropy of the coded bytes, in bits; REF blocks add none
+    uint64_t kind_bytes[BLOCK_REF + 1];     // raw bytes by the Block_kind they would be coded as
+    double encode_seconds;      // estimated, one core
+    double decode_seconds;
+} Archive_analysis;
+
+/*
+ * Predicts Archive_compress without writing anything: the same block cuts,
+ * histograms, code tables and choices, with sizes exact for every kind; only
+ * tANS and pairs blocks are coded to get them. The times come from coding and decoding the
+ * first 256 KiB or so of every kind and transform that occurs. With `report`,
+ * prints one line per block.
+ */
+int Archive_analyze(FILE* input, const Archive_options* options, FILE* report, Archive_analysis* analysis);
+
+/*
+ * Adds the blocks of `input` to the last member of the block-format file
+ * `archive` (opened for update). The END block, index and footer at its
+ * tail are rewritten in place, so the cost is proportional to the new data.
+ * New blocks keep the member's block size, and with options->dedup may
+ * refer to the member's old blocks. *raw_size is the appended size.
+ */
+int Archive_append(FILE* archive, FILE* input, const Archive_options* options, uint64_t* raw_size);
+
+/*
+ * Compresses `input`, a new version of what the block-format file `old`
+ * holds, into `output`. Old blocks are found in the input by content, at
+ * any offset, and one whose size and hash match its old index entry, and
+ * whose decoded bytes match the input, is copied from `old` instead of
+ * being encoded, so the work follows the changed data. New bytes between them take the last member's block size.
+ * *reused_size is the part of *raw_size that was copied.
+ */
+int Archive_update(FILE* old, FILE* input, FILE* output, const Archive_options* options,
+                   uint64_t* raw_size, uint64_t* reused_size);
+
+/*
+ * Decodes every member, so concatenated files decode to their concatenation.
+ * REF blocks that reach back past the output still in memory are read from
+ * `output`, which must then be a file opened for reading too.
+ */
+int Archive_decompress(FILE* input, FILE* output, uint64_t* raw_size);
+
+typedef struct {
+    uint64_t raw_size;
+    uint64_t matches;
+    uint64_t blocks;
+    uint64_t skipped_blocks;    // ruled out by their code table, never decoded
+    uint64_t decoded_bytes;
+} Archive_grep_stats;
+
+/*
+ * Finds every occurrence of `pattern` (length >= 1) in what the block-format
+ * file `input` decodes to, without writing it out, and prints the original
+ * offset of each to `report`, one per line, if it is not NULL. A block whose
+ * code table has no code for a byte of the pattern cannot hold a match and
+ * is not decoded, unless a match may cross into its neighbour. The rest are
+ * decoded into one block-sized buffer and scanned. REF blocks are read back
+ * from `input`, which must then be a regular file.
+ */
+int Archive_grep(FILE* input, const uint8_t* pattern, size_t length, FILE* report, Archive_grep_stats* stats);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef BIT_READER_H
+#define BIT_READER_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * MSB-first bit reader over a 64-bit container.
+ *
+ * `container` holds the next unread bits left-aligned; the top `bit_count`
+ * of them are valid. A refill loads one unaligned big-endian word while at
+ * least 8 input bytes are left and leaves 56..63 valid bits, so a decoder
+ * can take several table lookups between refills. Near the end of the
+ * current buffer it falls back to loading single bytes.
+ *
+ * The reader never looks behind `end`, and the container survives a
+ * Bit_reader_feed, so a stream split across arbitrary buffers is decoded by
+ * feeding the next buffer once Bit_reader_input_left() reaches zero.
+ */
+typedef struct {
+    uint64_t container;
+    unsigned bit_count;
+    const uint8_t* ptr;
+    const uint8_t* end;
+} Bit_reader;
+
+void Bit_reader_init(Bit_reader* br, const uint8_t* data, size_t size);
+
+void Bit_reader_feed(Bit_reader* br, const uint8_t* data, size_t size);
+
+void Bit_reader_refill_slow(Bit_reader* br);
+
+
+static inline size_t Bit_reader_input_left(const Bit_reader* br) {
+    return (size_t)(br->end - br->ptr);
+}
+
+static inline void Bit_reader_refill(Bit_reader* br) {
+    if (br->end - br->ptr >= 8) {
+        uint64_t word;
+        memcpy(&word, br->ptr, sizeof(word));
+        br->container |= __builtin_bswap64(word) >> br->bit_count;
+        br->ptr += (63 - br->bit_count) >> 3;
+        br->bit_count |= 56;
+    } else {
+        Bit_reader_refill_slow(br);
+    }
+}
+
+// n must be in [1, bit_count]; bits past the end of the stream read as 0.
+static inline uint64_t Bit_reader_peek(const Bit_reader* br, unsigned n) {
+    return br->container >> (64 - n);
+}
+
+static inline void Bit_reader_consume(Bit_reader* br, unsigned n) {
+    br->container <<= n;
+    br->bit_count -= n;
+}
+
+static inline uint64_t Bit_reader_read(Bit_reader* br, unsigned n) {
+    uint64_t value = Bit_reader_peek(br, n);
+    Bit_reader_consume(br, n);
+    return value;
+}
+
+#endif
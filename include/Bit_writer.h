@@ -0,0 +1,51 @@
+#ifndef BIT_WRITER_H
+#define BIT_WRITER_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * MSB-first bit writer, the counterpart of Bit_reader. Codes are OR-ed into
+ * a left-aligned 64-bit accumulator and whole bytes are flushed with one
+ * unaligned 8-byte store, so the writer needs 8 bytes of slack past `ptr`
+ * (BIT_WRITER_SLACK). Fewer than 8 pending bits are kept in the accumulator
+ * across Bit_writer_retarget, which is how a bitstream continues into the
+ * next output buffer.
+ */
+#define BIT_WRITER_SLACK 8
+
+typedef struct {
+    uint64_t acc;
+    unsigned bit_count;
+    uint8_t* ptr;
+    uint8_t* end;
+} Bit_writer;
+
+void Bit_writer_init(Bit_writer* bw, uint8_t* buffer, size_t capacity);
+
+void Bit_writer_retarget(Bit_writer* bw, uint8_t* buffer, size_t capacity);
+
+size_t Bit_writer_finish(Bit_writer* bw);
+
+
+static inline size_t Bit_writer_room(const Bit_writer* bw) {
+    size_t room = (size_t)(bw->end - bw->ptr);
+    return room > BIT_WRITER_SLACK ? room - BIT_WRITER_SLACK : 0;
+}
+
+// length must be in [1, 56] and code must fit in `length` bits.
+static inline void Bit_writer_put(Bit_writer* bw, uint64_t code, unsigned length) {
+    bw->acc |= code << (64 - bw->bit_count - length);
+    bw->bit_count += length;
+}
+
+static inline void Bit_writer_flush(Bit_writer* bw) {
+    uint64_t word = __builtin_bswap64(bw->acc);
+    memcpy(bw->ptr, &word, sizeof(word));
+    bw->ptr += bw->bit_count >> 3;
+    bw->acc <<= bw->bit_count & ~7u;
+    bw->bit_count &= 7;
+}
+
+#endif
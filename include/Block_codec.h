@@ -0,0 +1,123 @@
+#ifndef BLOCK_CODEC_H
+#define BLOCK_CODEC_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Block_format.h"
+#include "Huffman_table.h"
+#include "Huffman_encoder.h"
+#include "Bit_reader.h"
+#include "Transform.h"
+#include "Tans.h"
+#include "Pair_code.h"
+
+#define BLOCK_CODEC_FOUR_STREAM_MIN (16 * 1024)
+#define BLOCK_CODEC_STREAM_SIZES 12
+// Sampled histograms count one window of this many bytes in 2^sample_shift.
+#define BLOCK_CODEC_SAMPLE_WINDOW 4096
+
+/*
+ * Decode loops are instantiated at build time for every table width
+ * (HUFFMAN_TABLE_MIN_BITS..HUFFMAN_TABLE_MAX_BITS), stream count (1 or 4) and
+ * table kind (one symbol, two symbols or one byte-pair alphabet symbol per
+ * lookup); Block_decode picks one per block from its header.
+ */
+#define BLOCK_DECODE_VARIANT_COUNT ((HUFFMAN_TABLE_MAX_BITS - HUFFMAN_TABLE_MIN_BITS + 1) * 6)
+#define BLOCK_DECODE_INDEX(table_bits, streams, multi) \
+    (((table_bits) - HUFFMAN_TABLE_MIN_BITS) * 6 + ((streams) == 4) * 3 + (multi))
+#define BLOCK_DECODE_PAIRS 2
+
+/*
+ * Entropy coder of non-trivial blocks; AUTO takes tANS when it is clearly
+ * smaller. PAIRS tries the byte-pair alphabet first and falls back to Huffman.
+ */
+typedef enum {
+    BLOCK_ENTROPY_AUTO = 0,
+    BLOCK_ENTROPY_HUFFMAN = 1,
+    BLOCK_ENTROPY_TANS = 2,
+    BLOCK_ENTROPY_PAIRS = 3
+} Block_entropy;
+
+typedef int (*Block_decode_fn)(const Huffman_decode_entry* table, const Huffman_decode_entry2* table2,
+                               Bit_reader* br, uint8_t** op, uint8_t* const* oend);
+
+extern const Block_decode_fn Block_decode_scalar_variants[BLOCK_DECODE_VARIANT_COUNT];
+extern const Block_decode_fn Block_decode_bmi2_variants[BLOCK_DECODE_VARIANT_COUNT];
+
+typedef struct {
+    uint64_t counts[256];
+    uint8_t lengths[256];
+    Huffman_encoder codes;
+    uint16_t norm[256];
+    Tans_encoder tans;
+    unsigned num_streams;   // 0 picks 1 or 4 from the block size
+    unsigned transforms;    // TRANSFORM_SET of candidates; 0 skips the stage
+    unsigned entropy;       // Block_entropy
+    unsigned sample_shift;  // 0 counts every byte
+    Transform_workspace* transform;
+    Pair_encoder* pairs;    // created by the first BLOCK_ENTROPY_PAIRS block
+    uint8_t* scratch;       // tANS and pairs payloads coded by Block_encode_estimate
+    size_t scratch_capacity;
+} Block_encoder;
+
+typedef struct {
+    Huffman_decode_entry table[1 << HUFFMAN_TABLE_MAX_BITS];
+    Huffman_decode_entry2 table2[1 << HUFFMAN_TABLE_MAX_BITS];
+    uint8_t lengths[PAIR_CODE_MAX_SYMBOLS];
+    uint8_t pairs[2 * PAIR_CODE_MAX_PAIRS];
+    Tans_decode_entry tans_table[1 << TANS_MAX_TABLE_LOG];
+    uint16_t norm[256];
+    uint8_t* scratch;       // transformed bytes, before the inverse transform
+    size_t scratch_capacity;
+    Transform_workspace* transform;
+} Block_decoder;
+
+Block_encoder* Block_encoder_create(void);
+
+// Parses "huffman", "tans", "pairs" or "auto" into a Block_entropy; -1 if unknown.
+int Block_entropy_parse(const char* name, unsigned* entropy);
+
+size_t Block_encode_bound(size_t raw_size);
+
+size_t Block_encode(Block_encoder* enc, const uint8_t* in, size_t size, uint8_t* out);
+
+// Block_encode with the byte counts of `in` already known, e.g. from Block_split.
+size_t Block_encode_counted(Block_encoder* enc, const uint8_t* in, size_t size, const uint64_t counts[256], uint8_t* out);
+
+/*
+ * What Block_encode would write for a block, worked out from its byte
+ * counts and code table without coding it.
+ */
+typedef struct {
+    uint8_t kind;           // Block_kind
+    uint8_t transform;
+    uint8_t num_streams;
+    uint32_t payload_size;
+    double entropy;         // order-0 entropy of the coded (transformed) bytes, in bits
+} Block_estimate;
+
+/*
+ * Takes the same choices as Block_encode_counted, and payload_size is what it
+ * writes. Huffman sizes come from the code table; transforms, tANS and pairs
+ * blocks are run in full into a scratch buffer.
+ */
+void Block_encode_estimate(Block_encoder* enc, const uint8_t* in, size_t size, const uint64_t counts[256],
+                           Block_estimate* est);
+
+void Block_encoder_destroy(Block_encoder* enc);
+
+Block_decoder* Block_decoder_create(void);
+
+int Block_decode(Block_decoder* dec, const Block_header* header, const uint8_t* payload, uint8_t* out);
+
+/*
+ * Sets present[b] for every byte value b the block's original bytes may
+ * hold, read from its code table without decoding: the bytes with a code
+ * or in a pair with a code, the byte of an RLE block. Stored, transformed
+ * and REF blocks may hold anything. -1 if the table is corrupt.
+ */
+int Block_present_bytes(const Block_header* header, const uint8_t* payload, uint8_t present[256]);
+
+void Block_decoder_destroy(Block_decoder* dec);
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef BLOCK_FORMAT_H
+#define BLOCK_FORMAT_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Transform.h"
+
+#define BLOCK_FORMAT_MAGIC 0x32465548   // "HUF2"
+#define BLOCK_FORMAT_VERSION 1
+#define BLOCK_FORMAT_FILE_HEADER_SIZE 16
+#define BLOCK_FORMAT_BLOCK_HEADER_SIZE 16
+#define BLOCK_FORMAT_END_PAYLOAD_SIZE 8
+#define BLOCK_FORMAT_REF_PAYLOAD_SIZE 8
+#define BLOCK_FORMAT_DEFAULT_BLOCK_SIZE (256 * 1024)
+#define BLOCK_FORMAT_MAX_BLOCK_SIZE (64 * 1024 * 1024)
+
+#define BLOCK_FLAG_MULTI_SYMBOL 0x01
+
+/*
+ * Optional block index after the END block: one entry per block of the
+ * member, then a footer that ends the file, so an appender finds the END
+ * block, the total size and the member header from the last bytes alone.
+ * Entries are 16 bytes: raw and payload size, then Block_hash of the
+ * block's original bytes. Readers also take the 8-byte entries of the
+ * first index version, which have no hash.
+ */
+#define BLOCK_FORMAT_INDEX_MAGIC 0x58465548     // "HUFX"
+#define BLOCK_FORMAT_INDEX_ENTRY_SIZE 16
+#define BLOCK_FORMAT_INDEX_ENTRY_SIZE_V1 8
+#define BLOCK_FORMAT_FOOTER_SIZE 24
+
+typedef enum {
+    BLOCK_STORED = 0,
+    BLOCK_HUFFMAN = 1,
+    BLOCK_RLE = 2,
+    BLOCK_TANS = 3,
+    BLOCK_PAIRS = 4,
+    BLOCK_REF = 5,
+    BLOCK_INDEX = 0xFE,
+    BLOCK_END = 0xFF
+} Block_kind;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t block_size;
+    uint32_t reserved;
+} Block_file_header;
+
+typedef struct {
+    uint32_t raw_size;
+    uint32_t payload_size;
+    uint8_t kind;
+    uint8_t max_code_length;
+    uint8_t num_streams;
+    uint8_t flags;
+    uint8_t transform;      // Transform_kind applied before coding
+} Block_header;
+
+typedef struct {
+    uint32_t raw_size;
+    uint32_t payload_size;
+    uint64_t hash;          // 0 when not recorded
+} Block_index_entry;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t entry_size;
+    uint16_t flags;
+    uint64_t count;
+    uint64_t member_size;   // file header through the end of this footer
+} Block_footer;
+
+void Block_file_header_init(Block_file_header* header, uint32_t block_size);
+
+void Block_file_header_serialize(const Block_file_header* header, uint8_t* out);
+
+int Block_file_header_deserialize(Block_file_header* header, const uint8_t* in);
+
+// "stored", "huffman", ... for reports; "unknown" for other values.
+const char* Block_kind_name(unsigned kind);
+
+void Block_header_serialize(const Block_header* header, uint8_t* out);
+
+int Block_header_deserialize(Block_header* header, const uint8_t* in, uint32_t block_size);
+
+// Writes the END block (header and total raw size) and returns its size.
+size_t Block_end_serialize(uint64_t total, uint8_t* out);
+
+/*
+ * Writes a REF block and returns its size: the block's raw_size bytes are
+ * the same as those `distance` bytes back in the decoded output, which the
+ * decoder copies instead of decoding. Used for deduplicated blocks.
+ */
+size_t Block_ref_serialize(uint32_t raw_size, uint64_t distance, uint8_t* out);
+
+void Block_index_entry_serialize(const Block_index_entry* entry, uint8_t* out);
+
+// `entry_size` comes from the footer; 8-byte entries get hash 0.
+void Block_index_entry_deserialize(Block_index_entry* entry, const uint8_t* in, uint16_t entry_size);
+
+void Block_footer_serialize(const Block_footer* footer, uint8_t* out);
+
+int Block_footer_deserialize(Block_footer* footer, const uint8_t* in);
+
+// Size of the INDEX block (header, entries, footer) for `count` entries of `entry_size` bytes.
+uint64_t Block_index_size(uint64_t count, uint16_t entry_size);
+
+/*
+ * XXH64 (seed 0) of a block's original bytes, as stored in the index. A
+ * hash of 0 is stored as 1, since 0 marks an entry without one.
+ */
+uint64_t Block_hash(const uint8_t* data, size_t size);
+
+#endif
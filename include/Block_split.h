@@ -0,0 +1,43 @@
+#ifndef BLOCK_SPLIT_H
+#define BLOCK_SPLIT_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Entropy-driven block boundaries. A block_size run of input is cut into
+ * up to BLOCK_SPLIT_MAX_WINDOWS equal windows and histogrammed with the
+ * histogram kernel, keeping prefix sums so that the counts of any run of
+ * windows are one subtraction. A range costs its order-0 entropy (the bits
+ * of counts x ideal code lengths) plus BLOCK_SPLIT_BLOCK_COST for its own
+ * header, table and index entry. The range is cut at the window boundary
+ * that minimizes the cost of both halves, as long as that saves more than
+ * 1/128, and each half is tried again. The counts of every piece are
+ * handed back so the block encoder need not count them again.
+ */
+#define BLOCK_SPLIT_MAX_WINDOWS 32
+#define BLOCK_SPLIT_MIN_WINDOW (16 * 1024)
+#define BLOCK_SPLIT_BLOCK_COST ((16 + 128 + 16) * 8)
+
+typedef struct {
+    uint64_t prefix[BLOCK_SPLIT_MAX_WINDOWS + 1][256];
+    size_t bounds[BLOCK_SPLIT_MAX_WINDOWS + 1];    // byte offset of every window boundary
+    unsigned windows;
+    uint8_t symbols[256];   // byte values present in the data, the only ones a cost looks at
+    unsigned distinct;
+    uint64_t costs[BLOCK_SPLIT_MAX_WINDOWS + 1][BLOCK_SPLIT_MAX_WINDOWS + 1];  // by window range, 0 until known
+    unsigned cuts[BLOCK_SPLIT_MAX_WINDOWS + 1];     // window boundaries of the pieces, from 0
+    unsigned pieces;
+} Block_splitter;
+
+Block_splitter* Block_splitter_create(void);
+
+// Splits data[0..size) and returns the number of pieces, at least 1.
+unsigned Block_split(Block_splitter* sp, const uint8_t* data, size_t size);
+
+// Byte range and byte counts of piece `piece` of the last split.
+void Block_split_piece(const Block_splitter* sp, unsigned piece, size_t* start, size_t* end, uint64_t counts[256]);
+
+void Block_splitter_destroy(Block_splitter* sp);
+
+#endif
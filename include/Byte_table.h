@@ -22,6 +22,7 @@ struct ByteTable{
 
 ByteTable* ByteTable_create();
 void ByteTable_increment(ByteTable* bt, uint8_t byte);
+void ByteTable_add_counts(ByteTable* bt, const uint64_t counts[256]);
 void ByteTable_set_codeword(ByteTable* bt, uint8_t byte, const uint8_t* codeword);
 void ByteTable_print(ByteTable* bt);
 void ByteTable_destroy(ByteTable* bt);
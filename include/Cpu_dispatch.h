@@ -0,0 +1,38 @@
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+#include <stdint.h>
+#include <stddef.h>
+#include "Huffman_encoder.h"
+#include "Trie_decoder.h"
+#include "Bit_reader.h"
+#include "Bit_writer.h"
+#include "Block_codec.h"
+
+typedef enum {
+    KERNEL_SCALAR = 0,
+    KERNEL_BMI2,
+    KERNEL_LEVEL_COUNT
+} Kernel_level;
+
+typedef struct {
+    Kernel_level level;
+    const char* name;
+    void (*histogram)(const uint8_t* data, size_t size, uint64_t counts[256]);
+    void (*encode)(const Huffman_encoder* enc, const uint8_t* in, size_t size, Bit_writer* bw);
+    size_t (*decode)(Trie_decoder* dec, Bit_reader* br, uint8_t* out, size_t max_symbols);
+    const Block_decode_fn* block_decode;
+} Kernel_set;
+
+/*
+ * The kernel set is picked once, on the first Kernels_get(): the best level
+ * cpuid reports, unless HUFF_KERNEL (scalar|bmi2) or an earlier
+ * Kernels_select() forces one. Forcing a level the CPU lacks is an error.
+ * Kernels_select() must run before any thread calls Kernels_get().
+ */
+const Kernel_set* Kernels_get(void);
+
+int Kernels_select(const char* name);
+
+int Cpu_supports(Kernel_level level);
+
+#endif
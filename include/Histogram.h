@@ -0,0 +1,15 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Byte histogram kernels. Every variant adds the byte counts of `data` to
+ * `counts`; they only differ in whether the increments are spread over
+ * sub-tables. Callers go through Kernels_get()->histogram.
+ */
+void Histogram_count_scalar(const uint8_t* data, size_t size, uint64_t counts[256]);
+
+void Histogram_count_tables(const uint8_t* data, size_t size, uint64_t counts[256]);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef HUFF_CONTEXT_H
+#define HUFF_CONTEXT_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Block_codec.h"
+
+/*
+ * Reusable in-memory codec for whole HUF2 images. The block encoder,
+ * decoder tables and output buffer survive between calls, so a long-running
+ * caller (huffd) pays for them once instead of per request. The result
+ * pointer stays valid until the next call on the same context. A context is
+ * not thread-safe; use one per thread.
+ */
+typedef struct {
+    Block_encoder* encoder;
+    Block_decoder* decoder;
+    uint8_t* output;
+    size_t output_capacity;
+    uint32_t block_size;
+} Huff_context;
+
+Huff_context* Huff_context_create(uint32_t block_size);
+
+// Both return 0 on success and -1 on corrupt input or allocation failure.
+int Huff_context_compress(Huff_context* ctx, const uint8_t* in, size_t size,
+                          const uint8_t** out, size_t* out_size);
+
+int Huff_context_decompress(Huff_context* ctx, const uint8_t* in, size_t size,
+                            const uint8_t** out, size_t* out_size);
+
+void Huff_context_destroy(Huff_context* ctx);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef HUFF_STREAM_H
+#define HUFF_STREAM_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Archive.h"
+#include "Block_codec.h"
+#include "Block_split.h"
+#include "Huffman_header.h"
+#include "Trie_decoder.h"
+
+/*
+ * Push/pull codec in the manner of z_stream. The caller points next_in and
+ * next_out at buffers of any size and calls Huff_stream_compress or
+ * Huff_stream_decompress, which consume and produce as much as both allow
+ * and advance the pointers, counts and totals. Everything between calls
+ * (the partial block, a half-read header, decoded bytes that did not fit,
+ * the FFUH bit container and trie cursor) lives in the stream, so the
+ * caller may stop at any byte and may move the unconsumed input before the
+ * next call.
+ *
+ * Whole blocks are coded in place: a block that is all in next_in is not
+ * copied, and one whose result fits in next_out is written there directly.
+ * Only blocks that straddle calls go through the stream's buffers.
+ *
+ * The compressor writes one HUF2 member without an index, like
+ * Huff_context. The decompressor takes HUF2 members, their indexes and
+ * members after them, or one FFUH file. It keeps no decoded output, so it
+ * fails on the REF blocks of --dedup files.
+ */
+#define HUFF_STREAM_OK 0
+#define HUFF_STREAM_END 1
+#define HUFF_STREAM_ERROR (-1)
+
+typedef enum {
+    HUFF_STREAM_RUN = 0,        // code whole blocks only
+    HUFF_STREAM_FLUSH = 1,      // also end the current block, so all input so far can be decoded
+    HUFF_STREAM_FINISH = 2      // no more input: end the member (or, decoding, expect it to end)
+} Huff_stream_flush;
+
+// The FFUH header with its metadata and section divider.
+#define HUFF_STREAM_HEADER_CAPACITY (HUFFMAN_HEADER_FIXED_SIZE + HUFFMAN_HEADER_MAX_METADATA_SIZE + 2)
+
+typedef struct {
+    const uint8_t* next_in;
+    size_t avail_in;
+    uint64_t total_in;
+    uint8_t* next_out;
+    size_t avail_out;
+    uint64_t total_out;
+
+    int state;
+    uint32_t block_size;
+    Block_encoder* encoder;
+    Block_splitter* splitter;
+    Block_decoder* decoder;
+    uint8_t* block;             // input block being filled, or block payload being gathered
+    size_t block_capacity;
+    size_t fill;
+    uint8_t* pending;           // output that did not fit in next_out yet
+    size_t pending_capacity;
+    size_t pending_size;
+    size_t pending_done;
+    uint8_t header[HUFF_STREAM_HEADER_CAPACITY];    // file, block or FFUH header being gathered
+    size_t header_fill;
+    Block_header current;
+    uint64_t member_total;      // raw bytes of the current member
+    uint64_t skip;              // index bytes still to pass over
+    TrieNode* root;
+    Trie_decoder* trie;
+    Bit_reader br;
+    uint64_t legacy_left;       // FFUH bytes still to decode
+} Huff_stream;
+
+// NULL options take the default level.
+Huff_stream* Huff_stream_compressor_create(const Archive_options* options);
+
+// HUFF_STREAM_END once FINISH has written everything, HUFF_STREAM_OK otherwise.
+int Huff_stream_compress(Huff_stream* s, int flush);
+
+Huff_stream* Huff_stream_decompressor_create(void);
+
+/*
+ * HUFF_STREAM_END once the FFUH file is decoded, or, with FINISH, once the
+ * input ran out where a member ended; HUFF_STREAM_OK when more input or
+ * output room is needed; HUFF_STREAM_ERROR on corrupt or, with FINISH,
+ * truncated input.
+ */
+int Huff_stream_decompress(Huff_stream* s, int flush);
+
+void Huff_stream_destroy(Huff_stream* s);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef HUFFD_PROTOCOL_H
+#define HUFFD_PROTOCOL_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * huffd wire protocol over a Unix stream socket. Every request is a 16-byte
+ * frame followed by `payload_size` bytes, unless HUFFD_FLAG_PAYLOAD_FD is
+ * set: then the payload size is 0 and one file descriptor travels with the
+ * frame (SCM_RIGHTS); the server reads that file from its current offset to
+ * EOF. Every request gets one 16-byte reply frame followed by its payload.
+ * Requests on one connection are served in order.
+ */
+#define HUFFD_REQUEST_MAGIC 0x51444648   // "HFDQ"
+#define HUFFD_REPLY_MAGIC 0x52444648     // "HFDR"
+#define HUFFD_FRAME_SIZE 16
+#define HUFFD_MAX_PAYLOAD ((uint64_t)1 << 32)
+
+#define HUFFD_FLAG_PAYLOAD_FD 0x01
+
+typedef enum {
+    HUFFD_OP_COMPRESS = 1,
+    HUFFD_OP_DECOMPRESS = 2,
+    HUFFD_OP_STATS = 3      // reply payload is a text latency report
+} Huffd_op;
+
+#define HUFFD_STATUS_TABLE \
+    X(HUFFD_STATUS_OK, 0, "ok") \
+    X(HUFFD_STATUS_BAD_REQUEST, 1, "bad request") \
+    X(HUFFD_STATUS_CORRUPT_INPUT, 2, "corrupt input") \
+    X(HUFFD_STATUS_IO_ERROR, 3, "cannot read payload") \
+    X(HUFFD_STATUS_TOO_LARGE, 4, "payload too large") \
+    X(HUFFD_STATUS_NO_MEMORY, 5, "out of memory")
+
+#define X(name, code, text) name = code,
+typedef enum {
+    HUFFD_STATUS_TABLE
+} Huffd_status;
+#undef X
+
+typedef struct {
+    uint8_t op;
+    uint8_t flags;
+    uint64_t payload_size;
+} Huffd_request;
+
+typedef struct {
+    uint32_t status;
+    uint64_t payload_size;
+} Huffd_reply;
+
+const char* Huffd_status_text(uint32_t status);
+
+/*
+ * All calls return 0 on success and -1 on a socket error or malformed
+ * frame. Huffd_recv_request returns 1 on a clean EOF between requests;
+ * *fd is -1 unless a descriptor came with the frame.
+ */
+int Huffd_send_request(int sock, const Huffd_request* request, const void* payload, int fd);
+
+int Huffd_recv_request(int sock, Huffd_request* request, int* fd);
+
+int Huffd_send_reply(int sock, uint32_t status, const void* payload, uint64_t size);
+
+int Huffd_recv_reply(int sock, Huffd_reply* reply);
+
+int Huffd_read_full(int fd, void* buffer, size_t size);
+
+int Huffd_write_full(int fd, const void* buffer, size_t size);
+
+#endif
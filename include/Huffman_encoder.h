@@ -0,0 +1,33 @@
+#ifndef HUFFMAN_ENCODER_H
+#define HUFFMAN_ENCODER_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Byte_table.h"
+#include "Bit_writer.h"
+
+#define HUFFMAN_ENCODER_MAX_CODE_LENGTH 64
+
+/*
+ * Packed form of the ByteTable codewords: code[b] holds the codeword of byte
+ * b right-aligned, length[b] its bit length. The encode kernels write
+ * `size` symbols without checking the output; callers bound the batch with
+ * Huffman_encoder_batch_limit first.
+ */
+typedef struct {
+    uint64_t code[256];
+    uint8_t length[256];
+    uint8_t max_length;
+} Huffman_encoder;
+
+Huffman_encoder* Huffman_encoder_create(const ByteTable* bt);
+
+size_t Huffman_encoder_batch_limit(const Huffman_encoder* enc, const Bit_writer* bw);
+
+void Huffman_encoder_encode_scalar(const Huffman_encoder* enc, const uint8_t* in, size_t size, Bit_writer* bw);
+
+void Huffman_encoder_encode_bmi2(const Huffman_encoder* enc, const uint8_t* in, size_t size, Bit_writer* bw);
+
+void Huffman_encoder_destroy(Huffman_encoder* enc);
+
+#endif
@@ -6,6 +6,11 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#define HUFFMAN_HEADER_FIXED_SIZE 20
+// 256 entries of (character, length, up to 32 bytes of a 255-bit codeword).
+// The size fields stay 32-bit on disk: the metadata never gets near 4 GiB,
+// only file_size grows with the input.
+#define HUFFMAN_HEADER_MAX_METADATA_SIZE (256 * (2 + 32))
 
 typedef struct {
     uint32_t magic_number;             
@@ -0,0 +1,67 @@
+#ifndef HUFFMAN_TABLE_H
+#define HUFFMAN_TABLE_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Huffman_encoder.h"
+
+#define HUFFMAN_TABLE_MAX_BITS 12
+#define HUFFMAN_TABLE_MIN_BITS 8
+#define HUFFMAN_TABLE_LENGTHS_SIZE 128
+// Largest alphabet the _n variants take, e.g. bytes plus byte pairs.
+#define HUFFMAN_TABLE_MAX_SYMBOLS 512
+
+typedef struct {
+    uint8_t symbol;
+    uint8_t length;
+} Huffman_decode_entry;
+
+// Two-symbol entry: `count` symbols (1 or 2) whose codes fill `length` bits.
+typedef struct {
+    uint8_t symbols[2];
+    uint8_t length;
+    uint8_t count;
+} Huffman_decode_entry2;
+
+/*
+ * Canonical, length-limited code tables for the block format. Only code
+ * lengths are stored (HUFFMAN_TABLE_LENGTHS_SIZE bytes, one nibble per
+ * byte value); codes are assigned in (length, byte) order on both sides.
+ * Lengths are computed in place in a flat array sorted by count (Moffat
+ * and Katajainen), without tree nodes or a priority queue.
+ */
+unsigned Huffman_table_build_lengths(const uint64_t counts[256], uint8_t lengths[256], unsigned max_length);
+
+/*
+ * The same for an alphabet of n <= HUFFMAN_TABLE_MAX_SYMBOLS symbols. Its
+ * lengths take (n + 1) / 2 bytes, which Huffman_table_write_lengths_n
+ * returns.
+ */
+unsigned Huffman_table_build_lengths_n(const uint64_t* counts, unsigned n, uint8_t* lengths, unsigned max_length);
+
+/*
+ * Canonical codewords of up to HUFFMAN_ENCODER_MAX_CODE_LENGTH bits as the
+ * '0'/'1' strings of the legacy FFUH metadata. A lone symbol gets the empty
+ * codeword, as FFUH single-symbol files have.
+ */
+void Huffman_table_set_codewords(const uint8_t lengths[256], ByteTable* bt);
+
+void Huffman_table_canonical_codes(const uint8_t* lengths, unsigned n, uint32_t* codes);
+
+size_t Huffman_table_write_lengths_n(const uint8_t* lengths, unsigned n, uint8_t* out);
+
+int Huffman_table_read_lengths_n(const uint8_t* in, unsigned n, uint8_t* lengths, unsigned* max_length);
+
+void Huffman_table_build_encoder(const uint8_t lengths[256], Huffman_encoder* enc);
+
+void Huffman_table_write_lengths(const uint8_t lengths[256], uint8_t* out);
+
+int Huffman_table_read_lengths(const uint8_t* in, uint8_t lengths[256], unsigned* max_length);
+
+unsigned Huffman_table_decode_bits(unsigned max_length);
+
+void Huffman_table_build_decode(const uint8_t lengths[256], unsigned table_bits, Huffman_decode_entry* table);
+
+void Huffman_table_build_decode2(const Huffman_decode_entry* table, unsigned table_bits, Huffman_decode_entry2* table2);
+
+#endif
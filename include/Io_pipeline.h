@@ -0,0 +1,68 @@
+#ifndef IO_PIPELINE_H
+#define IO_PIPELINE_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define IO_CHUNK_SIZE (1024 * 1024)
+#define IO_RING_DEPTH 4
+// Smallest reader chunk a memory limit may shrink a ring to.
+#define IO_MIN_CHUNK_SIZE (64 * 1024)
+
+typedef struct Io_chunk Io_chunk;
+typedef struct Io_reader Io_reader;
+typedef struct Io_writer Io_writer;
+
+struct Io_chunk {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+};
+
+/*
+ * Io_reader : read-ahead stage. Chunks of the input are filled in ring order
+ * while the caller is coding the previous ones. Regular files are read with
+ * io_uring when the kernel allows it, everything else with a reader thread.
+ * Set HUFF_IO=thread to force the thread backend. The stream position of
+ * `file` is unspecified after Io_reader_destroy; seek before reusing it.
+ * Under a memory limit (Mem.h) the ring takes at most a quarter of what is
+ * left: it drops to two slots, then halves the chunks down to
+ * IO_MIN_CHUNK_SIZE.
+ */
+Io_reader* Io_reader_create(FILE* file, size_t chunk_size, int depth);
+
+Io_chunk* Io_reader_next(Io_reader* reader);
+
+/*
+ * Byte-stream view over the same ring: returns `size` bytes, pointing into
+ * the current chunk when they are contiguous and copied into `scratch`
+ * otherwise. The pointer stays valid until the next call; NULL means the
+ * input ended first. Do not mix with Io_reader_next on one reader.
+ */
+const uint8_t* Io_reader_read(Io_reader* reader, size_t size, uint8_t* scratch);
+
+int Io_reader_failed(const Io_reader* reader);
+
+const char* Io_reader_backend(const Io_reader* reader);
+
+void Io_reader_destroy(Io_reader* reader);
+
+/*
+ * Io_writer : write-behind stage. The caller fills a chunk from
+ * Io_writer_acquire and hands it back with Io_writer_submit; a writer thread
+ * drains submitted chunks to the file in order. Callers rely on the chunk
+ * size, so a memory limit only takes slots away, down to two.
+ */
+Io_writer* Io_writer_create(FILE* file, size_t chunk_size, int depth);
+
+Io_chunk* Io_writer_acquire(Io_writer* writer);
+
+void Io_writer_submit(Io_writer* writer, Io_chunk* chunk);
+
+// Waits until every submitted chunk is in the file and flushes it; -1 if a write failed.
+int Io_writer_sync(Io_writer* writer);
+
+int Io_writer_destroy(Io_writer* writer);
+
+#endif
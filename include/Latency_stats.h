@@ -0,0 +1,40 @@
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/*
+ * Thread-safe latency recorder. Keeps the most recent `window` samples in a
+ * ring; percentiles are taken over that window, count and max over the
+ * whole lifetime.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    uint64_t* samples;
+    size_t window;
+    uint64_t count;
+    uint64_t max;
+} Latency_stats;
+
+typedef struct {
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+} Latency_summary;
+
+Latency_stats* Latency_stats_create(size_t window);
+
+void Latency_stats_record(Latency_stats* stats, uint64_t nanoseconds);
+
+void Latency_stats_summarize(Latency_stats* stats, Latency_summary* summary);
+
+// One line: "<label> n=.. p50=..us p90=..us p99=..us max=..us"
+int Latency_summary_format(const Latency_summary* summary, const char* label, char* out, size_t size);
+
+void Latency_stats_destroy(Latency_stats* stats);
+
+#endif
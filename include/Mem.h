@@ -0,0 +1,67 @@
+#ifndef MEM_H
+#define MEM_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Accounting allocator every module allocates through. Each block carries
+ * a small header with its size and subsystem, so Mem_free needs neither.
+ * Counters are atomic and shared by all threads: current and peak bytes
+ * overall, and per subsystem the allocation count, live blocks and bytes
+ * and peak bytes.
+ *
+ * With a limit set (Mem_set_limit, --max-memory), an allocation that would
+ * take the current total past it fails like malloc does and is reported on
+ * stderr. Modules that size buffers or thread counts ask Mem_fit first, so
+ * they shrink to the budget instead of failing.
+ */
+#define MEM_SUBSYSTEM_TABLE \
+    X(MEM_TRIE, "trie") \
+    X(MEM_TABLE, "table") \
+    X(MEM_HEADER, "header") \
+    X(MEM_IO, "io") \
+    X(MEM_BLOCK, "block") \
+    X(MEM_TRANSFORM, "transform") \
+    X(MEM_SERVER, "server") \
+    X(MEM_OTHER, "other")
+
+#define X(name, label) name,
+typedef enum {
+    MEM_SUBSYSTEM_TABLE
+    MEM_SUBSYSTEM_COUNT
+} Mem_subsystem;
+#undef X
+
+void* Mem_alloc(Mem_subsystem subsystem, size_t size);
+
+void* Mem_calloc(Mem_subsystem subsystem, size_t count, size_t size);
+
+// Keeps the subsystem of `ptr`; a NULL `ptr` allocates for `subsystem`.
+void* Mem_realloc(Mem_subsystem subsystem, void* ptr, size_t size);
+
+char* Mem_strdup(Mem_subsystem subsystem, const char* text);
+
+void Mem_free(void* ptr);
+
+// 0 removes the limit.
+void Mem_set_limit(uint64_t bytes);
+
+uint64_t Mem_limit(void);
+
+// Bytes left under the limit; UINT64_MAX without one.
+uint64_t Mem_available(void);
+
+/*
+ * Largest count in [minimum, wanted] whose count * unit bytes fit in
+ * 1/share of what is left under the limit; `wanted` without a limit.
+ */
+unsigned Mem_fit(size_t unit, unsigned wanted, unsigned minimum, unsigned share);
+
+// Parses a byte count with an optional K, M or G suffix (powers of 1024); -1 if malformed.
+int Mem_parse_size(const char* text, uint64_t* bytes);
+
+// Totals, then one line per subsystem; blocks still live are reported as leaks.
+void Mem_report(FILE* out);
+
+#endif
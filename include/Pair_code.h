@@ -0,0 +1,75 @@
+#ifndef PAIR_CODE_H
+#define PAIR_CODE_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Bit_writer.h"
+#include "Huffman_table.h"
+
+/*
+ * Extended alphabet for BLOCK_PAIRS: the 256 byte values plus up to
+ * PAIR_CODE_MAX_PAIRS frequent byte pairs, symbols 256 and up. The input
+ * is cut greedily, taking a pair symbol wherever the next two bytes are in
+ * the dictionary, and the symbols get an ordinary canonical, length-limited
+ * code. A decode table entry then yields up to two bytes per lookup for
+ * any code length, not only when two short codes fit.
+ *
+ * The table is stored as the pair count minus one (1 byte), the pairs
+ * (2 bytes each) and the code lengths of all 256 + count symbols as
+ * nibbles.
+ */
+#define PAIR_CODE_MAX_PAIRS 256
+#define PAIR_CODE_MAX_SYMBOLS (256 + PAIR_CODE_MAX_PAIRS)
+// A pair costs 20 bits of table, so rarer ones cannot pay for themselves.
+#define PAIR_CODE_MIN_COUNT 16
+
+typedef struct {
+    uint32_t pair_counts[1 << 16];
+    uint16_t symbol[1 << 16];       // (first << 8 | second) -> symbol, 0 if not a pair symbol
+    uint8_t pairs[2 * PAIR_CODE_MAX_PAIRS];
+    unsigned num_pairs;
+    uint64_t counts[PAIR_CODE_MAX_SYMBOLS];
+    uint8_t lengths[PAIR_CODE_MAX_SYMBOLS];
+    uint32_t codes[PAIR_CODE_MAX_SYMBOLS];
+} Pair_encoder;
+
+Pair_encoder* Pair_encoder_create(void);
+
+/*
+ * Fills the dictionary with the most frequent pairs of `in`, counting one
+ * window in 2^shift like the block histograms. Returns the pair count,
+ * 0 when no pair is frequent enough.
+ */
+unsigned Pair_choose(Pair_encoder* enc, const uint8_t* in, size_t size, unsigned shift, size_t window);
+
+// Adds the symbols of one stream segment to enc->counts.
+void Pair_count(Pair_encoder* enc, const uint8_t* in, size_t size);
+
+/*
+ * Builds the code from enc->counts and sets *bits to the encoded size.
+ * Returns the longest code length, or 0 when fewer than two symbols occur.
+ */
+unsigned Pair_build_code(Pair_encoder* enc, uint64_t* bits);
+
+size_t Pair_table_size(unsigned num_pairs);
+
+size_t Pair_write_table(const Pair_encoder* enc, uint8_t* out);
+
+// Encodes one stream segment; bw must have room for its exact size.
+void Pair_encode(const Pair_encoder* enc, const uint8_t* in, size_t size, Bit_writer* bw);
+
+/*
+ * Reads a table from the `size` bytes at `in`: pairs[] and lengths[] of the
+ * PAIR_CODE_MAX_SYMBOLS kind. Rejects codes that are not complete and sets
+ * *used to the bytes consumed.
+ */
+int Pair_read_table(const uint8_t* in, size_t size, uint8_t* pairs, unsigned* num_pairs, uint8_t* lengths,
+                    unsigned* max_length, size_t* used);
+
+// Decode table for the multi-symbol loops: each entry emits one symbol, i.e. one or two bytes.
+void Pair_build_decode(const uint8_t* pairs, unsigned num_pairs, const uint8_t* lengths, unsigned table_bits,
+                       Huffman_decode_entry2* table);
+
+void Pair_encoder_destroy(Pair_encoder* enc);
+
+#endif
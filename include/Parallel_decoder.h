@@ -0,0 +1,35 @@
+#ifndef PARALLEL_DECODER_H
+#define PARALLEL_DECODER_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Trie.h"
+
+// Compressed bytes per segment; the last segment also takes the remainder.
+#define PARALLEL_DECODER_SEGMENT_SIZE (1024 * 1024)
+// Bytes past a segment (and into the next) decoded symbol by symbol to find where the two agree.
+#define PARALLEL_DECODER_SYNC_WINDOW 1024
+
+/*
+ * Decoder for legacy FFUH bitstreams, which have no block index. The
+ * `data_size` bytes at `data_offset` of the regular file behind `fd` are cut
+ * into segments at byte boundaries and decoded in rounds, one segment per
+ * thread, with pread. A segment that starts at a known symbol boundary is
+ * decoded exactly; the others start speculatively at their first byte and
+ * record where their first symbols start. Each segment also decodes a sync
+ * window past its end and records those symbol starts. Prefix codes tend to
+ * fall back into step within a few dozen bits, so the first position both
+ * neighbours agree on joins them: the earlier segment keeps its symbols
+ * before it and the later one those from it on. If the window holds no
+ * common position, the later segment is decoded again from the earlier
+ * one's last boundary. Symbols are written to `output` in order, up to
+ * `file_size`.
+ *
+ * `threads` must be at least 1. Returns 0 with the bytes written in
+ * *written, which fall short of `file_size` if the data is corrupt, or -1
+ * if a read or write failed.
+ */
+int Parallel_decoder_file(int fd, uint64_t data_offset, uint64_t data_size, TrieNode* root, uint64_t file_size,
+                          unsigned threads, FILE* output, uint64_t* written);
+
+#endif
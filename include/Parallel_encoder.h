@@ -0,0 +1,25 @@
+#ifndef PARALLEL_ENCODER_H
+#define PARALLEL_ENCODER_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Huffman_encoder.h"
+
+/*
+ * Encode pass of the legacy format on all cores. The bit length of every
+ * Parallel_histogram_segment_size() segment of the input follows from its
+ * counts (kept by Parallel_histogram_file) and the code lengths, so a
+ * prefix sum over them gives the bit offset each segment starts at. Threads
+ * take segments in turn, read them with pread, encode them from that offset
+ * and pwrite their whole bytes to `out_fd`; a byte shared with a neighbour
+ * segment is held back, OR-ed with the neighbour's part and written at the
+ * end. The result is the serial encoder's bitstream byte for byte, starting
+ * at `out_offset` and zero-padded to a whole byte.
+ *
+ * `threads` 0 uses one per online CPU. Returns 0 with the encoded size in
+ * *out_size, or -1 if a read or write failed.
+ */
+int Parallel_encoder_file(int fd, uint64_t size, const uint32_t (*segments)[256], const Huffman_encoder* enc,
+                          unsigned threads, int out_fd, uint64_t out_offset, uint64_t* out_size);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef PARALLEL_HISTOGRAM_H
+#define PARALLEL_HISTOGRAM_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Smallest range worth its own thread; smaller files use fewer threads.
+#define PARALLEL_HISTOGRAM_MIN_RANGE (8u * 1024 * 1024)
+// Granularity of the optional per-segment counts, a whole number of I/O chunks.
+#define PARALLEL_HISTOGRAM_SEGMENT_SIZE (4u * 1024 * 1024)
+// Larger files get segments of twice, four times... that size, so the counts keep a fixed size.
+#define PARALLEL_HISTOGRAM_MAX_SEGMENTS 1024
+
+/*
+ * Whole-file byte histogram for the legacy format's first pass. The first
+ * `size` bytes of the regular file behind `fd` are split into ranges, each
+ * counted by its own thread into private counts with pread and the
+ * selected histogram kernel; the counts are merged into `counts` at the
+ * end. No thread touches a shared FILE* or file offset. `threads` 0 uses
+ * one per online CPU. Returns 0, or -1 if a read failed or the file ended
+ * early.
+ *
+ * With `segments` (Parallel_histogram_segments(size) zeroed rows), the
+ * counts of each Parallel_histogram_segment_size(size) slice of the file
+ * are kept there as well, for Parallel_encoder. A segment is below 4 GiB,
+ * so 32-bit counts hold it.
+ */
+int Parallel_histogram_file(int fd, uint64_t size, unsigned threads, uint64_t counts[256], uint32_t (*segments)[256]);
+
+uint64_t Parallel_histogram_segment_size(uint64_t size);
+
+// At most PARALLEL_HISTOGRAM_MAX_SEGMENTS; 0 for files too large for 32-bit segment counts.
+uint64_t Parallel_histogram_segments(uint64_t size);
+
+// Online CPUs, at least 1.
+unsigned Parallel_histogram_default_threads(void);
+
+#endif
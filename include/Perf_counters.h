@@ -0,0 +1,58 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Opt-in hardware counters around the phases of a run, via perf_event_open.
+ * Each counter is opened on its own (user space only, inherited by threads
+ * created later), so one the kernel or a container refuses is reported as
+ * n/a while the others and the phase timings still work. Counts are scaled
+ * by enabled/running time when the kernel multiplexes them.
+ */
+#define PERF_COUNTER_TABLE \
+    X(PERF_CYCLES, "cycles") \
+    X(PERF_INSTRUCTIONS, "instructions") \
+    X(PERF_BRANCH_MISSES, "branch-misses") \
+    X(PERF_L1D_MISSES, "L1d-misses") \
+    X(PERF_LLC_MISSES, "LLC-misses")
+
+#define X(name, label) name,
+typedef enum {
+    PERF_COUNTER_TABLE
+    PERF_COUNTER_COUNT
+} Perf_counter;
+#undef X
+
+#define PERF_MAX_PHASES 16
+
+typedef struct {
+    const char* name;
+    uint64_t nanoseconds;
+    uint64_t values[PERF_COUNTER_COUNT];
+} Perf_phase;
+
+typedef struct {
+    int enabled;
+    int fds[PERF_COUNTER_COUNT];    // -1 when the counter is unavailable
+    int open_error;                 // errno of the first refused counter
+    Perf_phase phases[PERF_MAX_PHASES];
+    size_t phase_count;
+    uint64_t start_ns;
+    uint64_t start_values[PERF_COUNTER_COUNT];
+} Perf_session;
+
+// A disabled session opens nothing and its calls are no-ops.
+Perf_session* Perf_session_create(int enabled);
+
+void Perf_phase_begin(Perf_session* session, const char* name);
+
+void Perf_phase_end(Perf_session* session);
+
+// One line per phase: its time, each counter and instructions per cycle.
+void Perf_session_report(const Perf_session* session, FILE* out);
+
+void Perf_session_destroy(Perf_session* session);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef TANS_H
+#define TANS_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Bit_reader.h"
+
+/*
+ * Table-based ANS (tANS / FSE) entropy coder.
+ *
+ * Byte counts are normalized to 2^table_log slots, every present symbol
+ * getting at least one; the slots are spread over the state table the way
+ * FSE does. Unlike Huffman, a symbol costs a fractional number of bits
+ * (table_log - log2(norm) on average), which matters once one byte takes
+ * most of the data.
+ *
+ * The encoder walks the input backwards and writes its stream back to front,
+ * so the decoder reads it forward with the shared MSB-first Bit_reader. A
+ * stream starts with zero padding and a 1 marker bit, then the initial state
+ * (table_log bits), then per symbol the bits of its state transition. The
+ * encoder starts from state 2^table_log, so a valid stream ends in state 0.
+ */
+#define TANS_MIN_TABLE_LOG 5
+#define TANS_MAX_TABLE_LOG 12
+#define TANS_DEFAULT_TABLE_LOG 11
+// Bytes the encoder may need beyond the packed bits: marker, final state, flush word.
+#define TANS_ENCODE_SLACK 16
+
+typedef struct {
+    uint16_t new_state;     // base of the next state, before adding the read bits
+    uint8_t symbol;
+    uint8_t bits;
+} Tans_decode_entry;
+
+typedef struct {
+    int32_t delta_find_state;
+    uint32_t delta_bits;
+} Tans_symbol_transform;
+
+typedef struct {
+    uint16_t state_table[1 << TANS_MAX_TABLE_LOG];
+    Tans_symbol_transform symbols[256];
+    unsigned table_log;
+} Tans_encoder;
+
+// Picks a table size for `total` bytes spread over `distinct` symbols.
+unsigned Tans_table_log(uint64_t total, unsigned distinct);
+
+void Tans_normalize(const uint64_t counts[256], uint64_t total, unsigned table_log, uint16_t norm[256]);
+
+// Estimated payload bits of the data behind `counts` under `norm`.
+double Tans_cost(const uint64_t counts[256], const uint16_t norm[256], unsigned table_log);
+
+/*
+ * The table is stored as table_log (1 byte), the last used symbol (1 byte)
+ * and the normalized counts of symbols 0..last as LEB128 varints. Reading
+ * checks that they sum to 2^table_log and sets *used to the bytes consumed.
+ */
+size_t Tans_write_norm(const uint16_t norm[256], unsigned table_log, uint8_t* out);
+
+int Tans_read_norm(const uint8_t* in, size_t size, uint16_t norm[256], unsigned* table_log, size_t* used);
+
+void Tans_build_encoder(const uint16_t norm[256], unsigned table_log, Tans_encoder* enc);
+
+void Tans_build_decode(const uint16_t norm[256], unsigned table_log, Tans_decode_entry* table);
+
+/*
+ * Encodes `in` into out[0..capacity) and returns the stream size, or 0 when
+ * it does not fit. The stream is built at the end of the buffer and moved to
+ * its start.
+ */
+size_t Tans_encode(const Tans_encoder* enc, const uint8_t* in, size_t size, uint8_t* out, size_t capacity);
+
+/*
+ * Decodes `streams` independent streams into op[s]..oend[s], interleaved so
+ * their table lookups overlap. Returns -1 if a stream is malformed, does not
+ * end in state 0 or has bits left over.
+ */
+int Tans_decode(const Tans_decode_entry* table, unsigned table_log, Bit_reader* br,
+                uint8_t** op, uint8_t* const* oend, unsigned streams);
+
+#endif
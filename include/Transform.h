@@ -0,0 +1,85 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Reversible per-block transforms that run ahead of the histogram:
+ *
+ *   DELTA1/2/4 : byte-wise difference to the byte 1, 2 or 4 positions back,
+ *                i.e. delta coding of fixed-width little-endian integers
+ *                when their high bytes change slowly.
+ *   MTF        : move-to-front; recently seen bytes become small indices.
+ *   BWT        : Burrows-Wheeler (block sorting of all rotations) followed
+ *                by move-to-front. The parameters are the rows that the
+ *                TRANSFORM_BWT_STREAMS inverse walks start from, 4 bytes each.
+ *
+ * The kind is stored in the block header; parameters are stored in front of
+ * the block payload.
+ */
+#define TRANSFORM_TABLE \
+    X(TRANSFORM_NONE, 0, "none") \
+    X(TRANSFORM_DELTA1, 1, "delta1") \
+    X(TRANSFORM_DELTA2, 2, "delta2") \
+    X(TRANSFORM_DELTA4, 3, "delta4") \
+    X(TRANSFORM_MTF, 4, "mtf") \
+    X(TRANSFORM_BWT, 5, "bwt")
+
+#define X(name, code, text) name = code,
+typedef enum {
+    TRANSFORM_TABLE
+    TRANSFORM_COUNT
+} Transform_kind;
+#undef X
+
+// A BWT block is inverted as this many interleaved streams.
+#define TRANSFORM_BWT_STREAMS 4
+#define TRANSFORM_MAX_PARAMETERS TRANSFORM_BWT_STREAMS
+
+// Sets of transforms a block may choose from.
+#define TRANSFORM_SET(kind) (1u << (kind))
+#define TRANSFORM_SET_DELTA (TRANSFORM_SET(TRANSFORM_DELTA1) | TRANSFORM_SET(TRANSFORM_DELTA2) | TRANSFORM_SET(TRANSFORM_DELTA4))
+#define TRANSFORM_SET_ALL (TRANSFORM_SET_DELTA | TRANSFORM_SET(TRANSFORM_MTF) | TRANSFORM_SET(TRANSFORM_BWT))
+
+// Blocks larger than twice this choose their transform on a sample of
+// TRANSFORM_SAMPLE_SLICES slices.
+#define TRANSFORM_SAMPLE_BYTES (64 * 1024)
+#define TRANSFORM_SAMPLE_SLICES 4
+
+typedef struct {
+    uint8_t* buffers[2];    // candidate and best-so-far outputs
+    uint8_t sample[TRANSFORM_SAMPLE_BYTES];  // slices of a large block
+    uint32_t* work;         // BWT rank / suffix arrays
+    size_t capacity;
+} Transform_workspace;
+
+Transform_workspace* Transform_workspace_create(void);
+
+void Transform_workspace_destroy(Transform_workspace* ws);
+
+const char* Transform_name(unsigned kind);
+
+// Parses "none", "delta", "mtf", "bwt" or "auto" into a transform set; -1 if unknown.
+int Transform_parse_set(const char* name, unsigned* set);
+
+size_t Transform_parameter_size(unsigned kind);
+
+/*
+ * Tries every transform in `allowed` and returns the output with the lowest
+ * order-0 entropy, or `in` itself with *kind = TRANSFORM_NONE when no
+ * transform beats the raw bytes. Blocks over 2 * TRANSFORM_SAMPLE_BYTES are
+ * judged on a sample, and only the winner runs over the whole block. The
+ * result stays valid until the next call.
+ */
+const uint8_t* Transform_choose(Transform_workspace* ws, const uint8_t* in, size_t size, unsigned allowed,
+                                uint8_t* kind, uint32_t parameter[TRANSFORM_MAX_PARAMETERS]);
+
+void Transform_forward(Transform_workspace* ws, unsigned kind, const uint8_t* in, size_t size,
+                       uint8_t* out, uint32_t parameter[TRANSFORM_MAX_PARAMETERS]);
+
+// Returns -1 when the parameters are inconsistent with the data.
+int Transform_inverse(Transform_workspace* ws, unsigned kind, const uint8_t* in, size_t size,
+                      const uint32_t parameter[TRANSFORM_MAX_PARAMETERS], uint8_t* out);
+
+#endif
@@ -22,6 +22,4 @@ TrieNode* Trie_build_from_metadata(const uint8_t* metadata, size_t metadata_size
 
 void Trie_destroy(TrieNode* root);
 
-void decode(TrieNode* root, uint8_t* data, size_t total_bits, FILE* outputFile);
-
 #endif
@@ -0,0 +1,38 @@
+#ifndef TRIE_DECODER_H
+#define TRIE_DECODER_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "Trie.h"
+#include "Bit_reader.h"
+
+#define TRIE_DECODER_TABLE_BITS 11
+
+typedef struct {
+    TrieNode* node;   // leaf reached, or interior node after TABLE_BITS bits
+    uint8_t length;   // code length when node is a leaf, 0 otherwise
+} Trie_decoder_entry;
+
+/*
+ * Decoder engine for the FFUH layout, whose codewords are arbitrary prefix
+ * codes stored as a trie. Codes of up to TRIE_DECODER_TABLE_BITS bits are
+ * resolved with one table lookup; longer codes continue bit by bit from the
+ * interior node the table points at. A symbol cut by a buffer boundary is
+ * resumed from `current` on the next call.
+ */
+typedef struct {
+    TrieNode* root;
+    TrieNode* current;
+    int error;
+    Trie_decoder_entry table[1 << TRIE_DECODER_TABLE_BITS];
+} Trie_decoder;
+
+Trie_decoder* Trie_decoder_create(TrieNode* root);
+
+size_t Trie_decoder_decode_scalar(Trie_decoder* dec, Bit_reader* br, uint8_t* out, size_t max_symbols);
+
+size_t Trie_decoder_decode_bmi2(Trie_decoder* dec, Bit_reader* br, uint8_t* out, size_t max_symbols);
+
+void Trie_decoder_destroy(Trie_decoder* dec);
+
+#endif
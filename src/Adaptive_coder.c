@@ -0,0 +1,200 @@
+#include "Adaptive_coder.h"
+#include <string.h>
+#include "Bit_reader.h"
+#include "Bit_writer.h"
+#include "Mem.h"
+
+
+// ===== MODEL =====
+
+static void Adaptive_model_rebuild(Adaptive_model* model) {
+    if (model->total > ADAPTIVE_MAX_TOTAL) {
+        model->total = 0;
+        for (int i = 0; i < 256; i++) {
+            model->counts[i] = (model->counts[i] + 1) / 2;
+            model->total += model->counts[i];
+        }
+    }
+    model->max_length = Huffman_table_build_lengths_n(model->counts, 256, model->lengths, HUFFMAN_TABLE_MAX_BITS);
+    model->model_bits = 0;
+    for (int i = 0; i < 256; i++) {
+        model->model_bits += model->counts[i] * model->lengths[i];
+    }
+    model->model_total = model->total;
+    model->seen = 0;
+    model->spent_bits = 0;
+}
+
+
+static void Adaptive_model_init(Adaptive_model* model) {
+    for (int i = 0; i < 256; i++) {
+        model->counts[i] = 1;
+    }
+    model->total = 256;
+    model->interval = ADAPTIVE_FIRST_INTERVAL;
+    Adaptive_model_rebuild(model);
+}
+
+
+// Counts `symbol`; returns 1 when the lengths were rebuilt.
+static inline int Adaptive_model_update(Adaptive_model* model, uint8_t symbol) {
+    model->counts[symbol] += ADAPTIVE_INCREMENT;
+    model->total += ADAPTIVE_INCREMENT;
+    model->spent_bits += model->lengths[symbol];
+    model->seen++;
+
+    if (model->seen == model->interval) {
+        if (model->interval < ADAPTIVE_REBUILD_INTERVAL) model->interval *= 2;
+        Adaptive_model_rebuild(model);
+        return 1;
+    }
+    // spent / seen > 5/4 * model_bits / model_total, kept in integers.
+    if (model->seen % ADAPTIVE_CHECK_INTERVAL == 0
+        && 4 * model->spent_bits * model->model_total > 5 * (uint64_t)model->seen * model->model_bits) {
+        Adaptive_model_rebuild(model);
+        return 1;
+    }
+    return 0;
+}
+
+
+static size_t Adaptive_put_varint(uint8_t* out, size_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+
+// Returns the varint's size, 0 if it is cut off and -1 if it is too long.
+static int Adaptive_get_varint(const uint8_t* in, size_t available, size_t* value) {
+    *value = 0;
+    for (int n = 0; n < 4; n++) {
+        if ((size_t)n == available) return 0;
+        *value |= (size_t)(in[n] & 0x7F) << (7 * n);
+        if (!(in[n] & 0x80)) return n + 1;
+    }
+    return -1;
+}
+
+
+// ===== ENCODER =====
+
+Adaptive_encoder* Adaptive_encoder_create(void) {
+    Adaptive_encoder* enc = (Adaptive_encoder*)Mem_calloc(MEM_TABLE, 1, sizeof(Adaptive_encoder));
+    if (!enc) {
+        perror("Failed to allocate Adaptive_encoder");
+        exit(EXIT_FAILURE);
+    }
+    Adaptive_model_init(&enc->model);
+    Huffman_table_build_encoder(enc->model.lengths, &enc->codes);
+    return enc;
+}
+
+
+size_t Adaptive_encode_bound(size_t size) {
+    return ADAPTIVE_MESSAGE_HEADER_MAX + (size * HUFFMAN_TABLE_MAX_BITS + 7) / 8 + BIT_WRITER_SLACK;
+}
+
+
+/*
+ * The payload is coded behind room for the largest header, then moved down
+ * once its size is known. Four codes fit between flushes.
+ */
+size_t Adaptive_encode_message(Adaptive_encoder* enc, const uint8_t* in, size_t size, uint8_t* out) {
+    uint8_t* payload = out + ADAPTIVE_MESSAGE_HEADER_MAX;
+    Bit_writer bw;
+    Bit_writer_init(&bw, payload, Adaptive_encode_bound(size) - ADAPTIVE_MESSAGE_HEADER_MAX);
+
+    for (size_t i = 0; i < size; i++) {
+        Bit_writer_put(&bw, enc->codes.code[in[i]], enc->codes.length[in[i]]);
+        if ((i & 3) == 3) Bit_writer_flush(&bw);
+        if (Adaptive_model_update(&enc->model, in[i])) {
+            Bit_writer_flush(&bw);
+            Huffman_table_build_encoder(enc->model.lengths, &enc->codes);
+        }
+    }
+    Bit_writer_flush(&bw);
+    Bit_writer_finish(&bw);
+    size_t payload_size = (size_t)(bw.ptr - payload);
+
+    size_t header_size = Adaptive_put_varint(out, size);
+    header_size += Adaptive_put_varint(out + header_size, payload_size);
+    memmove(out + header_size, payload, payload_size);
+    return header_size + payload_size;
+}
+
+
+void Adaptive_encoder_destroy(Adaptive_encoder* enc) {
+    Mem_free(enc);
+}
+
+
+// ===== DECODER =====
+
+static void Adaptive_decoder_build(Adaptive_decoder* dec) {
+    dec->table_bits = Huffman_table_decode_bits(dec->model.max_length);
+    Huffman_table_build_decode(dec->model.lengths, dec->table_bits, dec->table);
+}
+
+
+Adaptive_decoder* Adaptive_decoder_create(void) {
+    Adaptive_decoder* dec = (Adaptive_decoder*)Mem_calloc(MEM_TABLE, 1, sizeof(Adaptive_decoder));
+    if (!dec) {
+        perror("Failed to allocate Adaptive_decoder");
+        exit(EXIT_FAILURE);
+    }
+    Adaptive_model_init(&dec->model);
+    Adaptive_decoder_build(dec);
+    return dec;
+}
+
+
+int Adaptive_parse_message(const uint8_t* in, size_t available, size_t* raw_size, size_t* header_size,
+                           size_t* payload_size) {
+    int first = Adaptive_get_varint(in, available, raw_size);
+    if (first <= 0) return first;
+    int second = Adaptive_get_varint(in + first, available - first, payload_size);
+    if (second <= 0) return second;
+
+    if (*raw_size == 0 || *raw_size > ADAPTIVE_MAX_MESSAGE
+        || *payload_size > Adaptive_encode_bound(*raw_size) - ADAPTIVE_MESSAGE_HEADER_MAX - BIT_WRITER_SLACK) {
+        return -1;
+    }
+    *header_size = (size_t)(first + second);
+    return available - *header_size >= *payload_size ? 1 : 0;
+}
+
+
+int Adaptive_decode_message(Adaptive_decoder* dec, const uint8_t* payload, size_t payload_size, uint8_t* out,
+                            size_t size) {
+    Bit_reader br;
+    Bit_reader_init(&br, payload, payload_size);
+
+    for (size_t i = 0; i < size; i++) {
+        Bit_reader_refill(&br);
+        const Huffman_decode_entry* entry = &dec->table[Bit_reader_peek(&br, dec->table_bits)];
+        if (entry->length > br.bit_count) {
+            return -1;
+        }
+        out[i] = entry->symbol;
+        Bit_reader_consume(&br, entry->length);
+        if (Adaptive_model_update(&dec->model, entry->symbol)) {
+            Adaptive_decoder_build(dec);
+        }
+    }
+
+    // The message must end exactly in its zero padding.
+    if (Bit_reader_input_left(&br) != 0 || br.bit_count >= 8 || br.container != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+
+void Adaptive_decoder_destroy(Adaptive_decoder* dec) {
+    Mem_free(dec);
+}
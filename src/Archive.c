@@ -0,0 +1,1636 @@
+#define _GNU_SOURCE
+#include "Archive.h"
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "Block_codec.h"
+#include "Block_split.h"
+#include "Io_pipeline.h"
+#include "Mem.h"
+
+
+/*
+ * Level  block size  sampled  streams  entropy  transforms  split
+ * The fast end counts a fraction of each block and writes one stream per
+ * block; the strong end searches the transforms over larger blocks. From
+ * level 4 on, blocks are cut where the statistics shift.
+ */
+#define ARCHIVE_LEVEL_TABLE \
+    X(1, 1024 * 1024, 3, 1, BLOCK_ENTROPY_HUFFMAN, 0, 0) \
+    X(2, 1024 * 1024, 2, 1, BLOCK_ENTROPY_HUFFMAN, 0, 0) \
+    X(3, 512 * 1024, 1, 0, BLOCK_ENTROPY_HUFFMAN, 0, 0) \
+    X(4, 256 * 1024, 0, 0, BLOCK_ENTROPY_HUFFMAN, 0, 1) \
+    X(5, 256 * 1024, 0, 0, BLOCK_ENTROPY_AUTO, 0, 1) \
+    X(6, 256 * 1024, 0, 0, BLOCK_ENTROPY_AUTO, TRANSFORM_SET_DELTA, 1) \
+    X(7, 256 * 1024, 0, 0, BLOCK_ENTROPY_AUTO, TRANSFORM_SET_ALL, 1) \
+    X(8, 1024 * 1024, 0, 0, BLOCK_ENTROPY_AUTO, TRANSFORM_SET_ALL, 1) \
+    X(9, 4 * 1024 * 1024, 0, 0, BLOCK_ENTROPY_AUTO, TRANSFORM_SET_ALL, 1)
+
+#define X(level, block, shift, streams, coder, transform_set, cut) \
+    { .block_size = block, .num_streams = streams, .transforms = transform_set, .entropy = coder, \
+      .sample_shift = shift, .split = cut, .dedup = 0 },
+static const Archive_options ARCHIVE_LEVELS[ARCHIVE_MAX_LEVEL] = {
+    ARCHIVE_LEVEL_TABLE
+};
+#undef X
+
+
+void Archive_options_init(Archive_options* options) {
+    Archive_options_level(options, ARCHIVE_DEFAULT_LEVEL);
+}
+
+
+int Archive_options_level(Archive_options* options, int level) {
+    if (level < ARCHIVE_MIN_LEVEL || level > ARCHIVE_MAX_LEVEL) {
+        return -1;
+    }
+    *options = ARCHIVE_LEVELS[level - 1];
+    return 0;
+}
+
+
+static size_t Archive_output_chunk_size(uint32_t block_size) {
+    size_t needed = Block_encode_bound(block_size) + BLOCK_FORMAT_BLOCK_HEADER_SIZE + BLOCK_FORMAT_END_PAYLOAD_SIZE;
+    return needed > IO_CHUNK_SIZE ? needed : IO_CHUNK_SIZE;
+}
+
+
+// Peak bytes of Archive_write_blocks with both I/O rings at their smallest.
+static uint64_t Archive_compress_memory(const Archive_options* options, uint32_t block_size) {
+    uint64_t bytes = 2 * (uint64_t)IO_MIN_CHUNK_SIZE + 2 * (uint64_t)Archive_output_chunk_size(block_size)
+                   + block_size + sizeof(Block_encoder);
+    if (options->transforms) {
+        // Two candidate buffers and the BWT's suffix and rank arrays.
+        bytes += 2 * (uint64_t)block_size + (4 * (uint64_t)block_size + (block_size > 256 ? block_size : 256)) * 4;
+    }
+    if (options->entropy == BLOCK_ENTROPY_PAIRS) {
+        bytes += sizeof(Pair_encoder);
+    }
+    if (options->split) {
+        bytes += sizeof(Block_splitter);
+    }
+    return bytes;
+}
+
+
+void Archive_options_fit(Archive_options* options, uint64_t budget) {
+    while (options->block_size > ARCHIVE_MIN_FIT_BLOCK_SIZE && Archive_compress_memory(options, options->block_size) > budget) {
+        options->block_size /= 2;
+    }
+}
+
+
+static Io_chunk* Archive_reserve(Io_writer* writer, Io_chunk* chunk, size_t size) {
+    if (chunk->capacity - chunk->size < size) {
+        Io_writer_submit(writer, chunk);
+        chunk = Io_writer_acquire(writer);
+    }
+    return chunk;
+}
+
+
+typedef struct {
+    Block_index_entry* entries;
+    size_t count;
+    size_t capacity;
+} Archive_index;
+
+
+static void Archive_index_push(Archive_index* index, uint32_t raw_size, uint32_t payload_size, uint64_t hash) {
+    if (index->count == index->capacity) {
+        index->capacity = index->capacity ? index->capacity * 2 : 1024;
+        index->entries = (Block_index_entry*)Mem_realloc(MEM_BLOCK, index->entries, index->capacity * sizeof(Block_index_entry));
+        if (!index->entries) {
+            perror("Failed to allocate block index");
+            exit(EXIT_FAILURE);
+        }
+    }
+    index->entries[index->count].raw_size = raw_size;
+    index->entries[index->count].payload_size = payload_size;
+    index->entries[index->count].hash = hash;
+    index->count++;
+}
+
+
+static int Archive_pread(FILE* file, void* out, size_t size, uint64_t offset) {
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0 && fread(out, 1, size, file) == size ? 0 : -1;
+}
+
+
+// pread(2) without moving the stream position, for files another stage is reading or writing.
+static int Archive_pread_fd(int fd, void* out, size_t size, uint64_t offset) {
+    for (size_t done = 0; done < size;) {
+        ssize_t n = pread(fd, (uint8_t*)out + done, size - done, (off_t)(offset + done));
+        if (n <= 0) return -1;
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+
+// A block of the old file an update may copy instead of encoding.
+typedef struct {
+    uint64_t offset;            // of its block header
+    Block_index_entry entry;
+    uint64_t anchor;            // gear hash of its first ARCHIVE_ANCHOR_BYTES bytes, once decoded
+    uint64_t tail;              // and of its last ARCHIVE_ANCHOR_BYTES
+} Archive_old_block;
+
+/*
+ * Old blocks are found in the input by content. While the input follows the
+ * old file, each old block is checked where the previous one ended. At the
+ * first one that is not there, the old blocks from there on are decoded once
+ * and filed by a gear hash of their first ARCHIVE_ANCHOR_BYTES bytes. The
+ * input is then rolled through the same hash a byte at a time, and where it
+ * files an old block, the block is checked against its size and index hash.
+ * A block that passes is decoded and compared with the input byte for byte
+ * before it is copied, so a hash collision costs an encode, not the data.
+ * The bytes between matches are encoded as new blocks, so an insertion or
+ * deletion costs only the blocks it touches.
+ */
+#define ARCHIVE_ANCHOR_BYTES 64
+
+typedef struct {
+    FILE* file;
+    Archive_old_block* blocks;
+    size_t count;
+    size_t capacity;
+    uint32_t block_size;        // largest among the old members
+    uint32_t tail_block_size;   // the last member's, for input no old block matches
+    uint64_t reused_blocks;
+    uint64_t reused_bytes;
+    uint32_t* anchors;          // old block + 1 by anchor, open addressing; NULL until the first miss
+    unsigned anchor_bits;
+    uint64_t gear[256];
+    Block_decoder* decoder;     // old blocks are decoded to file them and to verify a copy
+    uint8_t* decoded;
+} Archive_reuse;
+
+
+static void Archive_reuse_gear(Archive_reuse* reuse) {
+    uint64_t state = 0;
+    for (int i = 0; i < 256; i++) {
+        // splitmix64
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        reuse->gear[i] = z ^ (z >> 31);
+    }
+}
+
+
+// Each byte shifts the hash left by one, so it depends on the last 64 bytes only.
+static uint64_t Archive_reuse_anchor(const Archive_reuse* reuse, const uint8_t* data) {
+    uint64_t hash = 0;
+    for (size_t i = 0; i < ARCHIVE_ANCHOR_BYTES; i++) hash = (hash << 1) + reuse->gear[data[i]];
+    return hash;
+}
+
+
+// Whether `data`, with `size` bytes available, starts with old block `block`: its size and index hash.
+static int Archive_reuse_matches(const Archive_reuse* reuse, size_t block, const uint8_t* data, size_t size) {
+    const Archive_old_block* old = &reuse->blocks[block];
+    return old->entry.hash && old->entry.raw_size <= size && Block_hash(data, old->entry.raw_size) == old->entry.hash;
+}
+
+
+// Decodes old block `block` from `encoded`, which holds its header and payload, into reuse->decoded.
+static int Archive_reuse_decode(Archive_reuse* reuse, size_t block, const uint8_t* encoded) {
+    if (!reuse->decoder) {
+        reuse->decoder = Block_decoder_create();
+        reuse->decoded = (uint8_t*)Mem_alloc(MEM_BLOCK, reuse->block_size);
+        if (!reuse->decoded) {
+            perror("Failed to allocate reuse buffers");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Block_header header;
+    if (Block_header_deserialize(&header, encoded, reuse->block_size) != 0 || header.kind == BLOCK_REF
+        || header.raw_size != reuse->blocks[block].entry.raw_size
+        || Block_decode(reuse->decoder, &header, encoded + BLOCK_FORMAT_BLOCK_HEADER_SIZE, reuse->decoded) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+
+static void Archive_reuse_destroy(Archive_reuse* reuse) {
+    Mem_free(reuse->blocks);
+    Mem_free(reuse->anchors);
+    Mem_free(reuse->decoded);
+    if (reuse->decoder) Block_decoder_destroy(reuse->decoder);
+}
+
+
+// Decodes the hashed old blocks from `first` on and files them by anchor; REF blocks are left out.
+static void Archive_reuse_anchors(Archive_reuse* reuse, size_t first) {
+    reuse->anchor_bits = 10;
+    while (((size_t)1 << reuse->anchor_bits) < 2 * (reuse->count - first)) reuse->anchor_bits++;
+    size_t mask = ((size_t)1 << reuse->anchor_bits) - 1;
+    size_t bound = Block_encode_bound(reuse->block_size);
+    reuse->anchors = (uint32_t*)Mem_calloc(MEM_BLOCK, mask + 1, sizeof(uint32_t));
+    uint8_t* encoded = (uint8_t*)Mem_alloc(MEM_BLOCK, bound);
+    if (!reuse->anchors || !encoded) {
+        perror("Failed to allocate block anchors");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = first; i < reuse->count; i++) {
+        Archive_old_block* old = &reuse->blocks[i];
+        size_t length = BLOCK_FORMAT_BLOCK_HEADER_SIZE + (size_t)old->entry.payload_size;
+        if (!old->entry.hash || old->entry.raw_size < ARCHIVE_ANCHOR_BYTES || length > bound
+            || Archive_pread(reuse->file, encoded, length, old->offset) != 0
+            || Archive_reuse_decode(reuse, i, encoded) != 0) {
+            continue;
+        }
+        old->anchor = Archive_reuse_anchor(reuse, reuse->decoded);
+        old->tail = Archive_reuse_anchor(reuse, reuse->decoded + old->entry.raw_size - ARCHIVE_ANCHOR_BYTES);
+        size_t slot = (size_t)(old->anchor >> (64 - reuse->anchor_bits));
+        while (reuse->anchors[slot]) slot = (slot + 1) & mask;
+        reuse->anchors[slot] = (uint32_t)(i + 1);
+    }
+    Mem_free(encoded);
+}
+
+
+// The old block filed under `anchor` that `data` starts with, or SIZE_MAX.
+static size_t Archive_reuse_find(const Archive_reuse* reuse, uint64_t anchor, const uint8_t* data, size_t size) {
+    size_t mask = ((size_t)1 << reuse->anchor_bits) - 1;
+    for (size_t slot = (size_t)(anchor >> (64 - reuse->anchor_bits)); reuse->anchors[slot]; slot = (slot + 1) & mask) {
+        size_t block = reuse->anchors[slot] - 1;
+        const Archive_old_block* old = &reuse->blocks[block];
+        // The tail hash turns away most blocks that only share their first bytes before hashing all of it.
+        if (old->anchor == anchor && old->entry.raw_size <= size
+            && Archive_reuse_anchor(reuse, data + old->entry.raw_size - ARCHIVE_ANCHOR_BYTES) == old->tail
+            && Archive_reuse_matches(reuse, block, data, size)) {
+            return block;
+        }
+    }
+    return SIZE_MAX;
+}
+
+
+/*
+ * Copies old block `block` with its header into `out` if it decodes to
+ * `data`; returns the bytes copied or 0 to encode instead. REF blocks are
+ * not copied, since their distance counts from where they were.
+ */
+static size_t Archive_reuse_copy(Archive_reuse* reuse, size_t block, const uint8_t* data, uint8_t* out, size_t bound) {
+    const Archive_old_block* old = &reuse->blocks[block];
+    size_t length = BLOCK_FORMAT_BLOCK_HEADER_SIZE + (size_t)old->entry.payload_size;
+    if (length > bound || Archive_pread(reuse->file, out, length, old->offset) != 0
+        || Archive_reuse_decode(reuse, block, out) != 0 || memcmp(reuse->decoded, data, old->entry.raw_size) != 0) {
+        return 0;
+    }
+    reuse->reused_blocks++;
+    reuse->reused_bytes += old->entry.raw_size;
+    return length;
+}
+
+
+// Copies `size` bytes into the output ring, across as many chunks as needed.
+static Io_chunk* Archive_write(Io_writer* writer, Io_chunk* chunk, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        if (chunk->size == chunk->capacity) {
+            Io_writer_submit(writer, chunk);
+            chunk = Io_writer_acquire(writer);
+        }
+        size_t take = chunk->capacity - chunk->size < size ? chunk->capacity - chunk->size : size;
+        memcpy(chunk->data + chunk->size, data, take);
+        chunk->size += take;
+        data += take;
+        size -= take;
+    }
+    return chunk;
+}
+
+
+// ===== DEDUP =====
+
+/*
+ * Blocks of the member by size and hash, kept at their first occurrence.
+ * A hit is only a candidate: the earlier block is read back from the output
+ * and decoded, and a REF is written only if its bytes are equal. Open
+ * addressing; raw_size 0 marks a free slot.
+ */
+typedef struct {
+    uint64_t hash;
+    uint64_t position;      // raw offset of the block in the member
+    uint64_t offset;        // file offset of its block header in the output
+    uint32_t raw_size;
+    uint32_t payload_size;
+} Archive_dedup_entry;
+
+typedef struct {
+    Archive_dedup_entry* entries;
+    size_t count;
+    size_t capacity;        // a power of two
+    Block_decoder* decoder; // the buffers below are made on the first hit
+    uint8_t* encoded;       // header and payload of the earlier block
+    uint8_t* decoded;
+} Archive_dedup;
+
+
+static size_t Archive_dedup_slot(const Archive_dedup* dedup, uint64_t hash, uint32_t raw_size) {
+    size_t mask = dedup->capacity - 1;
+    size_t slot = (size_t)hash & mask;
+    while (dedup->entries[slot].raw_size
+           && (dedup->entries[slot].hash != hash || dedup->entries[slot].raw_size != raw_size)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+
+// The earlier block with this size and hash, or NULL.
+static const Archive_dedup_entry* Archive_dedup_find(const Archive_dedup* dedup, uint64_t hash, uint32_t raw_size) {
+    if (!dedup->capacity) return NULL;
+    const Archive_dedup_entry* entry = &dedup->entries[Archive_dedup_slot(dedup, hash, raw_size)];
+    return entry->raw_size ? entry : NULL;
+}
+
+
+static void Archive_dedup_insert(Archive_dedup* dedup, uint64_t hash, uint32_t raw_size, uint64_t position,
+                                 uint64_t offset, uint32_t payload_size) {
+    if ((dedup->count + 1) * 4 > dedup->capacity * 3) {
+        Archive_dedup grown = { NULL, 0, dedup->capacity ? dedup->capacity * 2 : 1024, NULL, NULL, NULL };
+        grown.entries = (Archive_dedup_entry*)Mem_calloc(MEM_BLOCK, grown.capacity, sizeof(Archive_dedup_entry));
+        if (!grown.entries) {
+            perror("Failed to allocate dedup table");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < dedup->capacity; i++) {
+            const Archive_dedup_entry* entry = &dedup->entries[i];
+            if (entry->raw_size) grown.entries[Archive_dedup_slot(&grown, entry->hash, entry->raw_size)] = *entry;
+        }
+        Mem_free(dedup->entries);
+        dedup->entries = grown.entries;
+        dedup->capacity = grown.capacity;
+    }
+    Archive_dedup_entry* entry = &dedup->entries[Archive_dedup_slot(dedup, hash, raw_size)];
+    if (entry->raw_size) return;
+    entry->hash = hash;
+    entry->position = position;
+    entry->offset = offset;
+    entry->raw_size = raw_size;
+    entry->payload_size = payload_size;
+    dedup->count++;
+}
+
+
+/*
+ * Whether the earlier block `entry` decodes to `data`. It is taken from the
+ * output chunk not yet handed to the writer when it lies there, otherwise
+ * read back from the output file once the writer has caught up. A REF block
+ * or one that cannot be read is treated as a mismatch.
+ */
+static int Archive_dedup_matches(Archive_dedup* dedup, const Archive_dedup_entry* entry, const uint8_t* data,
+                                 size_t size, uint32_t block_size, Io_writer* writer, const Io_chunk* chunk,
+                                 uint64_t chunk_offset, FILE* output) {
+    size_t bound = Block_encode_bound(block_size);
+    size_t length = BLOCK_FORMAT_BLOCK_HEADER_SIZE + (size_t)entry->payload_size;
+    if (length > bound) return 0;
+    if (!dedup->decoder) {
+        dedup->decoder = Block_decoder_create();
+        dedup->encoded = (uint8_t*)Mem_alloc(MEM_BLOCK, bound);
+        dedup->decoded = (uint8_t*)Mem_alloc(MEM_BLOCK, block_size);
+        if (!dedup->encoded || !dedup->decoded) {
+            perror("Failed to allocate dedup buffers");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const uint8_t* bytes;
+    if (entry->offset >= chunk_offset) {
+        bytes = chunk->data + (entry->offset - chunk_offset);
+    } else {
+        if (Io_writer_sync(writer) != 0
+            || Archive_pread_fd(fileno(output), dedup->encoded, length, entry->offset) != 0) {
+            return 0;
+        }
+        bytes = dedup->encoded;
+    }
+
+    Block_header header;
+    if (Block_header_deserialize(&header, bytes, block_size) != 0 || header.kind == BLOCK_REF
+        || header.raw_size != size || header.payload_size != entry->payload_size
+        || Block_decode(dedup->decoder, &header, bytes + BLOCK_FORMAT_BLOCK_HEADER_SIZE, dedup->decoded) != 0) {
+        return 0;
+    }
+    return memcmp(dedup->decoded, data, size) == 0;
+}
+
+
+static void Archive_dedup_destroy(Archive_dedup* dedup) {
+    Mem_free(dedup->entries);
+    Mem_free(dedup->encoded);
+    Mem_free(dedup->decoded);
+    if (dedup->decoder) Block_decoder_destroy(dedup->decoder);
+}
+
+
+// A member being written by Archive_write_blocks.
+typedef struct {
+    const Archive_options* options;
+    uint32_t block_size;
+    size_t bound;
+    Block_encoder* encoder;
+    Io_writer* writer;
+    Io_chunk* chunk;
+    FILE* output;
+    Archive_index* index;
+    uint64_t member_bytes;
+    uint64_t raw;
+    off_t output_base;          // file offset of the first block written here
+    uint64_t written_bytes;
+    int dedup;
+    Archive_dedup table;
+} Archive_member;
+
+
+/*
+ * Writes one block of `size` bytes: a REF if --dedup finds its bytes earlier
+ * in the member, else old block `old` of `reuse` if one is given, else the
+ * block encoded. `counts` may be NULL.
+ */
+static void Archive_emit(Archive_member* m, const uint8_t* data, size_t size, const uint64_t counts[256],
+                         Archive_reuse* reuse, size_t old) {
+    m->chunk = Archive_reserve(m->writer, m->chunk, m->bound);
+    uint64_t hash = reuse ? reuse->blocks[old].entry.hash : Block_hash(data, size);
+    uint8_t* out = m->chunk->data + m->chunk->size;
+    uint64_t offset = (uint64_t)m->output_base + m->written_bytes;
+    size_t written = 0;
+    const Archive_dedup_entry* earlier = NULL;
+    if (m->dedup) {
+        earlier = Archive_dedup_find(&m->table, hash, (uint32_t)size);
+        if (earlier && Archive_dedup_matches(&m->table, earlier, data, size, m->block_size, m->writer, m->chunk,
+                                             offset - m->chunk->size, m->output)) {
+            written = Block_ref_serialize((uint32_t)size, m->raw - earlier->position, out);
+        }
+    }
+    if (written == 0 && reuse) written = Archive_reuse_copy(reuse, old, data, out, m->bound);
+    if (written == 0) written = Block_encode_counted(m->encoder, data, size, counts, out);
+    if (m->dedup && !earlier) {
+        Archive_dedup_insert(&m->table, hash, (uint32_t)size, m->raw, offset,
+                             (uint32_t)(written - BLOCK_FORMAT_BLOCK_HEADER_SIZE));
+    }
+    m->chunk->size += written;
+    m->written_bytes += written;
+    Archive_index_push(m->index, (uint32_t)size, (uint32_t)(written - BLOCK_FORMAT_BLOCK_HEADER_SIZE), hash);
+    m->member_bytes += written;
+    m->raw += size;
+}
+
+
+// Cuts the input into block_size runs, each cut further by Block_split with options->split.
+static void Archive_write_input(Archive_member* m, Io_reader* reader) {
+    uint8_t* block = (uint8_t*)Mem_alloc(MEM_BLOCK, m->block_size);
+    if (!block) {
+        perror("Failed to allocate block buffer");
+        exit(EXIT_FAILURE);
+    }
+    Block_splitter* splitter = m->options->split ? Block_splitter_create() : NULL;
+    Io_chunk* chunk;
+    size_t fill = 0;
+
+    for (;;) {
+        chunk = Io_reader_next(reader);
+        size_t offset = 0;
+        while (chunk ? offset < chunk->size : fill > 0) {
+            const uint8_t* data;
+            size_t size;
+
+            if (!chunk) {
+                // Input ended: the partial block is the last one.
+                data = block;
+                size = fill;
+                fill = 0;
+            } else if (fill == 0 && chunk->size - offset >= m->block_size) {
+                // Whole block inside this chunk: encode it in place.
+                data = chunk->data + offset;
+                size = m->block_size;
+                offset += size;
+            } else {
+                size_t take = chunk->size - offset;
+                if (take > m->block_size - fill) take = m->block_size - fill;
+                memcpy(block + fill, chunk->data + offset, take);
+                fill += take;
+                offset += take;
+                if (fill < m->block_size) break;
+                data = block;
+                size = fill;
+                fill = 0;
+            }
+
+            unsigned pieces = splitter ? Block_split(splitter, data, size) : 1;
+            for (unsigned p = 0; p < pieces; p++) {
+                size_t start = 0, end = size;
+                uint64_t counts[256];
+                if (splitter) Block_split_piece(splitter, p, &start, &end, counts);
+                Archive_emit(m, data + start, end - start, splitter ? counts : NULL, NULL, 0);
+            }
+        }
+        if (!chunk) break;
+    }
+    Mem_free(block);
+    Block_splitter_destroy(splitter);
+}
+
+
+/*
+ * Cuts the input of an update around the old blocks it still holds (see
+ * Archive_reuse). The window starts at the first byte not yet written and
+ * has room for a run of new bytes of up to tail_block_size, the anchor in
+ * front of a candidate and the whole old block after it.
+ */
+static void Archive_write_reused(Archive_member* m, Io_reader* reader, Archive_reuse* reuse) {
+    size_t run_max = reuse->tail_block_size;
+    size_t capacity = run_max + ARCHIVE_ANCHOR_BYTES + reuse->block_size;
+    uint8_t* window = (uint8_t*)Mem_alloc(MEM_BLOCK, capacity);
+    if (!window) {
+        perror("Failed to allocate block buffer");
+        exit(EXIT_FAILURE);
+    }
+    Io_chunk* chunk = NULL;
+    size_t offset = 0;
+    int ended = 0;
+    size_t filled = 0;
+    size_t scan = 0;            // bytes rolled into `rolling` since window[0]
+    uint64_t rolling = 0;
+    size_t next = 0;            // the old block expected where the last one ended
+    int follow = 1;
+
+    for (;;) {
+        while (!ended && filled < capacity) {
+            if (!chunk || offset == chunk->size) {
+                chunk = Io_reader_next(reader);
+                offset = 0;
+                if (!chunk) ended = 1;
+                continue;
+            }
+            size_t take = chunk->size - offset < capacity - filled ? chunk->size - offset : capacity - filled;
+            memcpy(window + filled, chunk->data + offset, take);
+            filled += take;
+            offset += take;
+        }
+
+        size_t found = SIZE_MAX;
+        size_t start = 0;
+        size_t used;
+        if (follow) {
+            follow = 0;
+            if (next < reuse->count && Archive_reuse_matches(reuse, next, window, filled)) found = next;
+        } else if (scan < filled) {
+            rolling = (rolling << 1) + reuse->gear[window[scan++]];
+            if (scan < ARCHIVE_ANCHOR_BYTES) continue;
+            start = scan - ARCHIVE_ANCHOR_BYTES;
+            if (!reuse->anchors) Archive_reuse_anchors(reuse, next);
+            found = Archive_reuse_find(reuse, rolling, window + start, filled - start);
+        } else {
+            break;
+        }
+
+        if (found != SIZE_MAX) {
+            if (start > 0) Archive_emit(m, window, start, NULL, NULL, 0);
+            Archive_emit(m, window + start, reuse->blocks[found].entry.raw_size, NULL, reuse, found);
+            used = start + reuse->blocks[found].entry.raw_size;
+            next = found + 1;
+            follow = 1;
+            scan = 0;
+            rolling = 0;
+        } else if (start == run_max) {
+            // No old block starts within a whole block of new bytes: write them out and go on rolling.
+            Archive_emit(m, window, run_max, NULL, NULL, 0);
+            used = run_max;
+            scan -= used;
+        } else {
+            continue;
+        }
+        memmove(window, window + used, filled - used);
+        filled -= used;
+    }
+
+    for (size_t done = 0; done < filled;) {
+        size_t size = filled - done < run_max ? filled - done : run_max;
+        Archive_emit(m, window + done, size, NULL, NULL, 0);
+        done += size;
+    }
+    Mem_free(window);
+}
+
+
+/*
+ * Encodes `input` into blocks of at most block_size bytes and ends the member
+ * with the END block (total raw size), the INDEX block and its footer.
+ * `index` holds the member's earlier blocks and `member_bytes` the bytes the
+ * member already has in front of the output position; *total carries its
+ * raw size in and out. With `reuse`, the old blocks still in the input are
+ * copied from the old file; otherwise, with options->split, every block_size
+ * run is cut further by Block_split. With options->dedup a block equal to an
+ * earlier one of the member, including those already in `index`, becomes a
+ * REF block; the earlier block is read back from `output`, which must then
+ * be open for reading and seekable.
+ */
+static int Archive_write_blocks(FILE* input, FILE* output, const Archive_options* options, uint32_t block_size,
+                                Archive_index* index, uint64_t member_bytes, uint64_t* total, Archive_reuse* reuse) {
+    Archive_member m;
+    memset(&m, 0, sizeof(m));
+    m.options = options;
+    m.block_size = block_size;
+    m.bound = Block_encode_bound(block_size);
+    m.encoder = Block_encoder_create();
+    m.encoder->num_streams = options->num_streams;
+    m.encoder->transforms = options->transforms;
+    m.encoder->entropy = options->entropy;
+    m.encoder->sample_shift = options->sample_shift;
+    m.output = output;
+    m.index = index;
+    m.member_bytes = member_bytes;
+    m.raw = *total;
+
+    // File offset of the member's next byte; the earlier blocks lie in front of it.
+    m.output_base = ftello(output);
+    m.dedup = options->dedup && m.output_base >= 0;
+    if (options->dedup && !m.dedup) {
+        fprintf(stderr, "Warning: output is not seekable, writing without --dedup\n");
+    } else if (m.dedup) {
+        // Blocks written without an index have hash 0 and are left out.
+        uint64_t position = 0;
+        uint64_t offset = (uint64_t)m.output_base - member_bytes + BLOCK_FORMAT_FILE_HEADER_SIZE;
+        for (size_t i = 0; i < index->count; i++) {
+            const Block_index_entry* entry = &index->entries[i];
+            if (entry->hash) {
+                Archive_dedup_insert(&m.table, entry->hash, entry->raw_size, position, offset, entry->payload_size);
+            }
+            position += entry->raw_size;
+            offset += BLOCK_FORMAT_BLOCK_HEADER_SIZE + (uint64_t)entry->payload_size;
+        }
+    }
+
+    Io_reader* reader = Io_reader_create(input, IO_CHUNK_SIZE, IO_RING_DEPTH);
+    m.writer = Io_writer_create(output, Archive_output_chunk_size(block_size), IO_RING_DEPTH);
+    m.chunk = Io_writer_acquire(m.writer);
+    if (reuse) {
+        Archive_write_reused(&m, reader, reuse);
+    } else {
+        Archive_write_input(&m, reader);
+    }
+
+    uint8_t trailer[BLOCK_FORMAT_BLOCK_HEADER_SIZE + BLOCK_FORMAT_END_PAYLOAD_SIZE];
+    size_t end_size = Block_end_serialize(m.raw, trailer);
+    m.chunk = Archive_write(m.writer, m.chunk, trailer, end_size);
+
+    uint64_t index_size = Block_index_size(index->count, BLOCK_FORMAT_INDEX_ENTRY_SIZE);
+    Block_header index_header;
+    memset(&index_header, 0, sizeof(index_header));
+    index_header.kind = BLOCK_INDEX;
+    index_header.payload_size = (uint32_t)(index_size - BLOCK_FORMAT_BLOCK_HEADER_SIZE);
+    Block_header_serialize(&index_header, trailer);
+    m.chunk = Archive_write(m.writer, m.chunk, trailer, BLOCK_FORMAT_BLOCK_HEADER_SIZE);
+    for (size_t i = 0; i < index->count; i++) {
+        uint8_t entry[BLOCK_FORMAT_INDEX_ENTRY_SIZE];
+        Block_index_entry_serialize(&index->entries[i], entry);
+        m.chunk = Archive_write(m.writer, m.chunk, entry, sizeof(entry));
+    }
+    Block_footer footer = { BLOCK_FORMAT_INDEX_MAGIC, BLOCK_FORMAT_INDEX_ENTRY_SIZE, 0, index->count,
+                            m.member_bytes + end_size + index_size };
+    uint8_t footer_bytes[BLOCK_FORMAT_FOOTER_SIZE];
+    Block_footer_serialize(&footer, footer_bytes);
+    m.chunk = Archive_write(m.writer, m.chunk, footer_bytes, sizeof(footer_bytes));
+    Io_writer_submit(m.writer, m.chunk);
+
+    int failed = Io_reader_failed(reader);
+    Io_reader_destroy(reader);
+    if (Io_writer_destroy(m.writer) != 0) failed = 1;
+    Archive_dedup_destroy(&m.table);
+    Block_encoder_destroy(m.encoder);
+
+    if (failed) {
+        fprintf(stderr, "I/O error while writing blocks\n");
+        return -1;
+    }
+    *total = m.raw;
+    return 0;
+}
+
+
+int Archive_compress(FILE* input, FILE* output, const Archive_options* options, uint64_t* raw_size) {
+    uint8_t file_header[BLOCK_FORMAT_FILE_HEADER_SIZE];
+    Block_file_header header;
+    Block_file_header_init(&header, options->block_size);
+    Block_file_header_serialize(&header, file_header);
+    if (fwrite(file_header, 1, sizeof(file_header), output) != sizeof(file_header) || fflush(output) != 0) {
+        fprintf(stderr, "Failed to write block file header\n");
+        return -1;
+    }
+
+    Archive_index index = { NULL, 0, 0 };
+    uint64_t total = 0;
+    int result = Archive_write_blocks(input, output, options, options->block_size, &index,
+                                      BLOCK_FORMAT_FILE_HEADER_SIZE, &total, NULL);
+    Mem_free(index.entries);
+    *raw_size = total;
+    return result;
+}
+
+
+// ===== ANALYZE =====
+
+static uint64_t Archive_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+
+// Coding time is sampled over up to this many bytes of every kind and transform.
+#define ARCHIVE_CALIBRATE_BYTES (256 * 1024)
+
+typedef struct {
+    uint64_t bytes[(BLOCK_REF + 1) * TRANSFORM_COUNT];
+    uint64_t encode_ns[(BLOCK_REF + 1) * TRANSFORM_COUNT];
+    uint64_t decode_ns[(BLOCK_REF + 1) * TRANSFORM_COUNT];
+} Archive_timing;
+
+
+// Codes and decodes the block for real while its (kind, transform) pair has too few bytes timed.
+static void Archive_calibrate(Archive_timing* timing, Block_encoder* encoder, Block_decoder* decoder,
+                              const Block_estimate* est, const uint8_t* data, size_t size, uint8_t* out) {
+    unsigned key = est->kind * TRANSFORM_COUNT + est->transform;
+    if (timing->bytes[key] >= ARCHIVE_CALIBRATE_BYTES) return;
+
+    uint64_t start = Archive_now_ns();
+    size_t written = Block_encode_counted(encoder, data, size, NULL, out);
+    uint64_t middle = Archive_now_ns();
+    Block_header header;
+    if (Block_header_deserialize(&header, out, (uint32_t)size) != 0
+        || Block_decode(decoder, &header, out + BLOCK_FORMAT_BLOCK_HEADER_SIZE, out + written) != 0) {
+        return;
+    }
+    uint64_t end = Archive_now_ns();
+    timing->bytes[key] += size;
+    timing->encode_ns[key] += middle - start;
+    timing->decode_ns[key] += end - middle;
+}
+
+
+int Archive_analyze(FILE* input, const Archive_options* options, FILE* report, Archive_analysis* analysis) {
+    memset(analysis, 0, sizeof(*analysis));
+    Block_encoder* encoder = Block_encoder_create();
+    encoder->num_streams = options->num_streams;
+    encoder->transforms = options->transforms;
+    encoder->entropy = options->entropy;
+    encoder->sample_shift = options->sample_shift;
+    Block_decoder* decoder = Block_decoder_create();
+    Block_splitter* splitter = options->split ? Block_splitter_create() : NULL;
+    uint32_t block_size = options->block_size;
+    // The block, then room for a calibration block and its decoded bytes.
+    uint8_t* block = (uint8_t*)Mem_alloc(MEM_BLOCK, block_size + Block_encode_bound(block_size) + block_size);
+    if (!block) {
+        perror("Failed to allocate block buffer");
+        exit(EXIT_FAILURE);
+    }
+    uint8_t* scratch = block + block_size;
+    // Like the writer, a dedup hit counts only if the earlier bytes, read back from the input, are equal.
+    off_t input_base = ftello(input);
+    Archive_dedup dedup = { NULL, 0, 0, NULL, NULL, NULL };
+    uint64_t kind_bytes[BLOCK_REF + 1][TRANSFORM_COUNT];
+    memset(kind_bytes, 0, sizeof(kind_bytes));
+    Archive_timing timing;
+    memset(&timing, 0, sizeof(timing));
+
+    if (report) {
+        fprintf(report, "%8s %12s %10s %-8s %-9s %7s %10s %9s\n",
+                "block", "offset", "raw", "kind", "transform", "streams", "payload", "bits/byte");
+    }
+    uint64_t compressed = BLOCK_FORMAT_FILE_HEADER_SIZE;
+    size_t size;
+    while ((size = fread(block, 1, block_size, input)) > 0) {
+        unsigned pieces = splitter ? Block_split(splitter, block, size) : 1;
+        for (unsigned p = 0; p < pieces; p++) {
+            size_t start = 0, end = size;
+            uint64_t counts[256];
+            if (splitter) Block_split_piece(splitter, p, &start, &end, counts);
+            const uint8_t* data = block + start;
+            size_t length = end - start;
+
+            Block_estimate est;
+            int repeat = 0;
+            if (options->dedup && input_base >= 0) {
+                uint64_t hash = Block_hash(data, length);
+                const Archive_dedup_entry* earlier = Archive_dedup_find(&dedup, hash, (uint32_t)length);
+                if (!earlier) {
+                    Archive_dedup_insert(&dedup, hash, (uint32_t)length, analysis->raw_size, 0, 0);
+                } else {
+                    repeat = Archive_pread_fd(fileno(input), scratch, length,
+                                              (uint64_t)input_base + earlier->position) == 0
+                          && memcmp(scratch, data, length) == 0;
+                }
+            }
+            if (repeat) {
+                memset(&est, 0, sizeof(est));
+                est.kind = BLOCK_REF;
+                est.payload_size = BLOCK_FORMAT_REF_PAYLOAD_SIZE;
+            } else {
+                Block_encode_estimate(encoder, data, length, splitter ? counts : NULL, &est);
+                Archive_calibrate(&timing, encoder, decoder, &est, data, length, scratch);
+                analysis->entropy += est.entropy;
+            }
+            kind_bytes[est.kind][est.transform] += length;
+
+            if (report) {
+                fprintf(report, "%8llu %12llu %10zu %-8s %-9s %7u %10u %9.3f\n",
+                        (unsigned long long)analysis->blocks, (unsigned long long)analysis->raw_size, length,
+                        Block_kind_name(est.kind), Transform_name(est.transform), est.num_streams,
+                        est.payload_size, est.entropy / (double)length);
+            }
+            compressed += BLOCK_FORMAT_BLOCK_HEADER_SIZE + est.payload_size;
+            analysis->raw_size += length;
+            analysis->blocks++;
+        }
+    }
+    int failed = ferror(input);
+
+    compressed += BLOCK_FORMAT_BLOCK_HEADER_SIZE + BLOCK_FORMAT_END_PAYLOAD_SIZE
+                + Block_index_size(analysis->blocks, BLOCK_FORMAT_INDEX_ENTRY_SIZE);
+    analysis->compressed_size = compressed;
+    for (unsigned kind = 0; kind <= BLOCK_REF; kind++) {
+        for (unsigned transform = 0; transform < TRANSFORM_COUNT; transform++) {
+            unsigned key = kind * TRANSFORM_COUNT + transform;
+            analysis->kind_bytes[kind] += kind_bytes[kind][transform];
+            if (timing.bytes[key]) {
+                double share = (double)kind_bytes[kind][transform] / (double)timing.bytes[key];
+                analysis->encode_seconds += share * (double)timing.encode_ns[key] / 1e9;
+                analysis->decode_seconds += share * (double)timing.decode_ns[key] / 1e9;
+            }
+        }
+    }
+
+    Archive_dedup_destroy(&dedup);
+    Mem_free(block);
+    Block_splitter_destroy(splitter);
+    Block_decoder_destroy(decoder);
+    Block_encoder_destroy(encoder);
+    if (failed) {
+        fprintf(stderr, "I/O error while analyzing\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+// ===== APPEND =====
+
+typedef struct {
+    uint64_t member_start;  // offset of the last member's file header
+    uint64_t end_offset;    // offset of its END block
+    uint32_t block_size;
+    uint64_t total;
+    Archive_index index;
+} Archive_tail;
+
+
+static int Archive_read_end(FILE* file, uint64_t offset, uint64_t* total) {
+    uint8_t bytes[BLOCK_FORMAT_BLOCK_HEADER_SIZE + BLOCK_FORMAT_END_PAYLOAD_SIZE];
+    Block_header end;
+    if (Archive_pread(file, bytes, sizeof(bytes), offset) != 0
+        || Block_header_deserialize(&end, bytes, BLOCK_FORMAT_MAX_BLOCK_SIZE) != 0 || end.kind != BLOCK_END) {
+        return -1;
+    }
+    memcpy(total, bytes + BLOCK_FORMAT_BLOCK_HEADER_SIZE, sizeof(*total));
+    return 0;
+}
+
+
+// Reads the tail from the footer: a few small reads, whatever the file size.
+static int Archive_locate_indexed(FILE* file, uint64_t size, Archive_tail* tail) {
+    uint8_t bytes[BLOCK_FORMAT_FOOTER_SIZE];
+    Block_footer footer;
+    if (size < BLOCK_FORMAT_FOOTER_SIZE
+        || Archive_pread(file, bytes, sizeof(bytes), size - BLOCK_FORMAT_FOOTER_SIZE) != 0
+        || Block_footer_deserialize(&footer, bytes) != 0) {
+        return -1;
+    }
+    uint64_t index_size = Block_index_size(footer.count, footer.entry_size);
+    uint64_t trailer_size = BLOCK_FORMAT_BLOCK_HEADER_SIZE + BLOCK_FORMAT_END_PAYLOAD_SIZE + index_size;
+    if (footer.member_size > size || footer.member_size < BLOCK_FORMAT_FILE_HEADER_SIZE + trailer_size) {
+        return -1;
+    }
+    tail->member_start = size - footer.member_size;
+    tail->end_offset = size - trailer_size;
+
+    uint8_t block_bytes[BLOCK_FORMAT_BLOCK_HEADER_SIZE];
+    Block_header block;
+    if (Archive_pread(file, block_bytes, sizeof(block_bytes), size - index_size) != 0
+        || Block_header_deserialize(&block, block_bytes, BLOCK_FORMAT_MAX_BLOCK_SIZE) != 0
+        || block.kind != BLOCK_INDEX || block.payload_size != index_size - BLOCK_FORMAT_BLOCK_HEADER_SIZE) {
+        return -1;
+    }
+
+    uint8_t header_bytes[BLOCK_FORMAT_FILE_HEADER_SIZE];
+    Block_file_header header;
+    if (Archive_pread(file, header_bytes, sizeof(header_bytes), tail->member_start) != 0
+        || Block_file_header_deserialize(&header, header_bytes) != 0
+        || Archive_read_end(file, tail->end_offset, &tail->total) != 0) {
+        return -1;
+    }
+    tail->block_size = header.block_size;
+
+    if (fseeko(file, (off_t)(size - index_size + BLOCK_FORMAT_BLOCK_HEADER_SIZE), SEEK_SET) != 0) return -1;
+    for (uint64_t i = 0; i < footer.count; i++) {
+        uint8_t entry_bytes[BLOCK_FORMAT_INDEX_ENTRY_SIZE];
+        Block_index_entry entry;
+        if (fread(entry_bytes, 1, footer.entry_size, file) != footer.entry_size) return -1;
+        Block_index_entry_deserialize(&entry, entry_bytes, footer.entry_size);
+        Archive_index_push(&tail->index, entry.raw_size, entry.payload_size, entry.hash);
+    }
+    return 0;
+}
+
+
+// Files without a footer: walk the block headers, seeking over payloads.
+static int Archive_locate_scan(FILE* file, uint64_t size, Archive_tail* tail) {
+    uint64_t position = 0;
+    while (position < size) {
+        uint8_t bytes[BLOCK_FORMAT_BLOCK_HEADER_SIZE];
+        Block_file_header header;
+        if (Archive_pread(file, bytes, BLOCK_FORMAT_FILE_HEADER_SIZE, position) != 0
+            || Block_file_header_deserialize(&header, bytes) != 0) {
+            return -1;
+        }
+        tail->member_start = position;
+        tail->block_size = header.block_size;
+        tail->index.count = 0;
+        position += BLOCK_FORMAT_FILE_HEADER_SIZE;
+
+        for (;;) {
+            Block_header block;
+            if (Archive_pread(file, bytes, sizeof(bytes), position) != 0
+                || Block_header_deserialize(&block, bytes, header.block_size) != 0) {
+                return -1;
+            }
+            if (block.kind == BLOCK_END) {
+                tail->end_offset = position;
+                if (Archive_read_end(file, position, &tail->total) != 0) return -1;
+                position += BLOCK_FORMAT_BLOCK_HEADER_SIZE + block.payload_size;
+                break;
+            }
+            if (block.kind == BLOCK_INDEX) return -1;
+            Archive_index_push(&tail->index, block.raw_size, block.payload_size, 0);
+            position += BLOCK_FORMAT_BLOCK_HEADER_SIZE + block.payload_size;
+        }
+
+        // Skip the INDEX block, if any; the next member starts with the magic.
+        uint32_t magic = BLOCK_FORMAT_MAGIC;
+        if (position < size && Archive_pread(file, bytes, sizeof(bytes), position) == 0) {
+            memcpy(&magic, bytes, sizeof(magic));
+        }
+        if (magic != BLOCK_FORMAT_MAGIC) {
+            Block_header block;
+            if (Block_header_deserialize(&block, bytes, BLOCK_FORMAT_MAX_BLOCK_SIZE) != 0 || block.kind != BLOCK_INDEX) {
+                return -1;
+            }
+            position += BLOCK_FORMAT_BLOCK_HEADER_SIZE + block.payload_size;
+        }
+    }
+    return position == size ? 0 : -1;
+}
+
+
+int Archive_append(FILE* archive, FILE* input, const Archive_options* options, uint64_t* raw_size) {
+    if (fseeko(archive, 0, SEEK_END) != 0) {
+        fprintf(stderr, "Failed to seek in archive\n");
+        return -1;
+    }
+    uint64_t size = (uint64_t)ftello(archive);
+
+    Archive_tail tail;
+    memset(&tail, 0, sizeof(tail));
+    if (Archive_locate_indexed(archive, size, &tail) != 0) {
+        tail.index.count = 0;
+        if (Archive_locate_scan(archive, size, &tail) != 0) {
+            fprintf(stderr, "Not a complete block-format .huff file\n");
+            Mem_free(tail.index.entries);
+            return -1;
+        }
+    }
+
+    // New blocks overwrite the old END block and trailer; the member keeps its block size.
+    uint64_t total = tail.total;
+    int result = -1;
+    if (fseeko(archive, (off_t)tail.end_offset, SEEK_SET) == 0) {
+        result = Archive_write_blocks(input, archive, options, tail.block_size, &tail.index,
+                                      tail.end_offset - tail.member_start, &total, NULL);
+    }
+    if (result == 0) {
+        off_t length = ftello(archive);
+        if (length < 0 || ftruncate(fileno(archive), length) != 0) {
+            fprintf(stderr, "Failed to truncate archive\n");
+            result = -1;
+        }
+    }
+    Mem_free(tail.index.entries);
+    *raw_size = total - tail.total;
+    return result;
+}
+
+
+// ===== UPDATE =====
+
+static void Archive_reuse_push(Archive_reuse* reuse, uint64_t offset, const Block_header* block) {
+    if (reuse->count == reuse->capacity) {
+        reuse->capacity = reuse->capacity ? reuse->capacity * 2 : 1024;
+        reuse->blocks = (Archive_old_block*)Mem_realloc(MEM_BLOCK, reuse->blocks, reuse->capacity * sizeof(Archive_old_block));
+        if (!reuse->blocks) {
+            perror("Failed to allocate block catalog");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Archive_old_block* old = &reuse->blocks[reuse->count++];
+    old->offset = offset;
+    old->entry.raw_size = block->raw_size;
+    old->entry.payload_size = block->payload_size;
+    old->entry.hash = 0;
+}
+
+
+// Takes the hashes of a member's blocks from its INDEX block at `offset`; entries that disagree with the blocks are ignored.
+static void Archive_catalog_hashes(FILE* file, uint64_t offset, const Block_header* index,
+                                   Archive_old_block* blocks, size_t count) {
+    uint8_t bytes[BLOCK_FORMAT_FOOTER_SIZE];
+    Block_footer footer;
+    uint64_t entries = offset + BLOCK_FORMAT_BLOCK_HEADER_SIZE;
+    if (Archive_pread(file, bytes, sizeof(bytes), entries + index->payload_size - BLOCK_FORMAT_FOOTER_SIZE) != 0
+        || Block_footer_deserialize(&footer, bytes) != 0 || footer.count != count
+        || Block_index_size(count, footer.entry_size) != BLOCK_FORMAT_BLOCK_HEADER_SIZE + (uint64_t)index->payload_size
+        || fseeko(file, (off_t)entries, SEEK_SET) != 0) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        uint8_t entry_bytes[BLOCK_FORMAT_INDEX_ENTRY_SIZE];
+        Block_index_entry entry;
+        if (fread(entry_bytes, 1, footer.entry_size, file) != footer.entry_size) return;
+        Block_index_entry_deserialize(&entry, entry_bytes, footer.entry_size);
+        if (entry.raw_size == blocks[i].entry.raw_size && entry.payload_size == blocks[i].entry.payload_size) {
+            blocks[i].entry.hash = entry.hash;
+        }
+    }
+}
+
+
+/*
+ * Lists the blocks of every member in file order, walking the block headers
+ * like Archive_locate_scan. Blocks of members without hashed index entries
+ * keep hash 0 and are never reused.
+ */
+static int Archive_catalog(FILE* file, uint64_t size, Archive_reuse* reuse) {
+    uint64_t position = 0;
+    while (position < size) {
+        uint8_t bytes[BLOCK_FORMAT_BLOCK_HEADER_SIZE];
+        Block_file_header header;
+        if (Archive_pread(file, bytes, BLOCK_FORMAT_FILE_HEADER_SIZE, position) != 0
+            || Block_file_header_deserialize(&header, bytes) != 0) {
+            return -1;
+        }
+        if (header.block_size > reuse->block_size) reuse->block_size = header.block_size;
+        reuse->tail_block_size = header.block_size;
+        size_t first = reuse->count;
+        position += BLOCK_FORMAT_FILE_HEADER_SIZE;
+
+        for (;;) {
+            Block_header block;
+            if (Archive_pread(file, bytes, sizeof(bytes), position) != 0
+                || Block_header_deserialize(&block, bytes, header.block_size) != 0 || block.kind == BLOCK_INDEX) {
+                return -1;
+            }
+            if (block.kind != BLOCK_END) Archive_reuse_push(reuse, position, &block);
+            position += BLOCK_FORMAT_BLOCK_HEADER_SIZE + block.payload_size;
+            if (block.kind == BLOCK_END) break;
+        }
+
+        uint32_t magic = BLOCK_FORMAT_MAGIC;
+        if (position < size && Archive_pread(file, bytes, sizeof(bytes), position) == 0) {
+            memcpy(&magic, bytes, sizeof(magic));
+        }
+        if (magic != BLOCK_FORMAT_MAGIC) {
+            Block_header block;
+            if (Block_header_deserialize(&block, bytes, header.block_size) != 0 || block.kind != BLOCK_INDEX) {
+                return -1;
+            }
+            Archive_catalog_hashes(file, position, &block, reuse->blocks + first, reuse->count - first);
+            position += BLOCK_FORMAT_BLOCK_HEADER_SIZE + block.payload_size;
+        }
+    }
+    return size > 0 && position == size ? 0 : -1;
+}
+
+
+int Archive_update(FILE* old, FILE* input, FILE* output, const Archive_options* options,
+                   uint64_t* raw_size, uint64_t* reused_size) {
+    Archive_reuse reuse;
+    memset(&reuse, 0, sizeof(reuse));
+    reuse.file = old;
+    Archive_reuse_gear(&reuse);
+    if (fseeko(old, 0, SEEK_END) != 0 || Archive_catalog(old, (uint64_t)ftello(old), &reuse) != 0) {
+        fprintf(stderr, "Not a complete block-format .huff file\n");
+        Archive_reuse_destroy(&reuse);
+        return -1;
+    }
+
+    // Old blocks are copied with their headers, so the member takes the largest old block size.
+    uint8_t file_header[BLOCK_FORMAT_FILE_HEADER_SIZE];
+    Block_file_header header;
+    Block_file_header_init(&header, reuse.block_size);
+    Block_file_header_serialize(&header, file_header);
+    if (fwrite(file_header, 1, sizeof(file_header), output) != sizeof(file_header) || fflush(output) != 0) {
+        fprintf(stderr, "Failed to write block file header\n");
+        Archive_reuse_destroy(&reuse);
+        return -1;
+    }
+
+    Archive_index index = { NULL, 0, 0 };
+    uint64_t total = 0;
+    int result = Archive_write_blocks(input, output, options, reuse.block_size, &index,
+                                      BLOCK_FORMAT_FILE_HEADER_SIZE, &total, &reuse);
+    Mem_free(index.entries);
+    Archive_reuse_destroy(&reuse);
+    *raw_size = total;
+    *reused_size = reuse.reused_bytes;
+    return result;
+}
+
+
+// Reads past a payload that may be larger than the scratch buffer.
+static int Archive_skip(Io_reader* reader, uint64_t size, uint8_t* scratch, size_t capacity) {
+    while (size > 0) {
+        size_t take = size < capacity ? (size_t)size : capacity;
+        if (!Io_reader_read(reader, take, scratch)) return -1;
+        size -= take;
+    }
+    return 0;
+}
+
+
+/*
+ * Copies the bytes of a REF block into the output chunk, which has room for
+ * them. `total` is the output position and `member_total` that within the
+ * member, which the reference may not reach out of. The part still in the
+ * chunk is copied from it; the rest is read back from `output` once the
+ * writer has put it there.
+ */
+static int Archive_resolve_ref(Io_writer* writer, Io_chunk* chunk, FILE* output, int64_t output_base,
+                               uint64_t total, uint64_t member_total, const Block_header* block, const uint8_t* payload) {
+    uint64_t distance;
+    memcpy(&distance, payload, sizeof(distance));
+    if (distance < block->raw_size || distance > member_total) return -1;
+
+    uint8_t* out = chunk->data + chunk->size;
+    uint64_t source = total - distance;
+    uint64_t chunk_start = total - chunk->size;
+    size_t size = block->raw_size;
+    if (source < chunk_start) {
+        size_t take = chunk_start - source < size ? (size_t)(chunk_start - source) : size;
+        if (output_base < 0 || Io_writer_sync(writer) != 0
+            || Archive_pread_fd(fileno(output), out, take, (uint64_t)output_base + source) != 0) {
+            return -1;
+        }
+        out += take;
+        source += take;
+        size -= take;
+    }
+    memcpy(out, chunk->data + (source - chunk_start), size);
+    return 0;
+}
+
+
+/*
+ * Decodes every member in turn, so concatenated .huff files decompress to
+ * the concatenation of their contents. A member's INDEX block is only
+ * checked against the blocks just decoded.
+ */
+int Archive_decompress(FILE* input, FILE* output, uint64_t* raw_size) {
+    Io_reader* reader = Io_reader_create(input, IO_CHUNK_SIZE, IO_RING_DEPTH);
+    Io_writer* writer = NULL;
+    Io_chunk* output_chunk = NULL;
+    size_t output_chunk_size = 0;
+    Block_decoder* decoder = Block_decoder_create();
+    uint8_t* scratch = NULL;
+    size_t payload_capacity = 0;
+    uint64_t total = 0;
+    int failed = 0;
+    int64_t output_base = (int64_t)ftello(output);
+    uint8_t file_header[BLOCK_FORMAT_FILE_HEADER_SIZE];
+    const uint8_t* bytes = Io_reader_read(reader, BLOCK_FORMAT_FILE_HEADER_SIZE, file_header);
+
+    for (;;) {
+        Block_file_header header;
+        if (!bytes || Block_file_header_deserialize(&header, bytes) != 0) {
+            fprintf(stderr, "Failed to read block file header\n");
+            failed = 1;
+            break;
+        }
+
+        if ((size_t)header.block_size * 2 + 1024 > payload_capacity) {
+            Mem_free(scratch);
+            payload_capacity = (size_t)header.block_size * 2 + 1024;
+            scratch = (uint8_t*)Mem_alloc(MEM_BLOCK, payload_capacity);
+            if (!scratch) {
+                perror("Failed to allocate block payload buffer");
+                exit(EXIT_FAILURE);
+            }
+        }
+        // A member with larger blocks than the output chunks gets a new writer.
+        if (header.block_size > output_chunk_size) {
+            if (writer) {
+                Io_writer_submit(writer, output_chunk);
+                if (Io_writer_destroy(writer) != 0) failed = 1;
+            }
+            output_chunk_size = header.block_size > IO_CHUNK_SIZE ? header.block_size : IO_CHUNK_SIZE;
+            writer = Io_writer_create(output, output_chunk_size, IO_RING_DEPTH);
+            output_chunk = Io_writer_acquire(writer);
+        }
+
+        uint64_t member_total = 0;
+        uint64_t blocks = 0;
+        for (;;) {
+            Block_header block;
+            bytes = Io_reader_read(reader, BLOCK_FORMAT_BLOCK_HEADER_SIZE, scratch);
+            if (!bytes || Block_header_deserialize(&block, bytes, header.block_size) != 0) {
+                fprintf(stderr, "Truncated or corrupt block header after %llu bytes\n", (unsigned long long)total);
+                failed = 1;
+                break;
+            }
+
+            if (block.kind == BLOCK_INDEX) {
+                // Only valid right after END, which ends this loop.
+                fprintf(stderr, "Unexpected block index after %llu bytes\n", (unsigned long long)total);
+                failed = 1;
+                break;
+            }
+
+            const uint8_t* payload = Io_reader_read(reader, block.payload_size, scratch);
+            if (!payload) {
+                fprintf(stderr, "Truncated block payload after %llu bytes\n", (unsigned long long)total);
+                failed = 1;
+                break;
+            }
+
+            if (block.kind == BLOCK_END) {
+                uint64_t expected;
+                memcpy(&expected, payload, sizeof(expected));
+                if (expected != member_total) {
+                    fprintf(stderr, "Decoded size (%llu) does not match original size (%llu)\n",
+                            (unsigned long long)member_total, (unsigned long long)expected);
+                    failed = 1;
+                }
+                break;
+            }
+
+            output_chunk = Archive_reserve(writer, output_chunk, block.raw_size);
+            if (block.kind == BLOCK_REF) {
+                if (Archive_resolve_ref(writer, output_chunk, output, output_base, total, member_total,
+                                        &block, payload) != 0) {
+                    fprintf(stderr, "Cannot resolve block reference after %llu bytes\n", (unsigned long long)total);
+                    failed = 1;
+                    break;
+                }
+            } else if (Block_decode(decoder, &block, payload, output_chunk->data + output_chunk->size) != 0) {
+                fprintf(stderr, "Corrupt block after %llu bytes\n", (unsigned long long)total);
+                failed = 1;
+                break;
+            }
+            output_chunk->size += block.raw_size;
+            total += block.raw_size;
+            member_total += block.raw_size;
+            blocks++;
+        }
+        if (failed) break;
+
+        // END is followed by the optional INDEX block, the next member's
+        // file header or nothing; the magic tells the two headers apart.
+        bytes = Io_reader_read(reader, BLOCK_FORMAT_BLOCK_HEADER_SIZE, file_header);
+        uint32_t magic = 0;
+        if (bytes) memcpy(&magic, bytes, sizeof(magic));
+        if (bytes && magic != BLOCK_FORMAT_MAGIC) {
+            Block_header block;
+            Block_footer footer;
+            if (Block_header_deserialize(&block, bytes, header.block_size) != 0 || block.kind != BLOCK_INDEX
+                || Archive_skip(reader, block.payload_size - BLOCK_FORMAT_FOOTER_SIZE, scratch, payload_capacity) != 0
+                || !(bytes = Io_reader_read(reader, BLOCK_FORMAT_FOOTER_SIZE, scratch))
+                || Block_footer_deserialize(&footer, bytes) != 0 || footer.count != blocks) {
+                fprintf(stderr, "Corrupt block index after %llu bytes\n", (unsigned long long)total);
+                failed = 1;
+                break;
+            }
+            bytes = Io_reader_read(reader, BLOCK_FORMAT_FILE_HEADER_SIZE, file_header);
+        }
+        if (!bytes) break;
+    }
+    if (writer) {
+        Io_writer_submit(writer, output_chunk);
+        if (Io_writer_destroy(writer) != 0) failed = 1;
+    }
+
+    if (Io_reader_failed(reader)) failed = 1;
+    Io_reader_destroy(reader);
+    Block_decoder_destroy(decoder);
+    Mem_free(scratch);
+
+    *raw_size = total;
+    return failed ? -1 : 0;
+}
+
+
+// ===== GREP =====
+
+typedef struct {
+    uint64_t raw;           // offset of the block's bytes in the member
+    uint64_t offset;        // file offset of its header
+} Archive_grep_block;
+
+typedef struct {
+    int fd;
+    const uint8_t* pattern;
+    size_t length;
+    uint8_t needed[256];            // the byte values of the pattern
+    uint32_t block_size;            // of the current member
+    Block_decoder* decoder;
+    uint8_t* window;                // length - 1 bytes of carry, then one decoded block
+    size_t tail;                    // carry bytes in front of window + length - 1
+    uint8_t* held;                  // payload of the last block if it was skipped but may start a match
+    Block_header held_header;
+    int held_valid;
+    uint8_t* ref;                   // block read back to resolve a REF block
+    size_t ref_capacity;
+    Archive_grep_block* blocks;     // of the current member, for REF blocks
+    size_t count;
+    size_t capacity;
+    FILE* report;
+    Archive_grep_stats* stats;
+} Archive_grep_state;
+
+
+static void Archive_grep_push(Archive_grep_state* g, uint64_t raw, uint64_t offset) {
+    if (g->count == g->capacity) {
+        g->capacity = g->capacity ? g->capacity * 2 : 1024;
+        g->blocks = (Archive_grep_block*)Mem_realloc(MEM_BLOCK, g->blocks, g->capacity * sizeof(Archive_grep_block));
+        if (!g->blocks) {
+            perror("Failed to allocate block list");
+            exit(EXIT_FAILURE);
+        }
+    }
+    g->blocks[g->count].raw = raw;
+    g->blocks[g->count].offset = offset;
+    g->count++;
+}
+
+
+// 1 when some match could start in a block holding `before` and end in the next, holding `after`.
+static int Archive_grep_spans(const Archive_grep_state* g, const uint8_t before[256], const uint8_t after[256]) {
+    size_t prefix = 0;
+    while (prefix < g->length && before[g->pattern[prefix]]) prefix++;
+    size_t suffix = g->length;
+    while (suffix > 0 && after[g->pattern[suffix - 1]]) suffix--;
+    size_t first = suffix > 1 ? suffix : 1;
+    size_t last = prefix < g->length - 1 ? prefix : g->length - 1;
+    return first <= last;
+}
+
+
+/*
+ * Decodes a block at member offset `raw` into `out`. A REF block is
+ * resolved by reading back the block it copies, which is listed at the
+ * offset it names, following any chain of references.
+ */
+static int Archive_grep_decode(Archive_grep_state* g, const Block_header* header, const uint8_t* payload,
+                               uint64_t raw, uint8_t* out) {
+    Block_header block = *header;
+    while (block.kind == BLOCK_REF) {
+        uint64_t distance;
+        memcpy(&distance, payload, sizeof(distance));
+        if (distance < block.raw_size || distance > raw) return -1;
+        raw -= distance;
+
+        size_t low = 0, high = g->count;
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (g->blocks[middle].raw < raw) low = middle + 1;
+            else high = middle;
+        }
+        uint8_t bytes[BLOCK_FORMAT_BLOCK_HEADER_SIZE];
+        Block_header source;
+        if (low == g->count || g->blocks[low].raw != raw
+            || Archive_pread_fd(g->fd, bytes, sizeof(bytes), g->blocks[low].offset) != 0
+            || Block_header_deserialize(&source, bytes, g->block_size) != 0 || source.raw_size != block.raw_size) {
+            return -1;
+        }
+        if (source.payload_size > g->ref_capacity) {
+            Mem_free(g->ref);
+            g->ref_capacity = source.payload_size;
+            g->ref = (uint8_t*)Mem_alloc(MEM_BLOCK, g->ref_capacity);
+            if (!g->ref) {
+                perror("Failed to allocate reference buffer");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (Archive_pread_fd(g->fd, g->ref, source.payload_size, g->blocks[low].offset + sizeof(bytes)) != 0) {
+            return -1;
+        }
+        block = source;
+        payload = g->ref;
+    }
+    g->stats->decoded_bytes += block.raw_size;
+    return Block_decode(g->decoder, &block, payload, out);
+}
+
+
+// Reports the matches in the carry and the block of `size` bytes at window + length - 1, which starts at `start`.
+static void Archive_grep_scan(Archive_grep_state* g, size_t size, uint64_t start) {
+    const uint8_t* region = g->window + (g->length - 1) - g->tail;
+    size_t region_size = g->tail + size;
+    uint64_t base = start - g->tail;
+    const uint8_t* p = region;
+    const uint8_t* end = region + region_size;
+    while ((p = memmem(p, (size_t)(end - p), g->pattern, g->length))) {
+        g->stats->matches++;
+        if (g->report) fprintf(g->report, "%llu\n", (unsigned long long)(base + (uint64_t)(p - region)));
+        p++;
+    }
+
+    size_t keep = region_size < g->length - 1 ? region_size : g->length - 1;
+    memmove(g->window + (g->length - 1) - keep, end - keep, keep);
+    g->tail = keep;
+}
+
+
+/*
+ * The next block: if its table leaves out a byte of the pattern, no match
+ * lies inside it and it is skipped. A match may still cross the boundary
+ * with a neighbour, which the two tables tell; then the block is decoded
+ * after all, or, for the block before, its held payload is.
+ */
+static int Archive_grep_visit(Archive_grep_state* g, const Block_header* header, const uint8_t* payload,
+                              uint64_t raw, uint64_t start, uint8_t present[256], const uint8_t previous[256],
+                              int first) {
+    if (Block_present_bytes(header, payload, present) != 0) return -1;
+    // A block shorter than the carry could be crossed by a match, so it is never skipped.
+    if (header->raw_size < g->length - 1) memset(present, 1, 256);
+
+    int all = 1;
+    for (int b = 0; b < 256; b++) {
+        if (g->needed[b] && !present[b]) all = 0;
+    }
+    int crossing = g->length > 1 && !first && Archive_grep_spans(g, previous, present);
+    if (crossing && g->held_valid) {
+        // Only the held block's tail is needed: no match lies inside it.
+        size_t size = g->held_header.raw_size;
+        if (Archive_grep_decode(g, &g->held_header, g->held, raw - size, g->window + g->length - 1) != 0) {
+            return -1;
+        }
+        memmove(g->window, g->window + size, g->length - 1);
+        g->tail = g->length - 1;
+    }
+    g->held_valid = 0;
+    if (!crossing) g->tail = 0;
+
+    if (all || crossing) {
+        if (Archive_grep_decode(g, header, payload, raw, g->window + g->length - 1) != 0) return -1;
+        Archive_grep_scan(g, header->raw_size, start);
+        return 0;
+    }
+
+    g->stats->skipped_blocks++;
+    if (g->length > 1 && present[g->pattern[0]]) {
+        memcpy(g->held, payload, header->payload_size);
+        g->held_header = *header;
+        g->held_valid = 1;
+    }
+    return 0;
+}
+
+
+int Archive_grep(FILE* input, const uint8_t* pattern, size_t length, FILE* report, Archive_grep_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    Archive_grep_state g;
+    memset(&g, 0, sizeof(g));
+    g.fd = fileno(input);
+    g.pattern = pattern;
+    g.length = length;
+    g.decoder = Block_decoder_create();
+    g.report = report;
+    g.stats = stats;
+    for (size_t i = 0; i < length; i++) {
+        g.needed[pattern[i]] = 1;
+    }
+
+    off_t base = ftello(input);
+    Io_reader* reader = Io_reader_create(input, IO_CHUNK_SIZE, IO_RING_DEPTH);
+    uint8_t* scratch = NULL;
+    size_t payload_capacity = 0;
+    uint8_t present[2][256];
+    int current = 0;
+    uint64_t position = base < 0 ? 0 : (uint64_t)base;
+    uint64_t total = 0;
+    int first = 1;
+    int failed = 0;
+    uint8_t file_header[BLOCK_FORMAT_FILE_HEADER_SIZE];
+    const uint8_t* bytes = Io_reader_read(reader, BLOCK_FORMAT_FILE_HEADER_SIZE, file_header);
+
+    while (!failed) {
+        Block_file_header header;
+        if (!bytes || Block_file_header_deserialize(&header, bytes) != 0) {
+            fprintf(stderr, "Failed to read block file header\n");
+            failed = 1;
+            break;
+        }
+        position += BLOCK_FORMAT_FILE_HEADER_SIZE;
+        g.block_size = header.block_size;
+        g.count = 0;
+
+        if ((size_t)header.block_size * 2 + 1024 > payload_capacity) {
+            payload_capacity = (size_t)header.block_size * 2 + 1024;
+            Mem_free(scratch);
+            scratch = (uint8_t*)Mem_alloc(MEM_BLOCK, payload_capacity);
+            // Both keep their contents: the carry and a held block cross members.
+            g.window = (uint8_t*)Mem_realloc(MEM_BLOCK, g.window, length - 1 + header.block_size);
+            g.held = (uint8_t*)Mem_realloc(MEM_BLOCK, g.held, payload_capacity);
+            if (!scratch || !g.window || !g.held) {
+                perror("Failed to allocate block buffers");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        uint64_t member_total = 0;
+        uint64_t blocks = 0;
+        for (;;) {
+            Block_header block;
+            bytes = Io_reader_read(reader, BLOCK_FORMAT_BLOCK_HEADER_SIZE, scratch);
+            if (!bytes || Block_header_deserialize(&block, bytes, header.block_size) != 0 || block.kind == BLOCK_INDEX) {
+                fprintf(stderr, "Truncated or corrupt block header after %llu bytes\n", (unsigned long long)total);
+                failed = 1;
+                break;
+            }
+            const uint8_t* payload = Io_reader_read(reader, block.payload_size, scratch);
+            if (!payload) {
+                fprintf(stderr, "Truncated block payload after %llu bytes\n", (unsigned long long)total);
+                failed = 1;
+                break;
+            }
+
+            if (block.kind == BLOCK_END) {
+                uint64_t expected;
+                memcpy(&expected, payload, sizeof(expected));
+                position += BLOCK_FORMAT_BLOCK_HEADER_SIZE + block.payload_size;
+                if (expected != member_total) {
+                    fprintf(stderr, "Block sizes (%llu) do not match original size (%llu)\n",
+                            (unsigned long long)member_total, (unsigned long long)expected);
+                    failed = 1;
+                }
+                break;
+            }
+
+            Archive_grep_push(&g, member_total, position);
+            current ^= 1;
+            if (Archive_grep_visit(&g, &block, payload, member_total, total, present[current], present[current ^ 1],
+                                   first) != 0) {
+                fprintf(stderr, "Corrupt block after %llu bytes\n", (unsigned long long)total);
+                failed = 1;
+                break;
+            }
+            position += BLOCK_FORMAT_BLOCK_HEADER_SIZE + block.payload_size;
+            total += block.raw_size;
+            member_total += block.raw_size;
+            stats->blocks++;
+            blocks++;
+            first = 0;
+        }
+        if (failed) break;
+
+        bytes = Io_reader_read(reader, BLOCK_FORMAT_BLOCK_HEADER_SIZE, file_header);
+        uint32_t magic = 0;
+        if (bytes) memcpy(&magic, bytes, sizeof(magic));
+        if (bytes && magic != BLOCK_FORMAT_MAGIC) {
+            Block_header block;
+            if (Block_header_deserialize(&block, bytes, header.block_size) != 0 || block.kind != BLOCK_INDEX
+                || Archive_skip(reader, block.payload_size, scratch, payload_capacity) != 0) {
+                fprintf(stderr, "Corrupt block index after %llu bytes\n", (unsigned long long)total);
+                failed = 1;
+                break;
+            }
+            position += BLOCK_FORMAT_BLOCK_HEADER_SIZE + block.payload_size;
+            bytes = Io_reader_read(reader, BLOCK_FORMAT_FILE_HEADER_SIZE, file_header);
+        }
+        if (!bytes) break;
+    }
+
+    if (Io_reader_failed(reader)) failed = 1;
+    Io_reader_destroy(reader);
+    Block_decoder_destroy(g.decoder);
+    Mem_free(scratch);
+    Mem_free(g.window);
+    Mem_free(g.held);
+    Mem_free(g.ref);
+    Mem_free(g.blocks);
+    stats->raw_size = total;
+    return failed ? -1 : 0;
+}
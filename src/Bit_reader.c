@@ -0,0 +1,27 @@
+#include "Bit_reader.h"
+
+
+void Bit_reader_init(Bit_reader* br, const uint8_t* data, size_t size) {
+    br->container = 0;
+    br->bit_count = 0;
+    br->ptr = data;
+    br->end = data + size;
+}
+
+
+void Bit_reader_feed(Bit_reader* br, const uint8_t* data, size_t size) {
+    if (br->ptr != br->end) {
+        fprintf(stderr, "Bit_reader_feed called with %zu unread input bytes\n", Bit_reader_input_left(br));
+        exit(EXIT_FAILURE);
+    }
+    br->ptr = data;
+    br->end = data + size;
+}
+
+
+void Bit_reader_refill_slow(Bit_reader* br) {
+    while (br->bit_count <= 56 && br->ptr < br->end) {
+        br->container |= (uint64_t)*br->ptr++ << (56 - br->bit_count);
+        br->bit_count += 8;
+    }
+}
@@ -0,0 +1,26 @@
+#include "Bit_writer.h"
+
+
+void Bit_writer_init(Bit_writer* bw, uint8_t* buffer, size_t capacity) {
+    bw->acc = 0;
+    bw->bit_count = 0;
+    bw->ptr = buffer;
+    bw->end = buffer + capacity;
+}
+
+
+void Bit_writer_retarget(Bit_writer* bw, uint8_t* buffer, size_t capacity) {
+    bw->ptr = buffer;
+    bw->end = buffer + capacity;
+}
+
+
+// Writes out the pending bits, zero-padding the last byte. Returns the number
+// of bytes that byte added (0 or 1).
+size_t Bit_writer_finish(Bit_writer* bw) {
+    if (bw->bit_count == 0) return 0;
+    *bw->ptr++ = (uint8_t)(bw->acc >> 56);
+    bw->acc = 0;
+    bw->bit_count = 0;
+    return 1;
+}
@@ -0,0 +1,870 @@
+#include "Block_codec.h"
+#include <math.h>
+#include <string.h>
+#include "Bit_writer.h"
+#include "Cpu_dispatch.h"
+#include "Mem.h"
+
+
+static void Block_stream_segment(size_t size, unsigned streams, unsigned index, size_t* start, size_t* end) {
+    size_t segment = (size + streams - 1) / streams;
+    *start = segment * index < size ? segment * index : size;
+    *end = segment * (index + 1) < size ? segment * (index + 1) : size;
+}
+
+
+// ===== ENCODER =====
+
+Block_encoder* Block_encoder_create(void) {
+    Block_encoder* enc = (Block_encoder*)Mem_calloc(MEM_BLOCK, 1, sizeof(Block_encoder));
+    if (!enc) {
+        perror("Failed to allocate Block_encoder");
+        exit(EXIT_FAILURE);
+    }
+    return enc;
+}
+
+
+// A Huffman payload is only kept when it is smaller than the raw block, so
+// the bound only adds header room and the bit writers' store slack.
+size_t Block_encode_bound(size_t raw_size) {
+    return BLOCK_FORMAT_BLOCK_HEADER_SIZE + raw_size + 4 * BIT_WRITER_SLACK + 16;
+}
+
+
+int Block_entropy_parse(const char* name, unsigned* entropy) {
+    if (strcmp(name, "auto") == 0) *entropy = BLOCK_ENTROPY_AUTO;
+    else if (strcmp(name, "huffman") == 0) *entropy = BLOCK_ENTROPY_HUFFMAN;
+    else if (strcmp(name, "tans") == 0) *entropy = BLOCK_ENTROPY_TANS;
+    else if (strcmp(name, "pairs") == 0) *entropy = BLOCK_ENTROPY_PAIRS;
+    else return -1;
+    return 0;
+}
+
+
+/*
+ * Counts one BLOCK_CODEC_SAMPLE_WINDOW in every 2^shift and scales the
+ * counts back up. Returns 0 when the block was counted in full instead,
+ * because shift is 0 or the block is too small to sample.
+ */
+static int Block_count(Block_encoder* enc, const uint8_t* in, size_t size, unsigned shift) {
+    const Kernel_set* kernels = Kernels_get();
+    size_t stride = (size_t)BLOCK_CODEC_SAMPLE_WINDOW << shift;
+    memset(enc->counts, 0, sizeof(enc->counts));
+    if (shift == 0 || size < 2 * stride) {
+        kernels->histogram(in, size, enc->counts);
+        return 0;
+    }
+    for (size_t offset = 0; offset < size; offset += stride) {
+        size_t window = size - offset < BLOCK_CODEC_SAMPLE_WINDOW ? size - offset : BLOCK_CODEC_SAMPLE_WINDOW;
+        kernels->histogram(in + offset, window, enc->counts);
+    }
+    for (int i = 0; i < 256; i++) {
+        enc->counts[i] <<= shift;
+    }
+    return 1;
+}
+
+
+static int Block_distinct(const uint64_t counts[256]) {
+    int distinct = 0;
+    for (int i = 0; i < 256; i++) {
+        if (counts[i]) distinct++;
+    }
+    return distinct;
+}
+
+
+/*
+ * With exact counts the payload size is known up front and the kernels run
+ * unchecked. A code built from a sample may cost more than estimated, so
+ * `checked` encodes in batches that cannot overrun `size` bytes of payload
+ * and returns -1 once the next batch would.
+ */
+static int Block_encode_huffman(Block_encoder* enc, const uint8_t* in, size_t size, uint8_t* payload,
+                                Block_header* header, unsigned streams, unsigned max_length, uint64_t bits,
+                                int checked) {
+    const Kernel_set* kernels = Kernels_get();
+    size_t table_size = HUFFMAN_TABLE_LENGTHS_SIZE + (streams == 4 ? BLOCK_CODEC_STREAM_SIZES : 0);
+
+    Huffman_table_build_encoder(enc->lengths, &enc->codes);
+    Huffman_table_write_lengths(enc->lengths, payload);
+
+    uint8_t* sizes = payload + HUFFMAN_TABLE_LENGTHS_SIZE;
+    uint8_t* stream = payload + table_size;
+    for (unsigned s = 0; s < streams; s++) {
+        size_t start, end;
+        Block_stream_segment(size, streams, s, &start, &end);
+
+        Bit_writer bw;
+        if (!checked) {
+            Bit_writer_init(&bw, stream, size + BIT_WRITER_SLACK);
+            kernels->encode(&enc->codes, in + start, end - start, &bw);
+        } else {
+            size_t used = (size_t)(stream - payload);
+            Bit_writer_init(&bw, stream, (used < size ? size - used : 0) + BIT_WRITER_SLACK);
+            while (start < end) {
+                size_t batch = Huffman_encoder_batch_limit(&enc->codes, &bw);
+                if (batch == 0) return -1;
+                if (batch > end - start) batch = end - start;
+                kernels->encode(&enc->codes, in + start, batch, &bw);
+                start += batch;
+            }
+        }
+        Bit_writer_finish(&bw);
+
+        uint32_t stream_size = (uint32_t)(bw.ptr - stream);
+        if (streams == 4 && s < 3) {
+            memcpy(sizes + 4 * s, &stream_size, sizeof(stream_size));
+        }
+        stream += stream_size;
+    }
+
+    unsigned table_bits = Huffman_table_decode_bits(max_length);
+    header->kind = BLOCK_HUFFMAN;
+    header->payload_size = (uint32_t)(stream - payload);
+    header->max_code_length = (uint8_t)max_length;
+    header->num_streams = (uint8_t)streams;
+    // Two-symbol lookups pay off once the average code fits twice in a lookup.
+    if (bits * 2 <= (uint64_t)size * table_bits) {
+        header->flags |= BLOCK_FLAG_MULTI_SYMBOL;
+    }
+    return header->payload_size < size ? 0 : -1;
+}
+
+
+// Writes the normalized table and the streams, never more than `size` bytes
+// in total; returns -1 when that does not fit.
+static int Block_encode_tans(Block_encoder* enc, const uint8_t* in, size_t size, uint8_t* payload,
+                             Block_header* header, unsigned streams, unsigned table_log) {
+    Tans_build_encoder(enc->norm, table_log, &enc->tans);
+    size_t table_size = Tans_write_norm(enc->norm, table_log, payload);
+
+    uint8_t* sizes = payload + table_size;
+    uint8_t* stream = sizes + (streams == 4 ? BLOCK_CODEC_STREAM_SIZES : 0);
+    for (unsigned s = 0; s < streams; s++) {
+        size_t start, end;
+        Block_stream_segment(size, streams, s, &start, &end);
+
+        size_t used = (size_t)(stream - payload);
+        if (used >= size) return -1;
+        size_t stream_size = Tans_encode(&enc->tans, in + start, end - start, stream, size - used);
+        if (stream_size == 0) return -1;
+
+        if (streams == 4 && s < 3) {
+            uint32_t value = (uint32_t)stream_size;
+            memcpy(sizes + 4 * s, &value, sizeof(value));
+        }
+        stream += stream_size;
+    }
+
+    header->kind = BLOCK_TANS;
+    header->payload_size = (uint32_t)(stream - payload);
+    header->max_code_length = (uint8_t)table_log;
+    header->num_streams = (uint8_t)streams;
+    return 0;
+}
+
+
+/*
+ * Tokenizes every stream segment on its own, so no pair straddles two
+ * streams, and keeps the result only when it is smaller than `limit`. The
+ * symbol counts are exact, so the streams are written unchecked.
+ */
+static unsigned Block_plan_pairs(Block_encoder* enc, const uint8_t* in, size_t size, unsigned streams, size_t limit,
+                                 size_t* estimate) {
+    if (!enc->pairs) enc->pairs = Pair_encoder_create();
+    Pair_encoder* pairs = enc->pairs;
+    if (Pair_choose(pairs, in, size, enc->sample_shift, BLOCK_CODEC_SAMPLE_WINDOW) == 0) {
+        return 0;
+    }
+
+    memset(pairs->counts, 0, sizeof(pairs->counts));
+    for (unsigned s = 0; s < streams; s++) {
+        size_t start, end;
+        Block_stream_segment(size, streams, s, &start, &end);
+        Pair_count(pairs, in + start, end - start);
+    }
+    uint64_t bits;
+    unsigned max_length = Pair_build_code(pairs, &bits);
+    *estimate = Pair_table_size(pairs->num_pairs) + (streams == 4 ? BLOCK_CODEC_STREAM_SIZES : 0) + bits / 8 + streams;
+    return max_length && *estimate < limit ? max_length : 0;
+}
+
+
+static int Block_encode_pairs(Block_encoder* enc, const uint8_t* in, size_t size, uint8_t* payload,
+                              Block_header* header, unsigned streams, size_t limit) {
+    size_t estimate;
+    unsigned max_length = Block_plan_pairs(enc, in, size, streams, limit, &estimate);
+    if (max_length == 0) return -1;
+
+    Pair_encoder* pairs = enc->pairs;
+    size_t table_size = Pair_table_size(pairs->num_pairs);
+    Pair_write_table(pairs, payload);
+    uint8_t* sizes = payload + table_size;
+    uint8_t* stream = sizes + (streams == 4 ? BLOCK_CODEC_STREAM_SIZES : 0);
+    for (unsigned s = 0; s < streams; s++) {
+        size_t start, end;
+        Block_stream_segment(size, streams, s, &start, &end);
+
+        Bit_writer bw;
+        Bit_writer_init(&bw, stream, size + BIT_WRITER_SLACK);
+        Pair_encode(pairs, in + start, end - start, &bw);
+        Bit_writer_finish(&bw);
+
+        uint32_t stream_size = (uint32_t)(bw.ptr - stream);
+        if (streams == 4 && s < 3) {
+            memcpy(sizes + 4 * s, &stream_size, sizeof(stream_size));
+        }
+        stream += stream_size;
+    }
+
+    header->kind = BLOCK_PAIRS;
+    header->payload_size = (uint32_t)(stream - payload);
+    header->max_code_length = (uint8_t)max_length;
+    header->num_streams = (uint8_t)streams;
+    return 0;
+}
+
+
+// What Block_encode_payload works out from the byte counts before it codes anything.
+typedef struct {
+    int sampled;
+    int rle;
+    unsigned streams;
+    unsigned max_length;
+    uint64_t bits;          // Huffman bits of the counted bytes
+    size_t huffman_size;    // at most the Huffman payload
+    unsigned table_log;
+    size_t tans_size;       // estimated tANS payload
+    int tans;               // tANS is the first choice
+} Block_plan;
+
+
+/*
+ * Counts `in` (or takes `counts`, when they are its exact byte counts) and
+ * builds the Huffman code, then sizes the tANS alternative and decides
+ * whether it goes first.
+ */
+static void Block_plan_payload(Block_encoder* enc, const uint8_t* in, size_t size, const uint64_t* counts,
+                               Block_plan* plan) {
+    memset(plan, 0, sizeof(*plan));
+    if (counts) {
+        memcpy(enc->counts, counts, sizeof(enc->counts));
+    } else {
+        plan->sampled = Block_count(enc, in, size, enc->sample_shift);
+    }
+    int distinct = Block_distinct(enc->counts);
+    if (plan->sampled && distinct == 1) {
+        // Possibly a run: only a full count can tell.
+        plan->sampled = Block_count(enc, in, size, 0);
+        distinct = Block_distinct(enc->counts);
+    }
+
+    if (distinct == 1 && !plan->sampled) {
+        plan->rle = 1;
+        return;
+    }
+
+    uint64_t total = size;
+    if (plan->sampled) {
+        // Bytes the sample missed still need a code.
+        total = 0;
+        distinct = 256;
+        for (int i = 0; i < 256; i++) {
+            if (!enc->counts[i]) enc->counts[i] = 1;
+            total += enc->counts[i];
+        }
+    }
+
+    plan->streams = enc->num_streams ? enc->num_streams : (size >= BLOCK_CODEC_FOUR_STREAM_MIN ? 4 : 1);
+    size_t sizes_size = plan->streams == 4 ? BLOCK_CODEC_STREAM_SIZES : 0;
+
+    plan->max_length = Huffman_table_build_lengths(enc->counts, enc->lengths, HUFFMAN_TABLE_MAX_BITS);
+    for (int i = 0; i < 256; i++) {
+        plan->bits += enc->counts[i] * enc->lengths[i];
+    }
+    plan->huffman_size = HUFFMAN_TABLE_LENGTHS_SIZE + sizes_size + plan->bits / 8 + plan->streams;
+
+    // tANS spends fractional bits per symbol, which wins on skewed blocks
+    // where Huffman rounds the dominant byte up to a whole bit. Auto mode
+    // only takes it when it saves over 1/64, since Huffman decodes faster.
+    if (enc->entropy == BLOCK_ENTROPY_AUTO || enc->entropy == BLOCK_ENTROPY_TANS) {
+        plan->table_log = Tans_table_log(size, (unsigned)distinct);
+        Tans_normalize(enc->counts, total, plan->table_log, enc->norm);
+        // Worst-case table, plus per stream the final state and marker.
+        plan->tans_size = 2 + 2 * (size_t)distinct + sizes_size
+                        + (size_t)(Tans_cost(enc->counts, enc->norm, plan->table_log) / 8) + 3 * plan->streams;
+        plan->tans = (enc->entropy == BLOCK_ENTROPY_TANS || plan->tans_size + plan->tans_size / 64 < plan->huffman_size)
+                     && plan->tans_size < size;
+    }
+}
+
+
+// Picks RLE, STORED, PAIRS, HUFFMAN or TANS for `in` and fills the kind fields and
+// payload_size of `header`. `counts`, when given, are the exact byte counts of `in`.
+static void Block_encode_payload(Block_encoder* enc, const uint8_t* in, size_t size, const uint64_t* counts,
+                                 uint8_t* payload, Block_header* header) {
+    header->kind = 0;
+    header->max_code_length = 0;
+    header->num_streams = 0;
+    header->flags = 0;
+
+    Block_plan plan;
+    Block_plan_payload(enc, in, size, counts, &plan);
+    if (plan.rle) {
+        header->kind = BLOCK_RLE;
+        header->payload_size = 1;
+        payload[0] = in[0];
+        return;
+    }
+
+    if (plan.tans && Block_encode_tans(enc, in, size, payload, header, plan.streams, plan.table_log) == 0) {
+        return;
+    }
+
+    // Taken whenever it is smaller than plain Huffman: it decodes faster too.
+    size_t huffman_size = plan.huffman_size;
+    if (enc->entropy == BLOCK_ENTROPY_PAIRS
+        && Block_encode_pairs(enc, in, size, payload, header, plan.streams, huffman_size < size ? huffman_size : size) == 0) {
+        return;
+    }
+
+    if (huffman_size >= size
+        || Block_encode_huffman(enc, in, size, payload, header, plan.streams, plan.max_length, plan.bits,
+                                plan.sampled) != 0) {
+        header->kind = BLOCK_STORED;
+        header->payload_size = (uint32_t)size;
+        header->max_code_length = 0;
+        header->num_streams = 0;
+        header->flags = 0;
+        memcpy(payload, in, size);
+    }
+}
+
+
+size_t Block_encode(Block_encoder* enc, const uint8_t* in, size_t size, uint8_t* out) {
+    return Block_encode_counted(enc, in, size, NULL, out);
+}
+
+
+size_t Block_encode_counted(Block_encoder* enc, const uint8_t* in, size_t size, const uint64_t counts[256], uint8_t* out) {
+    uint8_t* payload = out + BLOCK_FORMAT_BLOCK_HEADER_SIZE;
+    Block_header header;
+    memset(&header, 0, sizeof(header));
+    header.raw_size = (uint32_t)size;
+
+    if (enc->transforms) {
+        if (!enc->transform) enc->transform = Transform_workspace_create();
+        uint32_t parameter[TRANSFORM_MAX_PARAMETERS];
+        const uint8_t* transformed = Transform_choose(enc->transform, in, size, enc->transforms,
+                                                      &header.transform, parameter);
+        if (header.transform != TRANSFORM_NONE) {
+            size_t prefix = Transform_parameter_size(header.transform);
+            memcpy(payload, parameter, prefix);
+            Block_encode_payload(enc, transformed, size, NULL, payload + prefix, &header);
+            if (header.kind != BLOCK_STORED) {
+                header.payload_size += (uint32_t)prefix;
+                Block_header_serialize(&header, out);
+                return BLOCK_FORMAT_BLOCK_HEADER_SIZE + header.payload_size;
+            }
+            // Incompressible either way: store the original bytes.
+            header.transform = TRANSFORM_NONE;
+        }
+    }
+
+    Block_encode_payload(enc, in, size, counts, payload, &header);
+    Block_header_serialize(&header, out);
+    return BLOCK_FORMAT_BLOCK_HEADER_SIZE + header.payload_size;
+}
+
+
+// ===== ESTIMATE =====
+
+/*
+ * Block_encode_payload without the Huffman coding. The Huffman size is
+ * exact: the code comes from the plan's counts, sampled or not, and every
+ * stream is counted in full to price it. tANS and pairs have no such
+ * shortcut, so they are coded into enc->scratch, and a failure there falls
+ * back as it does in Block_encode_payload.
+ */
+static void Block_estimate_payload(Block_encoder* enc, const uint8_t* in, size_t size, const uint64_t* counts,
+                                   Block_estimate* est) {
+    const Kernel_set* kernels = Kernels_get();
+    Block_plan plan;
+    Block_plan_payload(enc, in, size, counts, &plan);
+    est->num_streams = 0;
+    est->entropy = 0.0;
+    if (plan.rle) {
+        est->kind = BLOCK_RLE;
+        est->payload_size = 1;
+        return;
+    }
+
+    uint64_t stream_counts[4][256];
+    uint64_t stream_bytes = 0;
+    memset(stream_counts, 0, sizeof(stream_counts));
+    for (unsigned s = 0; s < plan.streams; s++) {
+        size_t start, end;
+        Block_stream_segment(size, plan.streams, s, &start, &end);
+        kernels->histogram(in + start, end - start, stream_counts[s]);
+        uint64_t bits = 0;
+        for (int i = 0; i < 256; i++) {
+            bits += stream_counts[s][i] * enc->lengths[i];
+        }
+        stream_bytes += (bits + 7) / 8;
+    }
+    for (int i = 0; i < 256; i++) {
+        uint64_t count = stream_counts[0][i] + stream_counts[1][i] + stream_counts[2][i] + stream_counts[3][i];
+        if (count) est->entropy += (double)count * log2((double)size / (double)count);
+    }
+
+    est->num_streams = (uint8_t)plan.streams;
+    if (plan.tans || enc->entropy == BLOCK_ENTROPY_PAIRS) {
+        size_t capacity = Block_encode_bound(size);
+        if (enc->scratch_capacity < capacity) {
+            Mem_free(enc->scratch);
+            enc->scratch = (uint8_t*)Mem_alloc(MEM_BLOCK, capacity);
+            if (!enc->scratch) {
+                perror("Failed to allocate estimate scratch");
+                exit(EXIT_FAILURE);
+            }
+            enc->scratch_capacity = capacity;
+        }
+    }
+    Block_header header;
+    memset(&header, 0, sizeof(header));
+    if (plan.tans && Block_encode_tans(enc, in, size, enc->scratch, &header, plan.streams, plan.table_log) == 0) {
+        est->kind = BLOCK_TANS;
+        est->payload_size = header.payload_size;
+        return;
+    }
+    if (enc->entropy == BLOCK_ENTROPY_PAIRS
+        && Block_encode_pairs(enc, in, size, enc->scratch, &header, plan.streams,
+                              plan.huffman_size < size ? plan.huffman_size : size) == 0) {
+        est->kind = BLOCK_PAIRS;
+        est->payload_size = header.payload_size;
+        return;
+    }
+
+    size_t huffman_size = HUFFMAN_TABLE_LENGTHS_SIZE + (plan.streams == 4 ? BLOCK_CODEC_STREAM_SIZES : 0) + stream_bytes;
+    if (plan.huffman_size >= size || huffman_size >= size) {
+        est->kind = BLOCK_STORED;
+        est->payload_size = (uint32_t)size;
+        est->num_streams = 0;
+    } else {
+        est->kind = BLOCK_HUFFMAN;
+        est->payload_size = (uint32_t)huffman_size;
+    }
+}
+
+
+void Block_encode_estimate(Block_encoder* enc, const uint8_t* in, size_t size, const uint64_t counts[256],
+                           Block_estimate* est) {
+    est->transform = TRANSFORM_NONE;
+    if (enc->transforms) {
+        if (!enc->transform) enc->transform = Transform_workspace_create();
+        uint8_t kind;
+        uint32_t parameter[TRANSFORM_MAX_PARAMETERS];
+        const uint8_t* transformed = Transform_choose(enc->transform, in, size, enc->transforms, &kind, parameter);
+        if (kind != TRANSFORM_NONE) {
+            Block_estimate_payload(enc, transformed, size, NULL, est);
+            if (est->kind != BLOCK_STORED) {
+                est->transform = kind;
+                est->payload_size += (uint32_t)Transform_parameter_size(kind);
+                return;
+            }
+        }
+    }
+    Block_estimate_payload(enc, in, size, counts, est);
+}
+
+
+void Block_encoder_destroy(Block_encoder* enc) {
+    if (!enc) return;
+    Transform_workspace_destroy(enc->transform);
+    Pair_encoder_destroy(enc->pairs);
+    Mem_free(enc->scratch);
+    Mem_free(enc);
+}
+
+
+// ===== DECODE LOOPS =====
+
+/*
+ * Body shared by all decode variants; table_bits, streams and multi are
+ * compile-time constants in every instantiation, so the shifts are
+ * immediates and the lookup loops unroll. After a word refill each stream
+ * holds at least 56 bits, i.e. 56 / table_bits lookups. The loop drops to
+ * the checked one-symbol tail once any stream nears its output end or the
+ * end of its input. With multi == BLOCK_DECODE_PAIRS, table2 is a byte-pair
+ * alphabet table, whose pair symbols cannot be split, so the tail checks
+ * that a whole pair fits.
+ */
+static inline __attribute__((always_inline))
+int Block_decode_body(const Huffman_decode_entry* table, const Huffman_decode_entry2* table2,
+                      Bit_reader* br, uint8_t** op, uint8_t* const* oend,
+                      const unsigned table_bits, const unsigned streams, const int multi) {
+    const unsigned lookups = 56 / table_bits;
+    const size_t room = (size_t)lookups * (multi ? 2 : 1);
+    Bit_reader r[4];
+    uint8_t* o[4];
+
+    for (unsigned s = 0; s < streams; s++) {
+        r[s] = br[s];
+        o[s] = op[s];
+    }
+
+    for (;;) {
+        int ready = 1;
+        for (unsigned s = 0; s < streams; s++) {
+            ready &= (size_t)(oend[s] - o[s]) >= room;
+        }
+        if (!ready) break;
+
+        for (unsigned s = 0; s < streams; s++) {
+            Bit_reader_refill(&r[s]);
+            ready &= r[s].bit_count >= lookups * table_bits;
+        }
+        if (!ready) break;
+
+        for (unsigned k = 0; k < lookups; k++) {
+            for (unsigned s = 0; s < streams; s++) {
+                if (multi) {
+                    const Huffman_decode_entry2* entry = &table2[Bit_reader_peek(&r[s], table_bits)];
+                    memcpy(o[s], entry->symbols, 2);
+                    o[s] += entry->count;
+                    Bit_reader_consume(&r[s], entry->length);
+                } else {
+                    const Huffman_decode_entry* entry = &table[Bit_reader_peek(&r[s], table_bits)];
+                    *o[s]++ = entry->symbol;
+                    Bit_reader_consume(&r[s], entry->length);
+                }
+            }
+        }
+    }
+
+    for (unsigned s = 0; s < streams; s++) {
+        while (o[s] < oend[s] && multi == BLOCK_DECODE_PAIRS) {
+            Bit_reader_refill(&r[s]);
+            const Huffman_decode_entry2* entry = &table2[Bit_reader_peek(&r[s], table_bits)];
+            if (entry->length > r[s].bit_count || entry->count > (size_t)(oend[s] - o[s])) {
+                return -1;
+            }
+            memcpy(o[s], entry->symbols, entry->count);
+            o[s] += entry->count;
+            Bit_reader_consume(&r[s], entry->length);
+        }
+        while (o[s] < oend[s]) {
+            Bit_reader_refill(&r[s]);
+            const Huffman_decode_entry* entry = &table[Bit_reader_peek(&r[s], table_bits)];
+            if (entry->length > r[s].bit_count) {
+                return -1;
+            }
+            *o[s]++ = entry->symbol;
+            Bit_reader_consume(&r[s], entry->length);
+        }
+        br[s] = r[s];
+        op[s] = o[s];
+    }
+    return 0;
+}
+
+
+#define BLOCK_DECODE_VARIANTS \
+    X(8, 1, 0)  X(8, 1, 1)  X(8, 1, 2)  X(8, 4, 0)  X(8, 4, 1)  X(8, 4, 2)  \
+    X(9, 1, 0)  X(9, 1, 1)  X(9, 1, 2)  X(9, 4, 0)  X(9, 4, 1)  X(9, 4, 2)  \
+    X(10, 1, 0) X(10, 1, 1) X(10, 1, 2) X(10, 4, 0) X(10, 4, 1) X(10, 4, 2) \
+    X(11, 1, 0) X(11, 1, 1) X(11, 1, 2) X(11, 4, 0) X(11, 4, 1) X(11, 4, 2) \
+    X(12, 1, 0) X(12, 1, 1) X(12, 1, 2) X(12, 4, 0) X(12, 4, 1) X(12, 4, 2)
+
+#define X(tb, ns, multi) \
+    static int Block_decode_##tb##_##ns##_##multi(const Huffman_decode_entry* table, const Huffman_decode_entry2* table2, \
+                                                  Bit_reader* br, uint8_t** op, uint8_t* const* oend) { \
+        return Block_decode_body(table, table2, br, op, oend, tb, ns, multi); \
+    }
+BLOCK_DECODE_VARIANTS
+#undef X
+
+#define X(tb, ns, multi) [BLOCK_DECODE_INDEX(tb, ns, multi)] = Block_decode_##tb##_##ns##_##multi,
+const Block_decode_fn Block_decode_scalar_variants[BLOCK_DECODE_VARIANT_COUNT] = {
+    BLOCK_DECODE_VARIANTS
+};
+#undef X
+
+#if defined(__x86_64__)
+#define X(tb, ns, multi) \
+    __attribute__((target("bmi,bmi2"))) \
+    static int Block_decode_bmi2_##tb##_##ns##_##multi(const Huffman_decode_entry* table, const Huffman_decode_entry2* table2, \
+                                                       Bit_reader* br, uint8_t** op, uint8_t* const* oend) { \
+        return Block_decode_body(table, table2, br, op, oend, tb, ns, multi); \
+    }
+BLOCK_DECODE_VARIANTS
+#undef X
+
+#define X(tb, ns, multi) [BLOCK_DECODE_INDEX(tb, ns, multi)] = Block_decode_bmi2_##tb##_##ns##_##multi,
+const Block_decode_fn Block_decode_bmi2_variants[BLOCK_DECODE_VARIANT_COUNT] = {
+    BLOCK_DECODE_VARIANTS
+};
+#undef X
+#else
+#define X(tb, ns, multi) [BLOCK_DECODE_INDEX(tb, ns, multi)] = Block_decode_##tb##_##ns##_##multi,
+const Block_decode_fn Block_decode_bmi2_variants[BLOCK_DECODE_VARIANT_COUNT] = {
+    BLOCK_DECODE_VARIANTS
+};
+#undef X
+#endif
+
+
+// ===== DECODER =====
+
+Block_decoder* Block_decoder_create(void) {
+    Block_decoder* dec = (Block_decoder*)Mem_calloc(MEM_BLOCK, 1, sizeof(Block_decoder));
+    if (!dec) {
+        perror("Failed to allocate Block_decoder");
+        exit(EXIT_FAILURE);
+    }
+    return dec;
+}
+
+
+/*
+ * Points one bit reader at each stream and one output range at each segment
+ * of the block. The stream sizes follow the `table_size` bytes of table that
+ * start the payload; the last stream takes the rest.
+ */
+static int Block_open_streams(const Block_header* header, const uint8_t* payload, size_t table_size, uint8_t* out,
+                              Bit_reader* br, uint8_t** op, uint8_t** oend) {
+    unsigned streams = header->num_streams;
+    size_t header_size = table_size + (streams == 4 ? BLOCK_CODEC_STREAM_SIZES : 0);
+    if (header->payload_size < header_size) {
+        return -1;
+    }
+
+    const uint8_t* stream = payload + header_size;
+    size_t left = header->payload_size - header_size;
+    for (unsigned s = 0; s < streams; s++) {
+        uint32_t stream_size = (uint32_t)left;
+        if (streams == 4 && s < 3) {
+            memcpy(&stream_size, payload + table_size + 4 * s, sizeof(stream_size));
+        }
+        if (stream_size > left) {
+            return -1;
+        }
+        Bit_reader_init(&br[s], stream, stream_size);
+        stream += stream_size;
+        left -= stream_size;
+
+        size_t start, end;
+        Block_stream_segment(header->raw_size, streams, s, &start, &end);
+        op[s] = out + start;
+        oend[s] = out + end;
+    }
+    return 0;
+}
+
+
+// Every stream must end exactly in its zero padding.
+static int Block_streams_finished(const Bit_reader* br, unsigned streams) {
+    for (unsigned s = 0; s < streams; s++) {
+        if (Bit_reader_input_left(&br[s]) != 0 || br[s].bit_count >= 8 || br[s].container != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static int Block_decode_huffman(Block_decoder* dec, const Block_header* header, const uint8_t* payload, uint8_t* out) {
+    unsigned streams = header->num_streams;
+    unsigned max_length;
+
+    if (streams != 1 && streams != 4) {
+        return -1;
+    }
+    if (Huffman_table_read_lengths(payload, dec->lengths, &max_length) != 0 || max_length != header->max_code_length) {
+        return -1;
+    }
+
+    unsigned table_bits = Huffman_table_decode_bits(max_length);
+    int multi = (header->flags & BLOCK_FLAG_MULTI_SYMBOL) != 0;
+    Huffman_table_build_decode(dec->lengths, table_bits, dec->table);
+    if (multi) {
+        Huffman_table_build_decode2(dec->table, table_bits, dec->table2);
+    }
+
+    Bit_reader br[4];
+    uint8_t* op[4];
+    uint8_t* oend[4];
+    if (Block_open_streams(header, payload, HUFFMAN_TABLE_LENGTHS_SIZE, out, br, op, oend) != 0) {
+        return -1;
+    }
+
+    Block_decode_fn decode = Kernels_get()->block_decode[BLOCK_DECODE_INDEX(table_bits, streams, multi)];
+    if (decode(dec->table, dec->table2, br, op, oend) != 0) {
+        return -1;
+    }
+    return Block_streams_finished(br, streams);
+}
+
+
+static int Block_decode_pairs(Block_decoder* dec, const Block_header* header, const uint8_t* payload, uint8_t* out) {
+    unsigned streams = header->num_streams;
+    unsigned num_pairs, max_length;
+    size_t table_size;
+
+    if (streams != 1 && streams != 4) {
+        return -1;
+    }
+    if (Pair_read_table(payload, header->payload_size, dec->pairs, &num_pairs, dec->lengths, &max_length,
+                        &table_size) != 0
+        || max_length != header->max_code_length) {
+        return -1;
+    }
+
+    unsigned table_bits = Huffman_table_decode_bits(max_length);
+    Pair_build_decode(dec->pairs, num_pairs, dec->lengths, table_bits, dec->table2);
+
+    Bit_reader br[4];
+    uint8_t* op[4];
+    uint8_t* oend[4];
+    if (Block_open_streams(header, payload, table_size, out, br, op, oend) != 0) {
+        return -1;
+    }
+
+    Block_decode_fn decode = Kernels_get()->block_decode[BLOCK_DECODE_INDEX(table_bits, streams, BLOCK_DECODE_PAIRS)];
+    if (decode(dec->table, dec->table2, br, op, oend) != 0) {
+        return -1;
+    }
+    return Block_streams_finished(br, streams);
+}
+
+
+static int Block_decode_tans(Block_decoder* dec, const Block_header* header, const uint8_t* payload, uint8_t* out) {
+    unsigned streams = header->num_streams;
+    unsigned table_log;
+    size_t table_size;
+
+    if (streams != 1 && streams != 4) {
+        return -1;
+    }
+    if (Tans_read_norm(payload, header->payload_size, dec->norm, &table_log, &table_size) != 0
+        || table_log != header->max_code_length) {
+        return -1;
+    }
+    Tans_build_decode(dec->norm, table_log, dec->tans_table);
+
+    Bit_reader br[4];
+    uint8_t* op[4];
+    uint8_t* oend[4];
+    if (Block_open_streams(header, payload, table_size, out, br, op, oend) != 0) {
+        return -1;
+    }
+    return Tans_decode(dec->tans_table, table_log, br, op, oend, streams);
+}
+
+
+static int Block_decode_kind(Block_decoder* dec, const Block_header* header, const uint8_t* payload, uint8_t* out) {
+    switch (header->kind) {
+        case BLOCK_STORED:
+            if (header->payload_size != header->raw_size) return -1;
+            memcpy(out, payload, header->raw_size);
+            return 0;
+        case BLOCK_RLE:
+            if (header->payload_size != 1) return -1;
+            memset(out, payload[0], header->raw_size);
+            return 0;
+        case BLOCK_HUFFMAN:
+            return Block_decode_huffman(dec, header, payload, out);
+        case BLOCK_TANS:
+            return Block_decode_tans(dec, header, payload, out);
+        case BLOCK_PAIRS:
+            return Block_decode_pairs(dec, header, payload, out);
+        default:
+            fprintf(stderr, "Unknown block kind %u\n", header->kind);
+            return -1;
+    }
+}
+
+
+// Untransformed blocks decode straight into `out`; the others decode into
+// scratch first and the inverse transform writes `out`.
+int Block_decode(Block_decoder* dec, const Block_header* header, const uint8_t* payload, uint8_t* out) {
+    if (header->transform == TRANSFORM_NONE) {
+        return Block_decode_kind(dec, header, payload, out);
+    }
+
+    size_t prefix = Transform_parameter_size(header->transform);
+    if (header->payload_size < prefix) return -1;
+    uint32_t parameter[TRANSFORM_MAX_PARAMETERS] = { 0 };
+    memcpy(parameter, payload, prefix);
+
+    if (dec->scratch_capacity < header->raw_size) {
+        Mem_free(dec->scratch);
+        dec->scratch = (uint8_t*)Mem_alloc(MEM_BLOCK, header->raw_size);
+        if (!dec->scratch) {
+            perror("Failed to allocate transform scratch");
+            exit(EXIT_FAILURE);
+        }
+        dec->scratch_capacity = header->raw_size;
+    }
+    if (!dec->transform) dec->transform = Transform_workspace_create();
+
+    Block_header inner = *header;
+    inner.payload_size -= (uint32_t)prefix;
+    if (Block_decode_kind(dec, &inner, payload + prefix, dec->scratch) != 0) return -1;
+    return Transform_inverse(dec->transform, header->transform, dec->scratch, header->raw_size, parameter, out);
+}
+
+
+int Block_present_bytes(const Block_header* header, const uint8_t* payload, uint8_t present[256]) {
+    memset(present, 1, 256);
+    if (header->transform != TRANSFORM_NONE) return 0;
+
+    if (header->kind == BLOCK_RLE) {
+        if (header->payload_size != 1) return -1;
+        memset(present, 0, 256);
+        present[payload[0]] = 1;
+    } else if (header->kind == BLOCK_HUFFMAN) {
+        uint8_t lengths[256];
+        unsigned max_length;
+        if (header->payload_size < HUFFMAN_TABLE_LENGTHS_SIZE
+            || Huffman_table_read_lengths(payload, lengths, &max_length) != 0) {
+            return -1;
+        }
+        for (int i = 0; i < 256; i++) {
+            present[i] = lengths[i] != 0;
+        }
+    } else if (header->kind == BLOCK_TANS) {
+        uint16_t norm[256];
+        unsigned table_log;
+        size_t used;
+        if (Tans_read_norm(payload, header->payload_size, norm, &table_log, &used) != 0) return -1;
+        for (int i = 0; i < 256; i++) {
+            present[i] = norm[i] != 0;
+        }
+    } else if (header->kind == BLOCK_PAIRS) {
+        uint8_t lengths[PAIR_CODE_MAX_SYMBOLS];
+        uint8_t pairs[2 * PAIR_CODE_MAX_PAIRS];
+        unsigned num_pairs, max_length;
+        size_t used;
+        if (Pair_read_table(payload, header->payload_size, pairs, &num_pairs, lengths, &max_length, &used) != 0) {
+            return -1;
+        }
+        for (int i = 0; i < 256; i++) {
+            present[i] = lengths[i] != 0;
+        }
+        for (unsigned k = 0; k < num_pairs; k++) {
+            if (lengths[256 + k]) present[pairs[2 * k]] = present[pairs[2 * k + 1]] = 1;
+        }
+    }
+    return 0;
+}
+
+
+void Block_decoder_destroy(Block_decoder* dec) {
+    if (!dec) return;
+    Transform_workspace_destroy(dec->transform);
+    Mem_free(dec->scratch);
+    Mem_free(dec);
+}
@@ -0,0 +1,255 @@
+#include "Block_format.h"
+
+
+void Block_file_header_init(Block_file_header* header, uint32_t block_size) {
+    header->magic = BLOCK_FORMAT_MAGIC;
+    header->version = BLOCK_FORMAT_VERSION;
+    header->flags = 0;
+    header->block_size = block_size;
+    header->reserved = 0;
+}
+
+
+void Block_file_header_serialize(const Block_file_header* header, uint8_t* out) {
+    memcpy(out + 0, &header->magic, sizeof(header->magic));
+    memcpy(out + 4, &header->version, sizeof(header->version));
+    memcpy(out + 6, &header->flags, sizeof(header->flags));
+    memcpy(out + 8, &header->block_size, sizeof(header->block_size));
+    memcpy(out + 12, &header->reserved, sizeof(header->reserved));
+}
+
+
+int Block_file_header_deserialize(Block_file_header* header, const uint8_t* in) {
+    memcpy(&header->magic, in + 0, sizeof(header->magic));
+    memcpy(&header->version, in + 4, sizeof(header->version));
+    memcpy(&header->flags, in + 6, sizeof(header->flags));
+    memcpy(&header->block_size, in + 8, sizeof(header->block_size));
+    memcpy(&header->reserved, in + 12, sizeof(header->reserved));
+
+    if (header->magic != BLOCK_FORMAT_MAGIC) {
+        fprintf(stderr, "Not a block-format .huff file\n");
+        return -1;
+    }
+    if (header->version != BLOCK_FORMAT_VERSION) {
+        fprintf(stderr, "Unsupported block format version %u\n", header->version);
+        return -1;
+    }
+    if (header->block_size == 0 || header->block_size > BLOCK_FORMAT_MAX_BLOCK_SIZE) {
+        fprintf(stderr, "Invalid block size %u\n", header->block_size);
+        return -1;
+    }
+    return 0;
+}
+
+
+const char* Block_kind_name(unsigned kind) {
+    switch (kind) {
+        case BLOCK_STORED: return "stored";
+        case BLOCK_HUFFMAN: return "huffman";
+        case BLOCK_RLE: return "rle";
+        case BLOCK_TANS: return "tans";
+        case BLOCK_PAIRS: return "pairs";
+        case BLOCK_REF: return "ref";
+        case BLOCK_INDEX: return "index";
+        case BLOCK_END: return "end";
+        default: return "unknown";
+    }
+}
+
+
+void Block_header_serialize(const Block_header* header, uint8_t* out) {
+    memcpy(out + 0, &header->raw_size, sizeof(header->raw_size));
+    memcpy(out + 4, &header->payload_size, sizeof(header->payload_size));
+    out[8] = header->kind;
+    out[9] = header->max_code_length;
+    out[10] = header->num_streams;
+    out[11] = header->flags;
+    out[12] = header->transform;
+    memset(out + 13, 0, 3);
+}
+
+
+// Checks the header against the file's block size so that a corrupt size can
+// never make the caller allocate or decode more than one block's worth.
+int Block_header_deserialize(Block_header* header, const uint8_t* in, uint32_t block_size) {
+    memcpy(&header->raw_size, in + 0, sizeof(header->raw_size));
+    memcpy(&header->payload_size, in + 4, sizeof(header->payload_size));
+    header->kind = in[8];
+    header->max_code_length = in[9];
+    header->num_streams = in[10];
+    header->flags = in[11];
+    header->transform = in[12];
+
+    if (header->kind == BLOCK_END) {
+        return header->payload_size == BLOCK_FORMAT_END_PAYLOAD_SIZE ? 0 : -1;
+    }
+    if (header->kind == BLOCK_INDEX) {
+        uint32_t entries = header->payload_size - BLOCK_FORMAT_FOOTER_SIZE;
+        return header->raw_size == 0 && header->payload_size >= BLOCK_FORMAT_FOOTER_SIZE
+               && entries % BLOCK_FORMAT_INDEX_ENTRY_SIZE_V1 == 0 ? 0 : -1;
+    }
+    if (header->kind == BLOCK_REF) {
+        return header->payload_size == BLOCK_FORMAT_REF_PAYLOAD_SIZE && header->raw_size > 0
+               && header->raw_size <= block_size ? 0 : -1;
+    }
+    if (header->transform >= TRANSFORM_COUNT) {
+        fprintf(stderr, "Unknown block transform %u\n", header->transform);
+        return -1;
+    }
+    if (header->raw_size == 0 || header->raw_size > block_size) {
+        fprintf(stderr, "Invalid block raw size %u\n", header->raw_size);
+        return -1;
+    }
+    if (header->payload_size > (uint64_t)block_size * 2 + 1024) {
+        fprintf(stderr, "Invalid block payload size %u\n", header->payload_size);
+        return -1;
+    }
+    return 0;
+}
+
+
+size_t Block_end_serialize(uint64_t total, uint8_t* out) {
+    Block_header end;
+    memset(&end, 0, sizeof(end));
+    end.kind = BLOCK_END;
+    end.payload_size = BLOCK_FORMAT_END_PAYLOAD_SIZE;
+    Block_header_serialize(&end, out);
+    memcpy(out + BLOCK_FORMAT_BLOCK_HEADER_SIZE, &total, sizeof(total));
+    return BLOCK_FORMAT_BLOCK_HEADER_SIZE + BLOCK_FORMAT_END_PAYLOAD_SIZE;
+}
+
+
+size_t Block_ref_serialize(uint32_t raw_size, uint64_t distance, uint8_t* out) {
+    Block_header ref;
+    memset(&ref, 0, sizeof(ref));
+    ref.kind = BLOCK_REF;
+    ref.raw_size = raw_size;
+    ref.payload_size = BLOCK_FORMAT_REF_PAYLOAD_SIZE;
+    Block_header_serialize(&ref, out);
+    memcpy(out + BLOCK_FORMAT_BLOCK_HEADER_SIZE, &distance, sizeof(distance));
+    return BLOCK_FORMAT_BLOCK_HEADER_SIZE + BLOCK_FORMAT_REF_PAYLOAD_SIZE;
+}
+
+
+void Block_index_entry_serialize(const Block_index_entry* entry, uint8_t* out) {
+    memcpy(out + 0, &entry->raw_size, sizeof(entry->raw_size));
+    memcpy(out + 4, &entry->payload_size, sizeof(entry->payload_size));
+    memcpy(out + 8, &entry->hash, sizeof(entry->hash));
+}
+
+
+void Block_index_entry_deserialize(Block_index_entry* entry, const uint8_t* in, uint16_t entry_size) {
+    memcpy(&entry->raw_size, in + 0, sizeof(entry->raw_size));
+    memcpy(&entry->payload_size, in + 4, sizeof(entry->payload_size));
+    entry->hash = 0;
+    if (entry_size >= BLOCK_FORMAT_INDEX_ENTRY_SIZE) memcpy(&entry->hash, in + 8, sizeof(entry->hash));
+}
+
+
+void Block_footer_serialize(const Block_footer* footer, uint8_t* out) {
+    memcpy(out + 0, &footer->magic, sizeof(footer->magic));
+    memcpy(out + 4, &footer->entry_size, sizeof(footer->entry_size));
+    memcpy(out + 6, &footer->flags, sizeof(footer->flags));
+    memcpy(out + 8, &footer->count, sizeof(footer->count));
+    memcpy(out + 16, &footer->member_size, sizeof(footer->member_size));
+}
+
+
+int Block_footer_deserialize(Block_footer* footer, const uint8_t* in) {
+    memcpy(&footer->magic, in + 0, sizeof(footer->magic));
+    memcpy(&footer->entry_size, in + 4, sizeof(footer->entry_size));
+    memcpy(&footer->flags, in + 6, sizeof(footer->flags));
+    memcpy(&footer->count, in + 8, sizeof(footer->count));
+    memcpy(&footer->member_size, in + 16, sizeof(footer->member_size));
+    if (footer->magic != BLOCK_FORMAT_INDEX_MAGIC
+        || (footer->entry_size != BLOCK_FORMAT_INDEX_ENTRY_SIZE && footer->entry_size != BLOCK_FORMAT_INDEX_ENTRY_SIZE_V1)) {
+        return -1;
+    }
+    return 0;
+}
+
+
+uint64_t Block_index_size(uint64_t count, uint16_t entry_size) {
+    return BLOCK_FORMAT_BLOCK_HEADER_SIZE + count * entry_size + BLOCK_FORMAT_FOOTER_SIZE;
+}
+
+
+// ===== XXH64 =====
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ull
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define XXH_PRIME64_3 0x165667B19E3779F9ull
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ull
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ull
+
+static inline uint64_t Block_rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t Block_read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t Block_xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME64_2;
+    acc = Block_rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t Block_xxh_merge(uint64_t acc, uint64_t value) {
+    acc ^= Block_xxh_round(0, value);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+
+uint64_t Block_hash(const uint8_t* data, size_t size) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        uint64_t v1 = XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = XXH_PRIME64_2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - XXH_PRIME64_1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = Block_xxh_round(v1, Block_read64(p));
+            v2 = Block_xxh_round(v2, Block_read64(p + 8));
+            v3 = Block_xxh_round(v3, Block_read64(p + 16));
+            v4 = Block_xxh_round(v4, Block_read64(p + 24));
+        }
+        h = Block_rotl64(v1, 1) + Block_rotl64(v2, 7) + Block_rotl64(v3, 12) + Block_rotl64(v4, 18);
+        h = Block_xxh_merge(h, v1);
+        h = Block_xxh_merge(h, v2);
+        h = Block_xxh_merge(h, v3);
+        h = Block_xxh_merge(h, v4);
+    } else {
+        h = XXH_PRIME64_5;
+    }
+    h += (uint64_t)size;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= Block_xxh_round(0, Block_read64(p));
+        h = Block_rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        h ^= (uint64_t)v * XXH_PRIME64_1;
+        h = Block_rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (uint64_t)*p * XXH_PRIME64_5;
+        h = Block_rotl64(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h ? h : 1;
+}
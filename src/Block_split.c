@@ -0,0 +1,117 @@
+#include "Block_split.h"
+#include <string.h>
+#include "Cpu_dispatch.h"
+#include "Mem.h"
+
+// 256 * log2(1 + i / 32): the fraction of a fixed-point log2 from the 5 bits below the leading one.
+static const uint16_t BLOCK_SPLIT_LOG2_FRACTION[32] = {
+    0, 11, 22, 33, 44, 54, 63, 73, 82, 92, 100, 109, 118, 126, 134, 142,
+    150, 157, 165, 172, 179, 186, 193, 200, 207, 213, 220, 226, 232, 238, 244, 250
+};
+
+
+Block_splitter* Block_splitter_create(void) {
+    Block_splitter* sp = (Block_splitter*)Mem_calloc(MEM_BLOCK, 1, sizeof(Block_splitter));
+    if (!sp) {
+        perror("Failed to allocate Block_splitter");
+        exit(EXIT_FAILURE);
+    }
+    return sp;
+}
+
+
+// log2(x) in 1/256 bits, x >= 1.
+static inline uint64_t Block_split_log2(uint64_t x) {
+    unsigned e = 63 - (unsigned)__builtin_clzll(x);
+    unsigned fraction = e >= 5 ? (unsigned)(x >> (e - 5)) & 31 : (unsigned)(x << (5 - e)) & 31;
+    return ((uint64_t)e << 8) + BLOCK_SPLIT_LOG2_FRACTION[fraction];
+}
+
+
+// Estimated bits, in 1/256 bit, of coding windows [first, last) as one
+// block. A range is looked at again by the halves of a cut, so the costs
+// are kept.
+static uint64_t Block_split_cost(Block_splitter* sp, unsigned first, unsigned last) {
+    if (sp->costs[first][last]) return sp->costs[first][last];
+    const uint64_t* high = sp->prefix[last];
+    const uint64_t* low = sp->prefix[first];
+    uint64_t total = sp->bounds[last] - sp->bounds[first];
+    uint64_t log_total = Block_split_log2(total);
+    uint64_t bits = 0;
+    for (unsigned k = 0; k < sp->distinct; k++) {
+        uint64_t count = high[sp->symbols[k]] - low[sp->symbols[k]];
+        if (count) bits += count * (log_total - Block_split_log2(count));
+    }
+    sp->costs[first][last] = bits + ((uint64_t)BLOCK_SPLIT_BLOCK_COST << 8);
+    return sp->costs[first][last];
+}
+
+
+static void Block_split_range(Block_splitter* sp, unsigned first, unsigned last, uint64_t cost) {
+    unsigned best = 0;
+    uint64_t best_cost = cost, best_left = 0, best_right = 0;
+    for (unsigned k = first + 1; k < last; k++) {
+        uint64_t left = Block_split_cost(sp, first, k);
+        if (left >= best_cost) continue;
+        uint64_t right = Block_split_cost(sp, k, last);
+        if (left + right < best_cost) {
+            best = k;
+            best_cost = left + right;
+            best_left = left;
+            best_right = right;
+        }
+    }
+    if (best && best_cost + best_cost / 128 < cost) {
+        Block_split_range(sp, first, best, best_left);
+        Block_split_range(sp, best, last, best_right);
+    } else {
+        sp->cuts[++sp->pieces] = last;
+    }
+}
+
+
+unsigned Block_split(Block_splitter* sp, const uint8_t* data, size_t size) {
+    const Kernel_set* kernels = Kernels_get();
+    unsigned windows = (unsigned)(size / BLOCK_SPLIT_MIN_WINDOW);
+    if (windows > BLOCK_SPLIT_MAX_WINDOWS) windows = BLOCK_SPLIT_MAX_WINDOWS;
+    if (windows == 0) windows = 1;
+
+    sp->windows = windows;
+    memset(sp->prefix[0], 0, sizeof(sp->prefix[0]));
+    sp->bounds[0] = 0;
+    for (unsigned k = 0; k < windows; k++) {
+        sp->bounds[k + 1] = k + 1 == windows ? size : size / windows * (k + 1);
+        memcpy(sp->prefix[k + 1], sp->prefix[k], sizeof(sp->prefix[k]));
+        kernels->histogram(data + sp->bounds[k], sp->bounds[k + 1] - sp->bounds[k], sp->prefix[k + 1]);
+    }
+
+    sp->distinct = 0;
+    for (int i = 0; i < 256; i++) {
+        if (sp->prefix[windows][i]) sp->symbols[sp->distinct++] = (uint8_t)i;
+    }
+    memset(sp->costs, 0, sizeof(sp->costs));
+    sp->cuts[0] = 0;
+    sp->pieces = 0;
+    if (windows == 1) {
+        sp->cuts[++sp->pieces] = 1;
+    } else {
+        Block_split_range(sp, 0, windows, Block_split_cost(sp, 0, windows));
+    }
+    return sp->pieces;
+}
+
+
+void Block_split_piece(const Block_splitter* sp, unsigned piece, size_t* start, size_t* end, uint64_t counts[256]) {
+    unsigned first = sp->cuts[piece];
+    unsigned last = sp->cuts[piece + 1];
+    *start = sp->bounds[first];
+    *end = sp->bounds[last];
+    for (int i = 0; i < 256; i++) {
+        counts[i] = sp->prefix[last][i] - sp->prefix[first][i];
+    }
+}
+
+
+void Block_splitter_destroy(Block_splitter* sp) {
+    Mem_free(sp);
+}
@@ -4,10 +4,11 @@
 #include "Byte_table.h"
 #include <stdint.h>
 #include <math.h> 
+#include "Mem.h"
 
 
 ByteTable* ByteTable_create() {
-    ByteTable* bt = (ByteTable*)malloc(sizeof(ByteTable));
+    ByteTable* bt = (ByteTable*)Mem_alloc(MEM_TABLE, sizeof(ByteTable));
     if (!bt) {
         perror("Failed to allocate ByteTable");
         return NULL;
@@ -24,7 +25,7 @@ ByteTable* ByteTable_create() {
 void ByteTable_increment(ByteTable* bt, uint8_t byte) {
     if (!bt->table[byte]) {
         
-        bt->table[byte] = (ByteInfo*)malloc(sizeof(ByteInfo));
+        bt->table[byte] = (ByteInfo*)Mem_alloc(MEM_TABLE, sizeof(ByteInfo));
         bt->table[byte]->count = 0;
         bt->table[byte]->codeword = NULL;
     }
@@ -32,12 +33,25 @@ void ByteTable_increment(ByteTable* bt, uint8_t byte) {
 }
 
 
+void ByteTable_add_counts(ByteTable* bt, const uint64_t counts[256]) {
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] == 0) continue;
+        if (!bt->table[i]) {
+            bt->table[i] = (ByteInfo*)Mem_alloc(MEM_TABLE, sizeof(ByteInfo));
+            bt->table[i]->count = 0;
+            bt->table[i]->codeword = NULL;
+        }
+        bt->table[i]->count += counts[i];
+    }
+}
+
+
 void ByteTable_set_codeword(ByteTable* bt, uint8_t byte, const uint8_t* codeword) {
     if (bt->table[byte]) {
         if (bt->table[byte]->codeword) {
-            free(bt->table[byte]->codeword); 
+            Mem_free(bt->table[byte]->codeword); 
         }
-        bt->table[byte]->codeword = (uint8_t*) strdup((const char*)codeword); 
+        bt->table[byte]->codeword = (uint8_t*) Mem_strdup(MEM_TABLE, (const char*)codeword); 
     }
 }
 
@@ -58,11 +72,11 @@ void ByteTable_print(ByteTable* bt) {
 void ByteTable_destroy(ByteTable* bt) {
     for (int i = 0; i < 256; i++) {
         if (bt->table[i]) {
-            free(bt->table[i]->codeword); 
-            free(bt->table[i]);          
+            Mem_free(bt->table[i]->codeword); 
+            Mem_free(bt->table[i]);          
         }
     }
-    free(bt);
+    Mem_free(bt);
 }
 
 
@@ -85,7 +99,7 @@ uint8_t* ByteTable_make_codewords_map_metadata(ByteTable* bt, size_t* metadata_s
     }
 
     
-    uint8_t* metadata = (uint8_t*)malloc(total_size);
+    uint8_t* metadata = (uint8_t*)Mem_alloc(MEM_TABLE, total_size);
     if (!metadata) {
         perror("Failed to allocate memory for codewords_map_metadata");
         exit(EXIT_FAILURE);
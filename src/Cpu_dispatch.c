@@ -0,0 +1,81 @@
+#include "Cpu_dispatch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "Histogram.h"
+
+/*
+ * Bit-serial encode/decode gain nothing from SSE/AVX vectors and the byte
+ * histogram is bound by its table stores, so there are only two sets: the
+ * plain build and the bmi2 set, which swaps in the shlx/shrx encode/decode.
+ * The sub-table histogram is portable C and needs no cpuid check, so both
+ * sets use it.
+ */
+static const Kernel_set KERNEL_SETS[KERNEL_LEVEL_COUNT] = {
+    { KERNEL_SCALAR, "scalar", Histogram_count_tables, Huffman_encoder_encode_scalar, Trie_decoder_decode_scalar, Block_decode_scalar_variants },
+    { KERNEL_BMI2,   "bmi2",   Histogram_count_tables, Huffman_encoder_encode_bmi2,   Trie_decoder_decode_bmi2,   Block_decode_bmi2_variants },
+};
+
+static const Kernel_set* selected_kernels = NULL;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+
+int Cpu_supports(Kernel_level level) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    switch (level) {
+        case KERNEL_SCALAR: return 1;
+        case KERNEL_BMI2:   return __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2");
+        default:            return 0;
+    }
+#else
+    return level == KERNEL_SCALAR;
+#endif
+}
+
+
+int Kernels_select(const char* name) {
+    for (int level = 0; level < KERNEL_LEVEL_COUNT; level++) {
+        if (strcmp(name, KERNEL_SETS[level].name) == 0) {
+            if (!Cpu_supports((Kernel_level)level)) {
+                fprintf(stderr, "Kernel set '%s' is not supported by this CPU\n", name);
+                return -1;
+            }
+            selected_kernels = &KERNEL_SETS[level];
+            return 0;
+        }
+    }
+    fprintf(stderr, "Unknown kernel set '%s' (expected scalar or bmi2)\n", name);
+    return -1;
+}
+
+
+// Runs once, before the first Kernels_get() returns, so worker threads that
+// call it concurrently all see the same fully-initialized set.
+static void Kernels_init(void) {
+    if (selected_kernels) {
+        return;
+    }
+
+    const char* forced = getenv("HUFF_KERNEL");
+    if (forced && *forced) {
+        if (Kernels_select(forced) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    for (int level = KERNEL_LEVEL_COUNT - 1; level >= 0; level--) {
+        if (Cpu_supports((Kernel_level)level)) {
+            selected_kernels = &KERNEL_SETS[level];
+            break;
+        }
+    }
+}
+
+
+const Kernel_set* Kernels_get(void) {
+    pthread_once(&kernels_once, Kernels_init);
+    return selected_kernels;
+}
@@ -0,0 +1,52 @@
+#include "Histogram.h"
+#include <string.h>
+
+// Sub-table counters are 32-bit; fold them into `counts` before they can wrap.
+#define HISTOGRAM_FOLD_BYTES ((size_t)1 << 30)
+
+
+void Histogram_count_scalar(const uint8_t* data, size_t size, uint64_t counts[256]) {
+    for (size_t i = 0; i < size; i++) {
+        counts[data[i]]++;
+    }
+}
+
+
+static inline __attribute__((always_inline)) void Histogram_count_word(uint32_t tables[4][256], uint64_t word) {
+    tables[0][(uint8_t)(word)]++;
+    tables[1][(uint8_t)(word >> 8)]++;
+    tables[2][(uint8_t)(word >> 16)]++;
+    tables[3][(uint8_t)(word >> 24)]++;
+    tables[0][(uint8_t)(word >> 32)]++;
+    tables[1][(uint8_t)(word >> 40)]++;
+    tables[2][(uint8_t)(word >> 48)]++;
+    tables[3][(uint8_t)(word >> 56)]++;
+}
+
+static void Histogram_fold(uint32_t tables[4][256], uint64_t counts[256]) {
+    for (int i = 0; i < 256; i++) {
+        counts[i] += (uint64_t)tables[0][i] + tables[1][i] + tables[2][i] + tables[3][i];
+    }
+    memset(tables, 0, sizeof(uint32_t) * 4 * 256);
+}
+
+
+// Four interleaved sub-tables break the store-to-load dependency between
+// repeated bytes; each 8-byte load is split with shifts, no vector unit needed.
+void Histogram_count_tables(const uint8_t* data, size_t size, uint64_t counts[256]) {
+    uint32_t tables[4][256];
+    memset(tables, 0, sizeof(tables));
+
+    size_t i = 0;
+    while (i + 8 <= size) {
+        size_t stop = size - 8;
+        if (stop - i > HISTOGRAM_FOLD_BYTES) stop = i + HISTOGRAM_FOLD_BYTES;
+        for (; i <= stop; i += 8) {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            Histogram_count_word(tables, word);
+        }
+        Histogram_fold(tables, counts);
+    }
+    Histogram_count_scalar(data + i, size - i, counts);
+}
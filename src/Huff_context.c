@@ -0,0 +1,134 @@
+#include "Huff_context.h"
+#include <string.h>
+#include "Mem.h"
+
+#define HUFF_CONTEXT_MIN_OUTPUT (64 * 1024)
+
+
+Huff_context* Huff_context_create(uint32_t block_size) {
+    Huff_context* ctx = (Huff_context*)Mem_alloc(MEM_SERVER, sizeof(Huff_context));
+    if (!ctx) {
+        perror("Failed to allocate Huff_context");
+        exit(EXIT_FAILURE);
+    }
+    ctx->encoder = Block_encoder_create();
+    ctx->decoder = Block_decoder_create();
+    ctx->output = NULL;
+    ctx->output_capacity = 0;
+    ctx->block_size = block_size;
+    return ctx;
+}
+
+
+// Grows the output buffer to at least `size` bytes, keeping its contents.
+// Requests are served back to back, so the buffer is never shrunk.
+static int Huff_context_reserve(Huff_context* ctx, size_t size) {
+    if (size <= ctx->output_capacity) return 0;
+    size_t capacity = ctx->output_capacity ? ctx->output_capacity : HUFF_CONTEXT_MIN_OUTPUT;
+    while (capacity < size) capacity *= 2;
+    uint8_t* output = (uint8_t*)Mem_realloc(MEM_SERVER, ctx->output, capacity);
+    if (!output) return -1;
+    ctx->output = output;
+    ctx->output_capacity = capacity;
+    return 0;
+}
+
+
+int Huff_context_compress(Huff_context* ctx, const uint8_t* in, size_t size,
+                          const uint8_t** out, size_t* out_size) {
+    size_t blocks = (size + ctx->block_size - 1) / ctx->block_size;
+    size_t bound = BLOCK_FORMAT_FILE_HEADER_SIZE + blocks * Block_encode_bound(ctx->block_size)
+                 + BLOCK_FORMAT_BLOCK_HEADER_SIZE + BLOCK_FORMAT_END_PAYLOAD_SIZE;
+    if (Huff_context_reserve(ctx, bound) != 0) return -1;
+
+    Block_file_header header;
+    Block_file_header_init(&header, ctx->block_size);
+    Block_file_header_serialize(&header, ctx->output);
+    size_t position = BLOCK_FORMAT_FILE_HEADER_SIZE;
+
+    for (size_t offset = 0; offset < size; offset += ctx->block_size) {
+        size_t length = size - offset < ctx->block_size ? size - offset : ctx->block_size;
+        position += Block_encode(ctx->encoder, in + offset, length, ctx->output + position);
+    }
+    position += Block_end_serialize(size, ctx->output + position);
+
+    *out = ctx->output;
+    *out_size = position;
+    return 0;
+}
+
+
+// Decodes every member of the buffer, skipping their optional INDEX blocks.
+int Huff_context_decompress(Huff_context* ctx, const uint8_t* in, size_t size,
+                            const uint8_t** out, size_t* out_size) {
+    size_t position = 0;
+    uint64_t total = 0;
+    do {
+        Block_file_header header;
+        if (size - position < BLOCK_FORMAT_FILE_HEADER_SIZE
+            || Block_file_header_deserialize(&header, in + position) != 0) {
+            return -1;
+        }
+        position += BLOCK_FORMAT_FILE_HEADER_SIZE;
+
+        uint64_t member_total = 0;
+        for (;;) {
+            Block_header block;
+            if (size - position < BLOCK_FORMAT_BLOCK_HEADER_SIZE
+                || Block_header_deserialize(&block, in + position, header.block_size) != 0
+                || block.kind == BLOCK_INDEX) {
+                return -1;
+            }
+            position += BLOCK_FORMAT_BLOCK_HEADER_SIZE;
+            if (size - position < block.payload_size) return -1;
+
+            if (block.kind == BLOCK_END) {
+                uint64_t expected;
+                memcpy(&expected, in + position, sizeof(expected));
+                if (expected != member_total) return -1;
+                position += block.payload_size;
+                break;
+            }
+
+            if (Huff_context_reserve(ctx, total + block.raw_size) != 0) return -1;
+            if (block.kind == BLOCK_REF) {
+                uint64_t distance;
+                memcpy(&distance, in + position, sizeof(distance));
+                if (distance < block.raw_size || distance > member_total) return -1;
+                memcpy(ctx->output + total, ctx->output + total - distance, block.raw_size);
+            } else if (Block_decode(ctx->decoder, &block, in + position, ctx->output + total) != 0) {
+                return -1;
+            }
+            position += block.payload_size;
+            total += block.raw_size;
+            member_total += block.raw_size;
+        }
+
+        // Anything after END that is not the next member's header is its index.
+        uint32_t magic = 0;
+        if (size - position >= sizeof(magic)) memcpy(&magic, in + position, sizeof(magic));
+        if (position < size && magic != BLOCK_FORMAT_MAGIC) {
+            Block_header index;
+            if (size - position < BLOCK_FORMAT_BLOCK_HEADER_SIZE
+                || Block_header_deserialize(&index, in + position, header.block_size) != 0
+                || index.kind != BLOCK_INDEX
+                || size - position - BLOCK_FORMAT_BLOCK_HEADER_SIZE < index.payload_size) {
+                return -1;
+            }
+            position += BLOCK_FORMAT_BLOCK_HEADER_SIZE + index.payload_size;
+        }
+    } while (position < size);
+
+    *out = ctx->output;
+    *out_size = total;
+    return 0;
+}
+
+
+void Huff_context_destroy(Huff_context* ctx) {
+    if (!ctx) return;
+    Block_encoder_destroy(ctx->encoder);
+    Block_decoder_destroy(ctx->decoder);
+    Mem_free(ctx->output);
+    Mem_free(ctx);
+}
@@ -0,0 +1,413 @@
+#include "Huff_stream.h"
+#include <string.h>
+#include "Cpu_dispatch.h"
+#include "Mem.h"
+#include "Trie.h"
+
+typedef enum {
+    HUFF_STREAM_BLOCKS,         // compressing
+    HUFF_STREAM_MAGIC,          // first member: HUF2 or FFUH
+    HUFF_STREAM_FILE_HEADER,
+    HUFF_STREAM_BLOCK_HEADER,
+    HUFF_STREAM_PAYLOAD,
+    HUFF_STREAM_END_PAYLOAD,
+    HUFF_STREAM_AFTER_END,      // next member or this member's index
+    HUFF_STREAM_INDEX_HEADER,
+    HUFF_STREAM_INDEX,
+    HUFF_STREAM_NEXT_MEMBER,    // nothing or a further member
+    HUFF_STREAM_LEGACY_HEADER,
+    HUFF_STREAM_LEGACY_DATA,
+    HUFF_STREAM_DONE
+} Huff_stream_state;
+
+
+static Huff_stream* Huff_stream_create(int state) {
+    Huff_stream* s = (Huff_stream*)Mem_calloc(MEM_IO, 1, sizeof(Huff_stream));
+    if (!s) {
+        perror("Failed to allocate Huff_stream");
+        exit(EXIT_FAILURE);
+    }
+    s->state = state;
+    return s;
+}
+
+
+// Grows *buffer to at least `size` bytes, keeping its contents; -1 if that fails.
+static int Huff_stream_reserve(uint8_t** buffer, size_t* capacity, size_t size) {
+    if (size <= *capacity) return 0;
+    uint8_t* grown = (uint8_t*)Mem_realloc(MEM_IO, *buffer, size);
+    if (!grown) return -1;
+    *buffer = grown;
+    *capacity = size;
+    return 0;
+}
+
+
+static inline void Huff_stream_take(Huff_stream* s, size_t size) {
+    s->next_in += size;
+    s->avail_in -= size;
+    s->total_in += size;
+}
+
+
+static inline void Huff_stream_give(Huff_stream* s, size_t size) {
+    s->next_out += size;
+    s->avail_out -= size;
+    s->total_out += size;
+}
+
+
+// Copies pending output to next_out; 1 once none is left.
+static int Huff_stream_drain(Huff_stream* s) {
+    size_t size = s->pending_size - s->pending_done;
+    if (size > s->avail_out) size = s->avail_out;
+    if (size == 0) return s->pending_size == 0;
+    memcpy(s->next_out, s->pending + s->pending_done, size);
+    Huff_stream_give(s, size);
+    s->pending_done += size;
+    if (s->pending_done < s->pending_size) return 0;
+    s->pending_size = 0;
+    s->pending_done = 0;
+    return 1;
+}
+
+
+// Gathers input into s->header until it holds `size` bytes; 1 once it does.
+static int Huff_stream_gather(Huff_stream* s, size_t size) {
+    if (s->header_fill >= size) return 1;
+    size_t take = size - s->header_fill;
+    if (take > s->avail_in) take = s->avail_in;
+    memcpy(s->header + s->header_fill, s->next_in, take);
+    Huff_stream_take(s, take);
+    s->header_fill += take;
+    return s->header_fill == size;
+}
+
+
+// ===== COMPRESSOR =====
+
+Huff_stream* Huff_stream_compressor_create(const Archive_options* options) {
+    Archive_options defaults;
+    if (!options) {
+        Archive_options_init(&defaults);
+        options = &defaults;
+    }
+
+    Huff_stream* s = Huff_stream_create(HUFF_STREAM_BLOCKS);
+    s->block_size = options->block_size;
+    s->encoder = Block_encoder_create();
+    s->encoder->num_streams = options->num_streams;
+    s->encoder->transforms = options->transforms;
+    s->encoder->entropy = options->entropy;
+    s->encoder->sample_shift = options->sample_shift;
+    s->splitter = options->split ? Block_splitter_create() : NULL;
+    // Every piece of a split block has its own header and slack.
+    unsigned pieces = s->splitter ? BLOCK_SPLIT_MAX_WINDOWS : 1;
+    if (Huff_stream_reserve(&s->block, &s->block_capacity, s->block_size) != 0
+        || Huff_stream_reserve(&s->pending, &s->pending_capacity,
+                               pieces * Block_encode_bound(0) + s->block_size) != 0) {
+        perror("Failed to allocate stream buffers");
+        exit(EXIT_FAILURE);
+    }
+
+    // The file header is the first output.
+    Block_file_header header;
+    Block_file_header_init(&header, s->block_size);
+    Block_file_header_serialize(&header, s->pending);
+    s->pending_size = BLOCK_FORMAT_FILE_HEADER_SIZE;
+    return s;
+}
+
+
+/*
+ * Encodes one block_size run (cut further by the splitter, if any) straight
+ * into next_out when its bound fits there, else into the pending buffer.
+ */
+static void Huff_stream_encode(Huff_stream* s, const uint8_t* data, size_t size) {
+    unsigned pieces = s->splitter ? Block_split(s->splitter, data, size) : 1;
+    size_t bound = pieces * Block_encode_bound(0) + size;
+    uint8_t* out = s->pending_size == 0 && s->avail_out >= bound ? s->next_out : s->pending;
+
+    size_t position = 0;
+    for (unsigned p = 0; p < pieces; p++) {
+        size_t start = 0, end = size;
+        uint64_t counts[256];
+        if (s->splitter) {
+            Block_split_piece(s->splitter, p, &start, &end, counts);
+        }
+        position += Block_encode_counted(s->encoder, data + start, end - start, s->splitter ? counts : NULL,
+                                         out + position);
+    }
+
+    if (out == s->next_out) {
+        Huff_stream_give(s, position);
+    } else {
+        s->pending_size = position;
+    }
+}
+
+
+int Huff_stream_compress(Huff_stream* s, int flush) {
+    for (;;) {
+        if (!Huff_stream_drain(s)) return HUFF_STREAM_OK;
+        if (s->state == HUFF_STREAM_DONE) return HUFF_STREAM_END;
+
+        if (s->fill == 0 && s->avail_in >= s->block_size) {
+            // Whole block in the caller's buffer: encode it in place.
+            Huff_stream_encode(s, s->next_in, s->block_size);
+            Huff_stream_take(s, s->block_size);
+            continue;
+        }
+
+        size_t take = s->block_size - s->fill;
+        if (take > s->avail_in) take = s->avail_in;
+        memcpy(s->block + s->fill, s->next_in, take);
+        Huff_stream_take(s, take);
+        s->fill += take;
+
+        if (s->fill == s->block_size || (flush != HUFF_STREAM_RUN && s->avail_in == 0 && s->fill > 0)) {
+            Huff_stream_encode(s, s->block, s->fill);
+            s->fill = 0;
+        } else if (flush == HUFF_STREAM_FINISH) {
+            s->pending_size = Block_end_serialize(s->total_in, s->pending);
+            s->state = HUFF_STREAM_DONE;
+        } else {
+            return HUFF_STREAM_OK;
+        }
+    }
+}
+
+
+// ===== DECOMPRESSOR =====
+
+Huff_stream* Huff_stream_decompressor_create(void) {
+    Huff_stream* s = Huff_stream_create(HUFF_STREAM_MAGIC);
+    s->decoder = Block_decoder_create();
+    return s;
+}
+
+
+// Parses the gathered file header and sizes the buffers for its blocks.
+static int Huff_stream_file_header(Huff_stream* s) {
+    Block_file_header header;
+    if (Block_file_header_deserialize(&header, s->header) != 0) return -1;
+    size_t payload_max = (size_t)header.block_size * 2 + 1024;
+    if (Huff_stream_reserve(&s->block, &s->block_capacity, payload_max) != 0
+        || Huff_stream_reserve(&s->pending, &s->pending_capacity, header.block_size) != 0) {
+        return -1;
+    }
+    s->block_size = header.block_size;
+    s->member_total = 0;
+    return 0;
+}
+
+
+/*
+ * Decodes the current block once its payload is whole: from next_in when
+ * all of it is there, else from the gathered copy, and into next_out when
+ * the block fits, else into the pending buffer.
+ */
+static int Huff_stream_payload(Huff_stream* s) {
+    const uint8_t* payload;
+    size_t size = s->current.payload_size;
+    int in_place = s->fill == 0 && s->avail_in >= size;
+    if (in_place) {
+        payload = s->next_in;
+    } else {
+        size_t take = size - s->fill;
+        if (take > s->avail_in) take = s->avail_in;
+        memcpy(s->block + s->fill, s->next_in, take);
+        Huff_stream_take(s, take);
+        s->fill += take;
+        if (s->fill < size) return 0;
+        payload = s->block;
+    }
+
+    uint32_t raw_size = s->current.raw_size;
+    uint8_t* out = s->avail_out >= raw_size ? s->next_out : s->pending;
+    if (Block_decode(s->decoder, &s->current, payload, out) != 0) return -1;
+    if (out == s->next_out) {
+        Huff_stream_give(s, raw_size);
+    } else {
+        s->pending_size = raw_size;
+    }
+    if (in_place) Huff_stream_take(s, size);
+    s->fill = 0;
+    s->member_total += raw_size;
+    return 1;
+}
+
+
+// Parses the gathered FFUH header and rebuilds its trie.
+static int Huff_stream_legacy_header(Huff_stream* s) {
+    uint32_t header_size, metadata_size;
+    memcpy(&header_size, s->header + 4, sizeof(header_size));
+    memcpy(&s->legacy_left, s->header + 8, sizeof(s->legacy_left));
+    memcpy(&metadata_size, s->header + 16, sizeof(metadata_size));
+    if (metadata_size > HUFFMAN_HEADER_MAX_METADATA_SIZE || header_size != HUFFMAN_HEADER_FIXED_SIZE + metadata_size) {
+        return -1;
+    }
+    if (!Huff_stream_gather(s, header_size + 2)) return 0;
+
+    s->root = Trie_build_from_metadata(s->header + HUFFMAN_HEADER_FIXED_SIZE, metadata_size);
+    if (!s->root) return -1;
+    s->trie = Trie_decoder_create(s->root);
+    Bit_reader_init(&s->br, NULL, 0);
+    return 1;
+}
+
+
+/*
+ * Decodes FFUH symbols from next_in into next_out. A symbol cut by the end
+ * of the input waits in the bit container and trie cursor, and the reader
+ * is left with no input of its own, since next_in may move before the next
+ * call.
+ */
+static int Huff_stream_legacy_data(Huff_stream* s) {
+    size_t room = s->avail_out;
+    if (room > s->legacy_left) room = (size_t)s->legacy_left;
+    size_t decoded;
+    if (s->root->is_leaf) {
+        // Single-symbol input: the only codeword is empty and no data bits follow.
+        memset(s->next_out, s->root->character, room);
+        decoded = room;
+    } else {
+        Bit_reader_feed(&s->br, s->next_in, s->avail_in);
+        decoded = Kernels_get()->decode(s->trie, &s->br, s->next_out, room);
+        Huff_stream_take(s, (size_t)(s->br.ptr - s->next_in));
+        s->br.end = s->br.ptr;
+        if (s->trie->error) return -1;
+    }
+    Huff_stream_give(s, decoded);
+    s->legacy_left -= decoded;
+    return s->legacy_left == 0;
+}
+
+
+int Huff_stream_decompress(Huff_stream* s, int flush) {
+    for (;;) {
+        if (!Huff_stream_drain(s)) return HUFF_STREAM_OK;
+        if (s->avail_in == 0 && s->state != HUFF_STREAM_LEGACY_DATA && s->state != HUFF_STREAM_DONE) {
+            if (flush != HUFF_STREAM_FINISH) return HUFF_STREAM_OK;
+            // Input may only run out between members.
+            int between = (s->state == HUFF_STREAM_AFTER_END || s->state == HUFF_STREAM_NEXT_MEMBER)
+                          && s->header_fill == 0;
+            return between ? HUFF_STREAM_END : HUFF_STREAM_ERROR;
+        }
+
+        int status;
+        switch (s->state) {
+        case HUFF_STREAM_MAGIC:
+        case HUFF_STREAM_NEXT_MEMBER:
+        case HUFF_STREAM_AFTER_END: {
+            if (!Huff_stream_gather(s, sizeof(uint32_t))) continue;
+            uint32_t magic;
+            memcpy(&magic, s->header, sizeof(magic));
+            if (magic == BLOCK_FORMAT_MAGIC) {
+                s->state = HUFF_STREAM_FILE_HEADER;
+            } else if (s->state == HUFF_STREAM_MAGIC) {
+                s->state = HUFF_STREAM_LEGACY_HEADER;
+            } else if (s->state == HUFF_STREAM_AFTER_END) {
+                s->state = HUFF_STREAM_INDEX_HEADER;
+            } else {
+                return HUFF_STREAM_ERROR;
+            }
+            continue;
+        }
+
+        case HUFF_STREAM_FILE_HEADER:
+            if (!Huff_stream_gather(s, BLOCK_FORMAT_FILE_HEADER_SIZE)) continue;
+            if (Huff_stream_file_header(s) != 0) return HUFF_STREAM_ERROR;
+            s->header_fill = 0;
+            s->state = HUFF_STREAM_BLOCK_HEADER;
+            continue;
+
+        case HUFF_STREAM_BLOCK_HEADER:
+            if (!Huff_stream_gather(s, BLOCK_FORMAT_BLOCK_HEADER_SIZE)) continue;
+            if (Block_header_deserialize(&s->current, s->header, s->block_size) != 0
+                || s->current.kind == BLOCK_INDEX || s->current.kind == BLOCK_REF) {
+                return HUFF_STREAM_ERROR;
+            }
+            s->header_fill = 0;
+            s->state = s->current.kind == BLOCK_END ? HUFF_STREAM_END_PAYLOAD : HUFF_STREAM_PAYLOAD;
+            continue;
+
+        case HUFF_STREAM_PAYLOAD:
+            status = Huff_stream_payload(s);
+            if (status < 0) return HUFF_STREAM_ERROR;
+            if (status > 0) s->state = HUFF_STREAM_BLOCK_HEADER;
+            continue;
+
+        case HUFF_STREAM_END_PAYLOAD: {
+            if (!Huff_stream_gather(s, BLOCK_FORMAT_END_PAYLOAD_SIZE)) continue;
+            uint64_t expected;
+            memcpy(&expected, s->header, sizeof(expected));
+            if (expected != s->member_total) return HUFF_STREAM_ERROR;
+            s->header_fill = 0;
+            s->state = HUFF_STREAM_AFTER_END;
+            continue;
+        }
+
+        case HUFF_STREAM_INDEX_HEADER: {
+            if (!Huff_stream_gather(s, BLOCK_FORMAT_BLOCK_HEADER_SIZE)) continue;
+            Block_header index;
+            if (Block_header_deserialize(&index, s->header, s->block_size) != 0 || index.kind != BLOCK_INDEX) {
+                return HUFF_STREAM_ERROR;
+            }
+            s->skip = index.payload_size;
+            s->header_fill = 0;
+            s->state = HUFF_STREAM_INDEX;
+            continue;
+        }
+
+        case HUFF_STREAM_INDEX: {
+            // The index only serves random access; a stream passes over it.
+            size_t take = s->avail_in < s->skip ? s->avail_in : (size_t)s->skip;
+            Huff_stream_take(s, take);
+            s->skip -= take;
+            if (s->skip == 0) s->state = HUFF_STREAM_NEXT_MEMBER;
+            continue;
+        }
+
+        case HUFF_STREAM_LEGACY_HEADER:
+            if (!Huff_stream_gather(s, HUFFMAN_HEADER_FIXED_SIZE)) continue;
+            status = Huff_stream_legacy_header(s);
+            if (status < 0) return HUFF_STREAM_ERROR;
+            if (status > 0) s->state = HUFF_STREAM_LEGACY_DATA;
+            continue;
+
+        case HUFF_STREAM_LEGACY_DATA: {
+            uint64_t before_in = s->total_in, before_out = s->total_out;
+            status = Huff_stream_legacy_data(s);
+            if (status < 0) return HUFF_STREAM_ERROR;
+            if (status > 0) {
+                s->state = HUFF_STREAM_DONE;
+            } else if (s->total_in == before_in && s->total_out == before_out) {
+                // Out of input or output room; FFUH input cannot end before its last symbol.
+                return flush == HUFF_STREAM_FINISH && s->avail_in == 0 && s->avail_out > 0
+                       ? HUFF_STREAM_ERROR : HUFF_STREAM_OK;
+            }
+            continue;
+        }
+
+        case HUFF_STREAM_DONE:
+            return HUFF_STREAM_END;
+
+        default:
+            return HUFF_STREAM_ERROR;
+        }
+    }
+}
+
+
+void Huff_stream_destroy(Huff_stream* s) {
+    if (!s) return;
+    Block_encoder_destroy(s->encoder);
+    Block_splitter_destroy(s->splitter);
+    Block_decoder_destroy(s->decoder);
+    Trie_decoder_destroy(s->trie);
+    Trie_destroy(s->root);
+    Mem_free(s->block);
+    Mem_free(s->pending);
+    Mem_free(s);
+}
@@ -0,0 +1,148 @@
+#include "Huffd_protocol.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define X(name, code, text) [code] = text,
+static const char* HUFFD_STATUS_TEXT[] = {
+    HUFFD_STATUS_TABLE
+};
+#undef X
+
+
+const char* Huffd_status_text(uint32_t status) {
+    if (status >= sizeof(HUFFD_STATUS_TEXT) / sizeof(HUFFD_STATUS_TEXT[0])) return "unknown status";
+    return HUFFD_STATUS_TEXT[status];
+}
+
+
+int Huffd_read_full(int fd, void* buffer, size_t size) {
+    uint8_t* p = (uint8_t*)buffer;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+
+int Huffd_write_full(int fd, const void* buffer, size_t size) {
+    const uint8_t* p = (const uint8_t*)buffer;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK) n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+
+int Huffd_send_request(int sock, const Huffd_request* request, const void* payload, int fd) {
+    uint8_t frame[HUFFD_FRAME_SIZE] = { 0 };
+    uint32_t magic = HUFFD_REQUEST_MAGIC;
+    memcpy(frame + 0, &magic, sizeof(magic));
+    frame[4] = request->op;
+    frame[5] = request->flags;
+    memcpy(frame + 8, &request->payload_size, sizeof(request->payload_size));
+
+    if (fd < 0) {
+        if (Huffd_write_full(sock, frame, sizeof(frame)) != 0) return -1;
+        return Huffd_write_full(sock, payload, request->payload_size);
+    }
+
+    // The descriptor rides along with the frame itself.
+    struct iovec iov = { frame, sizeof(frame) };
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+    return Huffd_write_full(sock, frame + n, sizeof(frame) - (size_t)n);
+}
+
+
+int Huffd_recv_request(int sock, Huffd_request* request, int* fd) {
+    uint8_t frame[HUFFD_FRAME_SIZE];
+    struct iovec iov = { frame, sizeof(frame) };
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+
+    *fd = -1;
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n == 0) return 1;
+    if (n < 0) return -1;
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    if (Huffd_read_full(sock, frame + n, sizeof(frame) - (size_t)n) != 0) return -1;
+
+    uint32_t magic;
+    memcpy(&magic, frame + 0, sizeof(magic));
+    request->op = frame[4];
+    request->flags = frame[5];
+    memcpy(&request->payload_size, frame + 8, sizeof(request->payload_size));
+    if (magic != HUFFD_REQUEST_MAGIC) return -1;
+    if ((request->flags & HUFFD_FLAG_PAYLOAD_FD) && (*fd < 0 || request->payload_size != 0)) return -1;
+    return 0;
+}
+
+
+int Huffd_send_reply(int sock, uint32_t status, const void* payload, uint64_t size) {
+    uint8_t frame[HUFFD_FRAME_SIZE] = { 0 };
+    uint32_t magic = HUFFD_REPLY_MAGIC;
+    memcpy(frame + 0, &magic, sizeof(magic));
+    memcpy(frame + 4, &status, sizeof(status));
+    memcpy(frame + 8, &size, sizeof(size));
+    if (Huffd_write_full(sock, frame, sizeof(frame)) != 0) return -1;
+    return Huffd_write_full(sock, payload, size);
+}
+
+
+int Huffd_recv_reply(int sock, Huffd_reply* reply) {
+    uint8_t frame[HUFFD_FRAME_SIZE];
+    if (Huffd_read_full(sock, frame, sizeof(frame)) != 0) return -1;
+
+    uint32_t magic;
+    memcpy(&magic, frame + 0, sizeof(magic));
+    memcpy(&reply->status, frame + 4, sizeof(reply->status));
+    memcpy(&reply->payload_size, frame + 8, sizeof(reply->payload_size));
+    return magic == HUFFD_REPLY_MAGIC ? 0 : -1;
+}
@@ -0,0 +1,102 @@
+#include "Huffman_encoder.h"
+#include "Mem.h"
+
+
+Huffman_encoder* Huffman_encoder_create(const ByteTable* bt) {
+    Huffman_encoder* enc = (Huffman_encoder*)Mem_calloc(MEM_TABLE, 1, sizeof(Huffman_encoder));
+    if (!enc) {
+        perror("Failed to allocate Huffman_encoder");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < 256; i++) {
+        if (!bt->table[i] || !bt->table[i]->codeword) continue;
+
+        const uint8_t* codeword = bt->table[i]->codeword;
+        size_t length = strlen((const char*)codeword);
+        if (length > HUFFMAN_ENCODER_MAX_CODE_LENGTH) {
+            fprintf(stderr, "Codeword of byte %d is %zu bits long, more than %d\n",
+                    i, length, HUFFMAN_ENCODER_MAX_CODE_LENGTH);
+            Mem_free(enc);
+            return NULL;
+        }
+
+        uint64_t code = 0;
+        for (size_t j = 0; j < length; j++) {
+            code = (code << 1) | (codeword[j] == '1');
+        }
+        enc->code[i] = code;
+        enc->length[i] = (uint8_t)length;
+        if (length > enc->max_length) enc->max_length = (uint8_t)length;
+    }
+    return enc;
+}
+
+
+// Largest symbol count whose worst-case output still fits before the slack.
+size_t Huffman_encoder_batch_limit(const Huffman_encoder* enc, const Bit_writer* bw) {
+    size_t room_bits = Bit_writer_room(bw) * 8;
+    if (enc->max_length == 0) return SIZE_MAX;
+    return room_bits / enc->max_length;
+}
+
+
+/*
+ * Shared body of the encode kernels. Codes of up to 28 bits are written two
+ * per flush (7 + 28 + 28 < 64); longer ones one per flush, and codes above
+ * 56 bits in two pieces.
+ */
+static inline __attribute__((always_inline))
+void Huffman_encoder_encode_body(const Huffman_encoder* enc, const uint8_t* in, size_t size, Bit_writer* bw) {
+    const uint64_t* code = enc->code;
+    const uint8_t* length = enc->length;
+    size_t i = 0;
+
+    // A single-symbol table has one empty codeword: nothing to write.
+    if (enc->max_length == 0) return;
+
+    if (enc->max_length <= 28) {
+        for (; i + 2 <= size; i += 2) {
+            Bit_writer_put(bw, code[in[i]], length[in[i]]);
+            Bit_writer_put(bw, code[in[i + 1]], length[in[i + 1]]);
+            Bit_writer_flush(bw);
+        }
+    }
+
+    for (; i < size; i++) {
+        uint64_t c = code[in[i]];
+        unsigned l = length[in[i]];
+        if (l > 56) {
+            Bit_writer_put(bw, c >> 32, l - 32);
+            Bit_writer_flush(bw);
+            c &= 0xFFFFFFFFu;
+            l = 32;
+        }
+        Bit_writer_put(bw, c, l);
+        Bit_writer_flush(bw);
+    }
+}
+
+
+void Huffman_encoder_encode_scalar(const Huffman_encoder* enc, const uint8_t* in, size_t size, Bit_writer* bw) {
+    Huffman_encoder_encode_body(enc, in, size, bw);
+}
+
+
+#if defined(__x86_64__)
+// Same loop built for BMI2: every variable shift in put/flush becomes
+// shlx/shrx, which takes its count from any register and writes no flags.
+__attribute__((target("bmi,bmi2")))
+void Huffman_encoder_encode_bmi2(const Huffman_encoder* enc, const uint8_t* in, size_t size, Bit_writer* bw) {
+    Huffman_encoder_encode_body(enc, in, size, bw);
+}
+#else
+void Huffman_encoder_encode_bmi2(const Huffman_encoder* enc, const uint8_t* in, size_t size, Bit_writer* bw) {
+    Huffman_encoder_encode_body(enc, in, size, bw);
+}
+#endif
+
+
+void Huffman_encoder_destroy(Huffman_encoder* enc) {
+    Mem_free(enc);
+}
@@ -1,9 +1,10 @@
 #include "Huffman_header.h"
+#include "Mem.h"
 
 
 
 Huffman_header* Huffman_header_create(uint32_t magic_number, uint64_t file_size, uint32_t metadata_size, uint8_t* metadata) {
-    Huffman_header* header = (Huffman_header*)malloc(sizeof(Huffman_header));
+    Huffman_header* header = (Huffman_header*)Mem_alloc(MEM_HEADER, sizeof(Huffman_header));
     if (!header) {
         perror("Failed to allocate memory for Huffman_header");
         exit(EXIT_FAILURE);
@@ -14,16 +15,16 @@ Huffman_header* Huffman_header_create(uint32_t magic_number, uint64_t file_size,
     header->codeword_map_metadata_size = metadata_size;
 
     
-    header->codeword_map_metadata = (uint8_t*)malloc(metadata_size);
+    header->codeword_map_metadata = (uint8_t*)Mem_alloc(MEM_HEADER, metadata_size);
     if (!header->codeword_map_metadata) {
         perror("Failed to allocate memory for codeword_map_metadata");
-        free(header);
+        Mem_free(header);
         exit(EXIT_FAILURE);
     }
     memcpy(header->codeword_map_metadata, metadata, metadata_size);
 
     
-    header->header_size = 4 + 4 + 8 + 4 + metadata_size;
+    header->header_size = HUFFMAN_HEADER_FIXED_SIZE + metadata_size;
 
     return header;
 }
@@ -41,7 +42,7 @@ uint8_t* Huffman_header_serialize(const Huffman_header* header, size_t* serializ
     *serialized_size = header->header_size;
 
     
-    uint8_t* buffer = (uint8_t*)malloc(*serialized_size);
+    uint8_t* buffer = (uint8_t*)Mem_alloc(MEM_HEADER, *serialized_size);
     if (!buffer) {
         perror("Failed to allocate memory for serialized Huffman_header");
         exit(EXIT_FAILURE);
@@ -77,9 +78,9 @@ uint8_t* Huffman_header_serialize(const Huffman_header* header, size_t* serializ
 void Huffman_header_destroy(Huffman_header* header) {
     if (header) {
         if (header->codeword_map_metadata) {
-            free(header->codeword_map_metadata);
+            Mem_free(header->codeword_map_metadata);
         }
-        free(header);
+        Mem_free(header);
     }
 }
 
@@ -96,7 +97,7 @@ Huffman_header* Huffman_header_deserialize(FILE* file) {
         return NULL;
     }
 
-    Huffman_header* header = (Huffman_header*)malloc(sizeof(Huffman_header));
+    Huffman_header* header = (Huffman_header*)Mem_alloc(MEM_HEADER, sizeof(Huffman_header));
     if (!header) {
         perror("Failed to allocate memory for Huffman_header");
         return NULL;
@@ -105,43 +106,51 @@ Huffman_header* Huffman_header_deserialize(FILE* file) {
     
     if (fread(&header->magic_number, sizeof(header->magic_number), 1, file) != 1) {
         fprintf(stderr, "Failed to read magic_number\n");
-        free(header);
+        Mem_free(header);
         return NULL;
     }
 
     
     if (fread(&header->header_size, sizeof(header->header_size), 1, file) != 1) {
         fprintf(stderr, "Failed to read header_size\n");
-        free(header);
+        Mem_free(header);
         return NULL;
     }
 
     
     if (fread(&header->file_size, sizeof(header->file_size), 1, file) != 1) {
         fprintf(stderr, "Failed to read file_size\n");
-        free(header);
+        Mem_free(header);
         return NULL;
     }
 
     
     if (fread(&header->codeword_map_metadata_size, sizeof(header->codeword_map_metadata_size), 1, file) != 1) {
         fprintf(stderr, "Failed to read codeword_map_metadata_size\n");
-        free(header);
+        Mem_free(header);
         return NULL;
     }
 
-    
-    header->codeword_map_metadata = (uint8_t*)malloc(header->codeword_map_metadata_size);
+    // Reject sizes no encoder can produce before allocating for them.
+    if (header->codeword_map_metadata_size > HUFFMAN_HEADER_MAX_METADATA_SIZE
+        || header->header_size != HUFFMAN_HEADER_FIXED_SIZE + header->codeword_map_metadata_size) {
+        fprintf(stderr, "Invalid header size %u (metadata %u)\n",
+                header->header_size, header->codeword_map_metadata_size);
+        Mem_free(header);
+        return NULL;
+    }
+
+    header->codeword_map_metadata = (uint8_t*)Mem_alloc(MEM_HEADER, header->codeword_map_metadata_size);
     if (!header->codeword_map_metadata) {
         perror("Failed to allocate memory for codeword_map_metadata");
-        free(header);
+        Mem_free(header);
         return NULL;
     }
 
     if (fread(header->codeword_map_metadata, 1, header->codeword_map_metadata_size, file) != header->codeword_map_metadata_size) {
         fprintf(stderr, "Failed to read codeword_map_metadata\n");
-        free(header->codeword_map_metadata);
-        free(header);
+        Mem_free(header->codeword_map_metadata);
+        Mem_free(header);
         return NULL;
     }
 
@@ -0,0 +1,317 @@
+#include "Huffman_table.h"
+#include <string.h>
+#include "Mem.h"
+
+// Sort keys are count << HUFFMAN_TABLE_SYMBOL_BITS | symbol; counts are cut to the bits left.
+#define HUFFMAN_TABLE_SYMBOL_BITS 9
+#define HUFFMAN_TABLE_COUNT_BITS (64 - HUFFMAN_TABLE_SYMBOL_BITS)
+
+
+/*
+ * LSD radix sort of m keys, one byte per pass, skipping the passes above
+ * the largest key. Keys are small for block-sized inputs, so a 256-symbol
+ * sort is a few passes over a few hundred keys.
+ */
+static void Huffman_table_sort(uint64_t* keys, uint64_t* scratch, unsigned m, uint64_t max_key) {
+    for (unsigned shift = 0; shift < 64 && (max_key >> shift) != 0; shift += 8) {
+        unsigned start[256] = { 0 };
+        for (unsigned k = 0; k < m; k++) {
+            start[(keys[k] >> shift) & 0xFF]++;
+        }
+        unsigned sum = 0;
+        for (int b = 0; b < 256; b++) {
+            unsigned count = start[b];
+            start[b] = sum;
+            sum += count;
+        }
+        for (unsigned k = 0; k < m; k++) {
+            scratch[start[(keys[k] >> shift) & 0xFF]++] = keys[k];
+        }
+        memcpy(keys, scratch, m * sizeof(uint64_t));
+    }
+}
+
+
+/*
+ * Moffat and Katajainen's in-place code lengths: `a` holds m >= 2 weights in
+ * increasing order and ends up holding their code lengths, in the same
+ * order. The first pass merges like the two-queue method, keeping internal
+ * weights and then parent indexes in the slots the leaves left; the second
+ * turns parents into depths; the third hands out leaf depths level by
+ * level. No nodes, no heap and no recursion.
+ */
+static void Huffman_table_in_place_lengths(uint64_t* a, unsigned m) {
+    unsigned root = 0, leaf = 2, next;
+    a[0] += a[1];
+    for (next = 1; next < m - 1; next++) {
+        if (leaf >= m || a[root] < a[leaf]) {
+            a[next] = a[root];
+            a[root++] = next;
+        } else {
+            a[next] = a[leaf++];
+        }
+        if (leaf >= m || (root < next && a[root] < a[leaf])) {
+            a[next] += a[root];
+            a[root++] = next;
+        } else {
+            a[next] += a[leaf++];
+        }
+    }
+
+    a[m - 2] = 0;
+    for (int k = (int)m - 3; k >= 0; k--) {
+        a[k] = a[a[k]] + 1;
+    }
+
+    int internal = (int)m - 2;
+    int slot = (int)m - 1;
+    unsigned available = 1, depth = 0;
+    while (available > 0) {
+        unsigned used = 0;
+        while (internal >= 0 && a[internal] == depth) {
+            used++;
+            internal--;
+        }
+        while (available > used) {
+            a[slot--] = depth;
+            available--;
+        }
+        available = 2 * used;
+        depth++;
+    }
+}
+
+
+/*
+ * Brings every length down to max_length while keeping the code complete
+ * (the bl_count adjustment of JPEG Annex K.3), then hands the resulting
+ * lengths back out in order of decreasing count. `sorted` holds the m
+ * lengths by increasing count, as Huffman_table_in_place_lengths leaves
+ * them.
+ */
+static void Huffman_table_limit_lengths(uint64_t* sorted, unsigned m, unsigned max_depth, unsigned max_length) {
+    unsigned bl_count[HUFFMAN_TABLE_MAX_SYMBOLS] = { 0 };
+    for (unsigned k = 0; k < m; k++) {
+        bl_count[sorted[k]]++;
+    }
+
+    for (unsigned i = max_depth; i > max_length; i--) {
+        while (bl_count[i] > 0) {
+            unsigned j = i - 2;
+            while (bl_count[j] == 0) j--;
+            bl_count[i] -= 2;
+            bl_count[i - 1] += 1;
+            bl_count[j + 1] += 2;
+            bl_count[j] -= 1;
+        }
+    }
+
+    unsigned length = 1;
+    for (int k = (int)m - 1; k >= 0; k--) {
+        while (bl_count[length] == 0) length++;
+        sorted[k] = length;
+        bl_count[length]--;
+    }
+}
+
+
+unsigned Huffman_table_build_lengths(const uint64_t counts[256], uint8_t lengths[256], unsigned max_length) {
+    return Huffman_table_build_lengths_n(counts, 256, lengths, max_length);
+}
+
+
+unsigned Huffman_table_build_lengths_n(const uint64_t* counts, unsigned n, uint8_t* lengths, unsigned max_length) {
+    uint64_t keys[HUFFMAN_TABLE_MAX_SYMBOLS];
+    uint64_t lengths_sorted[HUFFMAN_TABLE_MAX_SYMBOLS];
+    unsigned m = 0;
+
+    memset(lengths, 0, n);
+    uint64_t largest = 0;
+    for (unsigned i = 0; i < n; i++) {
+        if (counts[i] > largest) largest = counts[i];
+    }
+    // No real input comes near 2^55 of one symbol, but scale rather than wrap.
+    unsigned scale = 0;
+    while ((largest >> scale) >> HUFFMAN_TABLE_COUNT_BITS) scale++;
+
+    uint64_t max_key = 0;
+    for (unsigned i = 0; i < n; i++) {
+        if (counts[i]) {
+            uint64_t count = counts[i] >> scale ? counts[i] >> scale : 1;
+            keys[m] = count << HUFFMAN_TABLE_SYMBOL_BITS | i;
+            if (keys[m] > max_key) max_key = keys[m];
+            m++;
+        }
+    }
+    if (m <= 1) {
+        if (m == 1) lengths[keys[0] & ((1u << HUFFMAN_TABLE_SYMBOL_BITS) - 1)] = 1;
+        return m;
+    }
+
+    Huffman_table_sort(keys, lengths_sorted, m, max_key);
+    for (unsigned k = 0; k < m; k++) {
+        lengths_sorted[k] = keys[k] >> HUFFMAN_TABLE_SYMBOL_BITS;
+    }
+    Huffman_table_in_place_lengths(lengths_sorted, m);
+
+    // The rarest symbol has the longest code.
+    unsigned max_depth = (unsigned)lengths_sorted[0];
+    if (max_depth > max_length) {
+        Huffman_table_limit_lengths(lengths_sorted, m, max_depth, max_length);
+        max_depth = max_length;
+    }
+    for (unsigned k = 0; k < m; k++) {
+        lengths[keys[k] & ((1u << HUFFMAN_TABLE_SYMBOL_BITS) - 1)] = (uint8_t)lengths_sorted[k];
+    }
+    return max_depth;
+}
+
+
+void Huffman_table_set_codewords(const uint8_t lengths[256], ByteTable* bt) {
+    unsigned bl_count[HUFFMAN_ENCODER_MAX_CODE_LENGTH + 1] = { 0 };
+    unsigned used = 0, lone = 0;
+    for (int i = 0; i < 256; i++) {
+        if (lengths[i]) {
+            bl_count[lengths[i]]++;
+            used++;
+            lone = (unsigned)i;
+        }
+    }
+    if (used == 1) {
+        ByteTable_set_codeword(bt, (uint8_t)lone, (const uint8_t*)"");
+        return;
+    }
+
+    uint64_t next_code[HUFFMAN_ENCODER_MAX_CODE_LENGTH + 1];
+    uint64_t code = 0;
+    for (unsigned length = 1; length <= HUFFMAN_ENCODER_MAX_CODE_LENGTH; length++) {
+        code = (code + bl_count[length - 1]) << 1;
+        next_code[length] = code;
+    }
+
+    uint8_t codeword[HUFFMAN_ENCODER_MAX_CODE_LENGTH + 1];
+    for (int i = 0; i < 256; i++) {
+        unsigned length = lengths[i];
+        if (!length) continue;
+        uint64_t value = next_code[length]++;
+        for (unsigned j = 0; j < length; j++) {
+            codeword[j] = (uint8_t)('0' + ((value >> (length - 1 - j)) & 1));
+        }
+        codeword[length] = '\0';
+        ByteTable_set_codeword(bt, (uint8_t)i, codeword);
+    }
+}
+
+
+void Huffman_table_canonical_codes(const uint8_t* lengths, unsigned n, uint32_t* codes) {
+    unsigned bl_count[HUFFMAN_TABLE_MAX_BITS + 1] = { 0 };
+    uint32_t next_code[HUFFMAN_TABLE_MAX_BITS + 2] = { 0 };
+
+    for (unsigned i = 0; i < n; i++) {
+        if (lengths[i]) bl_count[lengths[i]]++;
+    }
+    uint32_t code = 0;
+    for (int bits = 1; bits <= HUFFMAN_TABLE_MAX_BITS; bits++) {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        codes[i] = lengths[i] ? next_code[lengths[i]]++ : 0;
+    }
+}
+
+
+void Huffman_table_build_encoder(const uint8_t lengths[256], Huffman_encoder* enc) {
+    uint32_t codes[256];
+    Huffman_table_canonical_codes(lengths, 256, codes);
+
+    enc->max_length = 0;
+    for (int i = 0; i < 256; i++) {
+        enc->code[i] = codes[i];
+        enc->length[i] = lengths[i];
+        if (lengths[i] > enc->max_length) enc->max_length = lengths[i];
+    }
+}
+
+
+size_t Huffman_table_write_lengths_n(const uint8_t* lengths, unsigned n, uint8_t* out) {
+    for (unsigned i = 0; i < n / 2; i++) {
+        out[i] = (uint8_t)((lengths[2 * i] << 4) | lengths[2 * i + 1]);
+    }
+    if (n & 1) {
+        out[n / 2] = (uint8_t)(lengths[n - 1] << 4);
+    }
+    return (n + 1) / 2;
+}
+
+
+void Huffman_table_write_lengths(const uint8_t lengths[256], uint8_t* out) {
+    Huffman_table_write_lengths_n(lengths, 256, out);
+}
+
+
+// Rejects lengths above HUFFMAN_TABLE_MAX_BITS and codes that are not
+// complete, so every decode table slot is defined.
+int Huffman_table_read_lengths_n(const uint8_t* in, unsigned n, uint8_t* lengths, unsigned* max_length) {
+    uint32_t kraft = 0;
+    *max_length = 0;
+
+    for (unsigned i = 0; i < n; i++) {
+        lengths[i] = i & 1 ? in[i / 2] & 0x0F : in[i / 2] >> 4;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        if (lengths[i] == 0) continue;
+        if (lengths[i] > HUFFMAN_TABLE_MAX_BITS) return -1;
+        kraft += 1u << (HUFFMAN_TABLE_MAX_BITS - lengths[i]);
+        if (lengths[i] > *max_length) *max_length = lengths[i];
+    }
+    return kraft == (1u << HUFFMAN_TABLE_MAX_BITS) ? 0 : -1;
+}
+
+
+int Huffman_table_read_lengths(const uint8_t* in, uint8_t lengths[256], unsigned* max_length) {
+    return Huffman_table_read_lengths_n(in, 256, lengths, max_length);
+}
+
+
+unsigned Huffman_table_decode_bits(unsigned max_length) {
+    return max_length < HUFFMAN_TABLE_MIN_BITS ? HUFFMAN_TABLE_MIN_BITS : max_length;
+}
+
+
+void Huffman_table_build_decode(const uint8_t lengths[256], unsigned table_bits, Huffman_decode_entry* table) {
+    uint32_t codes[256];
+    Huffman_table_canonical_codes(lengths, 256, codes);
+
+    for (int i = 0; i < 256; i++) {
+        if (lengths[i] == 0) continue;
+        unsigned shift = table_bits - lengths[i];
+        uint32_t first = codes[i] << shift;
+        uint32_t last = first + (1u << shift);
+        for (uint32_t j = first; j < last; j++) {
+            table[j].symbol = (uint8_t)i;
+            table[j].length = lengths[i];
+        }
+    }
+}
+
+
+void Huffman_table_build_decode2(const Huffman_decode_entry* table, unsigned table_bits, Huffman_decode_entry2* table2) {
+    uint32_t mask = (1u << table_bits) - 1;
+
+    for (uint32_t i = 0; i <= mask; i++) {
+        const Huffman_decode_entry* first = &table[i];
+        const Huffman_decode_entry* second = &table[(i << first->length) & mask];
+
+        table2[i].symbols[0] = first->symbol;
+        if (first->length + second->length <= table_bits) {
+            table2[i].symbols[1] = second->symbol;
+            table2[i].length = first->length + second->length;
+            table2[i].count = 2;
+        } else {
+            table2[i].symbols[1] = 0;
+            table2[i].length = first->length;
+            table2[i].count = 1;
+        }
+    }
+}
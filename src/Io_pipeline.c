@@ -0,0 +1,533 @@
+#include "Io_pipeline.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "Mem.h"
+
+enum { SLOT_FREE = 0, SLOT_PENDING, SLOT_FILLED, SLOT_HELD };
+
+typedef struct {
+    int fd;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ptr;
+    size_t sq_len;
+    void* cq_ptr;
+    size_t cq_len;
+    size_t sqes_len;
+} Io_uring;
+
+struct Io_reader {
+    FILE* file;
+    Io_chunk* slots;
+    int* state;
+    int depth;
+    int next;
+    int held;
+    int eof;
+    int error;
+    Io_chunk* current;
+    size_t position;
+
+    int use_uring;
+    Io_uring ring;
+    struct iovec* iov;
+    off_t* offsets;
+    off_t next_offset;
+    int in_flight;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled_cond;
+    pthread_cond_t free_cond;
+    int stop;
+};
+
+struct Io_writer {
+    FILE* file;
+    Io_chunk* slots;
+    int* state;
+    int depth;
+    int acquire_index;
+    int drain_index;
+    int error;
+    int stop;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled_cond;
+    pthread_cond_t free_cond;
+};
+
+
+static Io_chunk* Io_slots_create(int depth, size_t chunk_size, int** state) {
+    Io_chunk* slots = (Io_chunk*)Mem_calloc(MEM_IO, depth, sizeof(Io_chunk));
+    *state = (int*)Mem_calloc(MEM_IO, depth, sizeof(int));
+    if (!slots || !*state) {
+        perror("Failed to allocate Io ring");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < depth; i++) {
+        slots[i].data = (uint8_t*)Mem_alloc(MEM_IO, chunk_size);
+        if (!slots[i].data) {
+            perror("Failed to allocate Io ring buffer");
+            exit(EXIT_FAILURE);
+        }
+        slots[i].capacity = chunk_size;
+        slots[i].size = 0;
+    }
+    return slots;
+}
+
+static void Io_slots_destroy(Io_chunk* slots, int* state, int depth) {
+    for (int i = 0; i < depth; i++) {
+        Mem_free(slots[i].data);
+    }
+    Mem_free(slots);
+    Mem_free(state);
+}
+
+
+// ===== io_uring backend =====
+
+static int Io_uring_setup(Io_uring* ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return -1;
+    }
+
+    ring->fd = fd;
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        if (ring->cq_len > ring->sq_len) ring->sq_len = ring->cq_len;
+        ring->cq_len = ring->sq_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    if (single_mmap) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_len);
+            close(fd);
+            return -1;
+        }
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (!single_mmap) munmap(ring->cq_ptr, ring->cq_len);
+        munmap(ring->sq_ptr, ring->sq_len);
+        close(fd);
+        return -1;
+    }
+
+    uint8_t* sq = (uint8_t*)ring->sq_ptr;
+    uint8_t* cq = (uint8_t*)ring->cq_ptr;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+static void Io_uring_teardown(Io_uring* ring) {
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr != ring->sq_ptr) munmap(ring->cq_ptr, ring->cq_len);
+    munmap(ring->sq_ptr, ring->sq_len);
+    close(ring->fd);
+}
+
+static int Io_uring_submit_read(Io_reader* reader, int slot) {
+    Io_uring* ring = &reader->ring;
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    reader->iov[slot].iov_base = reader->slots[slot].data;
+    reader->iov[slot].iov_len = reader->slots[slot].capacity;
+    reader->offsets[slot] = reader->next_offset;
+    reader->next_offset += (off_t)reader->slots[slot].capacity;
+
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fileno(reader->file);
+    sqe->addr = (uint64_t)(uintptr_t)&reader->iov[slot];
+    sqe->len = 1;
+    sqe->off = (uint64_t)reader->offsets[slot];
+    sqe->user_data = (uint64_t)slot;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0) {
+        return -1;
+    }
+    reader->state[slot] = SLOT_PENDING;
+    reader->in_flight++;
+    return 0;
+}
+
+static int Io_uring_reap(Io_reader* reader) {
+    Io_uring* ring = &reader->ring;
+    if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+        return -1;
+    }
+
+    unsigned head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        int slot = (int)cqe->user_data;
+        Io_chunk* chunk = &reader->slots[slot];
+
+        if (cqe->res < 0) {
+            reader->error = 1;
+            chunk->size = 0;
+        } else {
+            chunk->size = (size_t)cqe->res;
+            // Short reads only happen at EOF on regular files, but top the chunk up
+            // synchronously so a partial completion never leaves a gap in the stream.
+            while (chunk->size > 0 && chunk->size < chunk->capacity) {
+                ssize_t n = pread(fileno(reader->file), chunk->data + chunk->size,
+                                  chunk->capacity - chunk->size, reader->offsets[slot] + (off_t)chunk->size);
+                if (n <= 0) break;
+                chunk->size += (size_t)n;
+            }
+        }
+        reader->state[slot] = SLOT_FILLED;
+        reader->in_flight--;
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+// ===== reader thread backend =====
+
+static void* Io_reader_thread(void* arg) {
+    Io_reader* reader = (Io_reader*)arg;
+    int fill = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&reader->lock);
+        while (!reader->stop && reader->state[fill] != SLOT_FREE) {
+            pthread_cond_wait(&reader->free_cond, &reader->lock);
+        }
+        if (reader->stop) {
+            pthread_mutex_unlock(&reader->lock);
+            break;
+        }
+        pthread_mutex_unlock(&reader->lock);
+
+        Io_chunk* chunk = &reader->slots[fill];
+        chunk->size = fread(chunk->data, 1, chunk->capacity, reader->file);
+        int failed = ferror(reader->file);
+
+        pthread_mutex_lock(&reader->lock);
+        reader->state[fill] = SLOT_FILLED;
+        if (failed) reader->error = 1;
+        pthread_cond_signal(&reader->filled_cond);
+        pthread_mutex_unlock(&reader->lock);
+
+        if (chunk->size == 0) break;
+        fill = (fill + 1) % reader->depth;
+    }
+    return NULL;
+}
+
+
+Io_reader* Io_reader_create(FILE* file, size_t chunk_size, int depth) {
+    depth = (int)Mem_fit(chunk_size, (unsigned)depth, 2, 4);
+    while (chunk_size > IO_MIN_CHUNK_SIZE && (uint64_t)depth * chunk_size > Mem_available() / 4) {
+        chunk_size /= 2;
+    }
+    Io_reader* reader = (Io_reader*)Mem_calloc(MEM_IO, 1, sizeof(Io_reader));
+    if (!reader) {
+        perror("Failed to allocate Io_reader");
+        exit(EXIT_FAILURE);
+    }
+    reader->file = file;
+    reader->depth = depth;
+    reader->held = -1;
+    reader->slots = Io_slots_create(depth, chunk_size, &reader->state);
+
+    const char* forced = getenv("HUFF_IO");
+    struct stat st;
+    int regular = fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode);
+    off_t start = ftello(file);
+
+    if (regular && start >= 0 && !(forced && strcmp(forced, "thread") == 0)
+        && Io_uring_setup(&reader->ring, (unsigned)depth) == 0) {
+        reader->use_uring = 1;
+        reader->iov = (struct iovec*)Mem_calloc(MEM_IO, depth, sizeof(struct iovec));
+        reader->offsets = (off_t*)Mem_calloc(MEM_IO, depth, sizeof(off_t));
+        if (!reader->iov || !reader->offsets) {
+            perror("Failed to allocate Io_reader ring state");
+            exit(EXIT_FAILURE);
+        }
+        reader->next_offset = start;
+        for (int i = 0; i < depth; i++) {
+            if (Io_uring_submit_read(reader, i) != 0) {
+                reader->error = 1;
+                break;
+            }
+        }
+        return reader;
+    }
+
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->filled_cond, NULL);
+    pthread_cond_init(&reader->free_cond, NULL);
+    if (pthread_create(&reader->thread, NULL, Io_reader_thread, reader) != 0) {
+        perror("Failed to start Io_reader thread");
+        exit(EXIT_FAILURE);
+    }
+    return reader;
+}
+
+
+Io_chunk* Io_reader_next(Io_reader* reader) {
+    if (reader->held >= 0) {
+        int held = reader->held;
+        reader->held = -1;
+        if (reader->use_uring) {
+            reader->state[held] = SLOT_FREE;
+            if (!reader->eof && !reader->error && Io_uring_submit_read(reader, held) != 0) {
+                reader->error = 1;
+            }
+        } else {
+            pthread_mutex_lock(&reader->lock);
+            reader->state[held] = SLOT_FREE;
+            pthread_cond_signal(&reader->free_cond);
+            pthread_mutex_unlock(&reader->lock);
+        }
+    }
+    if (reader->eof || reader->error) {
+        return NULL;
+    }
+
+    int slot = reader->next;
+    if (reader->use_uring) {
+        while (reader->state[slot] != SLOT_FILLED) {
+            if (reader->state[slot] != SLOT_PENDING || Io_uring_reap(reader) != 0) {
+                reader->error = 1;
+                return NULL;
+            }
+        }
+    } else {
+        pthread_mutex_lock(&reader->lock);
+        while (reader->state[slot] != SLOT_FILLED) {
+            pthread_cond_wait(&reader->filled_cond, &reader->lock);
+        }
+        pthread_mutex_unlock(&reader->lock);
+    }
+
+    if (reader->slots[slot].size == 0) {
+        reader->eof = 1;
+        return NULL;
+    }
+    reader->state[slot] = SLOT_HELD;
+    reader->held = slot;
+    reader->next = (slot + 1) % reader->depth;
+    return &reader->slots[slot];
+}
+
+
+const uint8_t* Io_reader_read(Io_reader* reader, size_t size, uint8_t* scratch) {
+    if (reader->current && reader->position == reader->current->size) {
+        reader->current = Io_reader_next(reader);
+        reader->position = 0;
+    }
+    if (reader->current && reader->current->size - reader->position >= size) {
+        const uint8_t* view = reader->current->data + reader->position;
+        reader->position += size;
+        return view;
+    }
+
+    size_t copied = 0;
+    while (copied < size) {
+        if (!reader->current || reader->position == reader->current->size) {
+            reader->current = Io_reader_next(reader);
+            reader->position = 0;
+            if (!reader->current) return NULL;
+        }
+        size_t take = reader->current->size - reader->position;
+        if (take > size - copied) take = size - copied;
+        memcpy(scratch + copied, reader->current->data + reader->position, take);
+        copied += take;
+        reader->position += take;
+    }
+    return scratch;
+}
+
+
+int Io_reader_failed(const Io_reader* reader) {
+    return reader->error;
+}
+
+
+const char* Io_reader_backend(const Io_reader* reader) {
+    return reader->use_uring ? "io_uring" : "thread";
+}
+
+
+void Io_reader_destroy(Io_reader* reader) {
+    if (!reader) return;
+
+    if (reader->use_uring) {
+        while (reader->in_flight > 0) {
+            if (Io_uring_reap(reader) != 0) break;
+        }
+        Io_uring_teardown(&reader->ring);
+        Mem_free(reader->iov);
+        Mem_free(reader->offsets);
+    } else {
+        pthread_mutex_lock(&reader->lock);
+        reader->stop = 1;
+        pthread_cond_broadcast(&reader->free_cond);
+        pthread_mutex_unlock(&reader->lock);
+        pthread_join(reader->thread, NULL);
+        pthread_mutex_destroy(&reader->lock);
+        pthread_cond_destroy(&reader->filled_cond);
+        pthread_cond_destroy(&reader->free_cond);
+    }
+
+    Io_slots_destroy(reader->slots, reader->state, reader->depth);
+    Mem_free(reader);
+}
+
+
+// ===== writer =====
+
+static void* Io_writer_thread(void* arg) {
+    Io_writer* writer = (Io_writer*)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&writer->lock);
+        while (writer->state[writer->drain_index] != SLOT_FILLED && !writer->stop) {
+            pthread_cond_wait(&writer->filled_cond, &writer->lock);
+        }
+        if (writer->state[writer->drain_index] != SLOT_FILLED) {
+            pthread_mutex_unlock(&writer->lock);
+            break;
+        }
+        pthread_mutex_unlock(&writer->lock);
+
+        Io_chunk* chunk = &writer->slots[writer->drain_index];
+        int failed = chunk->size > 0 && fwrite(chunk->data, 1, chunk->size, writer->file) != chunk->size;
+
+        pthread_mutex_lock(&writer->lock);
+        if (failed) writer->error = 1;
+        writer->state[writer->drain_index] = SLOT_FREE;
+        writer->drain_index = (writer->drain_index + 1) % writer->depth;
+        pthread_cond_signal(&writer->free_cond);
+        pthread_mutex_unlock(&writer->lock);
+    }
+    return NULL;
+}
+
+
+Io_writer* Io_writer_create(FILE* file, size_t chunk_size, int depth) {
+    depth = (int)Mem_fit(chunk_size, (unsigned)depth, 2, 4);
+    Io_writer* writer = (Io_writer*)Mem_calloc(MEM_IO, 1, sizeof(Io_writer));
+    if (!writer) {
+        perror("Failed to allocate Io_writer");
+        exit(EXIT_FAILURE);
+    }
+    writer->file = file;
+    writer->depth = depth;
+    writer->slots = Io_slots_create(depth, chunk_size, &writer->state);
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->filled_cond, NULL);
+    pthread_cond_init(&writer->free_cond, NULL);
+    if (pthread_create(&writer->thread, NULL, Io_writer_thread, writer) != 0) {
+        perror("Failed to start Io_writer thread");
+        exit(EXIT_FAILURE);
+    }
+    return writer;
+}
+
+
+Io_chunk* Io_writer_acquire(Io_writer* writer) {
+    pthread_mutex_lock(&writer->lock);
+    int slot = writer->acquire_index;
+    while (writer->state[slot] != SLOT_FREE) {
+        pthread_cond_wait(&writer->free_cond, &writer->lock);
+    }
+    writer->state[slot] = SLOT_HELD;
+    writer->acquire_index = (slot + 1) % writer->depth;
+    pthread_mutex_unlock(&writer->lock);
+
+    writer->slots[slot].size = 0;
+    return &writer->slots[slot];
+}
+
+
+void Io_writer_submit(Io_writer* writer, Io_chunk* chunk) {
+    pthread_mutex_lock(&writer->lock);
+    writer->state[chunk - writer->slots] = SLOT_FILLED;
+    pthread_cond_signal(&writer->filled_cond);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+
+int Io_writer_sync(Io_writer* writer) {
+    pthread_mutex_lock(&writer->lock);
+    for (int i = 0; i < writer->depth; i++) {
+        while (writer->state[i] == SLOT_FILLED) {
+            pthread_cond_wait(&writer->free_cond, &writer->lock);
+        }
+    }
+    int error = writer->error;
+    pthread_mutex_unlock(&writer->lock);
+    if (fflush(writer->file) != 0) error = 1;
+    return error ? -1 : 0;
+}
+
+
+int Io_writer_destroy(Io_writer* writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = 1;
+    pthread_cond_signal(&writer->filled_cond);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    int error = writer->error;
+    if (fflush(writer->file) != 0) error = 1;
+
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->filled_cond);
+    pthread_cond_destroy(&writer->free_cond);
+    Io_slots_destroy(writer->slots, writer->state, writer->depth);
+    Mem_free(writer);
+    return error ? -1 : 0;
+}
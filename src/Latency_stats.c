@@ -0,0 +1,82 @@
+#include "Latency_stats.h"
+#include <string.h>
+#include "Mem.h"
+
+
+Latency_stats* Latency_stats_create(size_t window) {
+    Latency_stats* stats = (Latency_stats*)Mem_alloc(MEM_SERVER, sizeof(Latency_stats));
+    if (!stats) {
+        perror("Failed to allocate Latency_stats");
+        exit(EXIT_FAILURE);
+    }
+    stats->samples = (uint64_t*)Mem_calloc(MEM_SERVER, window, sizeof(uint64_t));
+    if (!stats->samples) {
+        perror("Failed to allocate latency samples");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&stats->lock, NULL);
+    stats->window = window;
+    stats->count = 0;
+    stats->max = 0;
+    return stats;
+}
+
+
+void Latency_stats_record(Latency_stats* stats, uint64_t nanoseconds) {
+    pthread_mutex_lock(&stats->lock);
+    stats->samples[stats->count % stats->window] = nanoseconds;
+    stats->count++;
+    if (nanoseconds > stats->max) stats->max = nanoseconds;
+    pthread_mutex_unlock(&stats->lock);
+}
+
+
+static int Latency_compare(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+// Nearest-rank percentile of a sorted array, in nanoseconds.
+static uint64_t Latency_percentile(const uint64_t* sorted, size_t n, unsigned percent) {
+    size_t rank = (n * percent + 99) / 100;
+    return sorted[rank ? rank - 1 : 0];
+}
+
+
+void Latency_stats_summarize(Latency_stats* stats, Latency_summary* summary) {
+    memset(summary, 0, sizeof(*summary));
+
+    pthread_mutex_lock(&stats->lock);
+    size_t n = stats->count < stats->window ? (size_t)stats->count : stats->window;
+    uint64_t* sorted = (uint64_t*)Mem_alloc(MEM_SERVER, (n ? n : 1) * sizeof(uint64_t));
+    if (sorted) memcpy(sorted, stats->samples, n * sizeof(uint64_t));
+    summary->count = stats->count;
+    summary->max = stats->max;
+    pthread_mutex_unlock(&stats->lock);
+
+    if (!sorted) return;
+    if (n > 0) {
+        qsort(sorted, n, sizeof(uint64_t), Latency_compare);
+        summary->p50 = Latency_percentile(sorted, n, 50);
+        summary->p90 = Latency_percentile(sorted, n, 90);
+        summary->p99 = Latency_percentile(sorted, n, 99);
+    }
+    Mem_free(sorted);
+}
+
+
+int Latency_summary_format(const Latency_summary* summary, const char* label, char* out, size_t size) {
+    return snprintf(out, size, "%s n=%llu p50=%.1fus p90=%.1fus p99=%.1fus max=%.1fus\n", label,
+                    (unsigned long long)summary->count, summary->p50 / 1000.0, summary->p90 / 1000.0,
+                    summary->p99 / 1000.0, summary->max / 1000.0);
+}
+
+
+void Latency_stats_destroy(Latency_stats* stats) {
+    if (!stats) return;
+    pthread_mutex_destroy(&stats->lock);
+    Mem_free(stats->samples);
+    Mem_free(stats);
+}
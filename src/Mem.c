@@ -0,0 +1,211 @@
+#include "Mem.h"
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+
+#define MEM_MAGIC 0x4D454D31u    // "MEM1"
+
+// 16 bytes, so the memory after it keeps malloc's alignment.
+typedef struct {
+    uint64_t size;
+    uint32_t subsystem;
+    uint32_t magic;
+} Mem_header;
+
+typedef struct {
+    uint64_t allocations;
+    uint64_t blocks;
+    uint64_t bytes;
+    uint64_t peak;
+} Mem_counters;
+
+#define X(name, label) [name] = label,
+static const char* MEM_LABELS[MEM_SUBSYSTEM_COUNT] = {
+    MEM_SUBSYSTEM_TABLE
+};
+#undef X
+
+static Mem_counters mem_subsystems[MEM_SUBSYSTEM_COUNT];
+static uint64_t mem_current = 0;
+static uint64_t mem_peak = 0;
+static uint64_t mem_limit = 0;
+
+
+static void Mem_raise(uint64_t* peak, uint64_t value) {
+    uint64_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (value > seen && !__atomic_compare_exchange_n(peak, &seen, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+
+// Charges `size` bytes to the totals; fails without a trace when over the limit.
+static int Mem_charge(Mem_subsystem subsystem, uint64_t size) {
+    uint64_t total = __atomic_add_fetch(&mem_current, size, __ATOMIC_RELAXED);
+    uint64_t limit = __atomic_load_n(&mem_limit, __ATOMIC_RELAXED);
+    if (limit && total > limit) {
+        __atomic_sub_fetch(&mem_current, size, __ATOMIC_RELAXED);
+        fprintf(stderr, "Memory limit of %llu bytes reached by a %llu-byte %s allocation\n",
+                (unsigned long long)limit, (unsigned long long)size, MEM_LABELS[subsystem]);
+        errno = ENOMEM;
+        return -1;
+    }
+    Mem_raise(&mem_peak, total);
+
+    Mem_counters* counters = &mem_subsystems[subsystem];
+    __atomic_add_fetch(&counters->allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counters->blocks, 1, __ATOMIC_RELAXED);
+    Mem_raise(&counters->peak, __atomic_add_fetch(&counters->bytes, size, __ATOMIC_RELAXED));
+    return 0;
+}
+
+
+static void Mem_discharge(Mem_subsystem subsystem, uint64_t size) {
+    __atomic_sub_fetch(&mem_current, size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&mem_subsystems[subsystem].blocks, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&mem_subsystems[subsystem].bytes, size, __ATOMIC_RELAXED);
+}
+
+
+static Mem_header* Mem_header_of(void* ptr) {
+    Mem_header* header = (Mem_header*)ptr - 1;
+    if (header->magic != MEM_MAGIC) {
+        fprintf(stderr, "Mem: %p was not allocated through Mem_alloc\n", ptr);
+        abort();
+    }
+    return header;
+}
+
+
+void* Mem_alloc(Mem_subsystem subsystem, size_t size) {
+    if (size > SIZE_MAX - sizeof(Mem_header)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (Mem_charge(subsystem, size) != 0) return NULL;
+    Mem_header* header = (Mem_header*)malloc(sizeof(Mem_header) + size);
+    if (!header) {
+        Mem_discharge(subsystem, size);
+        return NULL;
+    }
+    header->size = size;
+    header->subsystem = (uint32_t)subsystem;
+    header->magic = MEM_MAGIC;
+    return header + 1;
+}
+
+
+void* Mem_calloc(Mem_subsystem subsystem, size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void* ptr = Mem_alloc(subsystem, count * size);
+    if (ptr) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+
+void* Mem_realloc(Mem_subsystem subsystem, void* ptr, size_t size) {
+    if (!ptr) return Mem_alloc(subsystem, size);
+    if (size > SIZE_MAX - sizeof(Mem_header)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    Mem_header* header = Mem_header_of(ptr);
+    Mem_subsystem owner = (Mem_subsystem)header->subsystem;
+    uint64_t old_size = header->size;
+
+    // Charge the new size before giving back the old one, as realloc may hold both.
+    if (Mem_charge(owner, size) != 0) return NULL;
+    Mem_header* moved = (Mem_header*)realloc(header, sizeof(Mem_header) + size);
+    if (!moved) {
+        Mem_discharge(owner, size);
+        return NULL;
+    }
+    Mem_discharge(owner, old_size);
+    moved->size = size;
+    return moved + 1;
+}
+
+
+char* Mem_strdup(Mem_subsystem subsystem, const char* text) {
+    size_t length = strlen(text) + 1;
+    char* copy = (char*)Mem_alloc(subsystem, length);
+    if (copy) memcpy(copy, text, length);
+    return copy;
+}
+
+
+void Mem_free(void* ptr) {
+    if (!ptr) return;
+    Mem_header* header = Mem_header_of(ptr);
+    Mem_discharge((Mem_subsystem)header->subsystem, header->size);
+    header->magic = 0;
+    free(header);
+}
+
+
+void Mem_set_limit(uint64_t bytes) {
+    __atomic_store_n(&mem_limit, bytes, __ATOMIC_RELAXED);
+}
+
+
+uint64_t Mem_limit(void) {
+    return __atomic_load_n(&mem_limit, __ATOMIC_RELAXED);
+}
+
+
+uint64_t Mem_available(void) {
+    uint64_t limit = Mem_limit();
+    uint64_t current = __atomic_load_n(&mem_current, __ATOMIC_RELAXED);
+    if (!limit) return UINT64_MAX;
+    return current < limit ? limit - current : 0;
+}
+
+
+unsigned Mem_fit(size_t unit, unsigned wanted, unsigned minimum, unsigned share) {
+    uint64_t available = Mem_available();
+    if (available == UINT64_MAX || unit == 0) return wanted;
+    uint64_t fits = available / share / unit;
+    if (fits >= wanted) return wanted;
+    return fits > minimum ? (unsigned)fits : minimum;
+}
+
+
+int Mem_parse_size(const char* text, uint64_t* bytes) {
+    char* end;
+    if (!isdigit((unsigned char)text[0])) return -1;
+    unsigned long long value = strtoull(text, &end, 10);
+    unsigned shift = 0;
+    switch (toupper((unsigned char)*end)) {
+        case 'K': shift = 10; end++; break;
+        case 'M': shift = 20; end++; break;
+        case 'G': shift = 30; end++; break;
+        default: break;
+    }
+    if (*end != '\0' || value > (UINT64_MAX >> shift)) return -1;
+    *bytes = (uint64_t)value << shift;
+    return 0;
+}
+
+
+void Mem_report(FILE* out) {
+    uint64_t limit = Mem_limit();
+    fprintf(out, "memory: peak %llu bytes, current %llu bytes",
+            (unsigned long long)__atomic_load_n(&mem_peak, __ATOMIC_RELAXED),
+            (unsigned long long)__atomic_load_n(&mem_current, __ATOMIC_RELAXED));
+    if (limit) fprintf(out, ", limit %llu bytes\n", (unsigned long long)limit);
+    else fprintf(out, ", no limit\n");
+
+    fprintf(out, "%-10s %12s %14s %12s %14s\n", "subsystem", "allocations", "peak bytes", "leaked", "leaked bytes");
+    for (int i = 0; i < MEM_SUBSYSTEM_COUNT; i++) {
+        const Mem_counters* counters = &mem_subsystems[i];
+        uint64_t allocations = __atomic_load_n(&counters->allocations, __ATOMIC_RELAXED);
+        if (allocations == 0) continue;
+        fprintf(out, "%-10s %12llu %14llu %12llu %14llu\n", MEM_LABELS[i],
+                (unsigned long long)allocations,
+                (unsigned long long)__atomic_load_n(&counters->peak, __ATOMIC_RELAXED),
+                (unsigned long long)__atomic_load_n(&counters->blocks, __ATOMIC_RELAXED),
+                (unsigned long long)__atomic_load_n(&counters->bytes, __ATOMIC_RELAXED));
+    }
+}
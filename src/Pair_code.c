@@ -0,0 +1,210 @@
+#include "Pair_code.h"
+#include <string.h>
+#include "Mem.h"
+
+typedef struct {
+    uint64_t count;
+    uint16_t pair;
+} Pair_candidate;
+
+
+Pair_encoder* Pair_encoder_create(void) {
+    Pair_encoder* enc = (Pair_encoder*)Mem_calloc(MEM_BLOCK, 1, sizeof(Pair_encoder));
+    if (!enc) {
+        perror("Failed to allocate Pair_encoder");
+        exit(EXIT_FAILURE);
+    }
+    return enc;
+}
+
+
+static void Pair_count_pairs(Pair_encoder* enc, const uint8_t* in, size_t size) {
+    for (size_t i = 0; i + 1 < size; i++) {
+        enc->pair_counts[in[i] << 8 | in[i + 1]]++;
+    }
+}
+
+
+static int Pair_compare(const void* a, const void* b) {
+    return (int)((const Pair_candidate*)a)->pair - (int)((const Pair_candidate*)b)->pair;
+}
+
+
+// Keeps heap[0] the least frequent of the `size` candidates held.
+static void Pair_sift_down(Pair_candidate* heap, unsigned size, unsigned i) {
+    for (;;) {
+        unsigned least = i;
+        unsigned left = 2 * i + 1;
+        unsigned right = left + 1;
+        if (left < size && heap[left].count < heap[least].count) least = left;
+        if (right < size && heap[right].count < heap[least].count) least = right;
+        if (least == i) return;
+        Pair_candidate tmp = heap[i];
+        heap[i] = heap[least];
+        heap[least] = tmp;
+        i = least;
+    }
+}
+
+
+unsigned Pair_choose(Pair_encoder* enc, const uint8_t* in, size_t size, unsigned shift, size_t window) {
+    for (unsigned k = 0; k < enc->num_pairs; k++) {
+        enc->symbol[enc->pairs[2 * k] << 8 | enc->pairs[2 * k + 1]] = 0;
+    }
+    enc->num_pairs = 0;
+    memset(enc->pair_counts, 0, sizeof(enc->pair_counts));
+
+    size_t stride = window << shift;
+    if (shift == 0 || size < 2 * stride) {
+        Pair_count_pairs(enc, in, size);
+        shift = 0;
+    } else {
+        for (size_t offset = 0; offset < size; offset += stride) {
+            Pair_count_pairs(enc, in + offset, size - offset < window ? size - offset : window);
+        }
+    }
+
+    // The most frequent pairs, through a min-heap of PAIR_CODE_MAX_PAIRS.
+    Pair_candidate heap[PAIR_CODE_MAX_PAIRS];
+    unsigned held = 0;
+    for (uint32_t pair = 0; pair < (1u << 16); pair++) {
+        uint64_t count = (uint64_t)enc->pair_counts[pair] << shift;
+        if (count < PAIR_CODE_MIN_COUNT) continue;
+        if (held < PAIR_CODE_MAX_PAIRS) {
+            heap[held].count = count;
+            heap[held].pair = (uint16_t)pair;
+            if (++held == PAIR_CODE_MAX_PAIRS) {
+                for (unsigned i = held / 2; i-- > 0;) Pair_sift_down(heap, held, i);
+            }
+        } else if (count > heap[0].count) {
+            heap[0].count = count;
+            heap[0].pair = (uint16_t)pair;
+            Pair_sift_down(heap, held, 0);
+        }
+    }
+
+    qsort(heap, held, sizeof(Pair_candidate), Pair_compare);
+    for (unsigned k = 0; k < held; k++) {
+        enc->pairs[2 * k] = (uint8_t)(heap[k].pair >> 8);
+        enc->pairs[2 * k + 1] = (uint8_t)heap[k].pair;
+        enc->symbol[heap[k].pair] = (uint16_t)(256 + k);
+    }
+    enc->num_pairs = held;
+    return held;
+}
+
+
+void Pair_count(Pair_encoder* enc, const uint8_t* in, size_t size) {
+    size_t i = 0;
+    while (i + 1 < size) {
+        unsigned symbol = enc->symbol[in[i] << 8 | in[i + 1]];
+        if (symbol) {
+            enc->counts[symbol]++;
+            i += 2;
+        } else {
+            enc->counts[in[i]]++;
+            i++;
+        }
+    }
+    if (i < size) enc->counts[in[i]]++;
+}
+
+
+unsigned Pair_build_code(Pair_encoder* enc, uint64_t* bits) {
+    unsigned n = 256 + enc->num_pairs;
+    unsigned distinct = 0;
+    for (unsigned i = 0; i < n; i++) {
+        if (enc->counts[i]) distinct++;
+    }
+    if (distinct < 2) return 0;
+
+    unsigned max_length = Huffman_table_build_lengths_n(enc->counts, n, enc->lengths, HUFFMAN_TABLE_MAX_BITS);
+    Huffman_table_canonical_codes(enc->lengths, n, enc->codes);
+    *bits = 0;
+    for (unsigned i = 0; i < n; i++) {
+        *bits += enc->counts[i] * enc->lengths[i];
+    }
+    return max_length;
+}
+
+
+size_t Pair_table_size(unsigned num_pairs) {
+    return 1 + 2 * (size_t)num_pairs + (256 + num_pairs + 1) / 2;
+}
+
+
+size_t Pair_write_table(const Pair_encoder* enc, uint8_t* out) {
+    out[0] = (uint8_t)(enc->num_pairs - 1);
+    memcpy(out + 1, enc->pairs, 2 * enc->num_pairs);
+    Huffman_table_write_lengths_n(enc->lengths, 256 + enc->num_pairs, out + 1 + 2 * enc->num_pairs);
+    return Pair_table_size(enc->num_pairs);
+}
+
+
+// Four codes of at most HUFFMAN_TABLE_MAX_BITS fit between flushes.
+void Pair_encode(const Pair_encoder* enc, const uint8_t* in, size_t size, Bit_writer* bw) {
+    size_t i = 0;
+    unsigned pending = 0;
+    while (i < size) {
+        unsigned symbol = in[i];
+        if (i + 1 < size && enc->symbol[in[i] << 8 | in[i + 1]]) {
+            symbol = enc->symbol[in[i] << 8 | in[i + 1]];
+            i += 2;
+        } else {
+            i++;
+        }
+        Bit_writer_put(bw, enc->codes[symbol], enc->lengths[symbol]);
+        if (++pending == 4) {
+            Bit_writer_flush(bw);
+            pending = 0;
+        }
+    }
+    Bit_writer_flush(bw);
+}
+
+
+int Pair_read_table(const uint8_t* in, size_t size, uint8_t* pairs, unsigned* num_pairs, uint8_t* lengths,
+                    unsigned* max_length, size_t* used) {
+    if (size < 1) return -1;
+    *num_pairs = (unsigned)in[0] + 1;
+    *used = Pair_table_size(*num_pairs);
+    if (size < *used) return -1;
+
+    memcpy(pairs, in + 1, 2 * *num_pairs);
+    return Huffman_table_read_lengths_n(in + 1 + 2 * *num_pairs, 256 + *num_pairs, lengths, max_length);
+}
+
+
+void Pair_build_decode(const uint8_t* pairs, unsigned num_pairs, const uint8_t* lengths, unsigned table_bits,
+                       Huffman_decode_entry2* table) {
+    uint32_t codes[PAIR_CODE_MAX_SYMBOLS];
+    unsigned n = 256 + num_pairs;
+    Huffman_table_canonical_codes(lengths, n, codes);
+
+    for (unsigned i = 0; i < n; i++) {
+        if (lengths[i] == 0) continue;
+        Huffman_decode_entry2 entry;
+        if (i < 256) {
+            entry.symbols[0] = (uint8_t)i;
+            entry.symbols[1] = 0;
+            entry.count = 1;
+        } else {
+            entry.symbols[0] = pairs[2 * (i - 256)];
+            entry.symbols[1] = pairs[2 * (i - 256) + 1];
+            entry.count = 2;
+        }
+        entry.length = lengths[i];
+
+        unsigned shift = table_bits - lengths[i];
+        uint32_t first = codes[i] << shift;
+        uint32_t last = first + (1u << shift);
+        for (uint32_t j = first; j < last; j++) {
+            table[j] = entry;
+        }
+    }
+}
+
+
+void Pair_encoder_destroy(Pair_encoder* enc) {
+    Mem_free(enc);
+}
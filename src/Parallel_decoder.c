@@ -0,0 +1,236 @@
+#include "Parallel_decoder.h"
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "Cpu_dispatch.h"
+#include "Trie_decoder.h"
+#include "Mem.h"
+
+#define PARALLEL_DECODER_WINDOW_BITS (PARALLEL_DECODER_SYNC_WINDOW * 8)
+
+typedef struct {
+    uint64_t start_bit;     // where decoding starts in the bitstream
+    uint64_t end_bit;       // byte-aligned end; symbols starting before it belong here
+    int exact;              // start_bit is known to be a symbol boundary
+    uint8_t* symbols;
+    size_t capacity;
+    size_t main_count;      // symbols starting before end_bit
+    size_t count;           // and those decoded in the sync window after it
+    uint64_t* head;         // starts of the first symbols, within the window after start_bit
+    size_t head_count;
+    uint64_t* tail;         // starts of the window symbols, then the end of the last one
+    size_t tail_count;
+    int failed;
+} Parallel_decoder_segment;
+
+typedef struct {
+    int fd;
+    uint64_t data_offset;
+    uint64_t data_size;
+    Trie_decoder* decoder;
+    uint8_t* input;
+    Parallel_decoder_segment segment;
+    int read_failed;
+    pthread_t tid;
+} Parallel_decoder_worker;
+
+
+static int Parallel_decoder_pread(int fd, uint8_t* out, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t got = pread(fd, out, size, (off_t)offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return -1;
+        out += got;
+        size -= (size_t)got;
+        offset += (uint64_t)got;
+    }
+    return 0;
+}
+
+
+// Bits of the stream consumed so far; `feed` was fed to the reader at bit `feed_bit`.
+static inline uint64_t Parallel_decoder_position(const Bit_reader* br, const uint8_t* feed, uint64_t feed_bit) {
+    return feed_bit + (uint64_t)(br->ptr - feed) * 8 - br->bit_count;
+}
+
+
+static void* Parallel_decoder_run(void* arg) {
+    Parallel_decoder_worker* worker = (Parallel_decoder_worker*)arg;
+    Parallel_decoder_segment* segment = &worker->segment;
+    Trie_decoder* decoder = worker->decoder;
+    const Kernel_set* kernels = Kernels_get();
+
+    uint64_t first_byte = segment->start_bit / 8;
+    uint64_t end_byte = segment->end_bit / 8;
+    uint64_t window_end = end_byte + PARALLEL_DECODER_SYNC_WINDOW < worker->data_size
+                        ? end_byte + PARALLEL_DECODER_SYNC_WINDOW : worker->data_size;
+    segment->main_count = segment->count = segment->head_count = segment->tail_count = 0;
+    segment->failed = 0;
+    if (Parallel_decoder_pread(worker->fd, worker->input, (size_t)(window_end - first_byte),
+                               worker->data_offset + first_byte) != 0) {
+        worker->read_failed = 1;
+        segment->failed = 1;
+        return NULL;
+    }
+
+    decoder->current = decoder->root;
+    decoder->error = 0;
+    Bit_reader br;
+    Bit_reader_init(&br, worker->input, (size_t)(end_byte - first_byte));
+    const uint8_t* feed = worker->input;
+    uint64_t feed_bit = first_byte * 8;
+    if (segment->start_bit % 8) {
+        Bit_reader_refill(&br);
+        Bit_reader_consume(&br, (unsigned)(segment->start_bit % 8));
+    }
+
+    // A speculative start decodes its first window one symbol at a time to note where each begins.
+    while (!segment->exact && segment->count < segment->capacity) {
+        uint64_t at = Parallel_decoder_position(&br, feed, feed_bit);
+        if (at >= segment->start_bit + PARALLEL_DECODER_WINDOW_BITS) break;
+        if (kernels->decode(decoder, &br, segment->symbols + segment->count, 1) == 0) break;
+        segment->head[segment->head_count++] = at;
+        segment->count++;
+    }
+    segment->count += kernels->decode(decoder, &br, segment->symbols + segment->count,
+                                      segment->capacity - segment->count);
+    if (Bit_reader_input_left(&br) > 0 || br.bit_count > 0) decoder->error = 1;
+
+    // The sync window: finish the symbol cut by end_bit, then note every start.
+    Bit_reader_feed(&br, worker->input + (end_byte - first_byte), (size_t)(window_end - end_byte));
+    feed = worker->input + (end_byte - first_byte);
+    feed_bit = end_byte * 8;
+    if (decoder->current != decoder->root && segment->count < segment->capacity) {
+        segment->count += kernels->decode(decoder, &br, segment->symbols + segment->count, 1);
+    }
+    segment->main_count = segment->count;
+    for (;;) {
+        segment->tail[segment->tail_count++] = Parallel_decoder_position(&br, feed, feed_bit);
+        if (segment->count == segment->capacity || decoder->error
+            || kernels->decode(decoder, &br, segment->symbols + segment->count, 1) == 0) {
+            break;
+        }
+        segment->count++;
+    }
+    segment->failed = decoder->error;
+    return NULL;
+}
+
+
+// Fewest bits any symbol takes, which bounds the symbols a segment can hold.
+static unsigned Parallel_decoder_min_length(const TrieNode* node, unsigned depth) {
+    if (!node) return UINT32_MAX;
+    if (node->is_leaf) return depth;
+    unsigned left = Parallel_decoder_min_length(node->left, depth + 1);
+    unsigned right = Parallel_decoder_min_length(node->right, depth + 1);
+    return left < right ? left : right;
+}
+
+
+int Parallel_decoder_file(int fd, uint64_t data_offset, uint64_t data_size, TrieNode* root, uint64_t file_size,
+                          unsigned threads, FILE* output, uint64_t* written) {
+    uint64_t segments = data_size / PARALLEL_DECODER_SEGMENT_SIZE ? data_size / PARALLEL_DECODER_SEGMENT_SIZE : 1;
+    if (threads > segments) threads = (unsigned)segments;
+    unsigned min_length = Parallel_decoder_min_length(root, 0);
+    if (min_length == 0 || min_length == UINT32_MAX) min_length = 1;
+
+    // The last segment is up to two segments long, and any start may lie inside the previous window.
+    size_t input_size = 2 * PARALLEL_DECODER_SEGMENT_SIZE + 2 * PARALLEL_DECODER_SYNC_WINDOW;
+    size_t capacity = input_size * 8 / min_length + 2;
+    size_t positions = PARALLEL_DECODER_WINDOW_BITS + 2;
+    threads = Mem_fit(input_size + capacity + 2 * positions * sizeof(uint64_t), threads, 1, 2);
+
+    Parallel_decoder_worker* workers = (Parallel_decoder_worker*)Mem_calloc(MEM_IO, threads, sizeof(Parallel_decoder_worker));
+    if (!workers) {
+        perror("Failed to allocate decoder workers");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned t = 0; t < threads; t++) {
+        Parallel_decoder_worker* worker = &workers[t];
+        worker->fd = fd;
+        worker->data_offset = data_offset;
+        worker->data_size = data_size;
+        worker->decoder = Trie_decoder_create(root);
+        worker->input = (uint8_t*)Mem_alloc(MEM_IO, input_size);
+        worker->segment.symbols = (uint8_t*)Mem_alloc(MEM_IO, capacity);
+        worker->segment.capacity = capacity;
+        worker->segment.head = (uint64_t*)Mem_alloc(MEM_IO, positions * sizeof(uint64_t));
+        worker->segment.tail = (uint64_t*)Mem_alloc(MEM_IO, positions * sizeof(uint64_t));
+        if (!worker->input || !worker->segment.symbols || !worker->segment.head || !worker->segment.tail) {
+            perror("Failed to allocate decoder buffers");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint64_t total = 0;
+    uint64_t start_bit = 0;     // a known boundary: where this round's first segment starts
+    int failed = 0;
+    int corrupt = 0;
+    for (uint64_t first = 0; first < segments && total < file_size && !failed && !corrupt; first += threads) {
+        unsigned count = segments - first < threads ? (unsigned)(segments - first) : threads;
+        for (unsigned t = 0; t < count; t++) {
+            Parallel_decoder_segment* segment = &workers[t].segment;
+            uint64_t index = first + t;
+            segment->exact = t == 0;
+            segment->start_bit = t == 0 ? start_bit : index * PARALLEL_DECODER_SEGMENT_SIZE * 8;
+            segment->end_bit = index + 1 == segments ? data_size * 8 : (index + 1) * PARALLEL_DECODER_SEGMENT_SIZE * 8;
+        }
+        for (unsigned t = 1; t < count; t++) {
+            pthread_create(&workers[t].tid, NULL, Parallel_decoder_run, &workers[t]);
+        }
+        Parallel_decoder_run(&workers[0]);
+        for (unsigned t = 1; t < count; t++) {
+            pthread_join(workers[t].tid, NULL);
+        }
+
+        // Join each segment to the one before it, which is exact by now.
+        size_t keep_from = 0;
+        for (unsigned t = 0; t < count && !failed && !corrupt; t++) {
+            Parallel_decoder_segment* segment = &workers[t].segment;
+            failed = workers[t].read_failed;
+            if (segment->failed && segment->exact) corrupt = 1;
+            if (failed || corrupt) break;
+
+            size_t keep_to = segment->count;
+            size_t next_from = 0;
+            if (t + 1 < count) {
+                // The first start both sides found; the next segment's symbols before it were out of step.
+                Parallel_decoder_segment* next = &workers[t + 1].segment;
+                size_t i = 0, j = 0;
+                while (!next->failed && i < segment->tail_count && j < next->head_count
+                       && segment->tail[i] != next->head[j]) {
+                    if (segment->tail[i] < next->head[j]) i++;
+                    else j++;
+                }
+                if (!next->failed && i < segment->tail_count && j < next->head_count) {
+                    keep_to = segment->main_count + i;
+                    next_from = j;
+                } else {
+                    // Never fell into step: decode it again from a known boundary.
+                    next->exact = 1;
+                    next->start_bit = segment->tail[segment->tail_count - 1];
+                    Parallel_decoder_run(&workers[t + 1]);
+                }
+            }
+
+            size_t size = keep_to - keep_from;
+            if (size > file_size - total) size = (size_t)(file_size - total);
+            if (fwrite(segment->symbols + keep_from, 1, size, output) != size) failed = 1;
+            total += size;
+            start_bit = segment->tail[segment->tail_count - 1];
+            keep_from = next_from;
+        }
+    }
+
+    for (unsigned t = 0; t < threads; t++) {
+        Trie_decoder_destroy(workers[t].decoder);
+        Mem_free(workers[t].input);
+        Mem_free(workers[t].segment.symbols);
+        Mem_free(workers[t].segment.head);
+        Mem_free(workers[t].segment.tail);
+    }
+    Mem_free(workers);
+    *written = total;
+    return failed ? -1 : 0;
+}
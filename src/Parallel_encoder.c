@@ -0,0 +1,188 @@
+#include "Parallel_encoder.h"
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "Cpu_dispatch.h"
+#include "Io_pipeline.h"
+#include "Parallel_histogram.h"
+#include "Mem.h"
+
+// A byte of a segment's output that a neighbour segment also writes bits into.
+typedef struct {
+    uint64_t position;
+    uint8_t value;
+    uint8_t used;
+} Parallel_encoder_edge;
+
+typedef struct {
+    int fd;
+    uint64_t size;
+    int out_fd;
+    uint64_t out_offset;
+    const Huffman_encoder* enc;
+    const uint64_t* start_bits;     // segment s covers bits [start_bits[s], start_bits[s + 1])
+    Parallel_encoder_edge* edges;   // head and tail of each segment
+    uint64_t segment_count;
+    uint64_t segment_size;
+    uint64_t next;                  // next segment to take
+    int failed;
+} Parallel_encoder_job;
+
+
+static int Parallel_encoder_pwrite(int fd, const uint8_t* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t put = pwrite(fd, data, size, (off_t)offset);
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return -1;
+        data += put;
+        size -= (size_t)put;
+        offset += (uint64_t)put;
+    }
+    return 0;
+}
+
+
+/*
+ * Writes `size` encoded bytes of segment `s` that start at bitstream byte
+ * *position, keeping back its first byte if the previous segment ends in
+ * it and, on the `last` write, its final byte if the next one starts in it.
+ */
+static int Parallel_encoder_write(Parallel_encoder_job* job, uint64_t s, const uint8_t* data, size_t size,
+                                  uint64_t* position, int last) {
+    Parallel_encoder_edge* head = &job->edges[2 * s];
+    Parallel_encoder_edge* tail = &job->edges[2 * s + 1];
+    if (size > 0 && !head->used && job->start_bits[s] % 8) {
+        head->position = (*position)++;
+        head->value = data[0];
+        head->used = 1;
+        data++;
+        size--;
+    }
+    if (last && size > 0 && job->start_bits[s + 1] % 8) {
+        tail->position = *position + size - 1;
+        tail->value = data[size - 1];
+        tail->used = 1;
+        size--;
+    }
+    if (Parallel_encoder_pwrite(job->out_fd, data, size, job->out_offset + *position) != 0) return -1;
+    *position += size;
+    return 0;
+}
+
+
+static int Parallel_encoder_segment(Parallel_encoder_job* job, uint64_t s, const Kernel_set* kernels,
+                                    uint8_t* input, uint8_t* output) {
+    uint64_t offset = s * job->segment_size;
+    uint64_t end = job->size - offset < job->segment_size ? job->size : offset + job->segment_size;
+    uint64_t position = job->start_bits[s] / 8;
+
+    // The leading bits of the first byte belong to the previous segment; they stay zero here.
+    Bit_writer bw;
+    Bit_writer_init(&bw, output, IO_CHUNK_SIZE);
+    bw.bit_count = (unsigned)(job->start_bits[s] % 8);
+
+    while (offset < end) {
+        size_t want = end - offset < IO_CHUNK_SIZE ? (size_t)(end - offset) : IO_CHUNK_SIZE;
+        ssize_t got = pread(job->fd, input, want, (off_t)offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return -1;
+
+        size_t done = 0;
+        while (done < (size_t)got) {
+            size_t batch = Huffman_encoder_batch_limit(job->enc, &bw);
+            if (batch == 0) {
+                if (Parallel_encoder_write(job, s, output, (size_t)(bw.ptr - output), &position, 0) != 0) return -1;
+                Bit_writer_retarget(&bw, output, IO_CHUNK_SIZE);
+                continue;
+            }
+            if (batch > (size_t)got - done) batch = (size_t)got - done;
+            kernels->encode(job->enc, input + done, batch, &bw);
+            done += batch;
+        }
+        offset += (uint64_t)got;
+    }
+    Bit_writer_finish(&bw);
+    return Parallel_encoder_write(job, s, output, (size_t)(bw.ptr - output), &position, 1);
+}
+
+
+static void* Parallel_encoder_worker(void* arg) {
+    Parallel_encoder_job* job = (Parallel_encoder_job*)arg;
+    const Kernel_set* kernels = Kernels_get();
+    uint8_t* input = (uint8_t*)Mem_alloc(MEM_IO, IO_CHUNK_SIZE);
+    uint8_t* output = (uint8_t*)Mem_alloc(MEM_IO, IO_CHUNK_SIZE);
+
+    while (input && output && !__atomic_load_n(&job->failed, __ATOMIC_RELAXED)) {
+        uint64_t s = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (s >= job->segment_count) break;
+        if (Parallel_encoder_segment(job, s, kernels, input, output) != 0) {
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (!input || !output) __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    Mem_free(input);
+    Mem_free(output);
+    return NULL;
+}
+
+
+int Parallel_encoder_file(int fd, uint64_t size, const uint32_t (*segments)[256], const Huffman_encoder* enc,
+                          unsigned threads, int out_fd, uint64_t out_offset, uint64_t* out_size) {
+    uint64_t segment_count = Parallel_histogram_segments(size);
+    uint64_t* start_bits = (uint64_t*)Mem_alloc(MEM_IO, (segment_count + 1) * sizeof(uint64_t));
+    Parallel_encoder_edge* edges = (Parallel_encoder_edge*)Mem_calloc(MEM_IO, 2 * segment_count, sizeof(Parallel_encoder_edge));
+    if (!start_bits || !edges) {
+        perror("Failed to allocate encoder segments");
+        exit(EXIT_FAILURE);
+    }
+
+    // Bit length of each segment, summed into the offset it starts at.
+    start_bits[0] = 0;
+    for (uint64_t s = 0; s < segment_count; s++) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 256; i++) bits += (uint64_t)segments[s][i] * enc->length[i];
+        start_bits[s + 1] = start_bits[s] + bits;
+    }
+
+    if (threads == 0) threads = Parallel_histogram_default_threads();
+    if (threads > segment_count) threads = segment_count ? (unsigned)segment_count : 1;
+    // Each thread holds an input and an output buffer.
+    threads = Mem_fit(2 * IO_CHUNK_SIZE, threads, 1, 2);
+
+    Parallel_encoder_job job = { fd, size, out_fd, out_offset, enc, start_bits, edges, segment_count,
+                                 Parallel_histogram_segment_size(size), 0, 0 };
+    pthread_t* tids = (pthread_t*)Mem_alloc(MEM_IO, threads * sizeof(pthread_t));
+    if (!tids) {
+        perror("Failed to allocate encoder threads");
+        exit(EXIT_FAILURE);
+    }
+    // The calling thread encodes segments too.
+    for (unsigned t = 1; t < threads; t++) {
+        pthread_create(&tids[t], NULL, Parallel_encoder_worker, &job);
+    }
+    Parallel_encoder_worker(&job);
+    for (unsigned t = 1; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+
+    // Edges come in bitstream order; the parts of a shared byte are adjacent.
+    int failed = job.failed;
+    Parallel_encoder_edge pending = { 0, 0, 0 };
+    for (uint64_t e = 0; e < 2 * segment_count && !failed; e++) {
+        if (!edges[e].used) continue;
+        if (pending.used && edges[e].position == pending.position) {
+            pending.value |= edges[e].value;
+            continue;
+        }
+        if (pending.used) failed = Parallel_encoder_pwrite(out_fd, &pending.value, 1, out_offset + pending.position) != 0;
+        pending = edges[e];
+    }
+    if (pending.used && !failed) failed = Parallel_encoder_pwrite(out_fd, &pending.value, 1, out_offset + pending.position) != 0;
+
+    *out_size = (start_bits[segment_count] + 7) / 8;
+    Mem_free(tids);
+    Mem_free(edges);
+    Mem_free(start_bits);
+    return failed ? -1 : 0;
+}
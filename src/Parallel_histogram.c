@@ -0,0 +1,121 @@
+#include "Parallel_histogram.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "Cpu_dispatch.h"
+#include "Io_pipeline.h"
+#include "Mem.h"
+
+typedef struct {
+    int fd;
+    uint64_t start;
+    uint64_t end;
+    int failed;
+    uint64_t counts[256];
+    uint32_t (*segments)[256];
+    uint64_t segment_size;
+} Parallel_histogram_range;
+
+
+static void* Parallel_histogram_worker(void* arg) {
+    Parallel_histogram_range* range = (Parallel_histogram_range*)arg;
+    const Kernel_set* kernels = Kernels_get();
+    uint8_t* buffer = (uint8_t*)Mem_alloc(MEM_IO, IO_CHUNK_SIZE);
+    if (!buffer) {
+        range->failed = 1;
+        return NULL;
+    }
+
+    uint64_t offset = range->start;
+    while (offset < range->end) {
+        // Stop at the chunk boundary even after a short read, so no read spans two segments.
+        size_t want = IO_CHUNK_SIZE - (size_t)(offset % IO_CHUNK_SIZE);
+        if (range->end - offset < want) want = (size_t)(range->end - offset);
+        ssize_t got = pread(range->fd, buffer, want, (off_t)offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            range->failed = 1;
+            break;
+        }
+        if (range->segments) {
+            // The kernels count into 64-bit tables; a chunk is added to its segment's narrower row.
+            uint64_t counts[256] = { 0 };
+            kernels->histogram(buffer, (size_t)got, counts);
+            uint32_t* segment = range->segments[offset / range->segment_size];
+            for (int i = 0; i < 256; i++) {
+                segment[i] += (uint32_t)counts[i];
+                range->counts[i] += counts[i];
+            }
+        } else {
+            kernels->histogram(buffer, (size_t)got, range->counts);
+        }
+        offset += (uint64_t)got;
+    }
+    Mem_free(buffer);
+    return NULL;
+}
+
+
+unsigned Parallel_histogram_default_threads(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (unsigned)cpus : 1;
+}
+
+
+uint64_t Parallel_histogram_segment_size(uint64_t size) {
+    uint64_t segment = PARALLEL_HISTOGRAM_SEGMENT_SIZE;
+    while ((size + segment - 1) / segment > PARALLEL_HISTOGRAM_MAX_SEGMENTS) segment *= 2;
+    return segment;
+}
+
+
+uint64_t Parallel_histogram_segments(uint64_t size) {
+    uint64_t segment = Parallel_histogram_segment_size(size);
+    return segment <= UINT32_MAX ? (size + segment - 1) / segment : 0;
+}
+
+
+int Parallel_histogram_file(int fd, uint64_t size, unsigned threads, uint64_t counts[256], uint32_t (*segments)[256]) {
+    if (threads == 0) threads = Parallel_histogram_default_threads();
+    uint64_t useful = (size + PARALLEL_HISTOGRAM_MIN_RANGE - 1) / PARALLEL_HISTOGRAM_MIN_RANGE;
+    if (threads > useful) threads = useful ? (unsigned)useful : 1;
+    // Each thread holds one read buffer; under a memory limit run fewer of them.
+    threads = Mem_fit(IO_CHUNK_SIZE, threads, 1, 2);
+
+    // Ranges are whole chunks, so every pread but the last is full size.
+    uint64_t chunks = (size + IO_CHUNK_SIZE - 1) / IO_CHUNK_SIZE;
+    Parallel_histogram_range* ranges = (Parallel_histogram_range*)Mem_calloc(MEM_IO, threads, sizeof(Parallel_histogram_range));
+    pthread_t* tids = (pthread_t*)Mem_alloc(MEM_IO, threads * sizeof(pthread_t));
+    if (!ranges || !tids) {
+        perror("Failed to allocate histogram ranges");
+        exit(EXIT_FAILURE);
+    }
+    posix_fadvise(fd, 0, (off_t)size, POSIX_FADV_SEQUENTIAL);
+
+    for (unsigned t = 0; t < threads; t++) {
+        uint64_t first = chunks * t / threads;
+        uint64_t last = chunks * (t + 1) / threads;
+        ranges[t].fd = fd;
+        ranges[t].segments = segments;
+        ranges[t].segment_size = Parallel_histogram_segment_size(size);
+        ranges[t].start = first * IO_CHUNK_SIZE < size ? first * IO_CHUNK_SIZE : size;
+        ranges[t].end = last * IO_CHUNK_SIZE < size ? last * IO_CHUNK_SIZE : size;
+    }
+    // The calling thread takes the first range itself.
+    for (unsigned t = 1; t < threads; t++) {
+        pthread_create(&tids[t], NULL, Parallel_histogram_worker, &ranges[t]);
+    }
+    Parallel_histogram_worker(&ranges[0]);
+
+    int failed = 0;
+    for (unsigned t = 0; t < threads; t++) {
+        if (t > 0) pthread_join(tids[t], NULL);
+        failed |= ranges[t].failed;
+        for (int i = 0; i < 256; i++) counts[i] += ranges[t].counts[i];
+    }
+    Mem_free(ranges);
+    Mem_free(tids);
+    return failed ? -1 : 0;
+}
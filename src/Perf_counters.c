@@ -0,0 +1,133 @@
+#include "Perf_counters.h"
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "Mem.h"
+
+#define PERF_CACHE_MISSES(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} PERF_EVENTS[PERF_COUNTER_COUNT] = {
+    [PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [PERF_L1D_MISSES] = { PERF_TYPE_HW_CACHE, PERF_CACHE_MISSES(PERF_COUNT_HW_CACHE_L1D) },
+    [PERF_LLC_MISSES] = { PERF_TYPE_HW_CACHE, PERF_CACHE_MISSES(PERF_COUNT_HW_CACHE_LL) },
+};
+
+#define X(name, label) [name] = label,
+static const char* PERF_LABELS[PERF_COUNTER_COUNT] = {
+    PERF_COUNTER_TABLE
+};
+#undef X
+
+
+static uint64_t Perf_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+
+static int Perf_open(Perf_counter counter) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_EVENTS[counter].type;
+    attr.config = PERF_EVENTS[counter].config;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.inherit = 1;           // include the I/O pipeline threads
+    attr.exclude_kernel = 1;    // allowed at perf_event_paranoid 2
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+// Current count, extrapolated over the time the counter was multiplexed out.
+static uint64_t Perf_read(int fd) {
+    uint64_t data[3];
+    if (read(fd, data, sizeof(data)) != (ssize_t)sizeof(data) || data[2] == 0) {
+        return 0;
+    }
+    if (data[2] >= data[1]) return data[0];
+    return (uint64_t)((double)data[0] * (double)data[1] / (double)data[2]);
+}
+
+
+Perf_session* Perf_session_create(int enabled) {
+    Perf_session* session = (Perf_session*)Mem_calloc(MEM_OTHER, 1, sizeof(Perf_session));
+    if (!session) {
+        perror("Failed to allocate Perf_session");
+        exit(EXIT_FAILURE);
+    }
+    session->enabled = enabled;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        session->fds[i] = enabled ? Perf_open((Perf_counter)i) : -1;
+        if (enabled && session->fds[i] < 0 && !session->open_error) {
+            session->open_error = errno;
+        }
+    }
+    return session;
+}
+
+
+void Perf_phase_begin(Perf_session* session, const char* name) {
+    if (!session->enabled || session->phase_count == PERF_MAX_PHASES) return;
+    session->phases[session->phase_count].name = name;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        session->start_values[i] = session->fds[i] >= 0 ? Perf_read(session->fds[i]) : 0;
+    }
+    session->start_ns = Perf_now_ns();
+}
+
+
+void Perf_phase_end(Perf_session* session) {
+    if (!session->enabled || session->phase_count == PERF_MAX_PHASES) return;
+    Perf_phase* phase = &session->phases[session->phase_count++];
+    phase->nanoseconds = Perf_now_ns() - session->start_ns;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        phase->values[i] = session->fds[i] >= 0 ? Perf_read(session->fds[i]) - session->start_values[i] : 0;
+    }
+}
+
+
+void Perf_session_report(const Perf_session* session, FILE* out) {
+    if (!session->enabled) return;
+    if (session->open_error) {
+        fprintf(out, "Some hardware counters are unavailable (%s); see /proc/sys/kernel/perf_event_paranoid.\n",
+                strerror(session->open_error));
+    }
+
+    fprintf(out, "%-12s %10s", "phase", "ms");
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) fprintf(out, " %14s", PERF_LABELS[i]);
+    fprintf(out, " %6s\n", "IPC");
+
+    for (size_t p = 0; p < session->phase_count; p++) {
+        const Perf_phase* phase = &session->phases[p];
+        fprintf(out, "%-12s %10.2f", phase->name, phase->nanoseconds / 1e6);
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            if (session->fds[i] >= 0) fprintf(out, " %14llu", (unsigned long long)phase->values[i]);
+            else fprintf(out, " %14s", "n/a");
+        }
+        if (session->fds[PERF_CYCLES] >= 0 && session->fds[PERF_INSTRUCTIONS] >= 0 && phase->values[PERF_CYCLES]) {
+            fprintf(out, " %6.2f\n", (double)phase->values[PERF_INSTRUCTIONS] / (double)phase->values[PERF_CYCLES]);
+        } else {
+            fprintf(out, " %6s\n", "n/a");
+        }
+    }
+}
+
+
+void Perf_session_destroy(Perf_session* session) {
+    if (!session) return;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (session->fds[i] >= 0) close(session->fds[i]);
+    }
+    Mem_free(session);
+}
@@ -0,0 +1,306 @@
+#include "Tans.h"
+#include <string.h>
+#include <math.h>
+
+
+static inline unsigned Tans_highbit(uint32_t value) {
+    return 31 - (unsigned)__builtin_clz(value);
+}
+
+
+unsigned Tans_table_log(uint64_t total, unsigned distinct) {
+    unsigned table_log = TANS_DEFAULT_TABLE_LOG;
+    // No more slots than bytes, but room for every symbol with some precision.
+    unsigned by_total = total > 1 ? 64 - (unsigned)__builtin_clzll(total - 1) : 1;
+    unsigned by_distinct = (distinct > 1 ? Tans_highbit(distinct - 1) + 1 : 0) + 2;
+    if (table_log > by_total) table_log = by_total;
+    if (table_log < by_distinct) table_log = by_distinct;
+    if (table_log < TANS_MIN_TABLE_LOG) table_log = TANS_MIN_TABLE_LOG;
+    if (table_log > TANS_MAX_TABLE_LOG) table_log = TANS_MAX_TABLE_LOG;
+    return table_log;
+}
+
+
+/*
+ * Rounds every count to its share of the table (at least one slot), then
+ * hands out or takes back the rounding difference one slot at a time from
+ * the symbol where it changes the estimated size least.
+ */
+void Tans_normalize(const uint64_t counts[256], uint64_t total, unsigned table_log, uint16_t norm[256]) {
+    const uint64_t table_size = (uint64_t)1 << table_log;
+    uint64_t sum = 0;
+
+    for (int s = 0; s < 256; s++) {
+        norm[s] = 0;
+        if (!counts[s]) continue;
+        uint64_t share = (counts[s] * table_size + total / 2) / total;
+        norm[s] = (uint16_t)(share ? share : 1);
+        sum += norm[s];
+    }
+
+    while (sum < table_size) {
+        int best = -1;
+        double best_gain = -1.0;
+        for (int s = 0; s < 256; s++) {
+            if (!norm[s]) continue;
+            double gain = (double)counts[s] * log2((norm[s] + 1.0) / norm[s]);
+            if (gain > best_gain) {
+                best_gain = gain;
+                best = s;
+            }
+        }
+        norm[best]++;
+        sum++;
+    }
+    while (sum > table_size) {
+        int best = -1;
+        double best_loss = 0.0;
+        for (int s = 0; s < 256; s++) {
+            if (norm[s] < 2) continue;
+            double loss = (double)counts[s] * log2((double)norm[s] / (norm[s] - 1.0));
+            if (best < 0 || loss < best_loss) {
+                best_loss = loss;
+                best = s;
+            }
+        }
+        norm[best]--;
+        sum--;
+    }
+}
+
+
+double Tans_cost(const uint64_t counts[256], const uint16_t norm[256], unsigned table_log) {
+    double bits = 0.0;
+    for (int s = 0; s < 256; s++) {
+        if (counts[s]) bits += (double)counts[s] * (table_log - log2((double)norm[s]));
+    }
+    return bits;
+}
+
+
+size_t Tans_write_norm(const uint16_t norm[256], unsigned table_log, uint8_t* out) {
+    int last = 255;
+    while (last > 0 && norm[last] == 0) last--;
+
+    size_t size = 0;
+    out[size++] = (uint8_t)table_log;
+    out[size++] = (uint8_t)last;
+    for (int s = 0; s <= last; s++) {
+        unsigned value = norm[s];
+        while (value >= 0x80) {
+            out[size++] = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        out[size++] = (uint8_t)value;
+    }
+    return size;
+}
+
+
+int Tans_read_norm(const uint8_t* in, size_t size, uint16_t norm[256], unsigned* table_log, size_t* used) {
+    if (size < 2) return -1;
+    *table_log = in[0];
+    if (*table_log < TANS_MIN_TABLE_LOG || *table_log > TANS_MAX_TABLE_LOG) return -1;
+
+    unsigned last = in[1];
+    size_t position = 2;
+    uint32_t sum = 0;
+    memset(norm, 0, 256 * sizeof(uint16_t));
+    for (unsigned s = 0; s <= last; s++) {
+        uint32_t value = 0;
+        for (unsigned shift = 0;; shift += 7) {
+            if (position >= size || shift > 14) return -1;
+            uint8_t byte = in[position++];
+            value |= (uint32_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        if (value > (1u << *table_log)) return -1;
+        norm[s] = (uint16_t)value;
+        sum += value;
+    }
+    if (sum != (1u << *table_log)) return -1;
+    *used = position;
+    return 0;
+}
+
+
+// FSE's spread: an odd step visits every slot of the power-of-two table once.
+static void Tans_spread(const uint16_t norm[256], unsigned table_log, uint8_t* spread) {
+    const uint32_t table_size = 1u << table_log;
+    const uint32_t mask = table_size - 1;
+    const uint32_t step = (table_size >> 1) + (table_size >> 3) + 3;
+    uint32_t position = 0;
+
+    for (int s = 0; s < 256; s++) {
+        for (unsigned i = 0; i < norm[s]; i++) {
+            spread[position] = (uint8_t)s;
+            position = (position + step) & mask;
+        }
+    }
+}
+
+
+void Tans_build_encoder(const uint16_t norm[256], unsigned table_log, Tans_encoder* enc) {
+    const uint32_t table_size = 1u << table_log;
+    uint8_t spread[1 << TANS_MAX_TABLE_LOG];
+    uint32_t cumul[257];
+
+    Tans_spread(norm, table_log, spread);
+    cumul[0] = 0;
+    for (int s = 0; s < 256; s++) cumul[s + 1] = cumul[s] + norm[s];
+    for (uint32_t u = 0; u < table_size; u++) {
+        enc->state_table[cumul[spread[u]]++] = (uint16_t)(table_size + u);
+    }
+
+    // For a state x in [table_size, 2 * table_size), (x + delta_bits) >> 16
+    // is the number of bits to emit before x shrinks into [norm, 2 * norm).
+    int32_t total = 0;
+    for (int s = 0; s < 256; s++) {
+        Tans_symbol_transform* t = &enc->symbols[s];
+        if (norm[s] == 0) {
+            t->delta_bits = 0;
+            t->delta_find_state = 0;
+        } else if (norm[s] == 1) {
+            t->delta_bits = (table_log << 16) - table_size;
+            t->delta_find_state = total - 1;
+            total += 1;
+        } else {
+            uint32_t max_bits_out = table_log - Tans_highbit(norm[s] - 1u);
+            uint32_t min_state_plus = (uint32_t)norm[s] << max_bits_out;
+            t->delta_bits = (max_bits_out << 16) - min_state_plus;
+            t->delta_find_state = total - norm[s];
+            total += norm[s];
+        }
+    }
+    enc->table_log = table_log;
+}
+
+
+void Tans_build_decode(const uint16_t norm[256], unsigned table_log, Tans_decode_entry* table) {
+    const uint32_t table_size = 1u << table_log;
+    uint8_t spread[1 << TANS_MAX_TABLE_LOG];
+    uint32_t next[256];
+
+    Tans_spread(norm, table_log, spread);
+    for (int s = 0; s < 256; s++) next[s] = norm[s];
+    for (uint32_t u = 0; u < table_size; u++) {
+        uint8_t symbol = spread[u];
+        uint32_t state = next[symbol]++;
+        unsigned bits = table_log - Tans_highbit(state);
+        table[u].symbol = symbol;
+        table[u].bits = (uint8_t)bits;
+        table[u].new_state = (uint16_t)((state << bits) - table_size);
+    }
+}
+
+
+// ===== ENCODE =====
+
+size_t Tans_encode(const Tans_encoder* enc, const uint8_t* in, size_t size, uint8_t* out, size_t capacity) {
+    const uint32_t table_size = 1u << enc->table_log;
+    uint8_t* ptr = out + capacity;
+    uint64_t acc = 0;
+    unsigned bits = 0;
+    uint32_t state = table_size;
+
+    // Bits go in above the older ones; whole 32-bit words leave from the
+    // bottom of the accumulator towards the front of the buffer.
+    for (size_t i = size; i-- > 0;) {
+        const Tans_symbol_transform* t = &enc->symbols[in[i]];
+        unsigned n = (state + t->delta_bits) >> 16;
+        acc |= (uint64_t)(state & ((1u << n) - 1)) << bits;
+        bits += n;
+        state = enc->state_table[(state >> n) + t->delta_find_state];
+
+        if (bits >= 32) {
+            if (ptr - out < 4) return 0;
+            ptr -= 4;
+            uint32_t word = __builtin_bswap32((uint32_t)acc);
+            memcpy(ptr, &word, sizeof(word));
+            acc >>= 32;
+            bits -= 32;
+        }
+    }
+
+    acc |= (uint64_t)(state - table_size) << bits;
+    bits += enc->table_log;
+    acc |= (uint64_t)1 << bits;     // marker
+    bits += 1;
+    while (bits > 0) {
+        if (ptr == out) return 0;
+        *--ptr = (uint8_t)acc;
+        acc >>= 8;
+        bits = bits > 8 ? bits - 8 : 0;
+    }
+
+    size_t stream_size = (size_t)(out + capacity - ptr);
+    memmove(out, ptr, stream_size);
+    return stream_size;
+}
+
+
+// ===== DECODE =====
+
+// Like Bit_reader_read, but n == 0 is allowed and reads nothing.
+static inline uint32_t Tans_read_bits(Bit_reader* br, unsigned n) {
+    uint32_t value = (uint32_t)((br->container >> 1) >> (63 - n));
+    Bit_reader_consume(br, n);
+    return value;
+}
+
+
+int Tans_decode(const Tans_decode_entry* table, unsigned table_log, Bit_reader* br,
+                uint8_t** op, uint8_t* const* oend, unsigned streams) {
+    const unsigned per_refill = 4;
+    uint32_t state[4];
+    Bit_reader r[4];
+    uint8_t* o[4];
+
+    for (unsigned s = 0; s < streams; s++) {
+        r[s] = br[s];
+        o[s] = op[s];
+        Bit_reader_refill(&r[s]);
+        if (r[s].bit_count < 8) return -1;
+        unsigned first = (unsigned)Bit_reader_peek(&r[s], 8);
+        if (first == 0) return -1;
+        Bit_reader_consume(&r[s], (unsigned)__builtin_clz(first) - 24 + 1);
+        Bit_reader_refill(&r[s]);
+        if (r[s].bit_count < table_log) return -1;
+        state[s] = (uint32_t)Bit_reader_read(&r[s], table_log);
+    }
+
+    for (;;) {
+        int ready = 1;
+        for (unsigned s = 0; s < streams; s++) {
+            ready &= (size_t)(oend[s] - o[s]) >= per_refill;
+        }
+        if (!ready) break;
+        for (unsigned s = 0; s < streams; s++) {
+            Bit_reader_refill(&r[s]);
+            ready &= r[s].bit_count >= per_refill * table_log;
+        }
+        if (!ready) break;
+
+        for (unsigned k = 0; k < per_refill; k++) {
+            for (unsigned s = 0; s < streams; s++) {
+                Tans_decode_entry entry = table[state[s]];
+                *o[s]++ = entry.symbol;
+                state[s] = entry.new_state + Tans_read_bits(&r[s], entry.bits);
+            }
+        }
+    }
+
+    for (unsigned s = 0; s < streams; s++) {
+        while (o[s] < oend[s]) {
+            Bit_reader_refill(&r[s]);
+            Tans_decode_entry entry = table[state[s]];
+            if (entry.bits > r[s].bit_count) return -1;
+            *o[s]++ = entry.symbol;
+            state[s] = entry.new_state + Tans_read_bits(&r[s], entry.bits);
+        }
+        if (state[s] != 0 || Bit_reader_input_left(&r[s]) != 0 || r[s].bit_count != 0) return -1;
+        br[s] = r[s];
+        op[s] = o[s];
+    }
+    return 0;
+}
@@ -0,0 +1,555 @@
+#include "Transform.h"
+#include <string.h>
+#include <math.h>
+#include "Cpu_dispatch.h"
+#include "Mem.h"
+
+#define X(name, code, text) [code] = text,
+static const char* TRANSFORM_NAMES[TRANSFORM_COUNT] = {
+    TRANSFORM_TABLE
+};
+#undef X
+
+
+Transform_workspace* Transform_workspace_create(void) {
+    Transform_workspace* ws = (Transform_workspace*)Mem_calloc(MEM_TRANSFORM, 1, sizeof(Transform_workspace));
+    if (!ws) {
+        perror("Failed to allocate Transform_workspace");
+        exit(EXIT_FAILURE);
+    }
+    return ws;
+}
+
+
+void Transform_workspace_destroy(Transform_workspace* ws) {
+    if (!ws) return;
+    Mem_free(ws->buffers[0]);
+    Mem_free(ws->buffers[1]);
+    Mem_free(ws->work);
+    Mem_free(ws);
+}
+
+
+// BWT needs four n-entry arrays plus the counting-sort buckets.
+static void Transform_reserve(Transform_workspace* ws, size_t size) {
+    if (size <= ws->capacity) return;
+    Mem_free(ws->buffers[0]);
+    Mem_free(ws->buffers[1]);
+    Mem_free(ws->work);
+    ws->buffers[0] = (uint8_t*)Mem_alloc(MEM_TRANSFORM, size);
+    ws->buffers[1] = (uint8_t*)Mem_alloc(MEM_TRANSFORM, size);
+    ws->work = (uint32_t*)Mem_alloc(MEM_TRANSFORM, (4 * size + (size > 256 ? size : 256)) * sizeof(uint32_t));
+    if (!ws->buffers[0] || !ws->buffers[1] || !ws->work) {
+        perror("Failed to allocate transform buffers");
+        exit(EXIT_FAILURE);
+    }
+    ws->capacity = size;
+}
+
+
+const char* Transform_name(unsigned kind) {
+    return kind < TRANSFORM_COUNT ? TRANSFORM_NAMES[kind] : "unknown";
+}
+
+
+int Transform_parse_set(const char* name, unsigned* set) {
+    if (strcmp(name, "none") == 0) *set = 0;
+    else if (strcmp(name, "delta") == 0) *set = TRANSFORM_SET_DELTA;
+    else if (strcmp(name, "mtf") == 0) *set = TRANSFORM_SET(TRANSFORM_MTF);
+    else if (strcmp(name, "bwt") == 0) *set = TRANSFORM_SET(TRANSFORM_BWT);
+    else if (strcmp(name, "auto") == 0) *set = TRANSFORM_SET_ALL;
+    else return -1;
+    return 0;
+}
+
+
+size_t Transform_parameter_size(unsigned kind) {
+    return kind == TRANSFORM_BWT ? TRANSFORM_BWT_STREAMS * sizeof(uint32_t) : 0;
+}
+
+
+// ===== DELTA =====
+
+static void Transform_delta_forward(const uint8_t* in, size_t size, size_t stride, uint8_t* out) {
+    size_t head = size < stride ? size : stride;
+    memcpy(out, in, head);
+    for (size_t i = head; i < size; i++) {
+        out[i] = (uint8_t)(in[i] - in[i - stride]);
+    }
+}
+
+
+static void Transform_delta_inverse(const uint8_t* in, size_t size, size_t stride, uint8_t* out) {
+    size_t head = size < stride ? size : stride;
+    memcpy(out, in, head);
+    for (size_t i = head; i < size; i++) {
+        out[i] = (uint8_t)(in[i] + out[i - stride]);
+    }
+}
+
+
+// ===== MOVE-TO-FRONT =====
+
+static void Transform_mtf_forward(const uint8_t* in, size_t size, uint8_t* out) {
+    uint8_t order[256];
+    for (int i = 0; i < 256; i++) order[i] = (uint8_t)i;
+
+    for (size_t i = 0; i < size; i++) {
+        uint8_t byte = in[i];
+        if (order[0] == byte) {
+            out[i] = 0;
+            continue;
+        }
+        unsigned index = 1;
+        uint8_t moved = order[0];
+        // Shift while searching: every byte passed over moves one place back.
+        while (order[index] != byte) {
+            uint8_t swap = order[index];
+            order[index] = moved;
+            moved = swap;
+            index++;
+        }
+        order[index] = moved;
+        order[0] = byte;
+        out[i] = (uint8_t)index;
+    }
+}
+
+
+// A BWT leaves mostly zero indices, which repeat the front byte and leave the
+// order unchanged, so zero runs are filled with memset and small indices are
+// shifted in place instead of through memmove.
+static void Transform_mtf_inverse(const uint8_t* in, size_t size, uint8_t* out) {
+    uint8_t order[256];
+    for (int i = 0; i < 256; i++) order[i] = (uint8_t)i;
+
+    size_t i = 0;
+    while (i < size) {
+        if (in[i] == 0) {
+            size_t run = i + 1;
+            while (run < size && in[run] == 0) run++;
+            memset(out + i, order[0], run - i);
+            i = run;
+            continue;
+        }
+        unsigned index = in[i];
+        uint8_t byte = order[index];
+        if (index <= 8) {
+            for (unsigned j = index; j > 0; j--) order[j] = order[j - 1];
+        } else {
+            memmove(order + 1, order, index);
+        }
+        order[0] = byte;
+        out[i++] = byte;
+    }
+}
+
+
+// ===== BWT =====
+
+/*
+ * Rotation sort state. `order` lists rotations in sorted order, except that a
+ * negative entry -k starts a run of k rotations that are already in their
+ * final place. `group[i]` is the index of the last row of rotation i's group,
+ * so it is also the rank of i's first `depth` bytes.
+ */
+typedef struct {
+    int32_t* order;
+    int32_t* group;
+    size_t n;
+    size_t depth;
+} Transform_bwt_sort;
+
+#define TRANSFORM_BWT_RADIX_BUCKETS 65536
+
+#define TRANSFORM_BWT_KEY(sort, p) \
+    ((sort)->group[(size_t)*(p) + (sort)->depth < (sort)->n ? (size_t)*(p) + (sort)->depth : (size_t)*(p) + (sort)->depth - (sort)->n])
+
+#define TRANSFORM_BWT_SWAP(a, b) do { int32_t swap = *(a); *(a) = *(b); *(b) = swap; } while (0)
+
+
+static void Transform_bwt_update_group(Transform_bwt_sort* sort, int32_t* first, int32_t* last) {
+    int32_t g = (int32_t)(last - sort->order);
+    sort->group[*first] = g;
+    if (first == last) {
+        *first = -1;
+        return;
+    }
+    while (first < last) sort->group[*++first] = g;
+}
+
+
+static void Transform_bwt_select_split(Transform_bwt_sort* sort, int32_t* p, size_t n) {
+    int32_t* a = p;
+    int32_t* last = p + n - 1;
+    while (a < last) {
+        int32_t* b = a + 1;
+        int32_t min = TRANSFORM_BWT_KEY(sort, a);
+        for (int32_t* i = a + 1; i <= last; i++) {
+            int32_t key = TRANSFORM_BWT_KEY(sort, i);
+            if (key < min) {
+                min = key;
+                TRANSFORM_BWT_SWAP(i, a);
+                b = a + 1;
+            } else if (key == min) {
+                TRANSFORM_BWT_SWAP(i, b);
+                b++;
+            }
+        }
+        Transform_bwt_update_group(sort, a, b - 1);
+        a = b;
+    }
+    if (a == last) {
+        sort->group[*a] = (int32_t)(a - sort->order);
+        *a = -1;
+    }
+}
+
+
+static int32_t Transform_bwt_median(Transform_bwt_sort* sort, int32_t* a, int32_t* b, int32_t* c) {
+    int32_t x = TRANSFORM_BWT_KEY(sort, a), y = TRANSFORM_BWT_KEY(sort, b), z = TRANSFORM_BWT_KEY(sort, c);
+    if (x < y) return y < z ? y : (x < z ? z : x);
+    return x < z ? x : (y < z ? z : y);
+}
+
+
+/*
+ * Ternary quicksort of one group on the rank `depth` bytes further on. The
+ * equal part becomes a new group before the greater part is sorted, so keys
+ * read there already see the refined ranks.
+ */
+static void Transform_bwt_split(Transform_bwt_sort* sort, int32_t* p, size_t n) {
+    if (n < 7) {
+        Transform_bwt_select_split(sort, p, n);
+        return;
+    }
+
+    int32_t pivot;
+    if (n > 40) {
+        size_t step = n / 8;
+        pivot = Transform_bwt_median(sort, p, p + step, p + 2 * step);
+        int32_t mid = Transform_bwt_median(sort, p + n / 2 - step, p + n / 2, p + n / 2 + step);
+        int32_t end = Transform_bwt_median(sort, p + n - 1 - 2 * step, p + n - 1 - step, p + n - 1);
+        pivot = pivot < mid ? (mid < end ? mid : (pivot < end ? end : pivot))
+                            : (pivot < end ? pivot : (mid < end ? end : mid));
+    } else {
+        pivot = Transform_bwt_median(sort, p, p + n / 2, p + n - 1);
+    }
+
+    int32_t* a = p;
+    int32_t* b = p;
+    int32_t* c = p + n - 1;
+    int32_t* d = c;
+    for (;;) {
+        int32_t key;
+        while (b <= c && (key = TRANSFORM_BWT_KEY(sort, b)) <= pivot) {
+            if (key == pivot) {
+                TRANSFORM_BWT_SWAP(a, b);
+                a++;
+            }
+            b++;
+        }
+        while (c >= b && (key = TRANSFORM_BWT_KEY(sort, c)) >= pivot) {
+            if (key == pivot) {
+                TRANSFORM_BWT_SWAP(c, d);
+                d--;
+            }
+            c--;
+        }
+        if (b > c) break;
+        TRANSFORM_BWT_SWAP(b, c);
+        b++;
+        c--;
+    }
+
+    int32_t* end = p + n;
+    size_t s = (size_t)(a - p) < (size_t)(b - a) ? (size_t)(a - p) : (size_t)(b - a);
+    for (int32_t *l = p, *m = b - s; s; s--, l++, m++) TRANSFORM_BWT_SWAP(l, m);
+    s = (size_t)(d - c) < (size_t)(end - d - 1) ? (size_t)(d - c) : (size_t)(end - d - 1);
+    for (int32_t *l = b, *m = end - s; s; s--, l++, m++) TRANSFORM_BWT_SWAP(l, m);
+
+    size_t less = (size_t)(b - a);
+    size_t greater = (size_t)(d - c);
+    if (less > 0) Transform_bwt_split(sort, p, less);
+    Transform_bwt_update_group(sort, p + less, p + n - greater - 1);
+    if (greater > 0) Transform_bwt_split(sort, p + n - greater, greater);
+}
+
+
+/*
+ * Sorts all cyclic rotations of `in` by doubling (Larsson-Sadakane): each
+ * round re-sorts only the groups whose first `depth` bytes still tie, on the
+ * rank of the rotation `depth` bytes on, so text stops paying for its
+ * resolved rotations after a few rounds. No sentinel is needed; rotations
+ * that stay equal (periodic input) invert to the same bytes in any order.
+ * Writes the last column and the rows the inverse starts its walks from.
+ */
+static void Transform_bwt_forward(Transform_workspace* ws, const uint8_t* in, size_t n, uint8_t* out,
+                                  uint32_t parameter[TRANSFORM_MAX_PARAMETERS]) {
+    Transform_bwt_sort sort = { (int32_t*)ws->work, (int32_t*)ws->work + n, n, 1 };
+    uint32_t* next = ws->work + 2 * n;
+    uint32_t* count = ws->work + 4 * n;
+
+    if (n >= TRANSFORM_BWT_RADIX_BUCKETS) {
+        // Blocks with room for 64 Ki buckets start from their first 4 bytes,
+        // radix sorted in two 16-bit passes.
+        uint32_t* key = next;
+        uint32_t* low = ws->work + 3 * n;
+        for (size_t i = 0; i < n; i++) {
+            uint32_t k = 0;
+            for (size_t j = 0; j < 4; j++) k = (k << 8) | in[i + j < n ? i + j : i + j - n];
+            key[i] = k;
+        }
+        memset(count, 0, TRANSFORM_BWT_RADIX_BUCKETS * sizeof(uint32_t));
+        for (size_t i = 0; i < n; i++) count[key[i] & 0xFFFF]++;
+        for (size_t i = 1; i < TRANSFORM_BWT_RADIX_BUCKETS; i++) count[i] += count[i - 1];
+        for (size_t i = n; i-- > 0;) low[--count[key[i] & 0xFFFF]] = (uint32_t)i;
+        memset(count, 0, TRANSFORM_BWT_RADIX_BUCKETS * sizeof(uint32_t));
+        for (size_t i = 0; i < n; i++) count[key[i] >> 16]++;
+        for (size_t i = 1; i < TRANSFORM_BWT_RADIX_BUCKETS; i++) count[i] += count[i - 1];
+        for (size_t i = n; i-- > 0;) sort.order[--count[key[low[i]] >> 16]] = (int32_t)low[i];
+        sort.depth = 4;
+    } else {
+        memset(count, 0, 256 * sizeof(uint32_t));
+        for (size_t i = 0; i < n; i++) count[in[i]]++;
+        for (int i = 1; i < 256; i++) count[i] += count[i - 1];
+        for (size_t i = n; i-- > 0;) sort.order[--count[in[i]]] = (int32_t)i;
+        for (size_t i = 0; i < n; i++) next[i] = in[i];
+    }
+
+    // Each group is numbered by its last row; singletons are already placed.
+    for (size_t end = n; end > 0;) {
+        size_t first = end - 1;
+        uint32_t k = next[sort.order[first]];
+        while (first > 0 && next[sort.order[first - 1]] == k) first--;
+        for (size_t i = first; i < end; i++) sort.group[sort.order[i]] = (int32_t)(end - 1);
+        if (end - first == 1) sort.order[first] = -1;
+        end = first;
+    }
+
+    while (sort.order[0] != -(int32_t)n && sort.depth < n) {
+        size_t i = 0;
+        int32_t sorted = 0;
+        while (i < n) {
+            int32_t first = sort.order[i];
+            if (first < 0) {
+                i -= first;
+                sorted += first;
+                continue;
+            }
+            if (sorted) {
+                sort.order[i + sorted] = sorted;
+                sorted = 0;
+            }
+            size_t end = (size_t)sort.group[first] + 1;
+            Transform_bwt_split(&sort, sort.order + i, end - i);
+            i = end;
+        }
+        if (sorted) sort.order[i + sorted] = sorted;
+        sort.depth <<= 1;
+    }
+
+    // Rows of a group still tied after n bytes hold equal rotations; fill
+    // them from the group's last row down.
+    for (size_t i = 0; i < n; i++) next[i] = (uint32_t)i;
+    uint32_t* rows = (uint32_t*)sort.order;
+    for (size_t i = 0; i < n; i++) rows[next[sort.group[i]]--] = (uint32_t)i;
+
+    // Stream s decodes bytes [s * n / S, (s + 1) * n / S) backwards, so it
+    // starts at the row of the rotation that begins right after them.
+    uint32_t starts[TRANSFORM_BWT_STREAMS];
+    for (size_t s = 0; s < TRANSFORM_BWT_STREAMS; s++) {
+        starts[s] = (uint32_t)((s + 1) * n / TRANSFORM_BWT_STREAMS % n);
+    }
+    for (size_t i = 0; i < n; i++) {
+        out[i] = in[rows[i] ? rows[i] - 1 : n - 1];
+        for (size_t s = 0; s < TRANSFORM_BWT_STREAMS; s++) {
+            if (rows[i] == starts[s]) parameter[s] = (uint32_t)i;
+        }
+    }
+}
+
+
+// Largest block whose LF entries fit 24 bits next to their byte.
+#define TRANSFORM_BWT_PACKED_SIZE ((size_t)1 << 24)
+
+/*
+ * Walks the LF mapping back from the start rows, emitting bytes last to
+ * first. Every step is a random access, so the row's byte is packed into the
+ * low 8 bits of its LF entry, and the walks of the streams are interleaved
+ * so that their cache misses overlap instead of queueing.
+ */
+static int Transform_bwt_inverse(Transform_workspace* ws, const uint8_t* in, size_t n,
+                                 const uint32_t parameter[TRANSFORM_MAX_PARAMETERS], uint8_t* out) {
+    for (size_t s = 0; s < TRANSFORM_BWT_STREAMS; s++) {
+        if (parameter[s] >= n) return -1;
+    }
+    uint32_t* lf = ws->work;
+    uint32_t base[256] = { 0 };
+
+    for (size_t i = 0; i < n; i++) base[in[i]]++;
+    uint32_t sum = 0;
+    for (int i = 0; i < 256; i++) {
+        uint32_t count = base[i];
+        base[i] = sum;
+        sum += count;
+    }
+
+    size_t ends[TRANSFORM_BWT_STREAMS];
+    for (size_t s = 0; s < TRANSFORM_BWT_STREAMS; s++) {
+        ends[s] = (s + 1) * n / TRANSFORM_BWT_STREAMS;
+    }
+
+    if (n <= TRANSFORM_BWT_PACKED_SIZE) {
+        for (size_t i = 0; i < n; i++) lf[i] = (base[in[i]]++ << 8) | in[i];
+
+        uint32_t entry[TRANSFORM_BWT_STREAMS];
+        for (size_t s = 0; s < TRANSFORM_BWT_STREAMS; s++) entry[s] = lf[parameter[s]];
+        // Streams are n / S or n / S + 1 bytes long; the longer ones finish alone.
+        size_t shortest = n / TRANSFORM_BWT_STREAMS;
+        for (size_t step = 0; step < shortest; step++) {
+            for (size_t s = 0; s < TRANSFORM_BWT_STREAMS; s++) {
+                out[ends[s] - 1 - step] = (uint8_t)entry[s];
+                entry[s] = lf[entry[s] >> 8];
+            }
+        }
+        for (size_t s = 0; s < TRANSFORM_BWT_STREAMS; s++) {
+            size_t begin = s * n / TRANSFORM_BWT_STREAMS;
+            for (size_t k = ends[s] - shortest; k-- > begin;) {
+                out[k] = (uint8_t)entry[s];
+                entry[s] = lf[entry[s] >> 8];
+            }
+        }
+        return 0;
+    }
+
+    for (size_t i = 0; i < n; i++) lf[i] = base[in[i]]++;
+
+    for (size_t s = 0; s < TRANSFORM_BWT_STREAMS; s++) {
+        size_t begin = s * n / TRANSFORM_BWT_STREAMS;
+        size_t row = parameter[s];
+        for (size_t k = ends[s]; k-- > begin;) {
+            out[k] = in[row];
+            row = lf[row];
+        }
+    }
+    return 0;
+}
+
+
+// ===== SELECTION =====
+
+void Transform_forward(Transform_workspace* ws, unsigned kind, const uint8_t* in, size_t size,
+                       uint8_t* out, uint32_t parameter[TRANSFORM_MAX_PARAMETERS]) {
+    memset(parameter, 0, TRANSFORM_MAX_PARAMETERS * sizeof(uint32_t));
+    switch (kind) {
+        case TRANSFORM_DELTA1: Transform_delta_forward(in, size, 1, out); break;
+        case TRANSFORM_DELTA2: Transform_delta_forward(in, size, 2, out); break;
+        case TRANSFORM_DELTA4: Transform_delta_forward(in, size, 4, out); break;
+        case TRANSFORM_MTF: Transform_mtf_forward(in, size, out); break;
+        case TRANSFORM_BWT:
+            // The MTF pass turns the BWT's runs into small indices.
+            Transform_reserve(ws, size);
+            Transform_bwt_forward(ws, in, size, out, parameter);
+            Transform_mtf_forward(out, size, out);
+            break;
+        default: memcpy(out, in, size); break;
+    }
+}
+
+
+int Transform_inverse(Transform_workspace* ws, unsigned kind, const uint8_t* in, size_t size,
+                      const uint32_t parameter[TRANSFORM_MAX_PARAMETERS], uint8_t* out) {
+    switch (kind) {
+        case TRANSFORM_NONE: memcpy(out, in, size); return 0;
+        case TRANSFORM_DELTA1: Transform_delta_inverse(in, size, 1, out); return 0;
+        case TRANSFORM_DELTA2: Transform_delta_inverse(in, size, 2, out); return 0;
+        case TRANSFORM_DELTA4: Transform_delta_inverse(in, size, 4, out); return 0;
+        case TRANSFORM_MTF: Transform_mtf_inverse(in, size, out); return 0;
+        case TRANSFORM_BWT:
+            Transform_reserve(ws, size);
+            Transform_mtf_inverse(in, size, ws->buffers[0]);
+            return Transform_bwt_inverse(ws, ws->buffers[0], size, parameter, out);
+        default: return -1;
+    }
+}
+
+
+// Order-0 entropy in bits: what an ideal Huffman code would spend on `data`.
+static double Transform_cost(const uint8_t* data, size_t size) {
+    uint64_t counts[256] = { 0 };
+    Kernels_get()->histogram(data, size, counts);
+    double bits = 0.0;
+    for (int i = 0; i < 256; i++) {
+        if (counts[i]) bits += (double)counts[i] * log2((double)size / (double)counts[i]);
+    }
+    return bits;
+}
+
+
+// Tries every allowed transform on `in` and returns the cheapest output, or
+// NULL when none beats `in_cost`. Outputs alternate between the two buffers.
+static const uint8_t* Transform_pick(Transform_workspace* ws, const uint8_t* in, size_t size, unsigned allowed,
+                                     double in_cost, uint8_t* kind, uint32_t parameter[TRANSFORM_MAX_PARAMETERS]) {
+    const uint8_t* best = NULL;
+    double best_cost = in_cost;
+    int spare = 0;
+
+    for (unsigned candidate = TRANSFORM_NONE + 1; candidate < TRANSFORM_COUNT; candidate++) {
+        if (!(allowed & TRANSFORM_SET(candidate))) continue;
+
+        uint32_t candidate_parameter[TRANSFORM_MAX_PARAMETERS];
+        uint8_t* out = ws->buffers[spare];
+        Transform_forward(ws, candidate, in, size, out, candidate_parameter);
+        // Parameters are stored in the payload too, so they count against the candidate.
+        double cost = Transform_cost(out, size) + 8.0 * Transform_parameter_size(candidate);
+        if (cost < best_cost) {
+            best = out;
+            best_cost = cost;
+            *kind = (uint8_t)candidate;
+            memcpy(parameter, candidate_parameter, sizeof(candidate_parameter));
+            spare ^= 1;
+        }
+    }
+    return best;
+}
+
+
+const uint8_t* Transform_choose(Transform_workspace* ws, const uint8_t* in, size_t size, unsigned allowed,
+                                uint8_t* kind, uint32_t parameter[TRANSFORM_MAX_PARAMETERS]) {
+    *kind = TRANSFORM_NONE;
+    memset(parameter, 0, TRANSFORM_MAX_PARAMETERS * sizeof(uint32_t));
+    if (size < 2 || allowed == 0) return in;
+
+    Transform_reserve(ws, size);
+    double in_cost = Transform_cost(in, size);
+    if (size <= 2 * TRANSFORM_SAMPLE_BYTES) {
+        const uint8_t* best = Transform_pick(ws, in, size, allowed, in_cost, kind, parameter);
+        return best ? best : in;
+    }
+
+    /*
+     * Large blocks pick the candidate on slices spread over the block and
+     * run only the winner over all of it; a BWT is the bulk of the encode
+     * time, so it should not run on blocks that then keep another transform.
+     */
+    size_t slice = TRANSFORM_SAMPLE_BYTES / TRANSFORM_SAMPLE_SLICES;
+    for (size_t i = 0; i < TRANSFORM_SAMPLE_SLICES; i++) {
+        size_t offset = i * (size - slice) / (TRANSFORM_SAMPLE_SLICES - 1);
+        memcpy(ws->sample + i * slice, in + offset, slice);
+    }
+    uint8_t candidate;
+    uint32_t candidate_parameter[TRANSFORM_MAX_PARAMETERS];
+    double sample_cost = Transform_cost(ws->sample, TRANSFORM_SAMPLE_BYTES);
+    if (!Transform_pick(ws, ws->sample, TRANSFORM_SAMPLE_BYTES, allowed, sample_cost, &candidate, candidate_parameter)) {
+        return in;
+    }
+
+    Transform_forward(ws, candidate, in, size, ws->buffers[0], candidate_parameter);
+    double cost = Transform_cost(ws->buffers[0], size) + 8.0 * Transform_parameter_size(candidate);
+    if (cost >= in_cost) return in;
+
+    *kind = candidate;
+    memcpy(parameter, candidate_parameter, sizeof(candidate_parameter));
+    return ws->buffers[0];
+}
@@ -1,8 +1,9 @@
 #include "Trie.h"
+#include "Mem.h"
 
 
 TrieNode* TrieNode_create() {
-    TrieNode* node = (TrieNode*)malloc(sizeof(TrieNode));
+    TrieNode* node = (TrieNode*)Mem_alloc(MEM_TRIE, sizeof(TrieNode));
     if (!node) {
         perror("Failed to allocate TrieNode");
         exit(EXIT_FAILURE);
@@ -60,36 +61,5 @@ void Trie_destroy(TrieNode* root) {
 
     Trie_destroy(root->left);
     Trie_destroy(root->right);
-    free(root);
+    Mem_free(root);
 }
-
-void decode(TrieNode* root, uint8_t* data, size_t total_bits, FILE* outputFile) {
-    TrieNode* current = root; 
-    size_t bit_offset = 0;    
-
-    
-    while (bit_offset < total_bits) {
-        
-        size_t byte_index = bit_offset / 8;    
-        size_t bit_index = bit_offset % 8;    
-        uint8_t bit = (data[byte_index] >> (7 - bit_index)) & 1; 
-
-        
-        if (bit == 0) {
-            current = current->left;
-        } else {
-            current = current->right;
-        }
-
-        
-        if (current->is_leaf) {
-            
-            fwrite(&current->character, 1, 1, outputFile);
-            
-            current = root;
-        }
-
-        
-        bit_offset++;
-    }
-}
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include "Trie_decoder.h"
+#include "Mem.h"
+
+
+Trie_decoder* Trie_decoder_create(TrieNode* root) {
+    Trie_decoder* dec = (Trie_decoder*)Mem_alloc(MEM_TRIE, sizeof(Trie_decoder));
+    if (!dec) {
+        perror("Failed to allocate Trie_decoder");
+        exit(EXIT_FAILURE);
+    }
+    dec->root = root;
+    dec->current = root;
+    dec->error = 0;
+
+    for (uint32_t index = 0; index < (1u << TRIE_DECODER_TABLE_BITS); index++) {
+        TrieNode* node = root;
+        uint8_t length = 0;
+
+        for (int i = TRIE_DECODER_TABLE_BITS - 1; i >= 0 && node && !node->is_leaf; i--) {
+            node = ((index >> i) & 1) ? node->right : node->left;
+            length++;
+        }
+        dec->table[index].node = node;
+        dec->table[index].length = (node && node->is_leaf) ? length : 0;
+    }
+    return dec;
+}
+
+
+static inline __attribute__((always_inline))
+size_t Trie_decoder_decode_body(Trie_decoder* dec, Bit_reader* br, uint8_t* out, size_t max_symbols) {
+    const Trie_decoder_entry* table = dec->table;
+    TrieNode* root = dec->root;
+    TrieNode* current = dec->current;
+    size_t n = 0;
+
+    while (n < max_symbols) {
+        Bit_reader_refill(br);
+
+        if (current == root && br->bit_count >= TRIE_DECODER_TABLE_BITS) {
+            const Trie_decoder_entry* entry = &table[Bit_reader_peek(br, TRIE_DECODER_TABLE_BITS)];
+            if (entry->length == 0) {
+                Bit_reader_consume(br, TRIE_DECODER_TABLE_BITS);
+                current = entry->node;
+                if (!current) {
+                    dec->error = 1;
+                    break;
+                }
+                continue;
+            }
+
+            // A refill leaves at least 56 bits, enough for several short codes.
+            do {
+                Bit_reader_consume(br, entry->length);
+                out[n++] = entry->node->character;
+                if (n == max_symbols || br->bit_count < TRIE_DECODER_TABLE_BITS) {
+                    break;
+                }
+                entry = &table[Bit_reader_peek(br, TRIE_DECODER_TABLE_BITS)];
+            } while (entry->length != 0);
+            continue;
+        }
+
+        // Long code, or fewer than TABLE_BITS bits left in this buffer.
+        if (br->bit_count == 0) {
+            break;
+        }
+        current = Bit_reader_read(br, 1) ? current->right : current->left;
+        if (!current) {
+            dec->error = 1;
+            break;
+        }
+        if (current->is_leaf) {
+            out[n++] = current->character;
+            current = root;
+        }
+    }
+
+    dec->current = current;
+    return n;
+}
+
+
+size_t Trie_decoder_decode_scalar(Trie_decoder* dec, Bit_reader* br, uint8_t* out, size_t max_symbols) {
+    return Trie_decoder_decode_body(dec, br, out, max_symbols);
+}
+
+
+#if defined(__x86_64__)
+// BMI2 build of the same loop: peek/consume shifts compile to shrx/shlx.
+__attribute__((target("bmi,bmi2")))
+size_t Trie_decoder_decode_bmi2(Trie_decoder* dec, Bit_reader* br, uint8_t* out, size_t max_symbols) {
+    return Trie_decoder_decode_body(dec, br, out, max_symbols);
+}
+#else
+size_t Trie_decoder_decode_bmi2(Trie_decoder* dec, Bit_reader* br, uint8_t* out, size_t max_symbols) {
+    return Trie_decoder_decode_body(dec, br, out, max_symbols);
+}
+#endif
+
+
+void Trie_decoder_destroy(Trie_decoder* dec) {
+    Mem_free(dec);
+}
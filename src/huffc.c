@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "Huffd_protocol.h"
+#include "Latency_stats.h"
+#include "Mem.h"
+#include "exception_xmacro.h"
+
+#define USAGE "Usage: %s <socket_path> <-c | -dc | --stats> [input_file] [--fd] [--repeat=N] [--output=PATH]\n"
+
+/*
+ * huffc : client for huffd. Sends the input file inline (or, with --fd, its
+ * descriptor) as a compress/decompress request and writes the reply next to
+ * it the same way bin/main names its output. --repeat sends the request N
+ * times on one connection and prints the round-trip latency percentiles.
+ */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+
+static uint8_t* read_file(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, "Failed to open input file: %s\n", path);
+    }
+    fseeko(file, 0, SEEK_END);
+    *size = (size_t)ftello(file);
+    fseeko(file, 0, SEEK_SET);
+    uint8_t* data = (uint8_t*)Mem_alloc(MEM_SERVER, *size ? *size : 1);
+    if (!data) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, "Failed to allocate input buffer.\n");
+    }
+    if (fread(data, 1, *size, file) != *size) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, "Failed to read input file: %s\n", path);
+    }
+    fclose(file);
+    return data;
+}
+
+
+static char* output_path_for(const char* inputFilePath, uint8_t op) {
+    size_t length = strlen(inputFilePath);
+    char* path = (char*)Mem_alloc(MEM_SERVER, length + sizeof(".huff"));
+    if (!path) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, "Failed to allocate output path.\n");
+    }
+    memcpy(path, inputFilePath, length + 1);
+    if (op == HUFFD_OP_COMPRESS) {
+        strcat(path, ".huff");
+        return path;
+    }
+    char* extension = strrchr(path, '.');
+    if (!extension || strcmp(extension, ".huff") != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT,
+            "Error: Input file does not have a valid .huff extension.\n");
+    }
+    strcpy(extension, ".orig");
+    return path;
+}
+
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, USAGE, argv[0]);
+    }
+    const char* socketPath = argv[1];
+    const char* mode = argv[2];
+    const char* inputFilePath = NULL;
+    const char* outputFilePath = NULL;
+    int pass_fd = 0;
+    long repeat = 1;
+
+    Huffd_request request;
+    memset(&request, 0, sizeof(request));
+    if (strcmp(mode, "-c") == 0) {
+        request.op = HUFFD_OP_COMPRESS;
+    } else if (strcmp(mode, "-dc") == 0) {
+        request.op = HUFFD_OP_DECOMPRESS;
+    } else if (strcmp(mode, "--stats") == 0) {
+        request.op = HUFFD_OP_STATS;
+    } else {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, USAGE, argv[0]);
+    }
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--fd") == 0) {
+            pass_fd = 1;
+        } else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+            repeat = atol(argv[i] + 9);
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            outputFilePath = argv[i] + 9;
+        } else if (argv[i][0] != '-' && !inputFilePath) {
+            inputFilePath = argv[i];
+        } else {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, USAGE, argv[0]);
+        }
+    }
+    if (repeat < 1 || (request.op != HUFFD_OP_STATS && !inputFilePath)) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, USAGE, argv[0]);
+    }
+
+    // ===== INPUT =====
+    uint8_t* payload = NULL;
+    size_t payload_size = 0;
+    int input_fd = -1;
+    if (request.op != HUFFD_OP_STATS) {
+        if (pass_fd) {
+            input_fd = open(inputFilePath, O_RDONLY | O_CLOEXEC);
+            if (input_fd < 0) {
+                THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, "Failed to open input file: %s\n", inputFilePath);
+            }
+            request.flags |= HUFFD_FLAG_PAYLOAD_FD;
+        } else {
+            payload = read_file(inputFilePath, &payload_size);
+            request.payload_size = payload_size;
+        }
+    }
+
+    // ===== CONNECT =====
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, "Socket path is too long: %s\n", socketPath);
+    }
+    strcpy(addr.sun_path, socketPath);
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, "Failed to connect to %s: %s\n", socketPath, strerror(errno));
+    }
+
+    // ===== REQUESTS =====
+    Latency_stats* stats = Latency_stats_create((size_t)repeat);
+    uint8_t* result = NULL;
+    Huffd_reply reply;
+    for (long i = 0; i < repeat; i++) {
+        // The server reads a passed fd from its offset, which the descriptor shares with us.
+        if (input_fd >= 0) lseek(input_fd, 0, SEEK_SET);
+
+        uint64_t start = now_ns();
+        if (Huffd_send_request(sock, &request, payload, input_fd) != 0 || Huffd_recv_reply(sock, &reply) != 0) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, "Lost connection to %s\n", socketPath);
+        }
+        Mem_free(result);
+        result = (uint8_t*)Mem_alloc(MEM_SERVER, reply.payload_size ? reply.payload_size : 1);
+        if (!result) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, "Failed to allocate reply buffer.\n");
+        }
+        if (Huffd_read_full(sock, result, reply.payload_size) != 0) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, "Lost connection to %s\n", socketPath);
+        }
+        Latency_stats_record(stats, now_ns() - start);
+
+        if (reply.status != HUFFD_STATUS_OK) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, "huffd: %s\n", Huffd_status_text(reply.status));
+        }
+    }
+    close(sock);
+
+    // ===== OUTPUT =====
+    if (request.op == HUFFD_OP_STATS) {
+        fwrite(result, 1, reply.payload_size, stdout);
+    } else {
+        char* defaultPath = NULL;
+        if (!outputFilePath) {
+            defaultPath = output_path_for(inputFilePath, request.op);
+            outputFilePath = defaultPath;
+        }
+        FILE* outputFile = fopen(outputFilePath, "wb");
+        if (!outputFile || fwrite(result, 1, reply.payload_size, outputFile) != reply.payload_size || fclose(outputFile) != 0) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, "Failed to write output file: %s\n", outputFilePath);
+        }
+        if (repeat > 1) {
+            Latency_summary summary;
+            char line[256];
+            Latency_stats_summarize(stats, &summary);
+            Latency_summary_format(&summary, "round-trip", line, sizeof(line));
+            fputs(line, stdout);
+        }
+        Mem_free(defaultPath);
+    }
+
+    Latency_stats_destroy(stats);
+    if (input_fd >= 0) close(input_fd);
+    Mem_free(result);
+    Mem_free(payload);
+    return 0;
+}
@@ -0,0 +1,417 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "Huff_context.h"
+#include "Huffd_protocol.h"
+#include "Latency_stats.h"
+#include "Cpu_dispatch.h"
+#include "Mem.h"
+#include "exception_xmacro.h"
+
+#define USAGE "Usage: %s <socket_path> [--workers=N] [--block-size=BYTES] [--max-memory=SIZE[K|M|G]]\n"
+#define HUFFD_DEFAULT_WORKERS 4
+#define HUFFD_MAX_CONNECTIONS 1024
+#define HUFFD_IO_TIMEOUT_SECONDS 10
+#define HUFFD_LATENCY_WINDOW 16384
+
+/*
+ * huffd : compression server. The main thread accepts connections on a Unix
+ * socket and polls the idle ones; a connection with a request waiting is
+ * queued, and a fixed pool of workers, each owning one warm Huff_context,
+ * serves one request of it and hands it back to the poll set. An idle
+ * client therefore holds no worker, and one that stalls inside a request
+ * holds it for at most HUFFD_IO_TIMEOUT_SECONDS. Every connection is in one
+ * place at a time (polled, queued or served), so its requests are served in
+ * order. Latency is measured per request from its frame arriving to its
+ * reply being sent.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    int ready[HUFFD_MAX_CONNECTIONS];       // connections with a request waiting
+    int head;
+    int count;
+    int returned[HUFFD_MAX_CONNECTIONS];    // served connections going back to the poll set
+    int returned_count;
+    int connections;                        // open, wherever they are
+    int wake[2];                            // pipe: a worker filled `returned`
+    int closed;
+} Connection_queue;
+
+typedef struct {
+    pthread_t thread;
+    int active_fd;          // connection being served, -1 when idle
+    uint8_t* input;
+    size_t input_capacity;
+    Huff_context* ctx;
+} Worker;
+
+static Connection_queue queue;
+static Worker* workers;
+static int worker_count = HUFFD_DEFAULT_WORKERS;
+static Latency_stats* op_stats[HUFFD_OP_STATS + 1];
+static volatile sig_atomic_t stopping = 0;
+
+static const char* OP_NAMES[HUFFD_OP_STATS + 1] = { NULL, "compress", "decompress", "stats" };
+
+
+static void on_signal(int signo) {
+    (void)signo;
+    stopping = 1;
+}
+
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+
+// Never full: a connection is queued at most once and there are at most HUFFD_MAX_CONNECTIONS.
+static void queue_push(int fd) {
+    pthread_mutex_lock(&queue.lock);
+    queue.ready[(queue.head + queue.count) % HUFFD_MAX_CONNECTIONS] = fd;
+    queue.count++;
+    pthread_cond_signal(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+}
+
+
+// The popped fd becomes the worker's active connection under the queue lock,
+// so shutdown sees every connection either queued or active.
+static int queue_pop(Worker* worker) {
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == 0 && !queue.closed) {
+        pthread_cond_wait(&queue.not_empty, &queue.lock);
+    }
+    int fd = -1;
+    if (queue.count > 0) {
+        fd = queue.ready[queue.head];
+        queue.head = (queue.head + 1) % HUFFD_MAX_CONNECTIONS;
+        queue.count--;
+    }
+    worker->active_fd = fd;
+    pthread_mutex_unlock(&queue.lock);
+    return fd;
+}
+
+
+// Hands a served connection back to the poll thread, or closes it.
+static void queue_return(Worker* worker, int fd, int keep) {
+    pthread_mutex_lock(&queue.lock);
+    worker->active_fd = -1;
+    if (keep && !queue.closed) {
+        queue.returned[queue.returned_count++] = fd;
+        ssize_t n = write(queue.wake[1], "", 1);
+        (void)n;        // a full pipe already wakes the poll
+    } else {
+        close(fd);
+        queue.connections--;
+    }
+    pthread_mutex_unlock(&queue.lock);
+}
+
+
+static int reserve_input(Worker* worker, size_t size) {
+    if (size <= worker->input_capacity) return 0;
+    size_t capacity = worker->input_capacity ? worker->input_capacity : 64 * 1024;
+    while (capacity < size) capacity *= 2;
+    uint8_t* input = (uint8_t*)Mem_realloc(MEM_SERVER, worker->input, capacity);
+    if (!input) return -1;
+    worker->input = input;
+    worker->input_capacity = capacity;
+    return 0;
+}
+
+
+// Reads a passed descriptor from its current offset to EOF into worker->input.
+static uint32_t read_passed_fd(Worker* worker, int fd, size_t* size) {
+    *size = 0;
+    for (;;) {
+        if (*size == worker->input_capacity && reserve_input(worker, *size + 1) != 0) {
+            return HUFFD_STATUS_NO_MEMORY;
+        }
+        ssize_t n = read(fd, worker->input + *size, worker->input_capacity - *size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return HUFFD_STATUS_IO_ERROR;
+        if (n == 0) return HUFFD_STATUS_OK;
+        *size += (size_t)n;
+        if (*size > HUFFD_MAX_PAYLOAD) return HUFFD_STATUS_TOO_LARGE;
+    }
+}
+
+
+static size_t format_stats(char* out, size_t size) {
+    size_t used = 0;
+    for (int op = HUFFD_OP_COMPRESS; op <= HUFFD_OP_DECOMPRESS; op++) {
+        Latency_summary summary;
+        Latency_stats_summarize(op_stats[op], &summary);
+        int n = Latency_summary_format(&summary, OP_NAMES[op], out + used, size - used);
+        if (n > 0) used += (size_t)n < size - used ? (size_t)n : size - used - 1;
+    }
+    return used;
+}
+
+
+// Serves one request; returns -1 once the connection is unusable.
+static int serve_request(Worker* worker, int sock, const Huffd_request* request, int passed_fd) {
+    uint64_t start = now_ns();
+    uint32_t status = HUFFD_STATUS_OK;
+    const uint8_t* result = NULL;
+    size_t result_size = 0;
+    size_t input_size = 0;
+    char text[512];
+
+    if (request->flags & HUFFD_FLAG_PAYLOAD_FD) {
+        status = read_passed_fd(worker, passed_fd, &input_size);
+    } else if (request->payload_size > HUFFD_MAX_PAYLOAD) {
+        // The payload cannot be skipped reliably, so drop the connection.
+        Huffd_send_reply(sock, HUFFD_STATUS_TOO_LARGE, NULL, 0);
+        return -1;
+    } else {
+        input_size = (size_t)request->payload_size;
+        if (reserve_input(worker, input_size) != 0) {
+            Huffd_send_reply(sock, HUFFD_STATUS_NO_MEMORY, NULL, 0);
+            return -1;
+        }
+        if (Huffd_read_full(sock, worker->input, input_size) != 0) return -1;
+    }
+
+    if (status == HUFFD_STATUS_OK) {
+        switch (request->op) {
+            case HUFFD_OP_COMPRESS:
+                if (Huff_context_compress(worker->ctx, worker->input, input_size, &result, &result_size) != 0) {
+                    status = HUFFD_STATUS_NO_MEMORY;
+                }
+                break;
+            case HUFFD_OP_DECOMPRESS:
+                if (Huff_context_decompress(worker->ctx, worker->input, input_size, &result, &result_size) != 0) {
+                    status = HUFFD_STATUS_CORRUPT_INPUT;
+                }
+                break;
+            case HUFFD_OP_STATS:
+                result_size = format_stats(text, sizeof(text));
+                result = (const uint8_t*)text;
+                break;
+            default:
+                status = HUFFD_STATUS_BAD_REQUEST;
+        }
+    }
+    if (status != HUFFD_STATUS_OK) result_size = 0;
+
+    if (Huffd_send_reply(sock, status, result, result_size) != 0) return -1;
+    if (request->op == HUFFD_OP_COMPRESS || request->op == HUFFD_OP_DECOMPRESS) {
+        Latency_stats_record(op_stats[request->op], now_ns() - start);
+    }
+    return 0;
+}
+
+
+// Serves one request per turn: EOF, a timeout or an error closes the connection.
+static void* worker_main(void* arg) {
+    Worker* worker = (Worker*)arg;
+    int sock;
+    while ((sock = queue_pop(worker)) >= 0) {
+        Huffd_request request;
+        int passed_fd;
+        int keep = Huffd_recv_request(sock, &request, &passed_fd) == 0
+                && serve_request(worker, sock, &request, passed_fd) == 0;
+        if (passed_fd >= 0) close(passed_fd);
+        queue_return(worker, sock, keep);
+    }
+    return NULL;
+}
+
+
+// Bounds every read and write of a connection, so a stalled client cannot keep a worker.
+static void set_timeouts(int sock) {
+    struct timeval timeout = { HUFFD_IO_TIMEOUT_SECONDS, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, USAGE, argv[0]);
+    }
+    const char* socketPath = argv[1];
+    uint32_t block_size = BLOCK_FORMAT_DEFAULT_BLOCK_SIZE;
+
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--workers=", 10) == 0) {
+            worker_count = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--block-size=", 13) == 0) {
+            block_size = (uint32_t)strtoul(argv[i] + 13, NULL, 10);
+        } else if (strncmp(argv[i], "--max-memory=", 13) == 0) {
+            // Requests whose buffers would pass the limit get an error reply.
+            uint64_t limit;
+            if (Mem_parse_size(argv[i] + 13, &limit) != 0 || limit == 0) {
+                THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, "Invalid memory limit: %s\n", argv[i] + 13);
+            }
+            Mem_set_limit(limit);
+        } else {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, USAGE, argv[0]);
+        }
+    }
+    if (worker_count < 1 || worker_count > 256) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, "Invalid worker count: %d\n", worker_count);
+    }
+    if (block_size == 0 || block_size > BLOCK_FORMAT_MAX_BLOCK_SIZE) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, "Invalid block size: %u\n", block_size);
+    }
+
+    // ===== SOCKET SETUP =====
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, "Socket path is too long: %s\n", socketPath);
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    unlink(socketPath);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, "Failed to listen on %s: %s\n", socketPath, strerror(errno));
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;      // no SA_RESTART: poll() must return on a signal
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    if (pipe2(queue.wake, O_CLOEXEC | O_NONBLOCK) != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, "Failed to create wake pipe: %s\n", strerror(errno));
+    }
+
+    // ===== WORKER POOL =====
+    const Kernel_set* kernels = Kernels_get();    // resolve once, before any worker reads it
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.not_empty, NULL);
+    for (int op = HUFFD_OP_COMPRESS; op <= HUFFD_OP_DECOMPRESS; op++) {
+        op_stats[op] = Latency_stats_create(HUFFD_LATENCY_WINDOW);
+    }
+    workers = (Worker*)Mem_calloc(MEM_SERVER, worker_count, sizeof(Worker));
+    if (!workers) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, "Failed to allocate workers.\n");
+    }
+    // Workers start with the stop signals blocked, so they reach the poll thread.
+    sigset_t stop_signals, previous;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &previous);
+    for (int i = 0; i < worker_count; i++) {
+        workers[i].active_fd = -1;
+        workers[i].ctx = Huff_context_create(block_size);
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    fprintf(stderr, "huffd listening on %s (workers: %d, kernels: %s)\n", socketPath, worker_count, kernels->name);
+
+    // ===== POLL LOOP =====
+    // polls[0] is the listener, polls[1] the wake pipe, the rest idle connections.
+    static struct pollfd polls[2 + HUFFD_MAX_CONNECTIONS];
+    nfds_t count = 2;
+    polls[0] = (struct pollfd){ .fd = listener, .events = POLLIN };
+    polls[1] = (struct pollfd){ .fd = queue.wake[0], .events = POLLIN };
+    while (!stopping) {
+        if (poll(polls, count, -1) < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            break;
+        }
+
+        // A request (or EOF) is waiting: a worker takes it from here.
+        for (nfds_t i = count; i-- > 2;) {
+            if (polls[i].revents) {
+                queue_push(polls[i].fd);
+                polls[i] = polls[--count];
+            }
+        }
+
+        if (polls[1].revents) {
+            char drain[64];
+            while (read(queue.wake[0], drain, sizeof(drain)) > 0) {}
+            pthread_mutex_lock(&queue.lock);
+            for (int i = 0; i < queue.returned_count; i++) {
+                polls[count++] = (struct pollfd){ .fd = queue.returned[i], .events = POLLIN };
+            }
+            queue.returned_count = 0;
+            pthread_mutex_unlock(&queue.lock);
+        }
+
+        if (polls[0].revents) {
+            int sock;
+            while ((sock = accept4(listener, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+                pthread_mutex_lock(&queue.lock);
+                int full = queue.connections == HUFFD_MAX_CONNECTIONS;
+                if (!full) queue.connections++;
+                pthread_mutex_unlock(&queue.lock);
+                if (full) {
+                    fprintf(stderr, "Refusing a connection: %d are open\n", HUFFD_MAX_CONNECTIONS);
+                    close(sock);
+                    continue;
+                }
+                set_timeouts(sock);
+                polls[count++] = (struct pollfd){ .fd = sock, .events = POLLIN };
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                fprintf(stderr, "accept failed: %s\n", strerror(errno));
+                break;
+            }
+        }
+    }
+
+    // ===== SHUTDOWN =====
+    close(listener);
+    unlink(socketPath);
+    for (nfds_t i = 2; i < count; i++) close(polls[i].fd);
+    pthread_mutex_lock(&queue.lock);
+    queue.closed = 1;
+    while (queue.count > 0) {
+        close(queue.ready[queue.head]);
+        queue.head = (queue.head + 1) % HUFFD_MAX_CONNECTIONS;
+        queue.count--;
+    }
+    for (int i = 0; i < queue.returned_count; i++) close(queue.returned[i]);
+    queue.returned_count = 0;
+    // Requests in progress still get their reply; their worker then closes the fd.
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].active_fd >= 0) shutdown(workers[i].active_fd, SHUT_RD);
+    }
+    pthread_cond_broadcast(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        Huff_context_destroy(workers[i].ctx);
+        Mem_free(workers[i].input);
+    }
+    Mem_free(workers);
+    close(queue.wake[0]);
+    close(queue.wake[1]);
+
+    char report[512];
+    format_stats(report, sizeof(report));
+    fputs(report, stderr);
+    for (int op = HUFFD_OP_COMPRESS; op <= HUFFD_OP_DECOMPRESS; op++) {
+        Latency_stats_destroy(op_stats[op]);
+    }
+    Mem_report(stderr);
+    return 0;
+}
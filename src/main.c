@@ -1,71 +1,213 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <libgen.h> 
 #include <time.h>
-#include "Huffman_tree_util.h"
-#include "Huffman_node.h"
-#include "Priority_queue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "Byte_table.h"
+#include "Huffman_table.h"
 #include "Huffman_header.h"
 #include "Trie.h"
-#include "Stream_buffer.h"
+#include "Trie_decoder.h"
+#include "Huffman_encoder.h"
+#include "Cpu_dispatch.h"
+#include "Io_pipeline.h"
+#include "Archive.h"
+#include "Block_codec.h"
+#include "Perf_counters.h"
+#include "Parallel_histogram.h"
+#include "Parallel_encoder.h"
+#include "Parallel_decoder.h"
+#include "Adaptive_coder.h"
+#include "Huff_stream.h"
+#include "Mem.h"
 #include "exception_xmacro.h"
 
 const uint8_t SECTION_DIVIDER[2] = { 0x00, 0x00 };
+#define USAGE "Usage: %s <-c | -dc | -a <file.huff> | -u <old.huff>> <input_file> [-1..-9] [--kernel=scalar|bmi2] [--legacy]" \
+              " [--transform=none|delta|mtf|bwt|auto]" \
+              " [--entropy=huffman|tans|pairs|auto] [--dedup] [--analyze] [--grep=STRING] [--threads=N] [--perf] [--max-memory=SIZE[K|M|G]] [--mem-stats]\n" \
+              "   or: <-s | -ds | -p | -dp> <input|-> <output|->\n"
 void compress(const char* inputFilePath);
+void analyze(const char* inputFilePath);
+void search(const char* inputFilePath);
 void decompress(const char* inputFilePath);
+void append(const char* archivePath, const char* inputFilePath);
+void update(const char* oldPath, const char* inputFilePath);
+void stream_compress(const char* inputPath, const char* outputPath);
+void stream_decompress(const char* inputPath, const char* outputPath);
+void pipe_compress(const char* inputPath, const char* outputPath);
+void pipe_decompress(const char* inputPath, const char* outputPath);
+static uint64_t compress_legacy(FILE* inputFile, FILE* outputFile, const char* inputFilePath);
+static void decompress_legacy(FILE* inputFile, FILE* outputFile, const char* inputFilePath);
+static uint64_t decode_stream(FILE* inputFile, FILE* outputFile, TrieNode* root, uint64_t file_size, const char* inputFilePath);
+static void encode_stream(FILE* inputFile, FILE* outputFile, const Huffman_encoder* encoder, const char* inputFilePath);
+static char* make_output_path(const char* inputFilePath, int decompressing);
+static void block_options(Archive_options* options);
+
+// -c writes the block format (HUF2) unless --legacy asks for a single-table FFUH file.
+static int legacy_format = 0;
+// Preset of the block format's knobs; the options below override its choices.
+static int compression_level = ARCHIVE_DEFAULT_LEVEL;
+#define OPTION_FROM_LEVEL UINT_MAX
+// Transforms each block may choose from (block format only).
+static unsigned block_transforms = OPTION_FROM_LEVEL;
+// Entropy coder of each block (block format only).
+static unsigned block_entropy = OPTION_FROM_LEVEL;
+// --dedup writes repeated blocks as references to their first copy (block format only).
+static unsigned block_dedup = 0;
+// --analyze makes -c predict the block-format output instead of writing it.
+static int analyze_only = 0;
+// --grep=STRING makes -dc print where STRING occurs instead of writing the output.
+static const char* grep_pattern = NULL;
+// Threads of the legacy format's histogram and encode passes; 0 uses one per online CPU.
+static unsigned legacy_threads = 0;
+// --perf wraps each phase in hardware counters; otherwise the session is inert.
+static Perf_session* perf_session = NULL;
 
 int main(int argc, char* argv[]) {
     
     if (argc < 3) {
         THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, 
-            "Usage: %s <-c | -dc> <input_file>\n", argv[0]);
+            USAGE, argv[0]);
     }
 
     const char* mode = argv[1];
     const char* inputFilePath = argv[2];
+    int perf_enabled = 0;
+    int mem_stats = 0;
+    // -a and -u take the archive first and the data second; -s, -ds, -p and -dp take input and output.
+    int first_option = 3;
+    if (strcmp(mode, "-a") == 0 || strcmp(mode, "-u") == 0 || strcmp(mode, "-s") == 0 || strcmp(mode, "-ds") == 0
+        || strcmp(mode, "-p") == 0 || strcmp(mode, "-dp") == 0) {
+        if (argc < 4) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, USAGE, argv[0]);
+        }
+        first_option = 4;
+    }
+
+    for (int i = first_option; i < argc; i++) {
+        if (strncmp(argv[i], "--kernel=", 9) == 0) {
+            if (Kernels_select(argv[i] + 9) != 0) {
+                THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, 
+                    "Cannot use kernel set: %s\n", argv[i] + 9);
+            }
+        } else if (argv[i][0] == '-' && argv[i][1] >= '1' && argv[i][1] <= '9' && argv[i][2] == '\0') {
+            compression_level = argv[i][1] - '0';
+        } else if (strcmp(argv[i], "--legacy") == 0) {
+            legacy_format = 1;
+        } else if (strncmp(argv[i], "--transform=", 12) == 0) {
+            if (Transform_parse_set(argv[i] + 12, &block_transforms) != 0) {
+                THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, 
+                    "Unknown transform: %s\n", argv[i] + 12);
+            }
+        } else if (strncmp(argv[i], "--entropy=", 10) == 0) {
+            if (Block_entropy_parse(argv[i] + 10, &block_entropy) != 0) {
+                THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, 
+                    "Unknown entropy coder: %s\n", argv[i] + 10);
+            }
+        } else if (strcmp(argv[i], "--dedup") == 0) {
+            block_dedup = 1;
+        } else if (strcmp(argv[i], "--analyze") == 0) {
+            analyze_only = 1;
+        } else if (strncmp(argv[i], "--grep=", 7) == 0 && argv[i][7] != '\0') {
+            grep_pattern = argv[i] + 7;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            legacy_threads = (unsigned)atoi(argv[i] + 10);
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            perf_enabled = 1;
+        } else if (strncmp(argv[i], "--max-memory=", 13) == 0) {
+            uint64_t limit;
+            if (Mem_parse_size(argv[i] + 13, &limit) != 0 || limit == 0) {
+                THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, 
+                    "Invalid memory limit: %s\n", argv[i] + 13);
+            }
+            Mem_set_limit(limit);
+        } else if (strcmp(argv[i], "--mem-stats") == 0) {
+            mem_stats = 1;
+        } else {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, USAGE, argv[0]);
+        }
+    }
+    // Opened before any I/O thread starts, so the counters follow them too.
+    perf_session = Perf_session_create(perf_enabled);
+
+    if (strcmp(mode, "-c") == 0 && analyze_only) {
 
-    if (strcmp(mode, "-c") == 0) {
+        analyze(inputFilePath);
+    } else if (strcmp(mode, "-c") == 0) {
         
         compress(inputFilePath);
+    } else if (strcmp(mode, "-dc") == 0 && grep_pattern) {
+
+        search(inputFilePath);
     } else if (strcmp(mode, "-dc") == 0) {
         
         decompress(inputFilePath);
+    } else if (strcmp(mode, "-a") == 0) {
+
+        append(argv[2], argv[3]);
+    } else if (strcmp(mode, "-u") == 0) {
+
+        update(argv[2], argv[3]);
+    } else if (strcmp(mode, "-s") == 0) {
+
+        stream_compress(argv[2], argv[3]);
+    } else if (strcmp(mode, "-ds") == 0) {
+
+        stream_decompress(argv[2], argv[3]);
+    } else if (strcmp(mode, "-p") == 0) {
+
+        pipe_compress(argv[2], argv[3]);
+    } else if (strcmp(mode, "-dp") == 0) {
+
+        pipe_decompress(argv[2], argv[3]);
     } else {
         THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, 
-            "Usage: %s <-c | -dc> <input_file>\n", argv[0]);
+            USAGE, argv[0]);
     }
+    Perf_session_report(perf_session, stdout);
+    Perf_session_destroy(perf_session);
+    // Everything is freed by now, so whatever is still live leaked.
+    if (mem_stats) Mem_report(stdout);
     
     return 0;
 }
 
 
 /**
- * @brief Compress a file using the Huffman coding algorithm.
+ * @brief Compress a file into `<file>.huff`, in the block format (HUF2) or,
+ * with --legacy, the single-code FFUH format.
  * 
  * 
- * 1. **FILE READING**:
- *    - Opens the input file in binary mode.
- *    - Reads the file and calculates the frequency of each byte.
+ * 1. **FILE OPENING**:
+ *    - Opens the input file in binary mode and the output file for reading
+ *      and writing, since --dedup reads earlier blocks back.
  * 
- * 2. **HUFFMAN TREE CONSTRUCTION**:
- *    - Creates a priority queue to build the Huffman tree based on character frequencies.
- *    - Generates a Huffman tree and assigns codewords to each byte.
+ * 2. **BLOCK FORMAT (default)**:
+ *    - Archive_compress() cuts the input into blocks of the level's size.
+ *      Each block gets its own histogram, transform, entropy coder and code
+ *      lengths, and the file ends with an END block, an index and a footer.
  * 
- * 3. **HEADER METADATA CREATION & WRITE**:
- *    - Creates a metadata header that contains file size and codeword mapping table.
- *    - Writes the header to the output file.
+ * 3. **LEGACY FORMAT (--legacy)**:
+ *    - compress_legacy() counts the bytes of the whole file, builds
+ *      length-limited code lengths in place from the counts (no tree is
+ *      built) and assigns canonical codewords.
+ *    - Writes the FFUH header with the file size and code table, then the
+ *      encoded data. The encode runs in parallel segments for regular files,
+ *      otherwise through overlapping read/encode/write stages (see Io_pipeline.h).
  * 
- * 4. **COMPRESS ORIGINAL DATA & WRITE**:
- *    - Encodes the input file's contents using the generated Huffman codewords.
- *    - Writes the encoded binary data to the output file.
- * 
- * 5. **RESOURCE CLEANUP**:
- *    - Frees allocated memory and closes all file streams.
+ * 4. **REPORT**:
+ *    - Closes both files and prints the elapsed time and compression ratio.
  */
 void compress(const char* inputFilePath) {
-    printf("Running compression...\n");
+    printf("Running compression... (kernels: %s)\n", Kernels_get()->name);
     clock_t start_time, end_time;
     start_time = clock();
     double elapsed_time;
@@ -77,63 +219,633 @@ void compress(const char* inputFilePath) {
             "Failed to open input file: %s\n", inputFilePath);
     }
 
-    char outputFilePath[512]; 
-    snprintf(outputFilePath, sizeof(outputFilePath), "%s.huff", inputFilePath);
+    char* outputFilePath = make_output_path(inputFilePath, 0);
 
-    FILE* outputFile = fopen(outputFilePath, "wb");
+    // Readable too: --dedup reads earlier blocks back to compare them.
+    FILE* outputFile = fopen(outputFilePath, "w+b");
     if (!outputFile) {
         fclose(inputFile);
         THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, 
             "Failed to open output file: %s\n", outputFilePath);
     }
 
-    ByteTable* bt = ByteTable_create();
-    if (!bt) {
-        fclose(inputFile);
-        fclose(outputFile);
+    uint64_t filesize = 0;
+    if (legacy_format) {
+        filesize = compress_legacy(inputFile, outputFile, inputFilePath);
+    } else {
+        Archive_options options;
+        block_options(&options);
+        Perf_phase_begin(perf_session, "compress");
+        if (Archive_compress(inputFile, outputFile, &options, &filesize) != 0) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+                "I/O error while compressing: %s\n", inputFilePath);
+        }
+        Perf_phase_end(perf_session);
+    }
+    fclose(inputFile);
+    fclose(outputFile);
+
+
+    FILE* compressedFile = fopen(outputFilePath, "rb");
+    fseeko(compressedFile, 0, SEEK_END);
+    off_t compressed_size = ftello(compressedFile);
+    fclose(compressedFile);
+    double compression_ratio = 1.0 - ((double)compressed_size / (double)filesize);
+
+    end_time = clock();
+    elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+    printf("Compression completed in %.2f seconds. Output written to '%s'.\n", elapsed_time, outputFilePath);
+    printf("Compression ratio: %.2f%%\n", compression_ratio * 100.0);
+    Mem_free(outputFilePath);
+}
+
+
+/**
+ * @brief Append the contents of `inputFilePath` to the block-format file
+ * `archivePath` in place: only the new data is compressed, and the END
+ * block, index and footer at its tail are rewritten.
+ */
+void append(const char* archivePath, const char* inputFilePath) {
+    printf("Running append... (kernels: %s)\n", Kernels_get()->name);
+    clock_t start_time = clock();
+
+    FILE* archiveFile = fopen(archivePath, "r+b");
+    if (!archiveFile) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, 
+            "Failed to open archive: %s\n", archivePath);
+    }
+    uint32_t magic_number = 0;
+    if (fread(&magic_number, sizeof(magic_number), 1, archiveFile) != 1 || magic_number != BLOCK_FORMAT_MAGIC) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Only block-format files can be appended to: %s\n", archivePath);
+    }
+    FILE* inputFile = fopen(inputFilePath, "rb");
+    if (!inputFile) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, 
+            "Failed to open input file: %s\n", inputFilePath);
+    }
+
+    Archive_options options;
+    block_options(&options);
+    uint64_t appended = 0;
+    Perf_phase_begin(perf_session, "append");
+    if (Archive_append(archiveFile, inputFile, &options, &appended) != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Failed to append to archive: %s\n", archivePath);
+    }
+    Perf_phase_end(perf_session);
+    fclose(inputFile);
+    fclose(archiveFile);
+
+    double elapsed_time = (double)(clock() - start_time) / CLOCKS_PER_SEC;
+    printf("Appended %" PRIu64 " bytes in %.2f seconds to '%s'.\n", appended, elapsed_time, archivePath);
+}
+
+
+/**
+ * @brief Compress `inputFilePath` to `<input>.huff`, copying the blocks it
+ * shares with the block-format file `oldPath` instead of encoding them. The
+ * output goes to a temporary file first, since `oldPath` is usually the
+ * file being replaced.
+ */
+void update(const char* oldPath, const char* inputFilePath) {
+    printf("Running update... (kernels: %s)\n", Kernels_get()->name);
+    clock_t start_time = clock();
+
+    FILE* oldFile = fopen(oldPath, "rb");
+    if (!oldFile) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, 
+            "Failed to open archive: %s\n", oldPath);
+    }
+    uint32_t magic_number = 0;
+    if (fread(&magic_number, sizeof(magic_number), 1, oldFile) != 1 || magic_number != BLOCK_FORMAT_MAGIC) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Only block-format files can be updated from: %s\n", oldPath);
+    }
+    FILE* inputFile = fopen(inputFilePath, "rb");
+    if (!inputFile) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, 
+            "Failed to open input file: %s\n", inputFilePath);
+    }
+
+    char* outputFilePath = make_output_path(inputFilePath, 0);
+    size_t length = strlen(outputFilePath);
+    char* temporaryPath = (char*)Mem_alloc(MEM_OTHER, length + sizeof(".tmp"));
+    if (!temporaryPath) {
         THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, 
-            "Failed to create ByteTable.\n");
+            "Failed to allocate output path.\n");
     }
-    uint8_t c;
-    uint64_t filesize = 0;
-    while (fread(&c, 1, 1, inputFile) == 1) {
-        filesize++;
-        ByteTable_increment(bt, c);
+    memcpy(temporaryPath, outputFilePath, length);
+    memcpy(temporaryPath + length, ".tmp", sizeof(".tmp"));
+    // Readable too: --dedup reads earlier blocks back to compare them.
+    FILE* outputFile = fopen(temporaryPath, "w+b");
+    if (!outputFile) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, 
+            "Failed to create output file: %s\n", temporaryPath);
+    }
+
+    Archive_options options;
+    block_options(&options);
+    uint64_t total = 0;
+    uint64_t reused = 0;
+    Perf_phase_begin(perf_session, "update");
+    if (Archive_update(oldFile, inputFile, outputFile, &options, &total, &reused) != 0) {
+        remove(temporaryPath);
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Failed to update from archive: %s\n", oldPath);
+    }
+    Perf_phase_end(perf_session);
+    fclose(inputFile);
+    fclose(oldFile);
+    if (fclose(outputFile) != 0 || rename(temporaryPath, outputFilePath) != 0) {
+        remove(temporaryPath);
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Failed to write output file: %s\n", outputFilePath);
+    }
+
+    double elapsed_time = (double)(clock() - start_time) / CLOCKS_PER_SEC;
+    printf("Update completed in %.2f seconds. Output written to '%s'.\n", elapsed_time, outputFilePath);
+    printf("Reused %" PRIu64 " of %" PRIu64 " bytes (%.2f%%) from '%s'.\n", reused, total,
+           total ? 100.0 * (double)reused / (double)total : 0.0, oldPath);
+    Mem_free(temporaryPath);
+    Mem_free(outputFilePath);
+}
+
+
+// -s reads at most this much at once; each read becomes one message.
+#define STREAM_READ_SIZE (64 * 1024)
+
+static int open_stream(const char* path, int writing) {
+    if (strcmp(path, "-") == 0) return writing ? STDOUT_FILENO : STDIN_FILENO;
+    int fd = writing ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : open(path, O_RDONLY);
+    if (fd < 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, 
+            "Failed to open %s: %s\n", path, strerror(errno));
+    }
+    return fd;
+}
+
+static void write_stream(int fd, const uint8_t* data, size_t size, const char* path) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+                "Failed to write %s: %s\n", path, strerror(errno));
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+}
+
+static size_t read_stream(int fd, uint8_t* buffer, size_t capacity, const char* path) {
+    for (;;) {
+        ssize_t n = read(fd, buffer, capacity);
+        if (n >= 0) return (size_t)n;
+        if (errno != EINTR) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+                "Failed to read %s: %s\n", path, strerror(errno));
+        }
+    }
+}
+
+
+/**
+ * @brief One-pass adaptive compression for pipes and sockets ("-" is
+ * stdin/stdout). Whatever one read() returns is encoded as a message and
+ * written at once, so a message boundary on the input is one on the output
+ * too and nothing waits for a block to fill. Prints nothing, since the
+ * output may be stdout.
+ */
+void stream_compress(const char* inputPath, const char* outputPath) {
+    int input = open_stream(inputPath, 0);
+    int output = open_stream(outputPath, 1);
+    uint8_t* in = (uint8_t*)Mem_alloc(MEM_IO, STREAM_READ_SIZE);
+    uint8_t* out = (uint8_t*)Mem_alloc(MEM_IO, Adaptive_encode_bound(STREAM_READ_SIZE));
+    if (!in || !out) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, 
+            "Failed to allocate stream buffers.\n");
+    }
+    Adaptive_encoder* encoder = Adaptive_encoder_create();
+
+    uint32_t magic_number = ADAPTIVE_MAGIC;
+    write_stream(output, (const uint8_t*)&magic_number, sizeof(magic_number), outputPath);
+    size_t size;
+    while ((size = read_stream(input, in, STREAM_READ_SIZE, inputPath)) > 0) {
+        write_stream(output, out, Adaptive_encode_message(encoder, in, size, out), outputPath);
+    }
+
+    Adaptive_encoder_destroy(encoder);
+    Mem_free(in);
+    Mem_free(out);
+    if (input != STDIN_FILENO) close(input);
+    if (output != STDOUT_FILENO && close(output) != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Failed to write %s\n", outputPath);
+    }
+}
+
+
+/**
+ * @brief Inverse of stream_compress(): decodes and writes every message as
+ * soon as all of it has arrived, keeping a partial one for the next read.
+ */
+void stream_decompress(const char* inputPath, const char* outputPath) {
+    int input = open_stream(inputPath, 0);
+    int output = open_stream(outputPath, 1);
+    size_t capacity = Adaptive_encode_bound(ADAPTIVE_MAX_MESSAGE);
+    uint8_t* in = (uint8_t*)Mem_alloc(MEM_IO, capacity);
+    uint8_t* out = (uint8_t*)Mem_alloc(MEM_IO, ADAPTIVE_MAX_MESSAGE);
+    if (!in || !out) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, 
+            "Failed to allocate stream buffers.\n");
+    }
+    Adaptive_decoder* decoder = Adaptive_decoder_create();
+
+    int started = 0;
+    size_t filled = 0;
+    size_t size;
+    while ((size = read_stream(input, in + filled, capacity - filled, inputPath)) > 0) {
+        filled += size;
+        size_t position = 0;
+        if (!started) {
+            uint32_t magic_number;
+            if (filled < sizeof(magic_number)) continue;
+            memcpy(&magic_number, in, sizeof(magic_number));
+            if (magic_number != ADAPTIVE_MAGIC) {
+                THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+                    "Not an adaptive stream: %s\n", inputPath);
+            }
+            started = 1;
+            position = sizeof(magic_number);
+        }
+
+        size_t raw_size, header_size, payload_size;
+        int status;
+        while ((status = Adaptive_parse_message(in + position, filled - position,
+                                                &raw_size, &header_size, &payload_size)) == 1) {
+            if (Adaptive_decode_message(decoder, in + position + header_size, payload_size, out, raw_size) != 0) {
+                THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+                    "Corrupt message in %s\n", inputPath);
+            }
+            write_stream(output, out, raw_size, outputPath);
+            position += header_size + payload_size;
+        }
+        if (status < 0) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+                "Corrupt message header in %s\n", inputPath);
+        }
+        memmove(in, in + position, filled - position);
+        filled -= position;
+    }
+    if (!started || filled != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Truncated adaptive stream: %s\n", inputPath);
+    }
+
+    Adaptive_decoder_destroy(decoder);
+    Mem_free(in);
+    Mem_free(out);
+    if (input != STDIN_FILENO) close(input);
+    if (output != STDOUT_FILENO && close(output) != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Failed to write %s\n", outputPath);
+    }
+}
+
+
+/**
+ * @brief Block-format (HUF2) compression for pipes ("-" is stdin/stdout)
+ * through Huff_stream: reads of any size go in and the output buffer is
+ * written whenever it fills, so neither side needs to be a regular file.
+ * Prints nothing, since the output may be stdout.
+ */
+void pipe_compress(const char* inputPath, const char* outputPath) {
+    int input = open_stream(inputPath, 0);
+    int output = open_stream(outputPath, 1);
+    uint8_t* in = (uint8_t*)Mem_alloc(MEM_IO, STREAM_READ_SIZE);
+    uint8_t* out = (uint8_t*)Mem_alloc(MEM_IO, STREAM_READ_SIZE);
+    if (!in || !out) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, 
+            "Failed to allocate stream buffers.\n");
+    }
+    Archive_options options;
+    block_options(&options);
+    Huff_stream* stream = Huff_stream_compressor_create(&options);
+
+    int status;
+    do {
+        int flush = HUFF_STREAM_RUN;
+        if (stream->avail_in == 0) {
+            stream->next_in = in;
+            stream->avail_in = read_stream(input, in, STREAM_READ_SIZE, inputPath);
+            if (stream->avail_in == 0) flush = HUFF_STREAM_FINISH;
+        }
+        do {
+            stream->next_out = out;
+            stream->avail_out = STREAM_READ_SIZE;
+            status = Huff_stream_compress(stream, flush);
+            write_stream(output, out, STREAM_READ_SIZE - stream->avail_out, outputPath);
+        } while (status == HUFF_STREAM_OK && stream->avail_out == 0);
+    } while (status == HUFF_STREAM_OK);
+    if (status != HUFF_STREAM_END) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Failed to compress %s\n", inputPath);
+    }
+
+    Huff_stream_destroy(stream);
+    Mem_free(in);
+    Mem_free(out);
+    if (input != STDIN_FILENO) close(input);
+    if (output != STDOUT_FILENO && close(output) != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Failed to write %s\n", outputPath);
+    }
+}
+
+
+/**
+ * @brief Inverse of pipe_compress() for HUF2 and FFUH input alike; a block
+ * or symbol cut by a read boundary is finished when the next read arrives.
+ */
+void pipe_decompress(const char* inputPath, const char* outputPath) {
+    int input = open_stream(inputPath, 0);
+    int output = open_stream(outputPath, 1);
+    uint8_t* in = (uint8_t*)Mem_alloc(MEM_IO, STREAM_READ_SIZE);
+    uint8_t* out = (uint8_t*)Mem_alloc(MEM_IO, STREAM_READ_SIZE);
+    if (!in || !out) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, 
+            "Failed to allocate stream buffers.\n");
+    }
+    Huff_stream* stream = Huff_stream_decompressor_create();
+
+    int status;
+    do {
+        int flush = HUFF_STREAM_RUN;
+        if (stream->avail_in == 0) {
+            stream->next_in = in;
+            stream->avail_in = read_stream(input, in, STREAM_READ_SIZE, inputPath);
+            if (stream->avail_in == 0) flush = HUFF_STREAM_FINISH;
+        }
+        do {
+            stream->next_out = out;
+            stream->avail_out = STREAM_READ_SIZE;
+            status = Huff_stream_decompress(stream, flush);
+            write_stream(output, out, STREAM_READ_SIZE - stream->avail_out, outputPath);
+        } while (status == HUFF_STREAM_OK && stream->avail_out == 0);
+    } while (status == HUFF_STREAM_OK);
+    if (status != HUFF_STREAM_END) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Corrupt or truncated input: %s\n", inputPath);
+    }
+
+    Huff_stream_destroy(stream);
+    Mem_free(in);
+    Mem_free(out);
+    if (input != STDIN_FILENO) close(input);
+    if (output != STDOUT_FILENO && close(output) != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Failed to write %s\n", outputPath);
+    }
+}
+
+
+/**
+ * @brief What `-c` would write for a file, without writing it.
+ *
+ * Runs the block cuts, histograms and code tables of the block format at the
+ * chosen level and prints every block's kind, transform and size, then the
+ * predicted file size, the order-0 entropy and the estimated coding times.
+ * The sizes are exact; only the times are estimates.
+ */
+void analyze(const char* inputFilePath) {
+    if (legacy_format) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, 
+            "--analyze predicts the block format and cannot be combined with --legacy.\n");
+    }
+    printf("Running analysis... (kernels: %s)\n", Kernels_get()->name);
+    clock_t start_time = clock();
+
+    FILE* inputFile = fopen(inputFilePath, "rb");
+    if (!inputFile) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, 
+            "Failed to open input file: %s\n", inputFilePath);
+    }
+
+    Archive_options options;
+    block_options(&options);
+    Archive_analysis analysis;
+    Perf_phase_begin(perf_session, "analyze");
+    if (Archive_analyze(inputFile, &options, stdout, &analysis) != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "I/O error while analyzing: %s\n", inputFilePath);
+    }
+    Perf_phase_end(perf_session);
+    fclose(inputFile);
+
+    double raw = analysis.raw_size ? (double)analysis.raw_size : 1.0;
+    printf("Analysis completed in %.2f seconds. Nothing was written.\n",
+           (double)(clock() - start_time) / CLOCKS_PER_SEC);
+    printf("Original size: %" PRIu64 " bytes in %" PRIu64 " blocks (level %d)\n",
+           analysis.raw_size, analysis.blocks, compression_level);
+    printf("Compressed size: %" PRIu64 " bytes, ratio %.2f%%\n", analysis.compressed_size,
+           (1.0 - (double)analysis.compressed_size / raw) * 100.0);
+    printf("Order-0 entropy: %.0f bytes, %.3f bits/byte\n", analysis.entropy / 8.0, analysis.entropy / raw);
+    printf("Blocks by kind:");
+    for (unsigned kind = 0; kind <= BLOCK_REF; kind++) {
+        if (analysis.kind_bytes[kind]) {
+            printf(" %s %.1f%%", Block_kind_name(kind), 100.0 * (double)analysis.kind_bytes[kind] / raw);
+        }
+    }
+    printf("\n");
+    printf("Estimated time on one core: encode %.3f s, decode %.3f s\n",
+           analysis.encode_seconds, analysis.decode_seconds);
+}
+
+/**
+ * @brief Where `--grep` occurs in what a block-format file decodes to.
+ *
+ * Prints the original offset of every occurrence, then how many blocks the
+ * code tables ruled out. Nothing is written to disk.
+ */
+void search(const char* inputFilePath) {
+    printf("Running search... (kernels: %s)\n", Kernels_get()->name);
+    clock_t start_time = clock();
+
+    FILE* inputFile = fopen(inputFilePath, "rb");
+    if (!inputFile) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, 
+            "Failed to open input file: %s\n", inputFilePath);
     }
+    uint32_t magic_number = 0;
+    if (fread(&magic_number, sizeof(magic_number), 1, inputFile) != 1 || magic_number != BLOCK_FORMAT_MAGIC) {
+        fclose(inputFile);
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "--grep reads block-format (HUF2) files only: %s\n", inputFilePath);
+    }
+    fseeko(inputFile, 0, SEEK_SET);
 
+    Archive_grep_stats stats;
+    Perf_phase_begin(perf_session, "grep");
+    if (Archive_grep(inputFile, (const uint8_t*)grep_pattern, strlen(grep_pattern), stdout, &stats) != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Failed to search block file: %s\n", inputFilePath);
+    }
+    Perf_phase_end(perf_session);
+    fclose(inputFile);
+
+    printf("Search completed in %.2f seconds. %" PRIu64 " matches in %" PRIu64 " bytes.\n",
+           (double)(clock() - start_time) / CLOCKS_PER_SEC, stats.matches, stats.raw_size);
+    printf("Blocks skipped by their code table: %" PRIu64 " of %" PRIu64 ", %" PRIu64 " bytes decoded\n",
+           stats.skipped_blocks, stats.blocks, stats.decoded_bytes);
+}
+
+/**
+ * @brief Block-format options of this run: the preset of the chosen level,
+ * then the transforms and entropy coder if they were asked for explicitly
+ * and --dedup, with the block size cut down to fit --max-memory.
+ */
+static void block_options(Archive_options* options) {
+    Archive_options_level(options, compression_level);
+    if (block_transforms != OPTION_FROM_LEVEL) options->transforms = block_transforms;
+    if (block_entropy != OPTION_FROM_LEVEL) options->entropy = block_entropy;
+    options->dedup = block_dedup;
+    // Keep half of the limit for the rings and the output path.
+    if (Mem_limit()) Archive_options_fit(options, Mem_available() / 2);
+}
+
+/**
+ * @brief Serial decode pass of decompress_legacy(), from the current
+ * position of `inputFile`. Returns the bytes written, which fall short of
+ * `file_size` if the bitstream is corrupt.
+ */
+static uint64_t decode_stream(FILE* inputFile, FILE* outputFile, TrieNode* root, uint64_t file_size, const char* inputFilePath) {
+    // Compressed chunks are read ahead and decoded bytes are written behind
+    // the decode loop, so neither the disk nor the decoder waits on the other.
+    Io_reader* reader = Io_reader_create(inputFile, IO_CHUNK_SIZE, IO_RING_DEPTH);
+    Io_writer* writer = Io_writer_create(outputFile, IO_CHUNK_SIZE, IO_RING_DEPTH);
+    Io_chunk* output_chunk = Io_writer_acquire(writer);
     
-    fseek(inputFile, 0, SEEK_SET);
+    const Kernel_set* kernels = Kernels_get();
+    Trie_decoder* decoder = Trie_decoder_create(root);
+    Bit_reader br;
+    Bit_reader_init(&br, NULL, 0);
+    uint64_t bytes_written = 0;
+    Io_chunk* chunk;
 
-    // ===== HUFFMAN TREE CONSTRUCTION =====    
-    PriorityQueue* pq = Pq_create(256);
-    if (!pq) {
-        ByteTable_destroy(bt);
+    if (root->is_leaf) {
+        // Single-symbol input: the only codeword is empty and no data bits follow.
+        while (bytes_written < file_size) {
+            size_t count = output_chunk->capacity;
+            if (count > file_size - bytes_written) count = (size_t)(file_size - bytes_written);
+            memset(output_chunk->data, root->character, count);
+            output_chunk->size = count;
+            bytes_written += count;
+            Io_writer_submit(writer, output_chunk);
+            output_chunk = Io_writer_acquire(writer);
+        }
+    }
+
+    while (bytes_written < file_size && !decoder->error && (chunk = Io_reader_next(reader)) != NULL) {
+        Bit_reader_feed(&br, chunk->data, chunk->size);
+
+        // Decode until this chunk is used up; a partial symbol at its end stays
+        // in the bit container and decoder state until the next chunk arrives.
+        while (bytes_written < file_size && !decoder->error
+               && (Bit_reader_input_left(&br) > 0 || br.bit_count > 0)) {
+            size_t room = output_chunk->capacity - output_chunk->size;
+            if (room > file_size - bytes_written) room = (size_t)(file_size - bytes_written);
+
+            size_t decoded = kernels->decode(decoder, &br, output_chunk->data + output_chunk->size, room);
+            output_chunk->size += decoded;
+            bytes_written += decoded;
+            if (output_chunk->size == output_chunk->capacity) {
+                Io_writer_submit(writer, output_chunk);
+                output_chunk = Io_writer_acquire(writer);
+            } else if (decoded < room) {
+                break;
+            }
+        }
+    }
+    Io_writer_submit(writer, output_chunk);
+
+    int read_failed = Io_reader_failed(reader);
+    Io_reader_destroy(reader);
+    if (Io_writer_destroy(writer) != 0 || read_failed) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "I/O error while decompressing: %s\n", inputFilePath);
+    }
+    Trie_decoder_destroy(decoder);
+    return bytes_written;
+}
+
+
+
+/**
+ * @brief Single-table FFUH path of compress(): one histogram pass over the
+ * whole input, then one Huffman code for all of it. Returns the input size.
+ */
+static uint64_t compress_legacy(FILE* inputFile, FILE* outputFile, const char* inputFilePath) {
+    ByteTable* bt = ByteTable_create();
+    if (!bt) {
         fclose(inputFile);
         fclose(outputFile);
         THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, 
-            "Failed to create PriorityQueue.\n");
+            "Failed to create ByteTable.\n");
     }
-
-    for (int i = 0; i < 256; i++) {
-        if (bt->table[i] && bt->table[i]->count > 0) {
-            Huffman_node* node = Huffman_node_create(i, bt->table[i]->count, NULL, NULL);
-            Pq_pushNode(pq, node);
+    const Kernel_set* kernels = Kernels_get();
+    Perf_phase_begin(perf_session, "histogram");
+    uint64_t counts[256] = { 0 };
+    uint64_t filesize = 0;
+    uint32_t (*segments)[256] = NULL;
+    Io_reader* reader;
+    Io_chunk* chunk;
+    struct stat st;
+    if (fstat(fileno(inputFile), &st) == 0 && S_ISREG(st.st_mode)) {
+        // Regular files are counted in parallel ranges with pread. The counts
+        // of each segment (at most 1 KiB per segment and
+        // PARALLEL_HISTOGRAM_MAX_SEGMENTS of them, whatever the file size)
+        // let the encode pass run in parallel too, if they fit; --threads=1
+        // keeps the serial encoder.
+        filesize = (uint64_t)st.st_size;
+        uint64_t segments_size = Parallel_histogram_segments(filesize) * sizeof(*segments);
+        if (legacy_threads != 1 && segments_size && Mem_available() / 2 >= segments_size) {
+            segments = (uint32_t (*)[256])Mem_calloc(MEM_IO, 1, (size_t)segments_size);
+        }
+        if (Parallel_histogram_file(fileno(inputFile), filesize, legacy_threads, counts, segments) != 0) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+                "Failed to read input file: %s\n", inputFilePath);
+        }
+    } else {
+        reader = Io_reader_create(inputFile, IO_CHUNK_SIZE, IO_RING_DEPTH);
+        while ((chunk = Io_reader_next(reader)) != NULL) {
+            kernels->histogram(chunk->data, chunk->size, counts);
+            filesize += chunk->size;
+        }
+        if (Io_reader_failed(reader)) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+                "Failed to read input file: %s\n", inputFilePath);
         }
+        Io_reader_destroy(reader);
     }
+    ByteTable_add_counts(bt, counts);
+    Perf_phase_end(perf_session);
 
     
-    Huffman_node* root = Huffman_tree_generate(pq);
-    if (!root) {
-        Pq_destroy(pq);
+    fseeko(inputFile, 0, SEEK_SET);
+
+    // ===== HUFFMAN CODE CONSTRUCTION =====
+    // Canonical codes from in-place code lengths, limited to what Huffman_encoder packs.
+    Perf_phase_begin(perf_session, "tree");
+    uint8_t lengths[256];
+    if (Huffman_table_build_lengths(counts, lengths, HUFFMAN_ENCODER_MAX_CODE_LENGTH) == 0) {
         ByteTable_destroy(bt);
         fclose(inputFile);
         fclose(outputFile);
-        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, 
-            "Failed to generate Huffman tree.\n");
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, 
+            "Failed to build Huffman code: %s is empty.\n", inputFilePath);
     }
-
-    uint8_t code[256];
-    Huffman_tree_fill_codewords(root, code, 0, bt);
+    Huffman_table_set_codewords(lengths, bt);
 
     // ===== HEADER METADATA CREATION =====
     size_t codewords_metadata_size = 0;
@@ -147,80 +859,89 @@ void compress(const char* inputFilePath) {
     
     fwrite(header_serialized, 1, header_serialized_size, outputFile);    
     fwrite(SECTION_DIVIDER, 1, sizeof(SECTION_DIVIDER), outputFile);
+    Perf_phase_end(perf_session);
 
 
     // ===== COMPRESS ORIGINAL DATA & WRITE =====
-    size_t input_buffer_size = 1024 * 1024;  
-    size_t output_buffer_size = 1024 * 1024; 
-    uint8_t* input_buffer = (uint8_t*)malloc(input_buffer_size);
-    uint8_t* output_buffer = (uint8_t*)malloc(output_buffer_size);
-    if (!input_buffer || !output_buffer) {
-        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, 
-            "Failed to allocate buffers for compression.\n");
-    }
-
-    size_t input_bytes_read = 0; 
-    size_t output_bit_offset = 0; 
-    size_t output_byte_offset = 0; 
-
-    while ((input_bytes_read = fread(input_buffer, 1, input_buffer_size, inputFile)) > 0) {
-        for (size_t i = 0; i < input_bytes_read; i++) {
-            uint8_t byte = input_buffer[i]; 
-            const uint8_t* codeword = bt->table[byte]->codeword;
-            size_t codeword_length = strlen((char*)codeword); 
-
-            
-            for (size_t j = 0; j < codeword_length; j++) {
-                if (codeword[j] == '1') {
-                    output_buffer[output_byte_offset] |= (1 << (7 - output_bit_offset));
-                }
-                output_bit_offset++;
-
-                
-                if (output_bit_offset == 8) {
-                    output_bit_offset = 0;
-                    output_byte_offset++;
-                    if (output_byte_offset == output_buffer_size) {
-                        fwrite(output_buffer, 1, output_buffer_size, outputFile);
-                        memset(output_buffer, 0, output_buffer_size); 
-                        output_byte_offset = 0;
-                    }
-                }
-            }
-        }
+    fflush(outputFile);
+    Perf_phase_begin(perf_session, "encode");
+    Huffman_encoder* encoder = Huffman_encoder_create(bt);
+    if (!encoder) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, 
+            "Codewords are too long to encode: %s\n", inputFilePath);
     }
 
-    if (output_bit_offset > 0) {
-        output_byte_offset++;
-    }
-    if (output_byte_offset > 0) {
-        fwrite(output_buffer, 1, output_byte_offset, outputFile);
+    if (segments) {
+        // Every segment is encoded straight to its bit offset in the output (see Parallel_encoder.h).
+        uint64_t encoded_size = 0;
+        if (Parallel_encoder_file(fileno(inputFile), filesize, (const uint32_t (*)[256])segments, encoder, legacy_threads,
+                                  fileno(outputFile), (uint64_t)ftello(outputFile), &encoded_size) != 0) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+                "I/O error while compressing: %s\n", inputFilePath);
+        }
+        Mem_free(segments);
+    } else {
+        encode_stream(inputFile, outputFile, encoder, inputFilePath);
     }
+    Perf_phase_end(perf_session);
 
 
     // ===== RESOURCE CLEANUP =====
-    free(input_buffer);
-    free(output_buffer);
-    free(header_serialized);
-    free(codewords_metadata);
+    Huffman_encoder_destroy(encoder);
+    Mem_free(header_serialized);
+    Mem_free(codewords_metadata);
     Huffman_header_destroy(header);
-    Huffman_node_deallcoate(root);
-    Pq_destroy(pq);
     ByteTable_destroy(bt);
-    fclose(inputFile);
-    fclose(outputFile);
+    return filesize;
+}
 
 
-    FILE* compressedFile = fopen(outputFilePath, "rb");
-    fseek(compressedFile, 0, SEEK_END);
-    long compressed_size = ftell(compressedFile);
-    fclose(compressedFile);
-    double compression_ratio = 1.0 - ((double)compressed_size / (double)filesize);
+/**
+ * @brief Serial encode pass of compress_legacy() for pipes and other
+ * non-regular inputs, and for regular files under --threads=1 or when the
+ * segment counts do not fit: the reader stage keeps IO_RING_DEPTH input chunks in
+ * flight ahead of the encoder and the writer stage drains full output
+ * chunks behind it.
+ */
+static void encode_stream(FILE* inputFile, FILE* outputFile, const Huffman_encoder* encoder, const char* inputFilePath) {
+    const Kernel_set* kernels = Kernels_get();
+    Io_chunk* chunk;
+    Io_reader* reader = Io_reader_create(inputFile, IO_CHUNK_SIZE, IO_RING_DEPTH);
+    Io_writer* writer = Io_writer_create(outputFile, IO_CHUNK_SIZE, IO_RING_DEPTH);
 
-    end_time = clock();
-    elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
-    printf("Compression completed in %.2f seconds. Output written to '%s'.\n", elapsed_time, outputFilePath);
-    printf("Compression ratio: %.2f%%\n", compression_ratio * 100.0);
+    Io_chunk* output_chunk = Io_writer_acquire(writer);
+    Bit_writer bw;
+    Bit_writer_init(&bw, output_chunk->data, output_chunk->capacity);
+
+    while ((chunk = Io_reader_next(reader)) != NULL) {
+        size_t offset = 0;
+        while (offset < chunk->size) {
+            // Encode as many bytes as can never overrun the output chunk, so the
+            // kernel itself runs without bounds checks.
+            size_t batch = Huffman_encoder_batch_limit(encoder, &bw);
+            if (batch == 0) {
+                output_chunk->size = bw.ptr - output_chunk->data;
+                Io_writer_submit(writer, output_chunk);
+                output_chunk = Io_writer_acquire(writer);
+                Bit_writer_retarget(&bw, output_chunk->data, output_chunk->capacity);
+                continue;
+            }
+            if (batch > chunk->size - offset) batch = chunk->size - offset;
+            kernels->encode(encoder, chunk->data + offset, batch, &bw);
+            offset += batch;
+        }
+    }
+
+    Bit_writer_finish(&bw);
+    output_chunk->size = bw.ptr - output_chunk->data;
+    Io_writer_submit(writer, output_chunk);
+
+    int read_failed = Io_reader_failed(reader);
+    Io_reader_destroy(reader);
+    if (Io_writer_destroy(writer) != 0 || read_failed) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "I/O error while compressing: %s\n", inputFilePath);
+    }
 }
 
 
@@ -239,14 +960,14 @@ void compress(const char* inputFilePath) {
  *    - Generates a new output file with the original file name (excluding `.huff` extension).
  * 
  * 4.  **DATA DECOMPRESSION**
- *    - load the compressed data to the memory buffer, do Decompressing.
- *    - write decoded binary data to the output file(*.orig)
+ *    - stream the compressed data through the read-ahead ring, do Decompressing.
+ *    - hand decoded binary data to the write-behind stage for the output file(*.orig)
  * 
  * 5. **Resource Cleanup**:
  *    - Frees allocated memory and closes all file streams.
  */
 void decompress(const char* inputFilePath) {
-    printf("Running decompression...\n");
+    printf("Running decompression... (kernels: %s)\n", Kernels_get()->name);
     clock_t start_time, end_time;
     start_time = clock();
     double elapsed_time;
@@ -258,105 +979,133 @@ void decompress(const char* inputFilePath) {
             "Failed to open input file: %s\n", inputFilePath);
     }
 
-    
-    Huffman_header* header = Huffman_header_deserialize(inputFile);
-    if (!header) {
-        fclose(inputFile);
-        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
-            "Failed to deserialize Huffman header.\n");
-    }
-
-    // ===== HUFFMAN TREE RECONSTRUCTION =====
-    TrieNode* root = Trie_build_from_metadata(header->codeword_map_metadata, header->codeword_map_metadata_size);
-    if (!root) {
-        Huffman_header_destroy(header);
+    // The magic number tells the block format (HUF2) from a legacy FFUH file.
+    uint32_t magic_number = 0;
+    if (fread(&magic_number, sizeof(magic_number), 1, inputFile) != 1) {
         fclose(inputFile);
         THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
-            "Failed to build Trie from metadata.\n");
+            "Failed to read file header: %s\n", inputFilePath);
     }
-
-    
-    fseek(inputFile, sizeof(SECTION_DIVIDER), SEEK_CUR);
+    fseeko(inputFile, 0, SEEK_SET);
 
     
     // =====OUTPUT FILE INITILIZATION=====
-    char outputFilePath[512]; 
-    strncpy(outputFilePath, inputFilePath, sizeof(outputFilePath) - 1);
-    outputFilePath[sizeof(outputFilePath) - 1] = '\0';
-
-    char* extension = strrchr(outputFilePath, '.');
-    if (extension && strcmp(extension, ".huff") == 0) {
-        *extension = '\0'; 
-        strncat(outputFilePath, ".orig", sizeof(outputFilePath) - strlen(outputFilePath) - 1); // add .orig 
-    } else {
+    char* outputFilePath = make_output_path(inputFilePath, 1);
+    if (!outputFilePath) {
         fclose(inputFile);
         THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, 
             "Error: Input file does not have a valid .huff extension.\n");
     }
 
-    FILE* outputFile = fopen(outputFilePath, "wb");
+    // Readable too: REF blocks copy bytes already written.
+    FILE* outputFile = fopen(outputFilePath, "w+b");
     if (!outputFile) {
         fclose(inputFile);
         THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, 
             "Failed to open output file: %s\n", outputFilePath);
     }
 
-    
-
     // ===== DATA DECOMPRESSION =====
-    fseek(inputFile, 0, SEEK_END);
-    long file_size = ftell(inputFile);
-    fseek(inputFile, header->header_size + sizeof(SECTION_DIVIDER), SEEK_SET);
-    size_t compressed_size = file_size - header->header_size - sizeof(SECTION_DIVIDER);
-
-    Stream_buffer* compressed_data_buffer = Stream_buffer_create(inputFile, 1024 * 1024);
-    if (!compressed_data_buffer) {
-        Trie_destroy(root);
-        Huffman_header_destroy(header);
-        fclose(inputFile);
-        fclose(outputFile);
-        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, 
-            "Failed to allocate memory for compressed data.\n");
+    if (magic_number == BLOCK_FORMAT_MAGIC) {
+        uint64_t bytes_written = 0;
+        Perf_phase_begin(perf_session, "decompress");
+        if (Archive_decompress(inputFile, outputFile, &bytes_written) != 0) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+                "Failed to decompress block file: %s\n", inputFilePath);
+        }
+        Perf_phase_end(perf_session);
+    } else {
+        decompress_legacy(inputFile, outputFile, inputFilePath);
     }
-    
-    size_t total_bits = compressed_size * 8;
-    size_t bytes_written = 0;
-    TrieNode* current = root;
+    fclose(inputFile);
+    fclose(outputFile);
 
-    for (size_t bit_offset = 0; bit_offset < total_bits; bit_offset++) {
-        size_t byte_index = bit_offset / 8;
-        size_t bit_index = bit_offset % 8;
-        uint8_t bit = (Stream_buffer_get(compressed_data_buffer, byte_index) >> (7 - bit_index)) & 1;
+    end_time = clock();
+    elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+    printf("Decompression completed in %.2f seconds. Output written to '%s'.\n", elapsed_time,outputFilePath);
+    Mem_free(outputFilePath);
+}
 
-        current = (bit == 0) ? current->left : current->right;
 
-        if (current->is_leaf) {
-            fwrite(&current->character, 1, 1, outputFile);
-            bytes_written++;
-            current = root;
+/**
+ * @brief FFUH path of decompress(): rebuilds the trie from the header and
+ * decodes the single bitstream that follows the section divider.
+ */
+static void decompress_legacy(FILE* inputFile, FILE* outputFile, const char* inputFilePath) {
+    Perf_phase_begin(perf_session, "trie");
+    Huffman_header* header = Huffman_header_deserialize(inputFile);
+    if (!header) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Failed to deserialize Huffman header.\n");
+    }
 
-            if (bytes_written == header->file_size) {
-                break;
-            }
+    // ===== HUFFMAN TREE RECONSTRUCTION =====
+    TrieNode* root = Trie_build_from_metadata(header->codeword_map_metadata, header->codeword_map_metadata_size);
+    if (!root) {
+        Huffman_header_destroy(header);
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+            "Failed to build Trie from metadata.\n");
+    }
+    Perf_phase_end(perf_session);
+
+    // ===== DATA DECOMPRESSION =====
+    Perf_phase_begin(perf_session, "decode");
+    uint64_t data_offset = (uint64_t)header->header_size + sizeof(SECTION_DIVIDER);
+    uint64_t bytes_written = 0;
+    unsigned threads = legacy_threads ? legacy_threads : Parallel_histogram_default_threads();
+    struct stat st;
+    if (!root->is_leaf && threads > 1 && fstat(fileno(inputFile), &st) == 0 && S_ISREG(st.st_mode)
+        && (uint64_t)st.st_size >= data_offset + 2 * PARALLEL_DECODER_SEGMENT_SIZE) {
+        // Regular files have no index to split at, so threads start speculatively (see Parallel_decoder.h).
+        if (Parallel_decoder_file(fileno(inputFile), data_offset, (uint64_t)st.st_size - data_offset, root,
+                                  header->file_size, threads, outputFile, &bytes_written) != 0) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
+                "I/O error while decompressing: %s\n", inputFilePath);
         }
+    } else {
+        fseeko(inputFile, (off_t)data_offset, SEEK_SET);
+        bytes_written = decode_stream(inputFile, outputFile, root, header->file_size, inputFilePath);
     }
 
     if (bytes_written != header->file_size) {
         THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, 
-            "Error: Decoded file size (%zu) does not match original file size (%lu)\n",
+            "Error: Decoded file size (%" PRIu64 ") does not match original file size (%" PRIu64 ")\n",
             bytes_written, header->file_size);
     }
+    Perf_phase_end(perf_session);
 
 
 
     // ===== RESOURCE CLEANUP =====    
-    free(compressed_data_buffer);
     Trie_destroy(root);
     Huffman_header_destroy(header);
-    fclose(inputFile);
-    fclose(outputFile);
+}
 
-     end_time = clock();
-    elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
-    printf("Decompression completed in %.2f seconds. Output written to '%s'.\n", elapsed_time,outputFilePath);
+
+/**
+ * @brief Output path next to the input: `<input>.huff` when compressing,
+ * `<input without .huff>.orig` when decompressing. The result is heap
+ * allocated, so paths of any length work; NULL if a decompress input does not
+ * end in `.huff`.
+ */
+static char* make_output_path(const char* inputFilePath, int decompressing) {
+    size_t length = strlen(inputFilePath);
+    char* path = (char*)Mem_alloc(MEM_OTHER, length + sizeof(".huff"));
+    if (!path) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, 
+            "Failed to allocate output path.\n");
+    }
+    memcpy(path, inputFilePath, length + 1);
+
+    if (!decompressing) {
+        strcat(path, ".huff");
+        return path;
+    }
+    char* extension = strrchr(path, '.');
+    if (!extension || strcmp(extension, ".huff") != 0) {
+        Mem_free(path);
+        return NULL;
+    }
+    strcpy(extension, ".orig");
+    return path;
 }
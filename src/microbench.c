@@ -0,0 +1,798 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "Byte_table.h"
+#include "Huffman_table.h"
+#include "Huffman_encoder.h"
+#include "Trie.h"
+#include "Trie_decoder.h"
+#include "Block_codec.h"
+#include "Block_split.h"
+#include "Archive.h"
+#include "Cpu_dispatch.h"
+#include "Transform.h"
+#include "Huff_stream.h"
+#include "Mem.h"
+#include "exception_xmacro.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MICROBENCH_HAVE_TSC 1
+#else
+#define MICROBENCH_HAVE_TSC 0
+#endif
+
+#define USAGE "Usage: %s [--size=BYTES] [--reps=N] [--warmup=N] [--only=NAME] [--kernel=scalar|bmi2]" \
+              " [--level=1..9] [--entropy=NAME] [--file=PATH] [--check]\n"
+
+/*
+ * microbench : times the coding kernels in memory, without file I/O, on
+ * fixed synthetic distributions. Each kernel is calibrated to run for at
+ * least MIN_SAMPLE_NS per sample, warmed up, then sampled `reps` times; the
+ * report gives the mean and the 95% confidence half-width of ns/byte and
+ * cycles/byte (TSC reference cycles) over the samples. Tree and trie builds
+ * do not depend on the input size, so their ns/op column is the one to read.
+ * The block kernels use the block size and encoder settings of --level,
+ * with the entropy coder overridden by --entropy, and
+ * --file replaces the synthetic inputs with the contents of a file.
+ * --check times nothing and instead verifies the code-length builder on
+ * fixed count vectors (see check_lengths) and the transforms on blocks no
+ * level produces (see check_transforms) and Huff_stream fed and drained in
+ * small pieces (see check_stream), exiting non-zero on a mismatch.
+ */
+
+#define MIN_SAMPLE_NS 5000000ull
+
+typedef struct {
+    const char* name;
+    uint8_t* data;
+    size_t size;
+
+    // Legacy (FFUH) path: one code for the whole buffer.
+    uint64_t counts[256];
+    ByteTable* bt;
+    ByteTable* scratch_bt;
+    uint8_t* metadata;
+    size_t metadata_size;
+    Huffman_encoder* encoder;
+    uint8_t* encoded;
+    size_t encoded_capacity;
+    size_t encoded_size;
+    TrieNode* root;
+    Trie_decoder* decoder;
+    uint8_t* out;
+
+    // Block (HUF2) path.
+    uint32_t block_size;
+    Block_encoder* block_encoder;
+    Block_decoder* block_decoder;
+    Block_splitter* splitter;
+    uint8_t* blocks;
+    size_t blocks_size;
+} Bench_input;
+
+typedef struct {
+    const char* name;
+    int legacy;     // needs a code with at least two symbols
+    void (*run)(Bench_input* input);
+} Bench_kernel;
+
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+
+static uint64_t now_cycles(void) {
+#if MICROBENCH_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+// ===== DISTRIBUTIONS =====
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+
+static double rng_unit(void) {
+    return (double)(rng_next() >> 11) / 9007199254740992.0;
+}
+
+
+// Draws bytes from `weights` by inverse CDF.
+static void fill_weighted(uint8_t* data, size_t size, const double weights[256]) {
+    double cdf[256];
+    double sum = 0.0;
+    for (int i = 0; i < 256; i++) sum += weights[i];
+    double running = 0.0;
+    for (int i = 0; i < 256; i++) {
+        running += weights[i] / sum;
+        cdf[i] = running;
+    }
+    cdf[255] = 1.0;
+
+    for (size_t i = 0; i < size; i++) {
+        double u = rng_unit();
+        int lo = 0, hi = 255;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cdf[mid] < u) lo = mid + 1;
+            else hi = mid;
+        }
+        data[i] = (uint8_t)lo;
+    }
+}
+
+
+static void fill_uniform(uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; i++) data[i] = (uint8_t)rng_next();
+}
+
+
+// P(rank k) ~ 1 / (k + 1): a few dominant bytes and a long tail, like text.
+static void fill_zipf(uint8_t* data, size_t size) {
+    double weights[256];
+    for (int i = 0; i < 256; i++) weights[i] = 1.0 / (i + 1);
+    fill_weighted(data, size, weights);
+}
+
+
+// P(k) ~ 0.7^k: the skewed distributions where Huffman wastes most.
+static void fill_geometric(uint8_t* data, size_t size) {
+    double weights[256];
+    for (int i = 0; i < 256; i++) weights[i] = pow(0.7, i);
+    fill_weighted(data, size, weights);
+}
+
+
+static void fill_single(uint8_t* data, size_t size) {
+    memset(data, 'a', size);
+}
+
+
+static const struct {
+    const char* name;
+    void (*fill)(uint8_t* data, size_t size);
+} DISTRIBUTIONS[] = {
+    { "uniform", fill_uniform },
+    { "zipf", fill_zipf },
+    { "geometric", fill_geometric },
+    { "single", fill_single },
+};
+
+
+// Returns the size of `path` and, if `data` is not NULL, reads it there.
+static size_t load_file(const char* path, uint8_t* data) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FILE_NOT_FOUND, "Failed to open input file: %s\n", path);
+    }
+    fseeko(f, 0, SEEK_END);
+    size_t size = (size_t)ftello(f);
+    fseeko(f, 0, SEEK_SET);
+    if (size == 0 || (data && fread(data, 1, size, f) != size)) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, "Failed to read input file: %s\n", path);
+    }
+    fclose(f);
+    return size;
+}
+
+
+// ===== KERNELS =====
+
+static void run_histogram(Bench_input* input) {
+    memset(input->counts, 0, sizeof(input->counts));
+    Kernels_get()->histogram(input->data, input->size, input->counts);
+}
+
+
+static void run_bytetable(Bench_input* input) {
+    for (size_t i = 0; i < input->size; i++) {
+        ByteTable_increment(input->scratch_bt, input->data[i]);
+    }
+}
+
+
+// Code construction of the legacy format: in-place lengths, then canonical codeword strings.
+static void run_tree(Bench_input* input) {
+    uint8_t lengths[256];
+    Huffman_table_build_lengths(input->counts, lengths, HUFFMAN_ENCODER_MAX_CODE_LENGTH);
+    Huffman_table_set_codewords(lengths, input->scratch_bt);
+}
+
+
+// The per-block table build of the block format: limited lengths, then packed canonical codes.
+static void run_lengths(Bench_input* input) {
+    uint8_t lengths[256];
+    Huffman_encoder codes;
+    Huffman_table_build_lengths(input->counts, lengths, HUFFMAN_TABLE_MAX_BITS);
+    Huffman_table_build_encoder(lengths, &codes);
+}
+
+
+static void run_trie(Bench_input* input) {
+    Trie_destroy(Trie_build_from_metadata(input->metadata, input->metadata_size));
+}
+
+
+static void run_encode(Bench_input* input) {
+    Bit_writer bw;
+    Bit_writer_init(&bw, input->encoded, input->encoded_capacity);
+    Kernels_get()->encode(input->encoder, input->data, input->size, &bw);
+    Bit_writer_finish(&bw);
+    input->encoded_size = (size_t)(bw.ptr - input->encoded);
+}
+
+
+static void run_decode(Bench_input* input) {
+    Bit_reader br;
+    Bit_reader_init(&br, input->encoded, input->encoded_size);
+    input->decoder->current = input->root;
+    input->decoder->error = 0;
+    size_t decoded = Kernels_get()->decode(input->decoder, &br, input->out, input->size);
+    if (decoded != input->size || input->decoder->error) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, "Legacy decode failed on %s.\n", input->name);
+    }
+}
+
+
+static void run_block_encode(Bench_input* input) {
+    size_t written = 0;
+    for (size_t offset = 0; offset < input->size; offset += input->block_size) {
+        size_t size = input->size - offset;
+        if (size > input->block_size) size = input->block_size;
+        written += Block_encode(input->block_encoder, input->data + offset, size, input->blocks + written);
+    }
+    input->blocks_size = written;
+}
+
+
+static void run_block_decode(Bench_input* input) {
+    size_t position = 0;
+    uint8_t* out = input->out;
+    while (position < input->blocks_size) {
+        Block_header header;
+        Block_header_deserialize(&header, input->blocks + position, input->block_size);
+        position += BLOCK_FORMAT_BLOCK_HEADER_SIZE;
+        if (Block_decode(input->block_decoder, &header, input->blocks + position, out) != 0) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, "Block decode failed on %s.\n", input->name);
+        }
+        position += header.payload_size;
+        out += header.raw_size;
+    }
+}
+
+
+// Boundary analysis alone, over the same block_size runs Archive hands it.
+static void run_block_split(Bench_input* input) {
+    for (size_t offset = 0; offset < input->size; offset += input->block_size) {
+        size_t size = input->size - offset;
+        if (size > input->block_size) size = input->block_size;
+        Block_split(input->splitter, input->data + offset, size);
+    }
+}
+
+
+static const Bench_kernel KERNELS[] = {
+    { "histogram", 0, run_histogram },
+    { "bytetable", 0, run_bytetable },
+    { "tree", 1, run_tree },
+    { "lengths", 1, run_lengths },
+    { "trie", 1, run_trie },
+    { "encode", 1, run_encode },
+    { "decode", 1, run_decode },
+    { "block-split", 0, run_block_split },
+    { "block-encode", 0, run_block_encode },
+    { "block-decode", 0, run_block_decode },
+};
+
+
+// ===== SETUP =====
+
+static void input_prepare(Bench_input* input, const Archive_options* options) {
+    memset(input->counts, 0, sizeof(input->counts));
+    Kernels_get()->histogram(input->data, input->size, input->counts);
+    input->bt = ByteTable_create();
+    input->scratch_bt = ByteTable_create();
+    ByteTable_add_counts(input->bt, input->counts);
+    ByteTable_add_counts(input->scratch_bt, input->counts);
+
+    input->out = (uint8_t*)Mem_alloc(MEM_OTHER, input->size);
+    input->block_size = options->block_size;
+    size_t blocks = (input->size + input->block_size - 1) / input->block_size;
+    input->blocks = (uint8_t*)Mem_alloc(MEM_OTHER, blocks * Block_encode_bound(input->block_size));
+    if (!input->out || !input->blocks) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, "Failed to allocate benchmark buffers.\n");
+    }
+    input->block_encoder = Block_encoder_create();
+    input->block_encoder->num_streams = options->num_streams;
+    input->block_encoder->transforms = options->transforms;
+    input->block_encoder->entropy = options->entropy;
+    input->block_encoder->sample_shift = options->sample_shift;
+    input->block_decoder = Block_decoder_create();
+    input->splitter = Block_splitter_create();
+    run_block_encode(input);
+    run_block_decode(input);
+    if (memcmp(input->out, input->data, input->size) != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, "Block round trip differs on %s.\n", input->name);
+    }
+
+    int distinct = 0;
+    for (int i = 0; i < 256; i++) {
+        if (input->counts[i]) distinct++;
+    }
+    if (distinct < 2) return;
+
+    // One pass of the legacy pipeline produces what the timed kernels consume.
+    uint8_t lengths[256];
+    Huffman_table_build_lengths(input->counts, lengths, HUFFMAN_ENCODER_MAX_CODE_LENGTH);
+    Huffman_table_set_codewords(lengths, input->bt);
+
+    input->metadata = ByteTable_make_codewords_map_metadata(input->bt, &input->metadata_size);
+    input->encoder = Huffman_encoder_create(input->bt);
+    if (!input->encoder) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, "Codewords are too long to encode: %s\n", input->name);
+    }
+    input->encoded_capacity = input->size / 8 * input->encoder->max_length + input->encoder->max_length + 2 * BIT_WRITER_SLACK;
+    input->encoded = (uint8_t*)Mem_alloc(MEM_OTHER, input->encoded_capacity);
+    if (!input->encoded) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, "Failed to allocate benchmark buffers.\n");
+    }
+    run_encode(input);
+
+    input->root = Trie_build_from_metadata(input->metadata, input->metadata_size);
+    input->decoder = Trie_decoder_create(input->root);
+    run_decode(input);
+    if (memcmp(input->out, input->data, input->size) != 0) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_FILE, "Legacy round trip differs on %s.\n", input->name);
+    }
+}
+
+
+static void input_release(Bench_input* input) {
+    Trie_decoder_destroy(input->decoder);
+    Trie_destroy(input->root);
+    Huffman_encoder_destroy(input->encoder);
+    Block_encoder_destroy(input->block_encoder);
+    Block_decoder_destroy(input->block_decoder);
+    Block_splitter_destroy(input->splitter);
+    ByteTable_destroy(input->bt);
+    ByteTable_destroy(input->scratch_bt);
+    Mem_free(input->metadata);
+    Mem_free(input->encoded);
+    Mem_free(input->blocks);
+    Mem_free(input->out);
+}
+
+
+// ===== STATISTICS =====
+
+// Two-sided 95% Student t quantiles for 1..30 degrees of freedom.
+static const double T95[31] = {
+    0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+
+static void summarize(const double* samples, int n, double* mean, double* half_width) {
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) sum += samples[i];
+    *mean = sum / n;
+    if (n < 2) {
+        *half_width = 0.0;
+        return;
+    }
+    double squares = 0.0;
+    for (int i = 0; i < n; i++) squares += (samples[i] - *mean) * (samples[i] - *mean);
+    double t = n - 1 <= 30 ? T95[n - 1] : 1.96;
+    *half_width = t * sqrt(squares / (n - 1)) / sqrt((double)n);
+}
+
+
+static void bench(const Bench_kernel* kernel, Bench_input* input, int reps, int warmup) {
+    // Enough iterations per sample to dwarf the timer's resolution.
+    uint64_t iterations = 1;
+    for (;;) {
+        uint64_t start = now_ns();
+        for (uint64_t i = 0; i < iterations; i++) kernel->run(input);
+        if (now_ns() - start >= MIN_SAMPLE_NS || iterations >= (1ull << 30)) break;
+        iterations *= 2;
+    }
+    for (int i = 0; i < warmup; i++) {
+        for (uint64_t k = 0; k < iterations; k++) kernel->run(input);
+    }
+
+    double* ns = (double*)Mem_alloc(MEM_OTHER, reps * sizeof(double));
+    double* cycles = (double*)Mem_alloc(MEM_OTHER, reps * sizeof(double));
+    if (!ns || !cycles) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, "Failed to allocate samples.\n");
+    }
+    for (int r = 0; r < reps; r++) {
+        uint64_t start_ns = now_ns();
+        uint64_t start_cycles = now_cycles();
+        for (uint64_t k = 0; k < iterations; k++) kernel->run(input);
+        uint64_t end_cycles = now_cycles();
+        uint64_t end_ns = now_ns();
+        ns[r] = (double)(end_ns - start_ns) / (double)iterations;
+        cycles[r] = (double)(end_cycles - start_cycles) / (double)iterations;
+    }
+
+    double ns_mean, ns_ci, cycles_mean, cycles_ci;
+    summarize(ns, reps, &ns_mean, &ns_ci);
+    summarize(cycles, reps, &cycles_mean, &cycles_ci);
+    double bytes = (double)input->size;
+    printf("%-13s %-10s %12.0f %9.4f ±%-7.4f %8.3f ±%-7.3f %9.1f\n",
+           kernel->name, input->name, ns_mean,
+           ns_mean / bytes, ns_ci / bytes, cycles_mean / bytes, cycles_ci / bytes,
+           bytes / ns_mean * 1000.0);
+    Mem_free(ns);
+    Mem_free(cycles);
+}
+
+
+// ===== CHECKS =====
+
+// Total bits of an optimal unlimited code: the sum of all merged weights,
+// taking the two smallest each time as the node-and-heap tree builder did.
+static uint64_t reference_total_bits(const uint64_t* counts, unsigned n) {
+    uint64_t weights[HUFFMAN_TABLE_MAX_SYMBOLS];
+    unsigned m = 0;
+    for (unsigned i = 0; i < n; i++) {
+        if (counts[i]) weights[m++] = counts[i];
+    }
+    uint64_t total = 0;
+    while (m > 1) {
+        unsigned a = 0, b = 1;
+        if (weights[b] < weights[a]) { a = 1; b = 0; }
+        for (unsigned i = 2; i < m; i++) {
+            if (weights[i] < weights[a]) { b = a; a = i; }
+            else if (weights[i] < weights[b]) b = i;
+        }
+        uint64_t merged = weights[a] + weights[b];
+        total += merged;
+        unsigned high = a > b ? a : b, low = a < b ? a : b;
+        weights[low] = merged;
+        weights[high] = weights[--m];
+    }
+    return total;
+}
+
+
+static const uint64_t* compare_counts_base;
+
+static int compare_counts(const void* a, const void* b) {
+    uint64_t x = compare_counts_base[*(const uint64_t*)a], y = compare_counts_base[*(const uint64_t*)b];
+    return x < y ? -1 : x > y;
+}
+
+
+/*
+ * Builds the lengths of one count vector with and without `limit` and
+ * checks that both codes are complete (Kraft sum exactly 1), that the
+ * unlimited one costs what the reference builder's does, and that the
+ * limited one respects the limit, costs no less, and never gives a rarer
+ * symbol a shorter code. Returns 0 if all hold.
+ */
+static int check_lengths_vector(const uint64_t* counts, unsigned n, unsigned limit) {
+    uint8_t lengths[HUFFMAN_TABLE_MAX_SYMBOLS];
+    unsigned used = 0;
+    for (unsigned i = 0; i < n; i++) {
+        if (counts[i]) used++;
+    }
+    if (used < 2) return 0;
+
+    uint64_t reference = reference_total_bits(counts, n);
+    uint64_t order[HUFFMAN_TABLE_MAX_SYMBOLS];
+    for (unsigned i = 0; i < n; i++) order[i] = (uint64_t)i;
+    compare_counts_base = counts;
+    qsort(order, n, sizeof(order[0]), compare_counts);
+    for (int limited = 0; limited < 2; limited++) {
+        unsigned max_length = limited ? limit : HUFFMAN_ENCODER_MAX_CODE_LENGTH - 1;
+        unsigned longest = Huffman_table_build_lengths_n(counts, n, lengths, max_length);
+        if (longest > max_length) return -1;
+
+        // Kraft sum in units of 2^-63; every length is at most 63.
+        unsigned __int128 kraft = 0;
+        uint64_t total = 0;
+        for (unsigned i = 0; i < n; i++) {
+            if (!counts[i] != !lengths[i] || lengths[i] > longest) return -1;
+            if (!counts[i]) continue;
+            kraft += (unsigned __int128)1 << (63 - lengths[i]);
+            total += counts[i] * lengths[i];
+        }
+        // By increasing count, no group of equal counts may hold a code
+        // longer than the shortest one among the rarer symbols.
+        unsigned shortest_rarer = 255;
+        for (unsigned k = 0; k < n;) {
+            unsigned end = k, shortest = 255, longest_here = 0;
+            for (; end < n && counts[order[end]] == counts[order[k]]; end++) {
+                unsigned length = lengths[order[end]];
+                if (length < shortest) shortest = length;
+                if (length > longest_here) longest_here = length;
+            }
+            if (counts[order[k]] && longest_here > shortest_rarer) return -1;
+            if (counts[order[k]] && shortest < shortest_rarer) shortest_rarer = shortest;
+            k = end;
+        }
+        if (kraft != (unsigned __int128)1 << 63) return -1;
+        if (limited ? total < reference : total != reference) return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Deterministic checks of Huffman_table_build_lengths_n: Fibonacci and
+ * power-of-two counts, whose optimal codes are as deep as the alphabet is
+ * large, equal counts, and pseudo-random vectors whose counts span up to 40
+ * bits. Each is built both unlimited and with a 10- to 12-bit limit, the
+ * block format's range. Returns the number of failed vectors.
+ */
+static unsigned check_lengths(void) {
+    uint64_t counts[HUFFMAN_TABLE_MAX_SYMBOLS];
+    unsigned vectors = 0, failed = 0;
+
+    for (unsigned n = 2; n <= 60; n++) {
+        counts[0] = 1;
+        counts[1] = 1;
+        for (unsigned i = 2; i < n; i++) counts[i] = counts[i - 1] + counts[i - 2];
+        failed += check_lengths_vector(counts, n, HUFFMAN_TABLE_MAX_BITS) != 0;
+        for (unsigned i = 0; i < n; i++) counts[i] = 1ull << (i < 50 ? i : 50);
+        failed += check_lengths_vector(counts, n, HUFFMAN_TABLE_MAX_BITS) != 0;
+        vectors += 2;
+    }
+    for (unsigned i = 0; i < HUFFMAN_TABLE_MAX_SYMBOLS; i++) counts[i] = 7;
+    failed += check_lengths_vector(counts, 256, HUFFMAN_TABLE_MAX_BITS) != 0;
+    failed += check_lengths_vector(counts, HUFFMAN_TABLE_MAX_SYMBOLS, HUFFMAN_TABLE_MAX_BITS) != 0;
+    vectors += 2;
+
+    rng_state = 0x9E3779B97F4A7C15ull;
+    for (unsigned v = 0; v < 5000; v++) {
+        unsigned n = v % 2 ? 256 : HUFFMAN_TABLE_MAX_SYMBOLS;
+        unsigned zeros = (unsigned)(rng_next() % 100);
+        for (unsigned i = 0; i < n; i++) {
+            uint64_t r = rng_next();
+            counts[i] = r % 100 < zeros ? 0 : (r >> 8) % (1ull << (r % 40 + 1)) + 1;
+        }
+        unsigned limit = n == 256 ? 10 + v / 2 % 3 : HUFFMAN_TABLE_MAX_BITS;
+        failed += check_lengths_vector(counts, n, limit) != 0;
+        vectors++;
+    }
+
+    printf("lengths: %u count vectors, %u failed\n", vectors, failed);
+    return failed;
+}
+
+
+// Forward and inverse of one transform; returns 0 if the block comes back.
+static int check_transform(Transform_workspace* ws, unsigned kind, const uint8_t* in, size_t size,
+                           uint8_t* forward, uint8_t* back) {
+    uint32_t parameter[TRANSFORM_MAX_PARAMETERS];
+    Transform_forward(ws, kind, in, size, forward, parameter);
+    if (Transform_inverse(ws, kind, forward, size, parameter, back) != 0) return -1;
+    return memcmp(in, back, size) == 0 ? 0 : -1;
+}
+
+
+/*
+ * Round trips of the transforms on blocks the levels never produce: a
+ * periodic block, whose rotations tie in groups of the period, and a BWT
+ * block over 16 MiB, whose LF entries no longer fit next to their byte, so
+ * the inverse takes its unpacked path. Returns the number of failed blocks.
+ */
+static unsigned check_transforms(void) {
+    size_t large = ((size_t)16 << 20) + 4099;
+    uint8_t* in = (uint8_t*)Mem_alloc(MEM_OTHER, large);
+    uint8_t* forward = (uint8_t*)Mem_alloc(MEM_OTHER, large);
+    uint8_t* back = (uint8_t*)Mem_alloc(MEM_OTHER, large);
+    Transform_workspace* ws = Transform_workspace_create();
+    unsigned blocks = 0, failed = 0;
+
+    size_t periodic = 7 * 150000;
+    for (size_t i = 0; i < periodic; i++) in[i] = (uint8_t)"transfo"[i % 7];
+    for (unsigned kind = TRANSFORM_DELTA1; kind < TRANSFORM_COUNT; kind++) {
+        failed += check_transform(ws, kind, in, periodic, forward, back) != 0;
+        blocks++;
+    }
+
+    // Sixteen letters, so the sort needs several doubling rounds.
+    rng_state = 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < large; i++) in[i] = (uint8_t)('a' + rng_next() % 16);
+    failed += check_transform(ws, TRANSFORM_BWT, in, large, forward, back) != 0;
+    blocks++;
+
+    Transform_workspace_destroy(ws);
+    Mem_free(in);
+    Mem_free(forward);
+    Mem_free(back);
+    printf("transforms: %u blocks, %u failed\n", blocks, failed);
+    return failed;
+}
+
+
+/*
+ * Runs a Huff_stream over `in` with next_in and next_out moved in pieces of
+ * 1 to in_piece and 1 to out_piece bytes, ending the block (FLUSH) after
+ * every flush_every-th input piece when that is not 0, and FINISH at the
+ * end. Writes what it produced to `out` and returns its size, or -1 if the
+ * stream did not end or overran `capacity`. With `flushed`, the output size
+ * and input total after the last FLUSH are stored there.
+ */
+static long run_stream(Huff_stream* s, int compress, const uint8_t* in, size_t size, uint8_t* out,
+                       size_t capacity, size_t in_piece, size_t out_piece, unsigned flush_every,
+                       uint64_t flushed[2]) {
+    size_t produced = 0;
+    unsigned pieces = 0;
+    s->next_in = in;
+    s->avail_in = 0;
+    for (;;) {
+        size_t left = size - (size_t)(s->next_in - in);
+        s->avail_in = (size_t)(rng_next() % in_piece) + 1;
+        if (s->avail_in > left) s->avail_in = left;
+        int flush = s->avail_in == left ? HUFF_STREAM_FINISH
+                  : flush_every && ++pieces % flush_every == 0 ? HUFF_STREAM_FLUSH : HUFF_STREAM_RUN;
+        int status;
+        do {
+            s->next_out = out + produced;
+            s->avail_out = (size_t)(rng_next() % out_piece) + 1;
+            if (s->avail_out > capacity - produced) s->avail_out = capacity - produced;
+            size_t room = s->avail_out;
+            status = compress ? Huff_stream_compress(s, flush) : Huff_stream_decompress(s, flush);
+            produced += room - s->avail_out;
+            if (status == HUFF_STREAM_OK && produced == capacity) return -1;
+        } while (status == HUFF_STREAM_OK && (s->avail_in > 0 || s->avail_out == 0));
+        if (status == HUFF_STREAM_END) return (long)produced;
+        if (status != HUFF_STREAM_OK || flush == HUFF_STREAM_FINISH) return -1;
+        if (flush == HUFF_STREAM_FLUSH && flushed) {
+            flushed[0] = produced;
+            flushed[1] = s->total_in;
+        }
+    }
+}
+
+
+/*
+ * Huff_stream fed and drained a few bytes at a time, so blocks, headers and
+ * decoded output straddle calls: compressed with FLUSH between pieces, the
+ * output decodes to the input, and the output up to the last FLUSH alone
+ * decodes to all the input before it. Returns the number of failed checks.
+ */
+static unsigned check_stream(void) {
+    size_t size = ((size_t)3 << 20) + 17;
+    size_t capacity = size * 2 + 4096;
+    uint8_t* in = (uint8_t*)Mem_alloc(MEM_OTHER, size);
+    uint8_t* packed = (uint8_t*)Mem_alloc(MEM_OTHER, capacity);
+    uint8_t* back = (uint8_t*)Mem_alloc(MEM_OTHER, capacity);
+    unsigned checks = 0, failed = 0;
+
+    // Sixteen letters with runs of spaces.
+    rng_state = 0x2545F4914F6CDD1Dull;
+    for (size_t i = 0; i < size; i++) in[i] = rng_next() % 4 ? (uint8_t)('a' + rng_next() % 16) : ' ';
+
+    uint64_t flushed[2] = { 0, 0 };
+    Huff_stream* s = Huff_stream_compressor_create(NULL);
+    long packed_size = run_stream(s, 1, in, size, packed, capacity, 8191, 4095, 16, flushed);
+    Huff_stream_destroy(s);
+    checks++;
+    if (packed_size < 0 || flushed[1] == 0) {
+        failed++;
+    } else {
+        s = Huff_stream_decompressor_create();
+        long back_size = run_stream(s, 0, packed, (size_t)packed_size, back, capacity, 4095, 8191, 0, NULL);
+        Huff_stream_destroy(s);
+        checks++;
+        failed += back_size != (long)size || memcmp(in, back, size) != 0;
+
+        s = Huff_stream_decompressor_create();
+        s->next_in = packed;
+        s->avail_in = (size_t)flushed[0];
+        s->next_out = back;
+        s->avail_out = capacity;
+        int status = Huff_stream_decompress(s, HUFF_STREAM_RUN);
+        checks++;
+        failed += status != HUFF_STREAM_OK || s->avail_in != 0 || s->total_out != flushed[1]
+                  || memcmp(in, back, (size_t)flushed[1]) != 0;
+        Huff_stream_destroy(s);
+    }
+
+    Mem_free(in);
+    Mem_free(packed);
+    Mem_free(back);
+    printf("stream: %u checks, %u failed\n", checks, failed);
+    return failed;
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t size = 1 << 20;
+    int reps = 20;
+    int warmup = 3;
+    const char* only = NULL;
+    const char* file = NULL;
+    int level = ARCHIVE_DEFAULT_LEVEL;
+    const char* entropy = NULL;
+    int check = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--size=", 7) == 0) {
+            size = (size_t)strtoull(argv[i] + 7, NULL, 10);
+        } else if (strncmp(argv[i], "--reps=", 7) == 0) {
+            reps = atoi(argv[i] + 7);
+        } else if (strncmp(argv[i], "--warmup=", 9) == 0) {
+            warmup = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--only=", 7) == 0) {
+            only = argv[i] + 7;
+        } else if (strncmp(argv[i], "--level=", 8) == 0) {
+            level = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "--entropy=", 10) == 0) {
+            entropy = argv[i] + 10;
+        } else if (strncmp(argv[i], "--file=", 7) == 0) {
+            file = argv[i] + 7;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            check = 1;
+        } else if (strncmp(argv[i], "--kernel=", 9) == 0) {
+            if (Kernels_select(argv[i] + 9) != 0) {
+                THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, "Cannot use kernel set: %s\n", argv[i] + 9);
+            }
+        } else {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, USAGE, argv[0]);
+        }
+    }
+    Archive_options options;
+    if (size == 0 || reps < 1 || warmup < 0 || Archive_options_level(&options, level) != 0
+        || (entropy && Block_entropy_parse(entropy, &options.entropy) != 0)) {
+        THROW_EXCEPTION_AND_EXIT(EXCEPTION_INVALID_INPUT, USAGE, argv[0]);
+    }
+    if (check) {
+        unsigned failed = check_lengths();
+        failed += check_transforms();
+        failed += check_stream();
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (file) size = load_file(file, NULL);
+
+    printf("kernels: %s, %zu bytes, %d samples after %d warm-up, 95%% confidence%s, level %d\n",
+           Kernels_get()->name, size, reps, warmup, MICROBENCH_HAVE_TSC ? "" : ", no cycle counter", level);
+    printf("%-13s %-10s %12s %18s %17s %9s\n", "kernel", "input", "ns/op", "ns/byte", "cycles/byte", "MB/s");
+
+    size_t inputs = file ? 1 : sizeof(DISTRIBUTIONS) / sizeof(DISTRIBUTIONS[0]);
+    for (size_t d = 0; d < inputs; d++) {
+        Bench_input input;
+        memset(&input, 0, sizeof(input));
+        input.name = file ? "file" : DISTRIBUTIONS[d].name;
+        input.size = size;
+        input.data = (uint8_t*)Mem_alloc(MEM_OTHER, size);
+        if (!input.data) {
+            THROW_EXCEPTION_AND_EXIT(EXCEPTION_FAIL_MEMORY_ALLOCATION, "Failed to allocate input buffer.\n");
+        }
+        if (file) load_file(file, input.data);
+        else DISTRIBUTIONS[d].fill(input.data, size);
+        input_prepare(&input, &options);
+        printf("%-13s %-10s %12zu bytes, %.2f%% of the input\n", "block-size", input.name, input.blocks_size,
+               100.0 * (double)input.blocks_size / (double)input.size);
+
+        for (size_t k = 0; k < sizeof(KERNELS) / sizeof(KERNELS[0]); k++) {
+            if (only && strcmp(only, KERNELS[k].name) != 0) continue;
+            if (KERNELS[k].legacy && !input.encoder) continue;
+            bench(&KERNELS[k], &input, reps, warmup);
+        }
+
+        input_release(&input);
+        Mem_free(input.data);
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+#!/bin/bash
+
+# Large-file stress test: synthesizes sparse inputs of growing size, round-trips
+# them and checks that throughput and peak memory stay flat as size grows.
+#
+#   bash stress.sh [size_in_GiB ...]        (default: 1 2 4 8)
+#
+# STRESS_DIR   where the inputs are created (default /tmp; needs ~2x the
+#              largest size free, the decompressed copy is not sparse)
+# STRESS_ARGS  extra arguments for compression, e.g. --legacy
+# STRESS_MIN_RATIO  lowest accepted throughput of a size relative to the
+#              smallest one, in percent (default 70)
+#
+# Each size is also round-tripped through --legacy, whose per-segment counts
+# are capped at PARALLEL_HISTOGRAM_MAX_SEGMENTS rows of 1 KiB: its peak RSS
+# may exceed the smallest size's by at most LEGACY_SLACK_KIB.
+
+SIZES="${*:-1 2 4 8}"
+DIR="${STRESS_DIR:-/tmp}"
+MIN_RATIO="${STRESS_MIN_RATIO:-70}"
+ISLAND_MIB=16
+LEGACY_SLACK_KIB=2048
+BIN=bin/main
+
+make -s || exit 1
+
+# Runs a command and prints "<seconds> <peak RSS in KiB>".
+measure() {
+    local start end peak=0 hwm
+    start=$(date +%s.%N)
+    "$@" > /dev/null &
+    local pid=$!
+    # An exited (zombie) process has no VmHWM line left to read.
+    while hwm=$(awk '/VmHWM/ { print $2 }' "/proc/$pid/status" 2> /dev/null) && [ -n "$hwm" ]; do
+        [ "$hwm" -gt "$peak" ] && peak=$hwm
+        sleep 0.05
+    done
+    wait "$pid" || return 1
+    end=$(date +%s.%N)
+    awk -v s="$start" -v e="$end" -v p="$peak" 'BEGIN { printf "%.3f %d\n", e - s, p }'
+}
+
+# A sparse file: holes read back as zeros, with a block of text every GiB so
+# both the zero runs and the Huffman path are exercised.
+ISLAND="$DIR/stress_island.bin"
+cp test.txt "$ISLAND"
+while [ "$(stat -c %s "$ISLAND")" -lt $((ISLAND_MIB * 1024 * 1024)) ]; do
+    cat "$ISLAND" "$ISLAND" > "$ISLAND.tmp" && mv "$ISLAND.tmp" "$ISLAND"
+done
+truncate -s "${ISLAND_MIB}M" "$ISLAND"
+
+synthesize() {
+    local file=$1 gib=$2
+    rm -f "$file"
+    truncate -s "${gib}G" "$file"
+    for ((i = 0; i < gib; i++)); do
+        dd if="$ISLAND" of="$file" bs=1M seek=$((i * 1024 + 512)) conv=notrunc status=none
+    done
+}
+
+BASE_C=""
+BASE_D=""
+BASE_RSS=""
+BASE_LEGACY_RSS=""
+FAILED=0
+printf "%8s %14s %14s %12s %12s %12s\n" "size" "compress MB/s" "decomp. MB/s" "c. RSS KiB" "d. RSS KiB" "legacy KiB"
+
+for gib in $SIZES; do
+    INPUT="$DIR/stress_${gib}g.bin"
+    synthesize "$INPUT" "$gib"
+    bytes=$((gib * 1024 * 1024 * 1024))
+
+    read -r c_time c_rss < <(measure $BIN -c "$INPUT" $STRESS_ARGS) || { echo "compression failed"; exit 1; }
+    read -r d_time d_rss < <(measure $BIN -dc "$INPUT.huff") || { echo "decompression failed"; exit 1; }
+    if ! cmp -s "$INPUT" "$INPUT.orig"; then
+        echo "Test failed: ${gib} GiB round trip differs."
+        FAILED=1
+    fi
+    rm -f "$INPUT.huff" "$INPUT.orig"
+
+    read -r _ l_rss < <(measure $BIN -c "$INPUT" --legacy) || { echo "legacy compression failed"; exit 1; }
+    $BIN -dc "$INPUT.huff" > /dev/null || { echo "legacy decompression failed"; exit 1; }
+    if ! cmp -s "$INPUT" "$INPUT.orig"; then
+        echo "Test failed: ${gib} GiB legacy round trip differs."
+        FAILED=1
+    fi
+    rm -f "$INPUT" "$INPUT.huff" "$INPUT.orig"
+
+    c_rate=$(awk -v b=$bytes -v t="$c_time" 'BEGIN { printf "%d", b / t / 1000000 }')
+    d_rate=$(awk -v b=$bytes -v t="$d_time" 'BEGIN { printf "%d", b / t / 1000000 }')
+    printf "%6s G %14s %14s %12s %12s %12s\n" "$gib" "$c_rate" "$d_rate" "$c_rss" "$d_rss" "$l_rss"
+
+    if [ -z "$BASE_C" ]; then
+        BASE_C=$c_rate; BASE_D=$d_rate
+        BASE_RSS=$(( c_rss > d_rss ? c_rss : d_rss ))
+        BASE_LEGACY_RSS=$l_rss
+        continue
+    fi
+    if [ $((c_rate * 100)) -lt $((BASE_C * MIN_RATIO)) ] || [ $((d_rate * 100)) -lt $((BASE_D * MIN_RATIO)) ]; then
+        echo "Test failed: throughput at ${gib} GiB dropped below ${MIN_RATIO}% of the smallest size."
+        FAILED=1
+    fi
+    # Memory must not depend on the input size; allow 25% noise.
+    if [ "$c_rss" -gt $((BASE_RSS * 5 / 4)) ] || [ "$d_rss" -gt $((BASE_RSS * 5 / 4)) ]; then
+        echo "Test failed: peak RSS at ${gib} GiB grew beyond the smallest size."
+        FAILED=1
+    fi
+    if [ "$l_rss" -gt $((BASE_LEGACY_RSS + LEGACY_SLACK_KIB)) ]; then
+        echo "Test failed: legacy peak RSS at ${gib} GiB grew beyond the segment table bound."
+        FAILED=1
+    fi
+done
+
+rm -f "$ISLAND"
+if [ $FAILED -eq 0 ]; then
+    echo "Test passed: throughput and memory stayed flat."
+fi
+exit $FAILED
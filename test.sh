@@ -20,3 +20,319 @@ else
     echo "Test failed: '$INPUT_FILE' and '$DECOMPRESSED_FILE' differ."
     exit 1
 fi
+
+
+# ===== GENERATED INPUTS =====
+# The cases below build their inputs in a scratch directory and check paths
+# that a single round trip of one file does not reach.
+BIN=bin/main
+WORK=$(mktemp -d)
+HUFFD_PID=
+trap '[ -n "$HUFFD_PID" ] && kill "$HUFFD_PID" 2> /dev/null; rm -rf "$WORK"' EXIT
+FAILED=0
+
+# text <file> <bytes>: the repository's own sources, repeated up to <bytes>.
+text() {
+    local sources
+    sources=$(cat src/*.c include/*.h)
+    while [ "$(stat -c %s "$1" 2> /dev/null || echo 0)" -lt "$2" ]; do
+        printf '%s\n' "$sources" >> "$1"
+    done
+    truncate -s "$2" "$1"
+}
+
+# check <description> <command...>: runs one case and records its result.
+check() {
+    local description="$1"
+    shift
+    if "$@"; then
+        echo "Test passed: $description"
+    else
+        echo "Test failed: $description"
+        FAILED=1
+    fi
+}
+
+# The parallel legacy encoder must write the serial encoder's bytes exactly.
+parallel_encoder_matches_serial() {
+    local input="$WORK/$1"
+    "$BIN" -c "$input" --legacy --threads=4 > /dev/null || return 1
+    mv "$input.huff" "$WORK/parallel.huff"
+    "$BIN" -c "$input" --legacy --threads=1 > /dev/null || return 1
+    cmp -s "$WORK/parallel.huff" "$input.huff"
+}
+
+# The speculative parallel decoder must agree with the serial one and the input.
+parallel_decoder_matches_serial() {
+    local input="$WORK/$1"
+    "$BIN" -c "$input" --legacy > /dev/null || return 1
+    "$BIN" -dc "$input.huff" --threads=4 > /dev/null || return 1
+    mv "$input.orig" "$WORK/parallel.orig"
+    "$BIN" -dc "$input.huff" --threads=1 > /dev/null || return 1
+    cmp -s "$WORK/parallel.orig" "$input.orig" && cmp -s "$input" "$input.orig"
+}
+
+# --dedup round trip of four copies of a block-aligned chunk; the copies
+# must become REF blocks, so the file is well under the plain size.
+dedup_repeats_round_trip() {
+    local input="$WORK/repeats"
+    cat "$WORK/chunk" "$WORK/chunk" "$WORK/chunk" "$WORK/chunk" > "$input"
+    "$BIN" -c "$input" > /dev/null || return 1
+    mv "$input.huff" "$WORK/plain.huff"
+    "$BIN" -c "$input" --dedup > /dev/null || return 1
+    "$BIN" -dc "$input.huff" > /dev/null || return 1
+    cmp -s "$input" "$input.orig" \
+        && [ $(($(stat -c %s "$input.huff") * 3)) -lt "$(stat -c %s "$WORK/plain.huff")" ]
+}
+
+# -a --dedup of a copy the archive already holds refers back to the old
+# blocks and grows it by little; a second, different append still round-trips.
+dedup_append_round_trip() {
+    local archive="$WORK/appended"
+    cp "$WORK/chunk" "$archive"
+    "$BIN" -c "$archive" > /dev/null || return 1
+    local before
+    before=$(stat -c %s "$archive.huff")
+    "$BIN" -a "$archive.huff" "$WORK/chunk" --dedup > /dev/null || return 1
+    local grown=$(($(stat -c %s "$archive.huff") - before))
+    "$BIN" -a "$archive.huff" "$WORK/short" --dedup > /dev/null || return 1
+    "$BIN" -dc "$archive.huff" > /dev/null || return 1
+    cat "$WORK/chunk" "$WORK/chunk" "$WORK/short" | cmp -s - "$archive.orig" && [ $((grown * 20)) -lt "$before" ]
+}
+
+# -u after an 8-byte insertion and a deletion still finds the old blocks
+# behind them: most of the file is reused, and the result round-trips.
+update_resyncs_after_insertion() {
+    local input="$WORK/edited"
+    cp "$WORK/text" "$input"
+    "$BIN" -c "$input" > /dev/null || return 1
+    { head -c 3000000 "$WORK/text"; printf 'INSERTED'; tail -c +3000001 "$WORK/text" | head -c 4000000
+      tail -c +7100001 "$WORK/text"; } > "$input"
+    local reused
+    reused=$("$BIN" -u "$input.huff" "$input" | sed -n 's/^Reused \([0-9]*\) of.*/\1/p')
+    "$BIN" -dc "$input.huff" > /dev/null || return 1
+    cmp -s "$input" "$input.orig" && [ "${reused:-0}" -gt $(($(stat -c %s "$input") * 8 / 10)) ]
+}
+
+# -u decodes an old block and compares it with the input before copying it:
+# one whose payload changed after its index hash was written is encoded afresh.
+update_verifies_old_blocks() {
+    local input="$WORK/verified"
+    cp "$WORK/short" "$input"
+    "$BIN" -c "$input" > /dev/null || return 1
+    printf '\377\377\377\377' | dd of="$input.huff" bs=1 seek=100000 conv=notrunc 2> /dev/null
+    "$BIN" -u "$input.huff" "$input" > /dev/null || return 1
+    "$BIN" -dc "$input.huff" > /dev/null && cmp -s "$input" "$input.orig"
+}
+
+# --analyze must predict the exact size -c writes, tANS and pairs blocks included.
+analyze_predicts_size() {
+    local input="$WORK/short"
+    local predicted
+    predicted=$("$BIN" -c "$input" --analyze "$@" | sed -n 's/^Compressed size: \([0-9]*\) bytes.*/\1/p')
+    "$BIN" -c "$input" "$@" > /dev/null || return 1
+    [ -n "$predicted" ] && [ "$predicted" -eq "$(stat -c %s "$input.huff")" ]
+}
+
+# transform_round_trip <input> <set> <chosen> [options...]: -c --transform=<set>
+# round-trips, and --analyze shows a block whose transform matches <chosen>.
+transform_round_trip() {
+    local input="$WORK/$1" set=$2 chosen=$3
+    shift 3
+    "$BIN" -c "$input" --transform="$set" "$@" > /dev/null || return 1
+    "$BIN" -dc "$input.huff" > /dev/null && cmp -s "$input" "$input.orig" || return 1
+    "$BIN" -c "$input" --transform="$set" --analyze "$@" \
+        | awk -v chosen="$chosen" '$1 ~ /^[0-9]+$/ && $5 ~ chosen { found = 1 } END { exit !found }'
+}
+
+# entropy_round_trip <input> <coder> <streams> [options...]: -c --entropy=<coder>
+# round-trips, and --analyze shows every block coded so, the full-size ones
+# in <streams> streams (a short tail block may use fewer).
+entropy_round_trip() {
+    local input="$WORK/$1" coder=$2 streams=$3
+    shift 3
+    "$BIN" -c "$input" --entropy="$coder" "$@" > /dev/null || return 1
+    "$BIN" -dc "$input.huff" > /dev/null && cmp -s "$input" "$input.orig" || return 1
+    "$BIN" -c "$input" --entropy="$coder" --analyze "$@" \
+        | awk -v coder="$coder" -v streams="$streams" \
+            '$1 ~ /^[0-9]+$/ { if ($4 != coder) bad = 1; if ($6 == streams) found = 1 } END { exit bad || !found }'
+}
+
+# grep_finds <file.huff> <plain file> <pattern>: --grep prints the offsets grep -b finds in the plain file.
+grep_finds() {
+    local found expected
+    found=$("$BIN" -dc "$1" --grep="$3" | grep -E '^[0-9]+$') || return 1
+    expected=$(grep -obaF -- "$3" "$2" | cut -d: -f1)
+    [ -n "$expected" ] && [ "$found" = "$expected" ]
+}
+
+# A match across a block boundary, where neither block alone holds all the
+# pattern's bytes: both are skipped, and only the crossing is decoded.
+grep_across_skipped_block() {
+    local input="$WORK/alphabets"
+    { head -c $((1024 * 1024 - 2)) /dev/urandom | tr '\000-\377' '[a*128][b*128]'; printf 'ab12'
+      head -c $((1024 * 1024 - 2)) /dev/urandom | tr '\000-\377' '[1*128][2*128]'; } > "$input"
+    "$BIN" -c "$input" > /dev/null || return 1
+    grep_finds "$input.huff" "$input" ab12 \
+        && "$BIN" -dc "$input.huff" --grep=ab12 | grep -q '^Blocks skipped by their code table: [1-9]'
+}
+
+# Matches inside the REF blocks --dedup writes for repeated chunks.
+grep_inside_ref_block() {
+    local input="$WORK/referenced"
+    cat "$WORK/chunk" "$WORK/chunk" "$WORK/chunk" > "$input"
+    "$BIN" -c "$input" --dedup > /dev/null || return 1
+    [ $(($(stat -c %s "$input.huff") * 2)) -lt "$(stat -c %s "$input")" ] \
+        && grep_finds "$input.huff" "$input" Archive_grep
+}
+
+# Offsets run on across the members of a concatenated file.
+grep_multi_member() {
+    local input="$WORK/members"
+    "$BIN" -c "$WORK/short" > /dev/null || return 1
+    "$BIN" -c "$WORK/chunk" -7 > /dev/null || return 1
+    cat "$WORK/short.huff" "$WORK/chunk.huff" "$WORK/short.huff" > "$input.huff"
+    cat "$WORK/short" "$WORK/chunk" "$WORK/short" > "$input"
+    grep_finds "$input.huff" "$input" Archive_grep
+}
+
+# trickle <file>: writes the file to stdout in pieces of 1 byte to 4 KiB, so
+# a pipe reader gets short reads that cut headers, blocks and symbols.
+trickle() {
+    perl -e 'srand(3); open(my $f, "<", shift) or die; binmode $f;
+             while (read($f, my $piece, 1 + int(rand(4096)))) {
+                 syswrite(STDOUT, $piece) == length($piece) or die; select(undef, undef, undef, 0.0002) }' "$1"
+}
+
+# -p and -dp between trickled pipes: what -p writes, a -c file, a --legacy
+# (FFUH) file and three concatenated members all decode to their input.
+pipe_stream_round_trip() {
+    local input="$WORK/streamed"
+    cp "$WORK/short" "$input"
+    trickle "$input" | "$BIN" -p - - > "$WORK/piped.huff" || return 1
+    trickle "$WORK/piped.huff" | "$BIN" -dp - - | cmp -s - "$input" || return 1
+    "$BIN" -c "$input" > /dev/null || return 1
+    trickle "$input.huff" | "$BIN" -dp - - | cmp -s - "$input" || return 1
+    cat "$input.huff" "$WORK/piped.huff" "$input.huff" > "$WORK/streamed_members.huff"
+    trickle "$WORK/streamed_members.huff" | "$BIN" -dp - - | cmp -s - <(cat "$input" "$input" "$input") || return 1
+    "$BIN" -c "$input" --legacy > /dev/null || return 1
+    trickle "$input.huff" | "$BIN" -dp - - | cmp -s - "$input"
+}
+
+# -dp keeps no decoded output to copy from, so a --dedup file's REF blocks are an error.
+pipe_stream_rejects_ref() {
+    local input="$WORK/streamed_refs"
+    cat "$WORK/chunk" "$WORK/chunk" > "$input"
+    "$BIN" -c "$input" --dedup > /dev/null || return 1
+    "$BIN" -c "$input" --dedup --analyze | awk '$4 == "ref" { found = 1 } END { exit !found }' || return 1
+    ! "$BIN" -dp "$input.huff" "$WORK/streamed_refs.out" 2> /dev/null
+}
+
+# -s and -ds through pipes: short reads become short messages, a file input
+# full-size ones, and both decode; a stream cut inside its last message is
+# an error, not a shorter output.
+adaptive_stream_round_trip() {
+    local input="$WORK/short"
+    trickle "$input" | "$BIN" -s - - > "$WORK/adaptive.trickled" || return 1
+    trickle "$WORK/adaptive.trickled" | "$BIN" -ds - - | cmp -s - "$input" || return 1
+    "$BIN" -s "$input" "$WORK/adaptive.whole" || return 1
+    "$BIN" -ds - - < "$WORK/adaptive.whole" | cmp -s - "$input" || return 1
+    head -c -5 "$WORK/adaptive.whole" > "$WORK/adaptive.cut"
+    ! "$BIN" -ds "$WORK/adaptive.cut" "$WORK/adaptive.cut.out" 2> /dev/null
+}
+
+# huffd/huffc: inline and --fd requests round-trip, bin/main reads what
+# huffd writes, and a corrupt payload gets an error reply without taking
+# the server down.
+huffd_round_trip() {
+    local input="$WORK/served"
+    cp "$WORK/short" "$input"
+    bin/huffc "$SOCKET" -c "$input" > /dev/null || return 1
+    "$BIN" -dc "$input.huff" > /dev/null && cmp -s "$input" "$input.orig" || return 1
+    rm "$input.orig"
+    bin/huffc "$SOCKET" -dc "$input.huff" --output="$WORK/served.inline" > /dev/null || return 1
+    bin/huffc "$SOCKET" -dc "$input.huff" --fd > /dev/null || return 1
+    cmp -s "$input" "$WORK/served.inline" && cmp -s "$input" "$input.orig" || return 1
+    cp "$input.huff" "$WORK/corrupt.huff"
+    printf 'XXXXXXXXXXXXXXXX' | dd of="$WORK/corrupt.huff" bs=1 seek=5000 conv=notrunc 2> /dev/null
+    ! bin/huffc "$SOCKET" -dc "$WORK/corrupt.huff" > /dev/null 2>&1 \
+        && bin/huffc "$SOCKET" --stats | grep -q '^decompress n=3 '
+}
+
+# With one worker, an idle connection must not keep the next client waiting.
+huffd_idle_client() {
+    perl -MIO::Socket::UNIX -e 'my $idle = IO::Socket::UNIX->new(Peer => shift) or die; sleep 30' "$SOCKET" &
+    local idle=$!
+    sleep 0.2
+    timeout 5 bin/huffc "$SOCKET" -c "$WORK/short" --output="$WORK/idle.huff" > /dev/null
+    local result=$?
+    kill "$idle" 2> /dev/null
+    wait "$idle" 2> /dev/null
+    return $result
+}
+
+# Code lengths against a reference builder on fixed count vectors,
+# transform round trips on blocks over 16 MiB, and Huff_stream fed and
+# drained a few bytes at a time with FLUSH between calls (microbench --check).
+microbench_check() {
+    make -s microbench > /dev/null && bin/microbench --check > /dev/null
+}
+
+text "$WORK/text" $((10 * 1024 * 1024 + 12345))
+text "$WORK/short" $((700 * 1024))
+text "$WORK/chunk" $((1024 * 1024))
+head -c $((9 * 1024 * 1024 + 7)) /dev/urandom > "$WORK/random"
+head -c $((5 * 1024 * 1024)) /dev/zero | tr '\0' x > "$WORK/single"
+# Two equally likely symbols get 1-bit codes: every bit starts a symbol.
+head -c $((24 * 1024 * 1024)) /dev/urandom | tr '\000-\377' '[a*128][b*128]' > "$WORK/binary"
+# Inputs each transform wins on: a slowly rising 32-bit counter for delta,
+# runs of random bytes for MTF, an 8-byte phrase repeated (a block is a whole
+# number of periods, so its rotations tie in groups; an all-zero block would
+# be stored as RLE instead) and text under 64 KiB for the BWT sort.
+perl -e 'print pack("V*", map { $_ * 3 } 0 .. 300000)' > "$WORK/counter"
+perl -e 'srand(7); print chr(int(rand(256))) x (1 + int(rand(20))) for 1 .. 100000' > "$WORK/runs"
+perl -e 'print "periods " x 200000' > "$WORK/periodic"
+text "$WORK/small" $((40 * 1024))
+
+check "parallel encoder matches serial, text" parallel_encoder_matches_serial text
+check "parallel encoder matches serial, random" parallel_encoder_matches_serial random
+check "parallel decoder matches serial, text" parallel_decoder_matches_serial text
+check "parallel decoder matches serial, random" parallel_decoder_matches_serial random
+check "parallel decoder matches serial, two symbols" parallel_decoder_matches_serial binary
+check "parallel decoder matches serial, one symbol" parallel_decoder_matches_serial single
+check "parallel decoder matches serial, shorter than a segment" parallel_decoder_matches_serial short
+check "dedup round trip, repeats within one file" dedup_repeats_round_trip
+check "dedup round trip, appended copy" dedup_append_round_trip
+check "update reuses the blocks after an insertion" update_resyncs_after_insertion
+check "update re-encodes an old block whose bytes differ" update_verifies_old_blocks
+check "analyze predicts the size, tans" analyze_predicts_size --entropy=tans
+check "analyze predicts the size, pairs" analyze_predicts_size --entropy=pairs
+check "analyze predicts the size, level 7" analyze_predicts_size -7
+check "transform round trip, delta" transform_round_trip counter delta '^delta'
+check "transform round trip, mtf" transform_round_trip runs mtf '^mtf$'
+check "transform round trip, bwt over 64 KiB blocks" transform_round_trip text bwt '^bwt$'
+check "transform round trip, bwt of a 4 MiB block" transform_round_trip text bwt '^bwt$' -9
+check "transform round trip, bwt under 64 KiB" transform_round_trip small bwt '^bwt$'
+check "transform round trip, bwt of a periodic block" transform_round_trip periodic bwt '^bwt$'
+check "transform round trip, auto" transform_round_trip text auto .
+check "entropy round trip, tans in one stream at -1" entropy_round_trip text tans 1 -1
+check "entropy round trip, tans in four streams at the default level" entropy_round_trip text tans 4
+check "entropy round trip, pairs at the default level" entropy_round_trip text pairs 4
+check "entropy round trip, pairs in one stream at -1" entropy_round_trip short pairs 1 -1
+check "grep finds a match across a skipped block" grep_across_skipped_block
+check "grep finds matches inside REF blocks" grep_inside_ref_block
+check "grep finds matches across members" grep_multi_member
+check "pipe stream round trip, HUF2, FFUH and members in small reads" pipe_stream_round_trip
+check "pipe stream rejects REF blocks" pipe_stream_rejects_ref
+check "adaptive stream round trip and truncated message" adaptive_stream_round_trip
+SOCKET="$WORK/huffd.sock"
+bin/huffd "$SOCKET" --workers=1 2> "$WORK/huffd.log" &
+HUFFD_PID=$!
+for _ in $(seq 50); do [ -S "$SOCKET" ] && break; sleep 0.1; done
+check "huffd round trip, inline, --fd, corrupt payload and --stats" huffd_round_trip
+check "huffd serves a request while another client is idle" huffd_idle_client
+kill "$HUFFD_PID" && wait "$HUFFD_PID"
+HUFFD_PID=
+check "code lengths, large transforms and chunked Huff_stream calls" microbench_check
+
+exit $FAILED